@@ -56,6 +56,68 @@
 #define CL_DISP_INITIAL_REG_COUNT   16
 #define CL_DISP_REG_GROW_SIZE       16
 
+/********************************************************************
+   __cl_disp_get_msg
+
+   Description:
+   This function pops the message at the head of the FIFO.  Must be
+   called with the Dispatcher lock held.
+
+   Inputs:
+   p_disp - Pointer to Dispatcher object
+
+   Outputs:
+   None
+
+   Returns:
+   Pointer to the message to process or NULL
+********************************************************************/
+static cl_disp_msg_t *__cl_disp_get_msg(IN cl_dispatcher_t * const p_disp)
+{
+	if (cl_is_qlist_empty(&p_disp->msg_fifo))
+		return NULL;
+
+	return (cl_disp_msg_t *) cl_qlist_remove_head(&p_disp->msg_fifo);
+}
+
+/********************************************************************
+   __cl_disp_msg_done
+
+   Description:
+   This function updates the concurrency state of the Dispatcher after
+   a message was processed.  Must be called with the Dispatcher lock
+   held and before the recipient's reference count is released.
+
+   Inputs:
+   p_disp - Pointer to Dispatcher object
+   p_msg - Pointer to the processed message
+
+   Outputs:
+   None
+
+   Returns:
+   TRUE if messages held back by this one may now be processed
+********************************************************************/
+static boolean_t __cl_disp_msg_done(IN cl_dispatcher_t * const p_disp,
+				    IN cl_disp_msg_t * const p_msg)
+{
+	cl_disp_reg_info_t *p_reg = p_msg->p_dest_reg;
+
+	switch (p_reg->conc_class) {
+	case CL_DISP_CONC_SERIAL:
+		if (cl_is_qlist_empty(&p_reg->serial_pending)) {
+			p_reg->serial_busy = FALSE;
+			return FALSE;
+		}
+		cl_qlist_insert_tail(&p_disp->msg_fifo,
+				     cl_qlist_remove_head(&p_reg->
+							  serial_pending));
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
 /********************************************************************
    __cl_disp_worker
 
@@ -76,15 +138,12 @@ void __cl_disp_worker(IN void *context)
 {
 	cl_disp_msg_t *p_msg;
 	cl_dispatcher_t *p_disp = (cl_dispatcher_t *) context;
+	uint32_t wake_count = 0;
 
 	cl_spinlock_acquire(&p_disp->lock);
 
 	/* Process the FIFO until we drain it dry. */
-	while (cl_qlist_count(&p_disp->msg_fifo)) {
-		/* Pop the message at the head from the FIFO. */
-		p_msg =
-		    (cl_disp_msg_t *) cl_qlist_remove_head(&p_disp->msg_fifo);
-
+	while ((p_msg = __cl_disp_get_msg(p_disp)) != NULL) {
 		/* we track the time the last message spent in the queue */
 		p_disp->last_msg_queue_time_us =
 		    cl_get_time_stamp() - p_msg->in_time;
@@ -99,8 +158,6 @@ void __cl_disp_worker(IN void *context)
 						    context,
 						    (void *)p_msg->p_data);
 
-		cl_atomic_dec(&p_msg->p_dest_reg->ref_cnt);
-
 		/* The client has seen the data.  Notify the sender as appropriate. */
 		if (p_msg->pfn_xmt_callback) {
 			p_msg->pfn_xmt_callback((void *)p_msg->context,
@@ -111,11 +168,25 @@ void __cl_disp_worker(IN void *context)
 		/* Grab the lock for the next iteration through the list. */
 		cl_spinlock_acquire(&p_disp->lock);
 
+		/*
+		 * Messages held back by a serial one may now
+		 * be processed by other worker threads as well.
+		 */
+		if (__cl_disp_msg_done(p_disp, p_msg))
+			wake_count = cl_qlist_count(&p_disp->msg_fifo);
+
+		cl_atomic_dec(&p_msg->p_dest_reg->ref_cnt);
+
 		/* Return this message to the pool. */
 		cl_qpool_put(&p_disp->msg_pool, (cl_pool_item_t *) p_msg);
 	}
 
 	cl_spinlock_release(&p_disp->lock);
+
+	if (wake_count > p_disp->worker_threads.running_count)
+		wake_count = p_disp->worker_threads.running_count;
+	while (wake_count--)
+		cl_thread_pool_signal(&p_disp->worker_threads);
 }
 
 void cl_disp_construct(IN cl_dispatcher_t * const p_disp)
@@ -229,6 +300,8 @@ cl_disp_reg_handle_t cl_disp_register(IN cl_dispatcher_t * const p_disp,
 	p_reg->pfn_rcv_callback = pfn_callback;
 	p_reg->context = context;
 	p_reg->msg_id = msg_id;
+	p_reg->conc_class = CL_DISP_CONC_PARALLEL;
+	cl_qlist_init(&p_reg->serial_pending);
 
 	/* Insert the registration in the list. */
 	cl_qlist_insert_tail(&p_disp->reg_list, (cl_list_item_t *) p_reg);
@@ -249,6 +322,18 @@ cl_disp_reg_handle_t cl_disp_register(IN cl_dispatcher_t * const p_disp,
 	return (p_reg);
 }
 
+void cl_disp_set_conc_class(IN const cl_disp_reg_handle_t handle,
+			    IN const cl_disp_conc_class_t conc_class)
+{
+	cl_disp_reg_info_t *p_reg = (cl_disp_reg_info_t *) handle;
+
+	CL_ASSERT(handle != CL_DISP_INVALID_HANDLE);
+
+	cl_spinlock_acquire(&p_reg->p_disp->lock);
+	p_reg->conc_class = conc_class;
+	cl_spinlock_release(&p_reg->p_disp->lock);
+}
+
 void cl_disp_unregister(IN const cl_disp_reg_handle_t handle)
 {
 	cl_disp_reg_info_t *p_reg;
@@ -337,6 +422,20 @@ cl_status_t cl_disp_post(IN const cl_disp_reg_handle_t handle,
 	/* Increment the recipient's reference count. */
 	cl_atomic_inc(&p_dest_reg->ref_cnt);
 
+	/*
+	 * A serial recipient with a message already queued or in process
+	 * holds this one back until the previous one is done.
+	 */
+	if (p_dest_reg->conc_class == CL_DISP_CONC_SERIAL) {
+		if (p_dest_reg->serial_busy) {
+			cl_qlist_insert_tail(&p_dest_reg->serial_pending,
+					     (cl_list_item_t *) p_msg);
+			cl_spinlock_release(&p_disp->lock);
+			return (CL_SUCCESS);
+		}
+		p_dest_reg->serial_busy = TRUE;
+	}
+
 	/* Queue the message in the FIFO. */
 	cl_qlist_insert_tail(&p_disp->msg_fifo, (cl_list_item_t *) p_msg);
 	cl_spinlock_release(&p_disp->lock);
@@ -351,6 +450,7 @@ void cl_disp_get_queue_status(IN const cl_disp_reg_handle_t handle,
 			      OUT uint64_t * p_last_msg_queue_time_ms)
 {
 	cl_dispatcher_t *p_disp = ((cl_disp_reg_info_t *) handle)->p_disp;
+	cl_list_item_t *p_item;
 
 	cl_spinlock_acquire(&p_disp->lock);
 
@@ -358,8 +458,15 @@ void cl_disp_get_queue_status(IN const cl_disp_reg_handle_t handle,
 		*p_last_msg_queue_time_ms =
 		    p_disp->last_msg_queue_time_us / 1000;
 
-	if (p_num_queued_msgs)
+	if (p_num_queued_msgs) {
 		*p_num_queued_msgs = cl_qlist_count(&p_disp->msg_fifo);
+		for (p_item = cl_qlist_head(&p_disp->reg_list);
+		     p_item != cl_qlist_end(&p_disp->reg_list);
+		     p_item = cl_qlist_next(p_item))
+			*p_num_queued_msgs +=
+			    cl_qlist_count(&((cl_disp_reg_info_t *) p_item)->
+					   serial_pending);
+	}
 
 	cl_spinlock_release(&p_disp->lock);
 }
@@ -77,7 +77,8 @@ BEGIN_C_DECLS
 *		cl_disp_construct, cl_disp_init, cl_disp_shutdown, cl_disp_destroy
 *
 *	Manipulation:
-*		cl_disp_post, cl_disp_register, cl_disp_unregister
+*		cl_disp_post, cl_disp_register, cl_disp_unregister,
+*		cl_disp_set_conc_class
 *********/
 /****s* Component Library: Dispatcher/cl_disp_msgid_t
 * NAME
@@ -119,6 +120,37 @@ typedef uint32_t cl_disp_msgid_t;
 #define CL_DISP_INVALID_HANDLE ((cl_disp_reg_handle_t)0)
 /*********/
 
+/****d* Component Library: Dispatcher/cl_disp_conc_class_t
+* NAME
+*	cl_disp_conc_class_t
+*
+* DESCRIPTION
+*	Enumerates the concurrency classes of Dispatcher registrations.
+*	The concurrency class of a registration controls how its messages
+*	are delivered when the Dispatcher has more than one worker thread.
+*
+* SYNOPSIS
+*/
+typedef enum _cl_disp_conc_class {
+	CL_DISP_CONC_PARALLEL = 0,
+	CL_DISP_CONC_SERIAL
+} cl_disp_conc_class_t;
+/*
+* VALUES
+*	CL_DISP_CONC_PARALLEL
+*		Messages may be delivered concurrently with any other
+*		message, including other messages of the same
+*		registration.  This is the default.
+*
+*	CL_DISP_CONC_SERIAL
+*		Messages of the registration are delivered one at a time
+*		and in posting order, but concurrently with messages of
+*		other registrations.
+*
+* SEE ALSO
+*	Dispatcher, cl_disp_set_conc_class
+*********/
+
 /****f* Component Library: Dispatcher/cl_pfn_msgrcv_cb_t
 * NAME
 *	cl_pfn_msgrcv_cb_t
@@ -266,6 +298,9 @@ typedef struct _cl_disp_reg_info {
 	atomic32_t ref_cnt;
 	cl_disp_msgid_t msg_id;
 	cl_dispatcher_t *p_disp;
+	cl_disp_conc_class_t conc_class;
+	boolean_t serial_busy;
+	cl_qlist_t serial_pending;
 } cl_disp_reg_info_t;
 /*
 * FIELDS
@@ -287,6 +322,17 @@ typedef struct _cl_disp_reg_info {
 *	p_disp
 *		Pointer to parent Dispatcher.
 *
+*	conc_class
+*		Concurrency class of the registration.
+*
+*	serial_busy
+*		For serial registrations, TRUE while one of its messages
+*		is in the Dispatcher FIFO or being processed.
+*
+*	serial_pending
+*		For serial registrations, messages posted while serial_busy
+*		is set.  They are moved to the Dispatcher FIFO one at a time.
+*
 * SEE ALSO
 *********/
 
@@ -399,7 +445,8 @@ cl_disp_init(IN cl_dispatcher_t * const p_disp,
 *		per CPU in the system.  When the Dispatcher is created with
 *		only one thread, the Dispatcher guarantees to deliver posted
 *		messages in order.  When the Dispatcher is created with more
-*		than one thread, messages may be delivered out of order.
+*		than one thread, messages may be delivered out of order,
+*		subject to the concurrency class of their registrations.
 *
 *	name
 *		[in] Name to associate with the threads.  The name may be up to 16
@@ -508,6 +555,37 @@ cl_disp_register(IN cl_dispatcher_t * const p_disp,
 *	Dispatcher, cl_disp_unregister, cl_disp_post
 *********/
 
+/****f* Component Library: Dispatcher/cl_disp_set_conc_class
+* NAME
+*	cl_disp_set_conc_class
+*
+* DESCRIPTION
+*	This function sets the concurrency class of a Dispatcher registration.
+*
+* SYNOPSIS
+*/
+void cl_disp_set_conc_class(IN const cl_disp_reg_handle_t handle,
+			    IN const cl_disp_conc_class_t conc_class);
+/*
+* PARAMETERS
+*	handle
+*		[in] cl_disp_reg_handle_t value return by cl_disp_register.
+*
+*	conc_class
+*		[in] Concurrency class for the messages of this registration.
+*
+* RETURN VALUE
+*	This function does not return a value.
+*
+* NOTES
+*	Registrations are created with CL_DISP_CONC_PARALLEL class.
+*	The class should be set before any message is posted
+*	to the registration.
+*
+* SEE ALSO
+*	Dispatcher, cl_disp_register, cl_disp_conc_class_t
+*********/
+
 /****f* Component Library: Dispatcher/cl_disp_unregister
 * NAME
 *	cl_disp_unregister
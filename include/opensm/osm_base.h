@@ -351,6 +351,18 @@ BEGIN_C_DECLS
 */
 #define OSM_DEFAULT_LONG_TRANS_TIMEOUT_MILLISEC 500
 /***********/
+/****d* OpenSM: OSM_DEFAULT_MIN_TRANS_TIMEOUT_MILLISEC
+* NAME
+*       OSM_DEFAULT_MIN_TRANS_TIMEOUT_MILLISEC
+*
+* DESCRIPTION
+*       Specifies the default lower bound in milliseconds of the SMP
+*       timeouts derived from measured round trip times.
+*
+* SYNOPSIS
+*/
+#define OSM_DEFAULT_MIN_TRANS_TIMEOUT_MILLISEC 20
+/***********/
 /****d* OpenSM: OSM_DEFAULT_SUBNET_TIMEOUT
 * NAME
 *	OSM_DEFAULT_SUBNET_TIMEOUT
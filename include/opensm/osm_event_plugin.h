@@ -80,6 +80,7 @@ typedef enum {
 	OSM_EVENT_ID_STATE_CHANGE,
 	OSM_EVENT_ID_SA_DB_DUMPED,
 	OSM_EVENT_ID_LFT_CHANGE,
+	OSM_EVENT_ID_SWEEP_STATS,
 	OSM_EVENT_ID_MAX
 } osm_epi_event_id_t;
 
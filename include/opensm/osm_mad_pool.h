@@ -43,8 +43,12 @@
 #ifndef _OSM_MAD_POOL_H_
 #define _OSM_MAD_POOL_H_
 
+#include <pthread.h>
 #include <iba/ib_types.h>
 #include <complib/cl_atomic.h>
+#include <complib/cl_qlist.h>
+#include <complib/cl_qpool.h>
+#include <complib/cl_spinlock.h>
 #include <opensm/osm_base.h>
 #include <opensm/osm_madw.h>
 #include <vendor/osm_vendor.h>
@@ -69,6 +73,12 @@ BEGIN_C_DECLS
 *
 *	The MAD Pool is thread safe.
 *
+*	MAD wrappers are carved out of slabs that are never returned to
+*	the system until the pool is destroyed.  Each thread keeps a small
+*	cache of free wrappers so that the common get/put pair does not
+*	take the pool lock; caches are refilled from and drained to the
+*	shared slab free list in batches.
+*
 *	This object should be treated as opaque and should be
 *	manipulated only through the provided functions.
 *
@@ -90,16 +100,81 @@ BEGIN_C_DECLS
 */
 typedef struct osm_mad_pool {
 	atomic32_t mads_out;
+	uint32_t max_mads_out;
+	uint32_t num_allocated;
+	cl_qpool_t madw_pool;
+	cl_spinlock_t lock;
+	cl_qlist_t cache_list;
+	pthread_key_t cache_key;
+	boolean_t cache_key_valid;
 } osm_mad_pool_t;
 /*
 * FIELDS
 *	mads_out
 *		Running total of the number of MADs outstanding.
 *
+*	max_mads_out
+*		High water mark of mads_out.
+*
+*	num_allocated
+*		Number of MAD wrappers carved out of slabs so far.
+*
+*	madw_pool
+*		Slab allocator and shared free list of MAD wrappers.
+*
+*	lock
+*		Protects madw_pool and cache_list.
+*
+*	cache_list
+*		List of the per thread wrapper caches of this pool.
+*
+*	cache_key
+*		Thread specific data key of the per thread caches.
+*
+*	cache_key_valid
+*		TRUE once cache_key has been created.
+*
 * SEE ALSO
 *	MAD Pool
 *********/
 
+/****s* OpenSM: MAD Pool/osm_mad_pool_stats_t
+* NAME
+*	osm_mad_pool_stats_t
+*
+* DESCRIPTION
+*	MAD Pool occupancy statistics.
+*
+* SYNOPSIS
+*/
+typedef struct osm_mad_pool_stats {
+	uint32_t mads_out;
+	uint32_t max_mads_out;
+	uint32_t allocated;
+	uint32_t free;
+	uint32_t cached;
+} osm_mad_pool_stats_t;
+/*
+* FIELDS
+*	mads_out
+*		Number of MAD wrappers currently handed out.
+*
+*	max_mads_out
+*		High water mark of mads_out.
+*
+*	allocated
+*		Number of MAD wrappers carved out of slabs.
+*
+*	free
+*		Number of MAD wrappers on the shared free list.
+*
+*	cached
+*		Number of free MAD wrappers held in per thread caches.
+*
+* SEE ALSO
+*	MAD Pool, osm_mad_pool_get_stats
+*********/
+
 /****f* OpenSM: MAD Pool/osm_mad_pool_construct
 * NAME
 *	osm_mad_pool_construct
@@ -153,6 +228,9 @@ void osm_mad_pool_destroy(IN osm_mad_pool_t * p_pool);
 *	This function should only be called after a call to osm_mad_pool_construct or
 *	osm_mad_pool_init.
 *
+*	All MAD wrappers must have been returned to the pool first, so the
+*	vendor that holds outstanding MADs has to be deleted before.
+*
 * SEE ALSO
 *	MAD Pool, osm_mad_pool_construct, osm_mad_pool_init
 *********/
@@ -366,5 +444,35 @@ osm_mad_pool_get_outstanding(IN const osm_mad_pool_t * p_pool)
 *	MAD Pool, osm_mad_pool_get
 *********/
 
+/****f* OpenSM: MAD Pool/osm_mad_pool_get_stats
+* NAME
+*	osm_mad_pool_get_stats
+*
+* DESCRIPTION
+*	Returns a snapshot of the MAD Pool occupancy.
+*
+* SYNOPSIS
+*/
+void osm_mad_pool_get_stats(IN osm_mad_pool_t * p_pool,
+			    OUT osm_mad_pool_stats_t * p_stats);
+/*
+* PARAMETERS
+*	p_pool
+*		[in] Pointer to an osm_mad_pool_t object.
+*
+*	p_stats
+*		[out] Pointer to the statistics to fill in.
+*
+* RETURN VALUES
+*	This function does not return a value.
+*
+* NOTES
+*	The counters are sampled without stopping other threads, so the
+*	cached count is approximate while MADs are in flight.
+*
+* SEE ALSO
+*	MAD Pool, osm_mad_pool_stats_t
+*********/
+
 END_C_DECLS
 #endif				/* _OSM_MAD_POOL_H_ */
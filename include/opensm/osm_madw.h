@@ -183,6 +183,7 @@ typedef struct osm_pi_context {
 	boolean_t light_sweep;
 	boolean_t active_transition;
 	boolean_t client_rereg;
+	uint8_t next_link_state;
 } osm_pi_context_t;
 /*********/
 
@@ -456,6 +457,10 @@ typedef struct osm_madw {
 	cl_disp_msgid_t fail_msg;
 	boolean_t resp_expected;
 	uint32_t timeout;
+	boolean_t rtt_timeout;
+	uint64_t send_time;
+	uint8_t dr_hop_count;
+	uint8_t dr_path[IB_SUBNET_PATH_HOPS_MAX];
 	const ib_mad_t *p_mad;
 } osm_madw_t;
 /*
@@ -499,6 +504,22 @@ typedef struct osm_madw {
 *	timeout
 *		Transaction timeout in msec.
 *
+*	rtt_timeout
+*		TRUE if timeout was not given by the originator but derived
+*		from the round trip times of the destination when the MAD
+*		was sent.
+*
+*	send_time
+*		Time stamp in usec at which the MAD was handed to the
+*		transport, used to measure the round trip time.
+*
+*	dr_hop_count
+*		Hop count of dr_path, 0 unless this is a LID routed SMP.
+*
+*	dr_path
+*		Directed route to the destination of a LID routed SMP,
+*		used to resend it directed route if it fails.
+*
 *	p_mad
 *		Pointer to the wire MAD.  The MAD itself cannot be part of the
 *		wrapper, since wire MADs typically reside in special memory
@@ -64,6 +64,7 @@
 #include <opensm/osm_mad_pool.h>
 #include <opensm/osm_vl15intf.h>
 #include <opensm/osm_congestion_control.h>
+#include <opensm/osm_snapshot.h>
 
 #ifdef __cplusplus
 #  define BEGIN_C_DECLS extern "C" {
@@ -145,6 +146,7 @@ typedef struct osm_routing_engine {
 			     unsigned block_length, unsigned block_num);
 	uint8_t (*path_sl)(void *context, IN uint8_t path_sl_hint,
 			   IN const ib_net16_t slid, IN const ib_net16_t dlid);
+	int (*ucast_publish) (void *context);
 	ib_api_status_t (*mcast_build_stree)(void *context,
 					     IN OUT osm_mgrp_box_t *mgb);
 	void (*destroy) (void *context);
@@ -188,6 +190,16 @@ typedef struct osm_routing_engine {
 *	path_sl
 *		The callback for computing path SL.
 *
+*	ucast_publish
+*		The callback to make the routing built by the last
+*		ucast_build_fwd_tables call visible to path_sl.  The lid
+*		matrices and forwarding tables are built with the subnet
+*		lock held shared only, so that SA queries are answered
+*		from the previous routing meanwhile, and this callback is
+*		called with the lock held exclusively.  Routing engines
+*		that provide path_sl but not ucast_publish are run with
+*		the lock held exclusively.
+*
 *	mcast_build_stree
 *		The callback for building the spanning tree for multicast
 *		forwarding, called per MLID.
@@ -269,6 +281,7 @@ typedef struct osm_opensm {
 	struct osm_routing_engine *default_routing_engine;
 	boolean_t no_fallback_routing_engine;
 	osm_stats_t stats;
+	osm_snapshot_t snapshot;
 	osm_console_t console;
 	nn_map_t *node_name_map;
 } osm_opensm_t;
@@ -327,6 +340,10 @@ typedef struct osm_opensm {
 *	stats
 *		Open SM statistics block
 *
+*	snapshot
+*		Fabric snapshot loaded from snapshot_file, used during the
+*		first master sweep after a restart.
+*
 * SEE ALSO
 *********/
 
@@ -719,6 +736,7 @@ void osm_opensm_report_event(osm_opensm_t *osm, osm_epi_event_id_t event_id,
 /* dump helpers */
 void osm_dump_mcast_routes(osm_opensm_t * osm);
 void osm_dump_all(osm_opensm_t * osm);
+void osm_dump_sweep_stats(osm_opensm_t * osm);
 void osm_dump_qmap_to_file(osm_opensm_t * p_osm, const char *file_name,
 			   cl_qmap_t * map,
 			   void (*func) (cl_map_item_t *, FILE *, void *),
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2004-2008 Voltaire, Inc. All rights reserved.
+ * Copyright (c) 2002-2005 Mellanox Technologies LTD. All rights reserved.
+ * Copyright (c) 1996-2003 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * Abstract:
+ * 	Declaration of the helpers the routing engines use to spread
+ *	independent work items over several threads.
+ */
+
+#ifndef _OSM_PARALLEL_H_
+#define _OSM_PARALLEL_H_
+
+#include <complib/cl_types.h>
+
+#ifdef __cplusplus
+#  define BEGIN_C_DECLS extern "C" {
+#  define END_C_DECLS   }
+#else				/* !__cplusplus */
+#  define BEGIN_C_DECLS
+#  define END_C_DECLS
+#endif				/* __cplusplus */
+
+BEGIN_C_DECLS
+/****h* OpenSM/Parallel
+* NAME
+*	Parallel
+*
+* DESCRIPTION
+*	Runs a function for each index of a range on a number of threads,
+*	and returns once all indexes are done.  The threads only live for
+*	the duration of the call, so nothing has to be set up beforehand.
+*
+*	The work items must be independent of each other.  The caller is
+*	blocked, and keeps any lock it holds, while they run.
+*
+*********/
+/****d* OpenSM: Parallel/osm_parallel_fn_t
+* NAME
+*	osm_parallel_fn_t
+*
+* DESCRIPTION
+*	Function processing one work item.
+*
+* SYNOPSIS
+*/
+typedef void (*osm_parallel_fn_t) (IN void *context, IN unsigned index,
+				   IN unsigned thread);
+/*
+* PARAMETERS
+*	context
+*		[in] Context passed to osm_parallel_for.
+*
+*	index
+*		[in] The work item to process.
+*
+*	thread
+*		[in] Number of the thread running the item, below the
+*		thread count passed to osm_parallel_for.  It can be used to
+*		pick per thread scratch buffers.
+*********/
+
+/****f* OpenSM: Parallel/osm_parallel_threads
+* NAME
+*	osm_parallel_threads
+*
+* DESCRIPTION
+*	Returns the number of threads to use for a configured thread count.
+*
+* SYNOPSIS
+*/
+unsigned osm_parallel_threads(IN uint32_t configured);
+/*
+* PARAMETERS
+*	configured
+*		[in] Configured number of threads, 0 for one thread per
+*		online CPU.
+*
+* RETURN VALUE
+*	The number of threads, at least 1.
+*********/
+
+/****f* OpenSM: Parallel/osm_parallel_for
+* NAME
+*	osm_parallel_for
+*
+* DESCRIPTION
+*	Calls a function for each index from 0 to count - 1, on up to
+*	num_threads threads.
+*
+* SYNOPSIS
+*/
+void osm_parallel_for(IN unsigned num_threads, IN unsigned count,
+		      IN osm_parallel_fn_t func, IN void *context);
+/*
+* PARAMETERS
+*	num_threads
+*		[in] Maximum number of threads, as returned by
+*		osm_parallel_threads.  The calling thread is one of them.
+*
+*	count
+*		[in] Number of work items.
+*
+*	func
+*		[in] Function processing a work item.
+*
+*	context
+*		[in] Context passed to func.
+*
+* NOTES
+*	Work items are handed out one at a time in increasing order, so
+*	expensive items should come first when the costs are known.  If
+*	threads cannot be created, the remaining items are run by the
+*	threads that could.
+*********/
+
+END_C_DECLS
+#endif				/* _OSM_PARALLEL_H_ */
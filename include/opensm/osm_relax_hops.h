@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2004-2008 Voltaire, Inc. All rights reserved.
+ * Copyright (c) 2002-2005 Mellanox Technologies LTD. All rights reserved.
+ * Copyright (c) 1996-2003 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * Abstract:
+ *    Declaration of the kernels that relax the min hop tables of a
+ *    switch port over a neighbor switch.
+ */
+
+#ifndef _OSM_RELAX_HOPS_H_
+#define _OSM_RELAX_HOPS_H_
+
+#include <complib/cl_types.h>
+
+#ifdef __cplusplus
+#  define BEGIN_C_DECLS extern "C" {
+#  define END_C_DECLS   }
+#else				/* !__cplusplus */
+#  define BEGIN_C_DECLS
+#  define END_C_DECLS
+#endif				/* __cplusplus */
+
+BEGIN_C_DECLS
+/****h* OpenSM/Relax Hops
+* NAME
+*	Relax Hops
+*
+* DESCRIPTION
+*	The min hop tables of a switch are stored by port, so the hop
+*	counts of a port to all switch LIDs are contiguous.  Relaxing a
+*	port over its neighbor switch combines that row with the least
+*	hop counts of the neighbor, which is done by a scalar kernel or
+*	by SSE2 and AVX2 kernels on x86 CPUs that support them.
+*
+*	All the kernels give the same tables.
+*
+*********/
+
+/****d* OpenSM: Relax Hops/osm_relax_hops_fn_t
+* NAME
+*	osm_relax_hops_fn_t
+*
+* DESCRIPTION
+*	Relaxes count hop counts of a switch port over a neighbor.
+*
+* SYNOPSIS
+*/
+typedef int (*osm_relax_hops_fn_t) (uint8_t * hops, uint8_t * least,
+				    const uint8_t * src, unsigned count,
+				    uint8_t hop_wf);
+/*
+* PARAMETERS
+*	hops
+*		[in out] Hop counts of the port.
+*
+*	least
+*		[in out] Least hop counts of the switch (port 0).
+*
+*	src
+*		[in] Least hop counts of the neighbor switch.
+*
+*	count
+*		Number of hop counts in each row.
+*
+*	hop_wf
+*		Hop weight of the port.
+*
+* RETURN VALUE
+*	Non zero if a hop count of the port changed.
+*
+* NOTES
+*	Every entry of hops becomes the smaller of itself and the
+*	entry of src plus hop_wf, saturated at OSM_NO_PATH, and least
+*	follows hops.
+*********/
+
+/****f* OpenSM: Relax Hops/osm_relax_hops_get
+* NAME
+*	osm_relax_hops_get
+*
+* DESCRIPTION
+*	Returns the relaxation kernel of the given name.
+*
+* SYNOPSIS
+*/
+osm_relax_hops_fn_t osm_relax_hops_get(IN const char *name);
+/*
+* PARAMETERS
+*	name
+*		[in] "scalar", "SSE2" or "AVX2".
+*
+* RETURN VALUE
+*	The kernel, or NULL if it is unknown or the CPU does not
+*	support it.
+*
+* SEE ALSO
+*	osm_relax_hops_select
+*********/
+
+/****f* OpenSM: Relax Hops/osm_relax_hops_select
+* NAME
+*	osm_relax_hops_select
+*
+* DESCRIPTION
+*	Returns the fastest relaxation kernel the CPU supports.
+*
+* SYNOPSIS
+*/
+osm_relax_hops_fn_t osm_relax_hops_select(OUT const char **p_name);
+/*
+* PARAMETERS
+*	p_name
+*		[out] Name of the kernel.
+*
+* RETURN VALUE
+*	The kernel.
+*
+* SEE ALSO
+*	osm_relax_hops_get
+*********/
+
+END_C_DECLS
+#endif				/* _OSM_RELAX_HOPS_H_ */
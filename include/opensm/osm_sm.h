@@ -131,6 +131,7 @@ typedef struct osm_sm {
 	osm_sm_mad_ctrl_t mad_ctrl;
 	osm_lid_mgr_t lid_mgr;
 	osm_ucast_mgr_t ucast_mgr;
+	uint8_t link_pipeline_state;
 	cl_disp_reg_handle_t sweep_fail_disp_h;
 	cl_disp_reg_handle_t ni_disp_h;
 	cl_disp_reg_handle_t pi_disp_h;
@@ -175,6 +176,11 @@ typedef struct osm_sm {
 *	p_lock
 *		Pointer to the serializing lock.
 *
+*	link_pipeline_state
+*		Highest port state the pipelined sweep may currently move
+*		ports to as their PortInfo Set responses arrive, or
+*		IB_LINK_NO_CHANGE when no pipeline is running.
+*
 * SEE ALSO
 *	SM object
 *********/
@@ -840,5 +846,99 @@ int osm_send_trap144(osm_sm_t *sm, ib_net16_t local);
 
 void osm_set_sm_priority(osm_sm_t *sm, uint8_t priority);
 
+/****f* OpenSM: SM/osm_link_mgr_pipeline_start
+* NAME
+*	osm_link_mgr_pipeline_start
+*
+* DESCRIPTION
+*	Starts the pipelined port configuration of a sweep: the PortInfo
+*	of every port is set and each port is moved on to ARMED as soon
+*	as its response arrives.
+*
+* SYNOPSIS
+*/
+int osm_link_mgr_pipeline_start(IN osm_sm_t * sm);
+/*
+* PARAMETERS
+*	sm
+*		[in] Pointer to an osm_sm_t object.
+*
+* RETURN VALUES
+*	0 on success, -1 if a PortInfo Set could not be sent.
+*
+* SEE ALSO
+*	osm_link_mgr_pipeline_activate, osm_link_mgr_pipeline_stop
+*********/
+
+/****f* OpenSM: SM/osm_link_mgr_pipeline_activate
+* NAME
+*	osm_link_mgr_pipeline_activate
+*
+* DESCRIPTION
+*	Lets the pipeline move ports on to ACTIVE, and does so for the
+*	links with both ends ARMED already.
+*
+* SYNOPSIS
+*/
+void osm_link_mgr_pipeline_activate(IN osm_sm_t * sm);
+/*
+* PARAMETERS
+*	sm
+*		[in] Pointer to an osm_sm_t object.
+*
+* SEE ALSO
+*	osm_link_mgr_pipeline_start
+*********/
+
+/****f* OpenSM: SM/osm_link_mgr_pipeline_stop
+* NAME
+*	osm_link_mgr_pipeline_stop
+*
+* DESCRIPTION
+*	Ends the pipeline; later PortInfo Set responses no longer change
+*	the port state.
+*
+* SYNOPSIS
+*/
+void osm_link_mgr_pipeline_stop(IN osm_sm_t * sm);
+/*
+* PARAMETERS
+*	sm
+*		[in] Pointer to an osm_sm_t object.
+*
+* SEE ALSO
+*	osm_link_mgr_pipeline_start
+*********/
+
+/****f* OpenSM: SM/osm_link_mgr_pipeline_advance
+* NAME
+*	osm_link_mgr_pipeline_advance
+*
+* DESCRIPTION
+*	Called by the PortInfo receiver for the successful PortInfo Set
+*	responses of the pipeline, to move the port on to its next state.
+*	The plock must be held before calling this function.
+*
+* SYNOPSIS
+*/
+void osm_link_mgr_pipeline_advance(IN osm_sm_t * sm,
+				   IN osm_physp_t * p_physp,
+				   IN uint8_t link_state);
+/*
+* PARAMETERS
+*	sm
+*		[in] Pointer to an osm_sm_t object.
+*
+*	p_physp
+*		[in] Port the response was received for.
+*
+*	link_state
+*		[in] Port state the port is to be moved on to next, as
+*		recorded in the context of the PortInfo Set.
+*
+* SEE ALSO
+*	osm_link_mgr_pipeline_start
+*********/
+
 END_C_DECLS
 #endif				/* _OSM_SM_H_ */
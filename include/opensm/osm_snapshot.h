@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2004-2008 Voltaire, Inc. All rights reserved.
+ * Copyright (c) 2002-2005 Mellanox Technologies LTD. All rights reserved.
+ * Copyright (c) 1996-2003 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * Abstract:
+ *    Declaration of the fabric snapshot used to speed up the first
+ *    heavy sweep after a restart.
+ */
+
+#ifndef _OSM_SNAPSHOT_H_
+#define _OSM_SNAPSHOT_H_
+
+#include <iba/ib_types.h>
+#include <complib/cl_qmap.h>
+
+#ifdef __cplusplus
+#  define BEGIN_C_DECLS extern "C" {
+#  define END_C_DECLS   }
+#else				/* !__cplusplus */
+#  define BEGIN_C_DECLS
+#  define END_C_DECLS
+#endif				/* __cplusplus */
+
+BEGIN_C_DECLS
+
+struct osm_opensm;
+struct osm_routing_engine;
+
+/****h* OpenSM/Snapshot
+* NAME
+*	Snapshot
+*
+* DESCRIPTION
+*	The Snapshot object holds a compact binary image of the fabric as
+*	it was when the last heavy sweep completed: every switch with its
+*	links and unicast forwarding table, and the LIDs of every port.
+*	It is written to snapshot_file after each successful heavy sweep
+*	and read back when OpenSM starts.
+*
+*	During the first master sweep after the restart the snapshot is
+*	compared with the discovered fabric.  If the switches, the links
+*	between them, the port LIDs and the routing options are unchanged,
+*	routing engines that keep no state besides the LFTs take their
+*	tables from the snapshot instead of recomputing them.  The LFTs
+*	are still sent to the switches as on any first sweep, since
+*	reading them back to find out which switches hold them costs as
+*	many SMPs as sending them.
+*
+*	The Snapshot object is only used by the SM sweeper thread.
+*
+*********/
+
+/****s* OpenSM: Snapshot/osm_snapshot_sw_t
+* NAME
+*	osm_snapshot_sw_t
+*
+* DESCRIPTION
+*	Switch record of the snapshot.
+*
+* SYNOPSIS
+*/
+typedef struct osm_snapshot_sw {
+	cl_map_item_t map_item;
+	uint8_t num_ports;
+	ib_net64_t *remote_guid;
+	uint8_t *remote_port;
+	uint16_t lft_size;
+	uint8_t *lft;
+} osm_snapshot_sw_t;
+/*
+* FIELDS
+*	map_item
+*		Linkage structure for cl_qmap, keyed by the node GUID.
+*		MUST BE FIRST MEMBER!
+*
+*	num_ports
+*		Number of ports of the switch, including port 0.
+*
+*	remote_guid
+*		Node GUID of the peer of every port, 0 if the port has
+*		no healthy link.
+*
+*	remote_port
+*		Port number of the peer of every port.
+*
+*	lft_size
+*		Size of the unicast forwarding table in bytes.
+*
+*	lft
+*		The unicast forwarding table.
+*
+* SEE ALSO
+*	Snapshot
+*********/
+
+/****s* OpenSM: Snapshot/osm_snapshot_port_t
+* NAME
+*	osm_snapshot_port_t
+*
+* DESCRIPTION
+*	Port record of the snapshot.
+*
+* SYNOPSIS
+*/
+typedef struct osm_snapshot_port {
+	cl_map_item_t map_item;
+	uint16_t base_lid;
+	uint8_t lmc;
+} osm_snapshot_port_t;
+/*
+* FIELDS
+*	map_item
+*		Linkage structure for cl_qmap, keyed by the port GUID.
+*		MUST BE FIRST MEMBER!
+*
+*	base_lid
+*		Base LID of the port, in host order.
+*
+*	lmc
+*		LMC of the port.
+*
+* SEE ALSO
+*	Snapshot
+*********/
+
+/****s* OpenSM: Snapshot/osm_snapshot_t
+* NAME
+*	osm_snapshot_t
+*
+* DESCRIPTION
+*	Snapshot loaded at startup.
+*
+* SYNOPSIS
+*/
+typedef struct osm_snapshot {
+	cl_qmap_t sw_tbl;
+	cl_qmap_t port_tbl;
+	uint32_t conf_hash;
+	char routing_engine[32];
+	boolean_t matched;
+} osm_snapshot_t;
+/*
+* FIELDS
+*	sw_tbl
+*		Switch records, keyed by node GUID.
+*
+*	port_tbl
+*		Port records, keyed by port GUID.
+*
+*	conf_hash
+*		Hash of the routing options the snapshot was taken with,
+*		including the content of the files they name.
+*
+*	routing_engine
+*		Name of the routing engine that computed the LFTs.
+*
+*	matched
+*		TRUE once the snapshot was found to describe the
+*		discovered fabric.
+*
+* SEE ALSO
+*	Snapshot
+*********/
+
+/****f* OpenSM: Snapshot/osm_snapshot_construct
+* NAME
+*	osm_snapshot_construct
+*
+* DESCRIPTION
+*	Constructs an empty snapshot.
+*
+* SYNOPSIS
+*/
+void osm_snapshot_construct(IN osm_snapshot_t * p_snap);
+/*
+* PARAMETERS
+*	p_snap
+*		[in] Pointer to the snapshot.
+*
+* SEE ALSO
+*	osm_snapshot_destroy
+*********/
+
+/****f* OpenSM: Snapshot/osm_snapshot_destroy
+* NAME
+*	osm_snapshot_destroy
+*
+* DESCRIPTION
+*	Releases all records of the snapshot, leaving it empty.
+*
+* SYNOPSIS
+*/
+void osm_snapshot_destroy(IN osm_snapshot_t * p_snap);
+/*
+* PARAMETERS
+*	p_snap
+*		[in] Pointer to the snapshot.
+*
+* SEE ALSO
+*	osm_snapshot_construct
+*********/
+
+/****f* OpenSM: Snapshot/osm_snapshot_load
+* NAME
+*	osm_snapshot_load
+*
+* DESCRIPTION
+*	Reads snapshot_file into osm->snapshot.  A missing, truncated or
+*	corrupted file leaves the snapshot empty.
+*
+* SYNOPSIS
+*/
+int osm_snapshot_load(IN struct osm_opensm *osm);
+/*
+* PARAMETERS
+*	osm
+*		[in] Pointer to the OpenSM object.
+*
+* RETURN VALUE
+*	0 if a snapshot was loaded, -1 otherwise.
+*
+* SEE ALSO
+*	osm_snapshot_store
+*********/
+
+/****f* OpenSM: Snapshot/osm_snapshot_store
+* NAME
+*	osm_snapshot_store
+*
+* DESCRIPTION
+*	Writes the current fabric to snapshot_file.  The file is replaced
+*	atomically.  The OpenSM lock must not be held.
+*
+* SYNOPSIS
+*/
+int osm_snapshot_store(IN struct osm_opensm *osm);
+/*
+* PARAMETERS
+*	osm
+*		[in] Pointer to the OpenSM object.
+*
+* RETURN VALUE
+*	0 on success, -1 on error.
+*
+* SEE ALSO
+*	osm_snapshot_load
+*********/
+
+/****f* OpenSM: Snapshot/osm_snapshot_verify
+* NAME
+*	osm_snapshot_verify
+*
+* DESCRIPTION
+*	Compares the loaded snapshot with the discovered fabric and
+*	discards it if they differ.  Must be called after LID
+*	assignment, with the OpenSM lock not held.
+*
+* SYNOPSIS
+*/
+boolean_t osm_snapshot_verify(IN struct osm_opensm *osm);
+/*
+* PARAMETERS
+*	osm
+*		[in] Pointer to the OpenSM object.
+*
+* RETURN VALUE
+*	TRUE if the snapshot describes the fabric, FALSE otherwise.
+*
+* SEE ALSO
+*	osm_snapshot_build_lfts
+*********/
+
+/****f* OpenSM: Snapshot/osm_snapshot_build_lfts
+* NAME
+*	osm_snapshot_build_lfts
+*
+* DESCRIPTION
+*	Fills the new LFTs of all switches from the snapshot instead of
+*	running the forwarding table stage of routing engine r.  Only
+*	done when the snapshot matches the fabric, was computed by the
+*	same engine, and the engine keeps no state besides the LFTs
+*	(no SL, VL or multicast hooks).  The OpenSM lock must be held.
+*
+* SYNOPSIS
+*/
+int osm_snapshot_build_lfts(IN struct osm_opensm *osm,
+			    IN struct osm_routing_engine *r);
+/*
+* PARAMETERS
+*	osm
+*		[in] Pointer to the OpenSM object.
+*
+*	r
+*		[in] Routing engine being run.
+*
+* RETURN VALUE
+*	0 if the LFTs were taken from the snapshot, 1 if the routing
+*	engine has to compute them.
+*
+* SEE ALSO
+*	osm_snapshot_verify
+*********/
+
+END_C_DECLS
+#endif				/* _OSM_SNAPSHOT_H_ */
@@ -48,6 +48,7 @@
 #else
 #include <complib/cl_event.h>
 #endif
+#include <time.h>
 #include <complib/cl_atomic.h>
 #include <opensm/osm_base.h>
 
@@ -72,6 +73,129 @@ BEGIN_C_DECLS
 *	Steve King, Intel
 *
 *********/
+/****d* OpenSM: Statistics/osm_sweep_phase_t
+* NAME
+*	osm_sweep_phase_t
+*
+* DESCRIPTION
+*	Phases of a heavy sweep that are timed separately.
+*
+* SYNOPSIS
+*/
+typedef enum osm_sweep_phase {
+	OSM_SWEEP_PHASE_HOP_0 = 0,
+	OSM_SWEEP_PHASE_DISCOVERY,
+	OSM_SWEEP_PHASE_DROP_MGR,
+	OSM_SWEEP_PHASE_PKEY,
+	OSM_SWEEP_PHASE_LID_MGR,
+	OSM_SWEEP_PHASE_SNAPSHOT,
+	OSM_SWEEP_PHASE_LID_MATRICES,
+	OSM_SWEEP_PHASE_FWD_TABLES,
+	OSM_SWEEP_PHASE_LFT_PUSH,
+	OSM_SWEEP_PHASE_QOS,
+	OSM_SWEEP_PHASE_MCAST,
+	OSM_SWEEP_PHASE_GUID,
+	OSM_SWEEP_PHASE_LINK_MGR,
+	OSM_SWEEP_PHASE_OTHER,
+	OSM_SWEEP_PHASE_MAX
+} osm_sweep_phase_t;
+/*
+* NOTES
+*	OSM_SWEEP_PHASE_DISCOVERY starts with the hop 1 SMPs and lasts until
+*	all nodes have been discovered.  OSM_SWEEP_PHASE_SNAPSHOT is the
+*	comparison of the fabric with the snapshot after a restart.
+*	OSM_SWEEP_PHASE_LFT_PUSH includes
+*	waiting for the forwarding and QoS tables to be acknowledged.
+*	OSM_SWEEP_PHASE_OTHER covers the rest, such as the checks for other
+*	SMs and writing the dump files.
+*********/
+
+/****s* OpenSM: Statistics/osm_sweep_phase_stats_t
+* NAME
+*	osm_sweep_phase_stats_t
+*
+* DESCRIPTION
+*	What one phase of a heavy sweep cost.
+*
+* SYNOPSIS
+*/
+typedef struct osm_sweep_phase_stats {
+	uint64_t wall_usec;
+	uint64_t cpu_usec;
+	uint32_t smps_sent;
+	uint32_t smps_rcvd;
+	uint32_t smps_timed_out;
+} osm_sweep_phase_stats_t;
+/*
+* FIELDS
+*	wall_usec
+*		Wall clock time spent in the phase.
+*
+*	cpu_usec
+*		CPU time used by all OpenSM threads during the phase.
+*
+*	smps_sent
+*		Number of QP0 MADs sent during the phase.
+*
+*	smps_rcvd
+*		Number of QP0 MADs received during the phase.
+*
+*	smps_timed_out
+*		Number of QP0 MADs that failed during the phase.
+*
+* NOTES
+*	With pipelined_sweep, the MADs of stages that overlap are counted
+*	to the phase in which they complete.
+*********/
+
+/****s* OpenSM: Statistics/osm_sweep_stats_t
+* NAME
+*	osm_sweep_stats_t
+*
+* DESCRIPTION
+*	Per phase statistics of one heavy sweep.  This is also the data
+*	of the OSM_EVENT_ID_SWEEP_STATS event.
+*
+* SYNOPSIS
+*/
+typedef struct osm_sweep_stats {
+	uint32_t sweep_num;
+	time_t start_time;
+	boolean_t errors;
+	osm_sweep_phase_t aborted;
+	osm_sweep_phase_stats_t total;
+	osm_sweep_phase_stats_t phase[OSM_SWEEP_PHASE_MAX];
+} osm_sweep_stats_t;
+/*
+* FIELDS
+*	sweep_num
+*		Number of heavy sweeps recorded before this one.
+*
+*	start_time
+*		Time the sweep started.
+*
+*	errors
+*		TRUE if the subnet did not come up because of errors
+*		during the sweep.
+*
+*	aborted
+*		Phase in which the sweep was given up, for instance while
+*		waiting for the MADs of a phase, or OSM_SWEEP_PHASE_MAX if
+*		the sweep ran to its end.  Only the phases up to this one
+*		have statistics.
+*
+*	total
+*		Sum of all phases.
+*
+*	phase
+*		Statistics of each phase, indexed by osm_sweep_phase_t.
+*
+* SEE ALSO
+*	osm_sweep_phase_t, osm_sweep_phase_stats_t
+*********/
+
+#define OSM_SWEEP_STATS_HISTORY 16
+
 /****s* OpenSM: Statistics/osm_stats_t
 * NAME
 *	osm_stats_t
@@ -88,11 +212,19 @@ typedef struct osm_stats {
 	atomic32_t qp0_mads_sent;
 	atomic32_t qp0_unicasts_sent;
 	atomic32_t qp0_mads_rcvd_unknown;
+	atomic32_t qp0_mads_timeout;
+	atomic32_t qp0_lid_routed_sent;
+	atomic32_t qp0_lid_routed_failed;
 	atomic32_t sa_mads_outstanding;
 	atomic32_t sa_mads_rcvd;
 	atomic32_t sa_mads_sent;
 	atomic32_t sa_mads_rcvd_unknown;
 	atomic32_t sa_mads_ignored;
+	osm_sweep_phase_t sweep_phase;
+	osm_sweep_phase_stats_t sweep_mark;
+	osm_sweep_stats_t sweep_cur;
+	osm_sweep_stats_t sweeps[OSM_SWEEP_STATS_HISTORY];
+	uint32_t sweep_count;
 #ifdef HAVE_LIBPTHREAD
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
@@ -126,6 +258,18 @@ typedef struct osm_stats {
 *		Total number of unknown QP0 MADs received. This includes
 *		unrecognized attribute IDs and methods.
 *
+*	qp0_mads_timeout
+*		Total number of QP0 MADs that failed, mostly because they
+*		timed out.
+*
+*	qp0_lid_routed_sent
+*		Total number of SMPs sent LID routed instead of directed
+*		route.
+*
+*	qp0_lid_routed_failed
+*		Total number of LID routed SMPs that failed and were resent
+*		directed route.
+*
 *	sa_mads_outstanding
 *		Contains the number of SA MADs outstanding on QP1.
 *
@@ -143,6 +287,23 @@ typedef struct osm_stats {
 *		Total number of SA MADs received because SM is not
 *		master or SM is in first time sweep.
 *
+*	sweep_phase
+*		Phase of the heavy sweep in progress, or
+*		OSM_SWEEP_PHASE_MAX when no sweep is being timed.
+*
+*	sweep_mark
+*		Clocks and MAD counters at the start of the current phase.
+*
+*	sweep_cur
+*		Statistics of the heavy sweep in progress.
+*
+*	sweeps
+*		Statistics of the last OSM_SWEEP_STATS_HISTORY heavy sweeps,
+*		indexed by sweep number modulo OSM_SWEEP_STATS_HISTORY.
+*
+*	sweep_count
+*		Number of heavy sweeps recorded so far.
+*
 * SEE ALSO
 ***************/
 
@@ -180,5 +341,122 @@ static inline uint32_t osm_stats_dec_qp0_outstanding(osm_stats_t *stats)
 	return outstanding;
 }
 
+/****f* OpenSM: Statistics/osm_sweep_stats_start
+* NAME
+*	osm_sweep_stats_start
+*
+* DESCRIPTION
+*	Starts timing a heavy sweep.  The first phase is
+*	OSM_SWEEP_PHASE_HOP_0.
+*
+* SYNOPSIS
+*/
+void osm_sweep_stats_start(IN osm_stats_t * stats);
+/*
+* PARAMETERS
+*	stats
+*		[in] Pointer to the statistics block.
+*
+* NOTES
+*	Only called by the SM thread.  A sweep that is started again
+*	before it ends or is aborted is not recorded.
+*
+* SEE ALSO
+*	osm_sweep_stats_phase, osm_sweep_stats_end
+*********/
+
+/****f* OpenSM: Statistics/osm_sweep_stats_phase
+* NAME
+*	osm_sweep_stats_phase
+*
+* DESCRIPTION
+*	Ends the current phase of the heavy sweep being timed and starts
+*	the given one.  Does nothing if no sweep is being timed.
+*
+* SYNOPSIS
+*/
+void osm_sweep_stats_phase(IN osm_stats_t * stats,
+			   IN osm_sweep_phase_t phase);
+/*
+* PARAMETERS
+*	stats
+*		[in] Pointer to the statistics block.
+*
+*	phase
+*		[in] The phase that starts.  A phase may be entered several
+*		times per sweep, its statistics add up.
+*
+* SEE ALSO
+*	osm_sweep_stats_start, osm_sweep_stats_end
+*********/
+
+/****f* OpenSM: Statistics/osm_sweep_stats_end
+* NAME
+*	osm_sweep_stats_end
+*
+* DESCRIPTION
+*	Ends the heavy sweep being timed and adds it to the history.
+*
+* SYNOPSIS
+*/
+osm_sweep_stats_t *osm_sweep_stats_end(IN osm_stats_t * stats,
+				       IN boolean_t errors);
+/*
+* PARAMETERS
+*	stats
+*		[in] Pointer to the statistics block.
+*
+*	errors
+*		[in] TRUE if the sweep ended with errors.
+*
+* RETURN VALUE
+*	The recorded sweep, or NULL if no sweep was being timed.
+*
+* SEE ALSO
+*	osm_sweep_stats_start, osm_sweep_stats_phase, osm_sweep_stats_abort
+*********/
+
+/****f* OpenSM: Statistics/osm_sweep_stats_abort
+* NAME
+*	osm_sweep_stats_abort
+*
+* DESCRIPTION
+*	Ends the heavy sweep being timed, which was given up in its
+*	current phase, and adds it to the history with errors set.
+*
+* SYNOPSIS
+*/
+osm_sweep_stats_t *osm_sweep_stats_abort(IN osm_stats_t * stats);
+/*
+* PARAMETERS
+*	stats
+*		[in] Pointer to the statistics block.
+*
+* RETURN VALUE
+*	The recorded sweep, or NULL if no sweep was being timed.
+*
+* SEE ALSO
+*	osm_sweep_stats_start, osm_sweep_stats_end
+*********/
+
+/****f* OpenSM: Statistics/osm_sweep_phase_str
+* NAME
+*	osm_sweep_phase_str
+*
+* DESCRIPTION
+*	Returns a short name of a sweep phase.
+*
+* SYNOPSIS
+*/
+const char *osm_sweep_phase_str(IN osm_sweep_phase_t phase);
+/*
+* PARAMETERS
+*	phase
+*		[in] The sweep phase.
+*
+* RETURN VALUE
+*	The name of the phase, without spaces.
+*********/
+
 END_C_DECLS
 #endif				/* _OSM_STATS_H_ */
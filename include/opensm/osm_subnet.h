@@ -259,9 +259,13 @@ typedef struct osm_subn_opt {
 	uint32_t max_wire_smps;
 	uint32_t max_wire_smps2;
 	uint32_t max_smps_timeout;
+	uint32_t max_wire_smps_per_dest;
 	uint32_t transaction_timeout;
 	uint32_t transaction_retries;
 	uint32_t long_transaction_timeout;
+	boolean_t adaptive_transaction_timeout;
+	uint32_t min_transaction_timeout;
+	boolean_t lid_routed_smps;
 	uint8_t sm_priority;
 	uint8_t lmc;
 	boolean_t lmc_esp0;
@@ -273,6 +277,7 @@ typedef struct osm_subn_opt {
 	boolean_t reassign_lids;
 	boolean_t ignore_other_sm;
 	boolean_t single_thread;
+	uint32_t disp_threads;
 	boolean_t disable_multicast;
 	boolean_t force_log_flush;
 	uint8_t subnet_timeout;
@@ -310,9 +315,18 @@ typedef struct osm_subn_opt {
 	char *port_search_ordering_file;
 	boolean_t port_profile_switch_nodes;
 	boolean_t sweep_on_trap;
+	boolean_t pipelined_sweep;
 	char *routing_engine_names;
+	uint32_t routing_threads;
+	boolean_t lid_matrix_bfs;
+	uint32_t dfsssp_batch_size;
+	uint32_t ftree_batch_size;
+	boolean_t ftree_incremental_reroute;
+	boolean_t nue_parallel_layers;
+	boolean_t nue_incremental_reroute;
 	boolean_t avoid_throttled_links;
 	boolean_t use_ucast_cache;
+	char *snapshot_file;
 	boolean_t connect_roots;
 	char *lid_matrix_dump_file;
 	char *lfts_file;
@@ -429,6 +443,10 @@ typedef struct osm_subn_opt {
 *		The wait time in usec for timeout based SMPs.  Default is
 *		timeout * retries.
 *
+*	max_wire_smps_per_dest
+*		The maximum number of SMPs sent in parallel to a single
+*		destination (DR path or LID).  Default is 0 (no limit).
+*
 *	transaction_timeout
 *		The maximum time in milliseconds allowed for a transaction
 *		to complete.  Default is 200.
@@ -440,6 +458,22 @@ typedef struct osm_subn_opt {
 *		The maximum time in milliseconds allowed for "long" transaction
 *		to complete.  Default is 500.
 *
+*	adaptive_transaction_timeout
+*		When TRUE, the timeout of each SMP is derived from the round
+*		trip times measured per destination and per hop count,
+*		bounded by min_transaction_timeout and transaction_timeout.
+*		Default is FALSE.
+*
+*	min_transaction_timeout
+*		The lower bound in milliseconds of adaptive SMP timeouts.
+*		Default is 20.
+*
+*	lid_routed_smps
+*		When TRUE, SMPs to nodes known to be reachable through the
+*		LFTs are sent LID routed instead of directed route, except
+*		for discovery and port configuration.  An SMP that fails
+*		LID routed is resent directed route.  Default is FALSE.
+*
 *	sm_priority
 *		The priority of this SM as specified by the user.  This
 *		value is made available in the SMInfo attribute.
@@ -472,6 +506,11 @@ typedef struct osm_subn_opt {
 *		last message stayed in the queue more than this value the SA
 *		request will be immediately returned with a BUSY status.
 *
+*	disp_threads
+*		The number of dispatcher worker threads handling received
+*		SMPs and SA queries. 0 means one thread per CPU.
+*		Ignored when single_thread is set.
+*
 *	subnet_timeout
 *		The subnet_timeout that will be set for all the ports in the
 *		design SubnSet(PortInfo.vl_stall_life))
@@ -543,9 +582,75 @@ typedef struct osm_subn_opt {
 *	sweep_on_trap
 *		Received traps will initiate a new sweep.
 *
+*	pipelined_sweep
+*		If TRUE, the heavy sweep does not wait for the whole fabric
+*		between the forwarding table, alias GUID and port state
+*		stages.  Each port moves to ARMED as soon as its own
+*		configuration is acknowledged, and to ACTIVE once its
+*		neighbor is ARMED and the unicast tables are in place.
+*		Default is FALSE.
+*
 *	routing_engine_names
 *		Name of routing engine(s) to use.
 *
+*	routing_threads
+*		Number of threads the routing engines may use for work
+*		that can be done in parallel, such as building the LFTs
+*		of the switches when neither lmc nor scatter_ports is
+*		set, or the LFTs of torus-2QoS.  0 means one thread per
+*		online CPU.
+*
+*	lid_matrix_bfs
+*		If TRUE, the min hop tables are built with a shortest path
+*		search from every switch over a flat copy of the switch
+*		graph, spread over routing_threads.  If FALSE, the hop
+*		counts are propagated between neighbors until nothing
+*		changes, which is usually faster unless many threads are
+*		available.  Both give the same tables.  Default is FALSE.
+*
+*	dfsssp_batch_size
+*		Number of destinations the dfsssp and sssp routing engines
+*		route at once.  The routes of a batch are computed on
+*		routing_threads against the same link weights, so larger
+*		batches are faster but balance the routes less evenly.
+*		The routes only depend on the batch size, not on the number
+*		of threads.  Default is 1, which routes one destination
+*		after the other.
+*
+*	ftree_batch_size
+*		Number of destinations the fat-tree routing engine routes
+*		at once.  Only the main paths of the destinations of a
+*		batch are chosen one after the other; the rest is routed on
+*		routing_threads against the port group load counters from
+*		before the batch, and the counter updates are added up
+*		afterwards.  Larger batches are faster but balance the
+*		routes less evenly; the routes only depend on the batch
+*		size, not on the number of threads.  Default is 1, which
+*		routes one destination after the other.
+*
+*	ftree_incremental_reroute
+*		If TRUE, the fat-tree routing engine keeps the fabric it
+*		ranked and indexed and the routes of the last routing, and
+*		if switch-to-switch links failed since then, only removes
+*		them from their port groups and reroutes the destinations
+*		whose routes used one of them.  Any other change of the
+*		subnet still rebuilds the fabric.  Default is FALSE.
+*
+*	nue_parallel_layers
+*		If TRUE, the Nue routing engine routes its virtual layers
+*		concurrently on routing_threads, each on its own copy of
+*		the network and the channel dependency graph.  All layers
+*		then start from the same link weights, which balances the
+*		routes slightly differently than routing one layer after
+*		the other.  Default is FALSE.
+*
+*	nue_incremental_reroute
+*		If TRUE, the Nue routing engine keeps the channel dependency
+*		graph and the routes of the last routing, and if switch-to-
+*		switch links failed since then, only reroutes the destinations
+*		whose routes used one of them.  Any other change of the
+*		subnet still reroutes all destinations.  Default is FALSE.
+*
 *	avoid_throttled_links
 *		This option will enforce that throttled switch-to-switch links
 *		in the fabric are treated as 'broken' by the routing engines
@@ -560,6 +665,13 @@ typedef struct osm_subn_opt {
 *	use_ucast_cache
 *		When TRUE enables unicast routing cache.
 *
+*	snapshot_file
+*		Name of the file the fabric and its LFTs are saved to
+*		after every successful heavy sweep.  After a restart the
+*		LFTs in it are used instead of running the routing engine
+*		when the fabric and the routing options are unchanged.
+*		NULL disables it.
+*
 *	lid_matrix_dump_file
 *		Name of the lid matrix dump file from where switch
 *		lid matrices (min hops tables) will be loaded
@@ -805,10 +917,12 @@ typedef struct osm_subn {
 	boolean_t coming_out_of_standby;
 	boolean_t sweeping_enabled;
 	unsigned need_update;
+	unsigned topology_gen;
 	cl_fmap_t mgrp_mgid_tbl;
 	osm_db_domain_t *p_g2m;
 	osm_db_domain_t *p_neighbor;
 	void *mboxes[IB_LID_MCAST_END_HO - IB_LID_MCAST_START_HO + 1];
+	uint8_t lid_route_ok[IB_LID_UCAST_END_HO + 1];
 } osm_subn_t;
 /*
 * FIELDS
@@ -948,6 +1062,13 @@ typedef struct osm_subn {
 *		This flag should be on during first non-master heavy
 *		(including pre-master discovery stage)
 *
+*	topology_gen
+*		Incremented with the lock held exclusively whenever a
+*		receiver may change the nodes, links, LIDs or port health.
+*		The unicast routing is built with the lock held shared and
+*		compares it to find out whether the subnet changed
+*		meanwhile.
+*
 *	mgrp_mgid_tbl
 *		Container of pointers to all Multicast group objects in
 *		the subnet. Indexed by MGID.
@@ -956,6 +1077,11 @@ typedef struct osm_subn {
 *		Array of pointers to all Multicast MLID box objects in the
 *		subnet. Indexed by MLID offset from base MLID.
 *
+*	lid_route_ok
+*		Non zero for the unicast LIDs known to be reachable by LID
+*		routed SMPs: those assigned when the subnet last came up
+*		without errors and not failed since.  Indexed by LID.
+*
 * SEE ALSO
 *	Subnet object
 *********/
@@ -79,6 +79,22 @@ BEGIN_C_DECLS
 *	Steve King, Intel
 *
 *********/
+/****d* OpenSM: Switch/OSM_NO_HOP_ROW
+* NAME
+*	OSM_NO_HOP_ROW
+*
+* DESCRIPTION
+*	Value of osm_switch_t.hop_rows for a LID without hop counts.
+*
+*	Only the LIDs of switches have rows.  The hop counts to an end
+*	port are those to the switch it is attached to, plus one; see
+*	osm_switch_get_port_least_hops.
+*
+* SYNOPSIS
+*/
+#define OSM_NO_HOP_ROW	0xFFFF
+/***********/
+
 /****s* OpenSM: Switch/osm_switch_t
 * NAME
 *	osm_switch_t
@@ -98,7 +114,8 @@ typedef struct osm_switch {
 	uint16_t max_lid_ho;
 	uint8_t num_ports;
 	uint16_t num_hops;
-	uint8_t **hops;
+	uint8_t *hops;
+	const uint16_t *hop_rows;
 	osm_port_profile_t *p_prof;
 	uint8_t *search_ordering_ports;
 	uint8_t *lft;
@@ -132,11 +149,19 @@ typedef struct osm_switch {
 *		Number of ports for this switch.
 *
 *	num_hops
-*		Size of hops table for this switch.
+*		Number of rows the hops table has room for.
 *
 *	hops
 *		LID Matrix for this switch containing the hop count
-*		to every LID from every port.
+*		to every switch LID from every port, in a single
+*		allocation.  The matrix is stored by port: the num_hops
+*		rows of a port are contiguous (see osm_switch_get_port_hops).
+*		Port 0 holds the least hop count of each row.
+*
+*	hop_rows
+*		Row of hops used for each LID up to max_lid_ho, or
+*		OSM_NO_HOP_ROW.  The array is shared by all switches and
+*		owned by the unicast manager.
 *
 *	p_prof
 *		Pointer to array of Port Profile objects for this switch.
@@ -267,8 +292,12 @@ static inline uint8_t osm_switch_get_hop_count(IN const osm_switch_t * p_sw,
 					       IN uint16_t lid_ho,
 					       IN uint8_t port_num)
 {
-	return (lid_ho > p_sw->max_lid_ho || !p_sw->hops[lid_ho]) ?
-	    OSM_NO_PATH : p_sw->hops[lid_ho][port_num];
+	uint16_t row;
+
+	if (lid_ho > p_sw->max_lid_ho ||
+	    (row = p_sw->hop_rows[lid_ho]) == OSM_NO_HOP_ROW)
+		return OSM_NO_PATH;
+	return p_sw->hops[port_num * p_sw->num_hops + row];
 }
 /*
 * PARAMETERS
@@ -289,6 +318,41 @@ static inline uint8_t osm_switch_get_hop_count(IN const osm_switch_t * p_sw,
 * SEE ALSO
 *********/
 
+/****f* OpenSM: Switch/osm_switch_get_port_hops
+* NAME
+*	osm_switch_get_port_hops
+*
+* DESCRIPTION
+*	Returns the hop counts from the specified port to all switch LIDs,
+*	indexed by their row in osm_switch_t.hop_rows.
+*
+* SYNOPSIS
+*/
+static inline uint8_t *osm_switch_get_port_hops(IN const osm_switch_t * p_sw,
+						IN uint8_t port_num)
+{
+	return p_sw->hops + port_num * p_sw->num_hops;
+}
+/*
+* PARAMETERS
+*	p_sw
+*		[in] Pointer to a Switch object.
+*
+*	port_num
+*		[in] Port number in the switch, or 0 for the least hop
+*		counts of the switch.
+*
+* RETURN VALUES
+*	Returns a pointer to num_hops hop counts.
+*
+* NOTES
+*	The least hop count of a row must never be larger than the hop
+*	count of any port in the same row.
+*
+* SEE ALSO
+*	osm_switch_get_hop_count, osm_switch_get_least_hops
+*********/
+
 /****f* OpenSM: Switch/osm_switch_set_hops
 * NAME
 *	osm_switch_set_hops
@@ -318,6 +382,8 @@ cl_status_t osm_switch_set_hops(IN osm_switch_t * p_sw, IN uint16_t lid_ho,
 *	Returns 0 if successful. -1 if it failed
 *
 * NOTES
+*	Hop counts to LIDs that are not switch LIDs are not stored and
+*	setting them succeeds without effect.
 *
 * SEE ALSO
 *********/
@@ -355,8 +421,12 @@ void osm_switch_clear_hops(IN osm_switch_t * p_sw);
 static inline uint8_t osm_switch_get_least_hops(IN const osm_switch_t * p_sw,
 						IN uint16_t lid_ho)
 {
-	return (lid_ho > p_sw->max_lid_ho || !p_sw->hops[lid_ho]) ?
-	    OSM_NO_PATH : p_sw->hops[lid_ho][0];
+	uint16_t row;
+
+	if (lid_ho > p_sw->max_lid_ho ||
+	    (row = p_sw->hop_rows[lid_ho]) == OSM_NO_HOP_ROW)
+		return OSM_NO_PATH;
+	return p_sw->hops[row];
 }
 /*
 * PARAMETERS
@@ -1103,7 +1173,9 @@ static inline uint32_t osm_switch_path_count_get(IN const osm_switch_t * p_sw,
 * SYNOPSIS
 */
 int osm_switch_prepare_path_rebuild(IN osm_switch_t * p_sw,
-				    IN uint16_t max_lids);
+				    IN uint16_t max_lids,
+				    IN const uint16_t * hop_rows,
+				    IN uint16_t num_hop_rows);
 /*
 * PARAMETERS
 *	p_sw
@@ -1112,10 +1184,19 @@ int osm_switch_prepare_path_rebuild(IN osm_switch_t * p_sw,
 *	max_lids
 *		[in] Max number of lids in the subnet.
 *
+*	hop_rows
+*		[in] Row of the hops table for each LID up to max_lids,
+*		or OSM_NO_HOP_ROW.  The array must stay valid until the
+*		next call.
+*
+*	num_hop_rows
+*		[in] Number of rows used in hop_rows.
+*
 * RETURN VALUE
 *	Returns zero on success, or negative value if an error occurred.
 *
 * NOTES
+*	The hops table is cleared.
 *
 * SEE ALSO
 *********/
@@ -76,6 +76,7 @@ typedef struct _switch {
 	int used_channels;
 	int *dij_channels;
 	int q_state;
+	int first_channel;
 	mesh_node_t *node;
 	struct routing_table {
 		unsigned out_link;
@@ -89,9 +90,12 @@ typedef struct _lash {
 	uint8_t vl_min;
 	int balance_limit;
 	switch_t **switches;
-	cdg_vertex_t ****cdg_vertex_matrix;
+	int num_channels;
+	cdg_vertex_t **cdg_vertices;
+	cdg_vertex_t **cdg_visited;
+	int num_cdg_visited;
 	int num_mst_in_lane[IB_MAX_NUM_VLS];
-	int ***virtual_location;
+	uint8_t *virtual_location;
 } lash_t;
 
 #endif
@@ -101,6 +101,8 @@ typedef struct osm_ucast_mgr {
 	boolean_t some_hop_count_set;
 	cl_qmap_t cache_sw_tbl;
 	boolean_t cache_valid;
+	uint16_t *hop_rows;
+	uint16_t num_hop_rows;
 } osm_ucast_mgr_t;
 /*
 * FIELDS
@@ -136,6 +138,13 @@ typedef struct osm_ucast_mgr {
 *	cache_valid
 *		TRUE if the unicast cache is valid.
 *
+*	hop_rows
+*		Row of the switch hops tables used for each unicast LID,
+*		shared by all switches.  See osm_switch_t.hop_rows.
+*
+*	num_hop_rows
+*		Number of rows in use, one per switch LID.
+*
 * SEE ALSO
 *	Unicast Manager object
 *********/
@@ -78,6 +78,17 @@ BEGIN_C_DECLS
 *	OpenSM modules may post VL15 MADs to the VL15 interface as fast
 *	as possible.
 *
+*	MADs expecting a response are queued per destination (DR path or
+*	LID) and, when max_wire_smps_per_dest is set, each destination is
+*	limited to that many MADs on the wire.  Destinations are serviced
+*	round robin so a slow or unresponsive node only holds its own
+*	slots, while max_wire_smps still bounds the total.
+*
+*	The round trip time of every completed SMP is fed to smoothed
+*	estimators, one per destination and one per hop count.  When
+*	adaptive_transaction_timeout is set, they provide the timeout of
+*	the next SMP to the same destination.
+*
 *	The VL15 object is thread safe.
 *
 *	This object should be treated as opaque and should
@@ -102,6 +113,92 @@ typedef enum _osm_vl15_state {
 } osm_vl15_state_t;
 /***********/
 
+/****s* OpenSM: VL15/osm_vl15_dest_t
+* NAME
+*	osm_vl15_dest_t
+*
+* DESCRIPTION
+*	Queue of response expected MADs for one destination bucket.
+*
+* SYNOPSIS
+*/
+typedef struct osm_vl15_dest {
+	cl_list_item_t list_item;
+	cl_qlist_t fifo;
+	uint32_t on_wire;
+	boolean_t ready;
+} osm_vl15_dest_t;
+/*
+* FIELDS
+*	list_item
+*		Linkage on the list of destinations ready to send.
+*
+*	fifo
+*		MADs waiting to be sent to this destination.
+*
+*	on_wire
+*		Number of MADs sent to this destination and not completed.
+*
+*	ready
+*		TRUE when the destination is on the ready list.
+*
+* SEE ALSO
+*	VL15 object
+*********/
+
+/****s* OpenSM: VL15/osm_vl15_rtt_t
+* NAME
+*	osm_vl15_rtt_t
+*
+* DESCRIPTION
+*	Round trip time estimator, as used by TCP (RFC 6298).
+*
+* SYNOPSIS
+*/
+typedef struct osm_vl15_rtt {
+	uint64_t tag;
+	uint32_t srtt;
+	uint32_t rttvar;
+	uint32_t min_rtt;
+	uint32_t max_rtt;
+	uint32_t samples;
+	uint32_t timeouts;
+	uint8_t backoff;
+} osm_vl15_rtt_t;
+/*
+* FIELDS
+*	tag
+*		Hash of the destination owning a per destination entry.
+*
+*	srtt
+*		Smoothed round trip time in usec.
+*
+*	rttvar
+*		Smoothed round trip time variation in usec.
+*
+*	min_rtt
+*		Shortest round trip time measured, in usec.
+*
+*	max_rtt
+*		Longest round trip time measured, in usec.
+*
+*	samples
+*		Number of round trip times measured.
+*
+*	timeouts
+*		Number of SMPs that timed out or were answered only after
+*		a retry.
+*
+*	backoff
+*		Binary exponential backoff applied to the timeout after
+*		timeouts, cleared by the next clean sample.
+*
+* SEE ALSO
+*	VL15 object
+*********/
+
+#define OSM_VL15_RTT_HIST_SIZE 24
+
 /****s* OpenSM: VL15/osm_vl15_t
 * NAME
 *	osm_vl15_t
@@ -120,10 +217,19 @@ typedef struct osm_vl15 {
 	uint32_t max_wire_smps;
 	uint32_t max_wire_smps2;
 	uint32_t max_smps_timeout;
+	uint32_t max_wire_smps_per_dest;
+	boolean_t adaptive_timeout;
+	uint32_t min_timeout;
+	uint32_t max_timeout;
 	cl_event_t signal;
 	cl_thread_t poller;
-	cl_qlist_t rfifo;
+	osm_vl15_dest_t *dest_tbl;
+	uint32_t dest_tbl_size;
+	cl_qlist_t ready_list;
 	cl_qlist_t ufifo;
+	osm_vl15_rtt_t hop_rtt[IB_SUBNET_PATH_HOPS_MAX + 1];
+	osm_vl15_rtt_t *rtt_tbl;
+	uint32_t rtt_hist[OSM_VL15_RTT_HIST_SIZE];
 	cl_spinlock_t lock;
 	osm_vendor_t *p_vend;
 	osm_log_t *p_log;
@@ -147,22 +253,59 @@ typedef struct osm_vl15 {
 *	max_smps_timeout
 *		Wait time in usec for timeout based SMPs.
 *
+*	max_wire_smps_per_dest
+*		Maximum number of VL15 MADs allowed on the wire to a single
+*		destination, 0 for no limit.
+*
+*	adaptive_timeout
+*		TRUE when SMP timeouts are derived from the measured
+*		round trip times.
+*
+*	min_timeout
+*		Lower bound of adaptive SMP timeouts in msec.
+*
+*	max_timeout
+*		Upper bound of adaptive SMP timeouts in msec, which is also
+*		the timeout of SMPs without an estimate.
+*
 *	signal
 *		Event on which the poller sleeps.
 *
 *	poller
 *		Worker thread pool that services the fifo to transmit VL15 MADs
 *
-*	rfifo
-*		First-in First-out queue for outbound VL15 MADs for which
-*		a response is expected, aka the "response fifo"
+*	dest_tbl
+*		Per destination queues of outbound VL15 MADs for which
+*		a response is expected, indexed by a hash of the destination.
+*
+*	dest_tbl_size
+*		Number of entries in dest_tbl.  A single entry is used when
+*		there is no per destination limit, which keeps the response
+*		MADs in one FIFO.
+*
+*	ready_list
+*		Destinations with queued MADs and room on the wire,
+*		serviced round robin.
 *
 *	ufifo
 *		First-in First-out queue for outbound VL15 MADs for which
 *		no response is expected, aka the "unicast fifo".
 *
+*	hop_rtt
+*		Round trip time estimators per directed route hop count.
+*		The last entry is shared by all LID routed SMPs.
+*
+*	rtt_tbl
+*		Round trip time estimators per destination, indexed by
+*		the same hash as dest_tbl.
+*
+*	rtt_hist
+*		Histogram of the measured round trip times.  Bucket i
+*		counts the times below 2^(i + 1) usec.
+*
 *	lock
-*		Spinlock guarding the FIFO.
+*		Spinlock guarding the FIFO and the round trip time
+*		estimators.
 *
 *	p_vend
 *		Pointer to the vendor transport object.
@@ -254,7 +397,8 @@ ib_api_status_t osm_vl15_init(IN osm_vl15_t * p_vl15, IN osm_vendor_t * p_vend,
 			      IN osm_subn_t * p_subn,
 			      IN int32_t max_wire_smps,
 			      IN int32_t max_wire_smps2,
-			      IN uint32_t max_smps_timeout);
+			      IN uint32_t max_smps_timeout,
+			      IN uint32_t max_wire_smps_per_dest);
 /*
 * PARAMETERS
 *	p_vl15
@@ -270,7 +414,8 @@ ib_api_status_t osm_vl15_init(IN osm_vl15_t * p_vl15, IN osm_vendor_t * p_vend,
 *		[in] Pointer to the OpenSM statistics block.
 *
 *	p_subn
-*		[in] Pointer to the OpenSM subnet object.
+*		[in] Pointer to the OpenSM subnet object.  The adaptive
+*		     timeout settings are taken from its options.
 *
 *	max_wire_smps
 *		[in] Maximum number of SMPs allowed on the wire at one time.
@@ -282,6 +427,9 @@ ib_api_status_t osm_vl15_init(IN osm_vl15_t * p_vl15, IN osm_vendor_t * p_vend,
 *	max_smps_timeout
 *		[in] Wait time in usec for timeout based SMPs.
 *
+*	max_wire_smps_per_dest
+*		[in] Maximum number of SMPs allowed on the wire to a single
+*		     destination, 0 for no limit.
 *
 * RETURN VALUES
 *	IB_SUCCESS if the VL15 object was initialized successfully.
@@ -351,6 +499,88 @@ void osm_vl15_poll(IN osm_vl15_t * p_vl);
 *	VL15 object, osm_vl15_construct, osm_vl15_init
 *********/
 
+/****f* OpenSM: VL15/osm_vl15_mad_done
+* NAME
+*	osm_vl15_mad_done
+*
+* DESCRIPTION
+*	Releases the wire slot of the destination of a completed MAD
+*	and feeds its round trip time to the estimators.
+*
+* SYNOPSIS
+*/
+void osm_vl15_mad_done(IN osm_vl15_t * p_vl, IN const osm_madw_t * p_madw);
+/*
+* PARAMETERS
+*	p_vl15
+*		[in] Pointer to an osm_vl15_t object.
+*
+*	p_madw
+*		[in] Pointer to the request MAD wrapper that completed,
+*		     either with a response or in error.
+*
+* RETURN VALUES
+*	None.
+*
+* NOTES
+*	Must be called once for every response expected MAD sent, before
+*	osm_vl15_poll, so that MADs queued for the destination can go.
+*
+* SEE ALSO
+*	VL15 object, osm_vl15_poll
+*********/
+
+/****f* OpenSM: VL15/osm_vl15_print_rtt
+* NAME
+*	osm_vl15_print_rtt
+*
+* DESCRIPTION
+*	Prints the round trip time statistics of SMPs.
+*
+* SYNOPSIS
+*/
+void osm_vl15_print_rtt(IN osm_vl15_t * p_vl, IN FILE * out);
+/*
+* PARAMETERS
+*	p_vl15
+*		[in] Pointer to an osm_vl15_t object.
+*
+*	out
+*		[in] Stream to print to.
+*
+* RETURN VALUES
+*	None.
+*
+* SEE ALSO
+*	VL15 object, osm_vl15_clear_rtt
+*********/
+
+/****f* OpenSM: VL15/osm_vl15_clear_rtt
+* NAME
+*	osm_vl15_clear_rtt
+*
+* DESCRIPTION
+*	Forgets all measured round trip times.
+*
+* SYNOPSIS
+*/
+void osm_vl15_clear_rtt(IN osm_vl15_t * p_vl);
+/*
+* PARAMETERS
+*	p_vl15
+*		[in] Pointer to an osm_vl15_t object.
+*
+* RETURN VALUES
+*	None.
+*
+* NOTES
+*	SMPs use the static transaction timeout until new round trip
+*	times are measured.
+*
+* SEE ALSO
+*	VL15 object, osm_vl15_print_rtt
+*********/
+
 /****f* OpenSM: VL15/osm_vl15_shutdown
 * NAME
 *	osm_vl15_shutdown
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2004-2008 Voltaire, Inc. All rights reserved.
+ * Copyright (c) 2002-2005 Mellanox Technologies LTD. All rights reserved.
+ * Copyright (c) 1996-2003 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * Abstract:
+ *    Implementation of the min hop relaxation kernels.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif				/* HAVE_CONFIG_H */
+
+#include <string.h>
+#include <opensm/osm_relax_hops.h>
+
+/*
+ * Relax the hop counts of one switch port over a neighbor: every row
+ * of hops (the port's hop counts) becomes the smaller of itself and
+ * the neighbor's least hop count plus the port's hop weight, and least
+ * (port 0) is updated along.  OSM_NO_PATH in src stays unreachable
+ * since the sum saturates at OSM_NO_PATH.  Returns non zero if a row
+ * changed.
+ *
+ * least is never larger than hops, so min(least, min(hops, new)) is
+ * the same as updating least only for the rows that changed, which
+ * lets the vector versions write every row unconditionally.
+ */
+static int relax_hops_scalar(uint8_t * hops, uint8_t * least,
+			     const uint8_t * src, unsigned count,
+			     uint8_t hop_wf)
+{
+	unsigned i, h;
+	int changed = 0;
+
+	for (i = 0; i < count; i++) {
+		h = src[i] + hop_wf;
+		if (h < hops[i]) {
+			hops[i] = h;
+			if (least[i] > h)
+				least[i] = h;
+			changed = 1;
+		}
+	}
+
+	return changed;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_RELAX_HOPS_X86 1
+
+__attribute__ ((target("sse2")))
+static int relax_hops_sse2(uint8_t * hops, uint8_t * least,
+			   const uint8_t * src, unsigned count,
+			   uint8_t hop_wf)
+{
+	__m128i wf = _mm_set1_epi8((char)hop_wf);
+	__m128i diff = _mm_setzero_si128();
+	__m128i h, n;
+	unsigned i;
+	int changed;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		h = _mm_loadu_si128((const __m128i *)(hops + i));
+		n = _mm_min_epu8(h, _mm_adds_epu8(_mm_loadu_si128
+						  ((const __m128i *)(src + i)),
+						  wf));
+		diff = _mm_or_si128(diff, _mm_xor_si128(h, n));
+		_mm_storeu_si128((__m128i *) (hops + i), n);
+		_mm_storeu_si128((__m128i *) (least + i),
+				 _mm_min_epu8(_mm_loadu_si128
+					      ((const __m128i *)(least + i)),
+					      n));
+	}
+
+	changed = _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128()))
+	    != 0xFFFF;
+	return relax_hops_scalar(hops + i, least + i, src + i, count - i,
+				 hop_wf) || changed;
+}
+
+__attribute__ ((target("avx2")))
+static int relax_hops_avx2(uint8_t * hops, uint8_t * least,
+			   const uint8_t * src, unsigned count,
+			   uint8_t hop_wf)
+{
+	__m256i wf = _mm256_set1_epi8((char)hop_wf);
+	__m256i diff = _mm256_setzero_si256();
+	__m256i h, n;
+	unsigned i;
+	int changed;
+
+	for (i = 0; i + 32 <= count; i += 32) {
+		h = _mm256_loadu_si256((const __m256i *)(hops + i));
+		n = _mm256_min_epu8(h, _mm256_adds_epu8(_mm256_loadu_si256
+							((const __m256i *)
+							 (src + i)), wf));
+		diff = _mm256_or_si256(diff, _mm256_xor_si256(h, n));
+		_mm256_storeu_si256((__m256i *) (hops + i), n);
+		_mm256_storeu_si256((__m256i *) (least + i),
+				    _mm256_min_epu8(_mm256_loadu_si256
+						    ((const __m256i *)
+						     (least + i)), n));
+	}
+
+	changed = !_mm256_testz_si256(diff, diff);
+	return relax_hops_scalar(hops + i, least + i, src + i, count - i,
+				 hop_wf) || changed;
+}
+#endif
+
+static const struct {
+	const char *name;
+	osm_relax_hops_fn_t relax;
+} relax_hops_tbl[] = {
+	{"scalar", relax_hops_scalar},
+#ifdef HAVE_RELAX_HOPS_X86
+	{"SSE2", relax_hops_sse2},
+	{"AVX2", relax_hops_avx2},
+#endif
+};
+
+osm_relax_hops_fn_t osm_relax_hops_get(IN const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < sizeof(relax_hops_tbl) / sizeof(relax_hops_tbl[0]);
+	     i++) {
+		if (strcmp(relax_hops_tbl[i].name, name))
+			continue;
+#ifdef HAVE_RELAX_HOPS_X86
+		__builtin_cpu_init();
+		if ((relax_hops_tbl[i].relax == relax_hops_sse2 &&
+		     !__builtin_cpu_supports("sse2")) ||
+		    (relax_hops_tbl[i].relax == relax_hops_avx2 &&
+		     !__builtin_cpu_supports("avx2")))
+			return NULL;
+#endif
+		return relax_hops_tbl[i].relax;
+	}
+	return NULL;
+}
+
+osm_relax_hops_fn_t osm_relax_hops_select(OUT const char **p_name)
+{
+	unsigned i = sizeof(relax_hops_tbl) / sizeof(relax_hops_tbl[0]);
+	osm_relax_hops_fn_t relax;
+
+	while (--i)
+		if ((relax = osm_relax_hops_get(relax_hops_tbl[i].name)))
+			break;
+	*p_name = relax_hops_tbl[i].name;
+	return relax_hops_tbl[i].relax;
+}
@@ -52,21 +52,175 @@
 #include <opensm/osm_madw.h>
 #include <vendor/osm_vendor_api.h>
 
+#define OSM_MAD_POOL_MIN_SIZE	256
+#define OSM_MAD_POOL_GROW_SIZE	256
+#define OSM_MAD_POOL_CACHE_SIZE	64
+
+typedef struct osm_madw_item {
+	cl_pool_item_t pool_item;
+	osm_madw_t madw;
+} osm_madw_item_t;
+
+typedef struct osm_mad_pool_cache {
+	cl_list_item_t list_item;
+	osm_mad_pool_t *p_pool;
+	unsigned count;
+	cl_pool_item_t *items[OSM_MAD_POOL_CACHE_SIZE];
+} osm_mad_pool_cache_t;
+
+static cl_status_t madw_item_init(IN void *const p_object, IN void *context,
+				  OUT cl_pool_item_t ** const pp_pool_item)
+{
+	osm_mad_pool_t *p_pool = context;
+	osm_madw_item_t *p_item = p_object;
+
+	p_pool->num_allocated++;
+	*pp_pool_item = &p_item->pool_item;
+	return CL_SUCCESS;
+}
+
+/*
+ * Called on thread exit: hand the cached wrappers back to the pool.
+ */
+static void cache_release(IN void *context)
+{
+	osm_mad_pool_cache_t *p_cache = context;
+	osm_mad_pool_t *p_pool = p_cache->p_pool;
+
+	cl_spinlock_acquire(&p_pool->lock);
+	while (p_cache->count)
+		cl_qpool_put(&p_pool->madw_pool,
+			     p_cache->items[--p_cache->count]);
+	cl_qlist_remove_item(&p_pool->cache_list, &p_cache->list_item);
+	cl_spinlock_release(&p_pool->lock);
+	free(p_cache);
+}
+
+static osm_mad_pool_cache_t *get_cache(IN osm_mad_pool_t * p_pool)
+{
+	osm_mad_pool_cache_t *p_cache;
+
+	if (!p_pool->cache_key_valid)
+		return NULL;
+
+	p_cache = pthread_getspecific(p_pool->cache_key);
+	if (p_cache)
+		return p_cache;
+
+	p_cache = malloc(sizeof(*p_cache));
+	if (!p_cache)
+		return NULL;
+
+	p_cache->p_pool = p_pool;
+	p_cache->count = 0;
+	if (pthread_setspecific(p_pool->cache_key, p_cache)) {
+		free(p_cache);
+		return NULL;
+	}
+
+	cl_spinlock_acquire(&p_pool->lock);
+	cl_qlist_insert_tail(&p_pool->cache_list, &p_cache->list_item);
+	cl_spinlock_release(&p_pool->lock);
+	return p_cache;
+}
+
+static osm_madw_t *madw_alloc(IN osm_mad_pool_t * p_pool)
+{
+	osm_mad_pool_cache_t *p_cache = get_cache(p_pool);
+	cl_pool_item_t *p_pool_item;
+	uint32_t out;
+
+	if (p_cache && p_cache->count)
+		p_pool_item = p_cache->items[--p_cache->count];
+	else {
+		cl_spinlock_acquire(&p_pool->lock);
+		p_pool_item = cl_qpool_get(&p_pool->madw_pool);
+		/* refill half of the cache to amortize the lock */
+		while (p_pool_item && p_cache &&
+		       p_cache->count < OSM_MAD_POOL_CACHE_SIZE / 2 &&
+		       cl_qpool_count(&p_pool->madw_pool))
+			p_cache->items[p_cache->count++] =
+			    cl_qpool_get(&p_pool->madw_pool);
+		cl_spinlock_release(&p_pool->lock);
+		if (!p_pool_item)
+			return NULL;
+	}
+
+	out = cl_atomic_inc(&p_pool->mads_out);
+	if (out > p_pool->max_mads_out)
+		p_pool->max_mads_out = out;
+
+	return &PARENT_STRUCT(p_pool_item, osm_madw_item_t, pool_item)->madw;
+}
+
+static void madw_free(IN osm_mad_pool_t * p_pool, IN osm_madw_t * p_madw)
+{
+	osm_mad_pool_cache_t *p_cache = get_cache(p_pool);
+	cl_pool_item_t *p_pool_item =
+	    &PARENT_STRUCT(p_madw, osm_madw_item_t, madw)->pool_item;
+
+	cl_atomic_dec(&p_pool->mads_out);
+
+	if (p_cache && p_cache->count < OSM_MAD_POOL_CACHE_SIZE) {
+		p_cache->items[p_cache->count++] = p_pool_item;
+		return;
+	}
+
+	cl_spinlock_acquire(&p_pool->lock);
+	/* drain half of the cache so that both get and put stay local */
+	while (p_cache && p_cache->count > OSM_MAD_POOL_CACHE_SIZE / 2)
+		cl_qpool_put(&p_pool->madw_pool,
+			     p_cache->items[--p_cache->count]);
+	cl_qpool_put(&p_pool->madw_pool, p_pool_item);
+	cl_spinlock_release(&p_pool->lock);
+}
+
 void osm_mad_pool_construct(IN osm_mad_pool_t * p_pool)
 {
 	CL_ASSERT(p_pool);
 
 	memset(p_pool, 0, sizeof(*p_pool));
+	cl_qpool_construct(&p_pool->madw_pool);
+	cl_spinlock_construct(&p_pool->lock);
+	cl_qlist_init(&p_pool->cache_list);
 }
 
 void osm_mad_pool_destroy(IN osm_mad_pool_t * p_pool)
 {
+	cl_list_item_t *p_item;
+
 	CL_ASSERT(p_pool);
+
+	if (p_pool->cache_key_valid) {
+		pthread_key_delete(p_pool->cache_key);
+		p_pool->cache_key_valid = FALSE;
+	}
+
+	/* cached wrappers live in the slabs released below */
+	while ((p_item = cl_qlist_remove_head(&p_pool->cache_list)) !=
+	       cl_qlist_end(&p_pool->cache_list))
+		free(p_item);
+
+	cl_qpool_destroy(&p_pool->madw_pool);
+	cl_spinlock_destroy(&p_pool->lock);
 }
 
 ib_api_status_t osm_mad_pool_init(IN osm_mad_pool_t * p_pool)
 {
 	p_pool->mads_out = 0;
+	p_pool->max_mads_out = 0;
+
+	if (cl_spinlock_init(&p_pool->lock) != CL_SUCCESS)
+		return IB_ERROR;
+
+	if (cl_qpool_init(&p_pool->madw_pool, OSM_MAD_POOL_MIN_SIZE, 0,
+			  OSM_MAD_POOL_GROW_SIZE, sizeof(osm_madw_item_t),
+			  madw_item_init, NULL, p_pool) != CL_SUCCESS)
+		return IB_INSUFFICIENT_MEMORY;
+
+	/* without per thread caches every MAD goes through the lock */
+	if (!pthread_key_create(&p_pool->cache_key, cache_release))
+		p_pool->cache_key_valid = TRUE;
 
 	return IB_SUCCESS;
 }
@@ -85,7 +239,7 @@ osm_madw_t *osm_mad_pool_get(IN osm_mad_pool_t * p_pool,
 	/*
 	   First, acquire a mad wrapper from the mad wrapper pool.
 	 */
-	p_madw = malloc(sizeof(*p_madw));
+	p_madw = madw_alloc(p_pool);
 	if (p_madw == NULL)
 		goto Exit;
 
@@ -97,12 +251,11 @@ osm_madw_t *osm_mad_pool_get(IN osm_mad_pool_t * p_pool,
 	p_mad = osm_vendor_get(h_bind, total_size, &p_madw->vend_wrap);
 	if (p_mad == NULL) {
 		/* Don't leak wrappers! */
-		free(p_madw);
+		madw_free(p_pool, p_madw);
 		p_madw = NULL;
 		goto Exit;
 	}
 
-	cl_atomic_inc(&p_pool->mads_out);
 	/*
 	   Finally, attach the wire MAD to this wrapper.
 	 */
@@ -127,14 +280,13 @@ osm_madw_t *osm_mad_pool_get_wrapper(IN osm_mad_pool_t * p_pool,
 	/*
 	   First, acquire a mad wrapper from the mad wrapper pool.
 	 */
-	p_madw = malloc(sizeof(*p_madw));
+	p_madw = madw_alloc(p_pool);
 	if (p_madw == NULL)
 		goto Exit;
 
 	/*
 	   Finally, initialize the wrapper object.
 	 */
-	cl_atomic_inc(&p_pool->mads_out);
 	osm_madw_init(p_madw, h_bind, total_size, p_mad_addr);
 	osm_madw_set_mad(p_madw, p_mad);
 
@@ -146,13 +298,12 @@ osm_madw_t *osm_mad_pool_get_wrapper_raw(IN osm_mad_pool_t * p_pool)
 {
 	osm_madw_t *p_madw;
 
-	p_madw = malloc(sizeof(*p_madw));
+	p_madw = madw_alloc(p_pool);
 	if (!p_madw)
 		return NULL;
 
 	osm_madw_init(p_madw, NULL, 0, NULL);
 	osm_madw_set_mad(p_madw, NULL);
-	cl_atomic_inc(&p_pool->mads_out);
 
 	return p_madw;
 }
@@ -170,6 +321,22 @@ void osm_mad_pool_put(IN osm_mad_pool_t * p_pool, IN osm_madw_t * p_madw)
 	/*
 	   Return the mad wrapper to the wrapper pool
 	 */
-	free(p_madw);
-	cl_atomic_dec(&p_pool->mads_out);
+	madw_free(p_pool, p_madw);
+}
+
+void osm_mad_pool_get_stats(IN osm_mad_pool_t * p_pool,
+			    OUT osm_mad_pool_stats_t * p_stats)
+{
+	uint32_t in_use;
+
+	cl_spinlock_acquire(&p_pool->lock);
+	p_stats->allocated = p_pool->num_allocated;
+	p_stats->free = cl_qpool_count(&p_pool->madw_pool);
+	cl_spinlock_release(&p_pool->lock);
+
+	p_stats->mads_out = p_pool->mads_out;
+	p_stats->max_mads_out = p_pool->max_mads_out;
+	in_use = p_stats->free + p_stats->mads_out;
+	p_stats->cached = p_stats->allocated > in_use ?
+	    p_stats->allocated - in_use : 0;
 }
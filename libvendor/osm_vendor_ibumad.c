@@ -130,41 +130,137 @@ static void log_send_error(osm_vendor_t * const p_vend, osm_madw_t *p_madw)
 	}
 }
 
+static inline boolean_t is_smp_class(uint8_t mgmt_class)
+{
+	return (mgmt_class == IB_MCLASS_SUBN_DIR ||
+		mgmt_class == IB_MCLASS_SUBN_LID);
+}
+
+static inline umad_match_t **match_bucket(vendor_match_tbl_t * p_tbl,
+					  ib_net64_t tid, uint8_t mgmt_class)
+{
+	uint64_t key = cl_ntoh64(tid) & 0x00000000ffffffffULL;
+	uint32_t h;
+
+	h = ((uint32_t) key ^ ((uint32_t) mgmt_class << 24)) * 0x9e3779b1U;
+	h ^= h >> 16;
+	return &p_tbl->hash[h & p_tbl->hash_mask];
+}
+
+/*
+ * Must be called with match_tbl_mutex held.
+ */
+static void match_tbl_insert(vendor_match_tbl_t * p_tbl, umad_match_t * m,
+			     ib_net64_t tid, uint8_t mgmt_class, void *v)
+{
+	umad_match_t **pp_bucket = match_bucket(p_tbl, tid, mgmt_class);
+
+	m->tid = tid;
+	m->mgmt_class = mgmt_class;
+	m->v = v;
+	m->p_hash_next = *pp_bucket;
+	*pp_bucket = m;
+	cl_qlist_insert_tail(is_smp_class(mgmt_class) ?
+			     &p_tbl->lru_smp : &p_tbl->lru_gs, &m->list_item);
+
+	p_tbl->stats.inserts++;
+	if (++p_tbl->stats.in_use > p_tbl->stats.max_in_use)
+		p_tbl->stats.max_in_use = p_tbl->stats.in_use;
+}
+
+/*
+ * Must be called with match_tbl_mutex held.
+ * Unlinks the entry from its hash bucket and LRU list
+ * and returns it to the free list.
+ */
+static void match_tbl_remove(vendor_match_tbl_t * p_tbl, umad_match_t * m)
+{
+	umad_match_t **pp = match_bucket(p_tbl, m->tid, m->mgmt_class);
+
+	while (*pp != m)
+		pp = &(*pp)->p_hash_next;
+	*pp = m->p_hash_next;
+	m->p_hash_next = NULL;
+
+	cl_qlist_remove_item(is_smp_class(m->mgmt_class) ?
+			     &p_tbl->lru_smp : &p_tbl->lru_gs, &m->list_item);
+	m->tid = 0;
+	m->mgmt_class = 0;
+	m->v = NULL;
+	cl_qlist_insert_tail(&p_tbl->free_list, &m->list_item);
+	p_tbl->stats.in_use--;
+}
+
+static int match_tbl_init(vendor_match_tbl_t * p_tbl)
+{
+	uint32_t n_buckets = 1;
+	int i;
+
+	while (n_buckets < 2 * (uint32_t) p_tbl->max)
+		n_buckets <<= 1;
+
+	p_tbl->tbl = calloc(p_tbl->max, sizeof(*p_tbl->tbl));
+	p_tbl->hash = calloc(n_buckets, sizeof(*p_tbl->hash));
+	if (!p_tbl->tbl || !p_tbl->hash) {
+		free(p_tbl->tbl);
+		free(p_tbl->hash);
+		p_tbl->tbl = NULL;
+		p_tbl->hash = NULL;
+		return -1;
+	}
+	p_tbl->hash_mask = n_buckets - 1;
+
+	cl_qlist_init(&p_tbl->free_list);
+	cl_qlist_init(&p_tbl->lru_smp);
+	cl_qlist_init(&p_tbl->lru_gs);
+	for (i = 0; i < p_tbl->max; i++)
+		cl_qlist_insert_tail(&p_tbl->free_list,
+				     &p_tbl->tbl[i].list_item);
+	memset(&p_tbl->stats, 0, sizeof(p_tbl->stats));
+	return 0;
+}
+
 static void clear_madw(osm_vendor_t * p_vend)
 {
-	umad_match_t *m, *e, *old_m;
+	vendor_match_tbl_t *p_tbl = &p_vend->mtbl;
+	cl_qlist_t *p_lru;
+	umad_match_t *m;
+	osm_madw_t *p_madw;
 	ib_net64_t old_tid;
 	uint8_t old_mgmt_class;
 
 	OSM_LOG_ENTER(p_vend->p_log);
 	pthread_mutex_lock(&p_vend->match_tbl_mutex);
-	for (m = p_vend->mtbl.tbl, e = m + p_vend->mtbl.max; m < e; m++) {
-		if (m->tid) {
-			old_m = m;
-			old_tid = m->tid;
-			old_mgmt_class = m->mgmt_class;
-			m->tid = 0;
-			osm_mad_pool_put(((osm_umad_bind_info_t
-					   *) ((osm_madw_t *) m->v)->h_bind)->
-					 p_mad_pool, m->v);
-			pthread_mutex_unlock(&p_vend->match_tbl_mutex);
-			OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 5401: "
-				"evicting entry %p (tid was 0x%" PRIx64
-				" mgmt class 0x%x)\n",
-				old_m, cl_ntoh64(old_tid), old_mgmt_class);
-			goto Exit;
-		}
+	for (;;) {
+		p_lru = cl_is_qlist_empty(&p_tbl->lru_gs) ?
+		    &p_tbl->lru_smp : &p_tbl->lru_gs;
+		if (cl_is_qlist_empty(p_lru))
+			break;
+		m = PARENT_STRUCT(cl_qlist_head(p_lru), umad_match_t,
+				  list_item);
+		old_tid = m->tid;
+		old_mgmt_class = m->mgmt_class;
+		p_madw = m->v;
+		match_tbl_remove(p_tbl, m);
+		osm_mad_pool_put(((osm_umad_bind_info_t *) p_madw->h_bind)->
+				 p_mad_pool, p_madw);
+		pthread_mutex_unlock(&p_vend->match_tbl_mutex);
+		OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 5401: "
+			"evicting entry %p (tid was 0x%" PRIx64
+			" mgmt class 0x%x)\n",
+			m, cl_ntoh64(old_tid), old_mgmt_class);
+		pthread_mutex_lock(&p_vend->match_tbl_mutex);
 	}
 	pthread_mutex_unlock(&p_vend->match_tbl_mutex);
 
-Exit:
 	OSM_LOG_EXIT(p_vend->p_log);
 }
 
 static osm_madw_t *get_madw(osm_vendor_t * p_vend, ib_net64_t * tid,
 			    uint8_t mgmt_class)
 {
-	umad_match_t *m, *e;
+	vendor_match_tbl_t *p_tbl = &p_vend->mtbl;
+	umad_match_t *m;
 	ib_net64_t mtid = (*tid & CL_HTON64(0x00000000ffffffffULL));
 	osm_madw_t *res;
 
@@ -176,12 +272,14 @@ static osm_madw_t *get_madw(osm_vendor_t * p_vend, ib_net64_t * tid,
 		return 0;
 
 	pthread_mutex_lock(&p_vend->match_tbl_mutex);
-	for (m = p_vend->mtbl.tbl, e = m + p_vend->mtbl.max; m < e; m++) {
+	p_tbl->stats.lookups++;
+	for (m = *match_bucket(p_tbl, mtid, mgmt_class); m;
+	     m = m->p_hash_next) {
 		if (m->tid == mtid && m->mgmt_class == mgmt_class) {
-			m->tid = 0;
-			m->mgmt_class = 0;
+			p_tbl->stats.hits++;
 			*tid = mtid;
 			res = m->v;
+			match_tbl_remove(p_tbl, m);
 			pthread_mutex_unlock(&p_vend->match_tbl_mutex);
 			return res;
 		}
@@ -201,70 +299,46 @@ static void
 put_madw(osm_vendor_t * p_vend, osm_madw_t * p_madw, ib_net64_t tid,
 	 uint8_t mgmt_class)
 {
-	umad_match_t *m, *e, *old_lru, *lru = 0, *lru_smp = 0;
+	vendor_match_tbl_t *p_tbl = &p_vend->mtbl;
+	umad_match_t *m, *old_lru;
 	osm_madw_t *p_req_madw;
 	osm_umad_bind_info_t *p_bind;
 	ib_net64_t old_tid;
-	uint32_t oldest = ~0, oldest_smp = ~0;
 	uint8_t old_mgmt_class;
 
 	pthread_mutex_lock(&p_vend->match_tbl_mutex);
-	for (m = p_vend->mtbl.tbl, e = m + p_vend->mtbl.max; m < e; m++) {
-		if (m->tid == 0 && m->mgmt_class == 0) {
-			m->tid = tid;
-			m->mgmt_class = mgmt_class;
-			m->v = p_madw;
-			m->version =
-			    cl_atomic_inc((atomic32_t *) & p_vend->mtbl.
-					  last_version);
-			pthread_mutex_unlock(&p_vend->match_tbl_mutex);
-			return;
-		}
-		if (m->mgmt_class == IB_MCLASS_SUBN_DIR ||
-		    m->mgmt_class == IB_MCLASS_SUBN_LID) {
-			if (oldest_smp >= m->version) {
-				oldest_smp = m->version;
-				lru_smp = m;
-			}
-		} else {
-			if (oldest >= m->version) {
-				oldest = m->version;
-				lru = m;
-			}
-		}
+	if (!cl_is_qlist_empty(&p_tbl->free_list)) {
+		m = PARENT_STRUCT(cl_qlist_remove_head(&p_tbl->free_list),
+				  umad_match_t, list_item);
+		match_tbl_insert(p_tbl, m, tid, mgmt_class, p_madw);
+		pthread_mutex_unlock(&p_vend->match_tbl_mutex);
+		return;
 	}
 
-	if (oldest != ~0) {
-		old_lru = lru;
-		old_tid = lru->tid;
-		old_mgmt_class = lru->mgmt_class;
-	} else {
-		CL_ASSERT(oldest_smp != ~0);
-		old_lru = lru_smp;
-		old_tid = lru_smp->tid;
-		old_mgmt_class = lru_smp->mgmt_class;
+	if (!cl_is_qlist_empty(&p_tbl->lru_gs))
+		old_lru = PARENT_STRUCT(cl_qlist_head(&p_tbl->lru_gs),
+					umad_match_t, list_item);
+	else {
+		CL_ASSERT(!cl_is_qlist_empty(&p_tbl->lru_smp));
+		old_lru = PARENT_STRUCT(cl_qlist_head(&p_tbl->lru_smp),
+					umad_match_t, list_item);
 	}
+	old_tid = old_lru->tid;
+	old_mgmt_class = old_lru->mgmt_class;
 	p_req_madw = old_lru->v;
+	match_tbl_remove(p_tbl, old_lru);
+	p_tbl->stats.evictions++;
+
 	p_bind = p_req_madw->h_bind;
 	p_req_madw->status = IB_CANCELED;
 	log_send_error(p_vend, p_req_madw);
 	pthread_mutex_lock(&p_vend->cb_mutex);
 	(*p_bind->send_err_callback) (p_bind->client_context, p_req_madw);
 	pthread_mutex_unlock(&p_vend->cb_mutex);
-	if (mgmt_class == IB_MCLASS_SUBN_DIR ||
-	    mgmt_class == IB_MCLASS_SUBN_LID) {
-		lru_smp->tid = tid;
-		lru_smp->mgmt_class = mgmt_class;
-		lru_smp->v = p_madw;
-		lru_smp->version =
-		    cl_atomic_inc((atomic32_t *) & p_vend->mtbl.last_version);
-	} else {
-		lru->tid = tid;
-		lru->mgmt_class = mgmt_class;
-		lru->v = p_madw;
-		lru->version =
-		    cl_atomic_inc((atomic32_t *) & p_vend->mtbl.last_version);
-	}
+
+	m = PARENT_STRUCT(cl_qlist_remove_head(&p_tbl->free_list),
+			  umad_match_t, list_item);
+	match_tbl_insert(p_tbl, m, tid, mgmt_class, p_madw);
 	pthread_mutex_unlock(&p_vend->match_tbl_mutex);
 	OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 5402: "
 		"evicting entry %p (tid was 0x%" PRIx64
@@ -586,8 +660,7 @@ osm_vendor_init(IN osm_vendor_t * const p_vend,
 	OSM_LOG(p_vend->p_log, OSM_LOG_INFO, "%d pending umads specified\n",
 		p_vend->mtbl.max);
 
-	p_vend->mtbl.tbl = calloc(p_vend->mtbl.max, sizeof(*(p_vend->mtbl.tbl)));
-	if (!p_vend->mtbl.tbl) {
+	if (match_tbl_init(&p_vend->mtbl)) {
 		OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "Error:"
 			"failed to allocate vendor match table\n");
 		r = IB_INSUFFICIENT_MEMORY;
@@ -633,8 +706,16 @@ Exit:
 
 void osm_vendor_delete(IN osm_vendor_t ** const pp_vend)
 {
+	vendor_match_tbl_stats_t *p_stats = &(*pp_vend)->mtbl.stats;
+
 	osm_vendor_close_port(*pp_vend);
 
+	OSM_LOG((*pp_vend)->p_log, OSM_LOG_VERBOSE,
+		"match table: %" PRIu64 " inserts, %" PRIu64 " lookups, %"
+		PRIu64 " hits, %" PRIu64 " evictions, max in use %u of %d\n",
+		p_stats->inserts, p_stats->lookups, p_stats->hits,
+		p_stats->evictions, p_stats->max_in_use, (*pp_vend)->mtbl.max);
+
 	clear_madw(*pp_vend);
 	/* make sure all ports are closed */
 	umad_done();
@@ -642,6 +723,7 @@ void osm_vendor_delete(IN osm_vendor_t ** const pp_vend)
 	pthread_mutex_destroy(&(*pp_vend)->cb_mutex);
 	pthread_mutex_destroy(&(*pp_vend)->match_tbl_mutex);
 	free((*pp_vend)->mtbl.tbl);
+	free((*pp_vend)->mtbl.hash);
 	free(*pp_vend);
 	*pp_vend = NULL;
 }
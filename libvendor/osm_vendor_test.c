@@ -35,11 +35,16 @@
 
 /*
  * Abstract:
- *    Implementation of vendor specific transport interface.
- *  This is the "Test" vendor which allows compilation and some
- *  testing without a real vendor interface.
- * These objects are part of the opensm family of objects.
+ *    Implementation of the "Test" vendor transport: an in-process
+ *    simulated fabric.  The topology is loaded from an ibnetdiscover
+ *    output or an opensm-subnet.lst dump and SMPs and PerfMgr MADs
+ *    are answered by the simulated nodes, with configurable latency,
+ *    loss and per switch response delays.
  *
+ *    Only the state OpenSM programs and reads back is simulated:
+ *    port states, LIDs, SwitchInfo and LFTs are kept per node, while
+ *    other tables (MFT, P_Key, SL2VL, VLArb, GUIDInfo) are stored as
+ *    opaque blocks and returned as written.
  */
 
 #if HAVE_CONFIG_H
@@ -50,33 +55,1666 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <iba/ib_types.h>
+#include <complib/cl_math.h>
+#include <complib/cl_qmap.h>
+#include <complib/cl_timer.h>
+#include <opensm/osm_file_ids.h>
+#define FILE_ID OSM_FILE_VENDOR_TEST_C
+#include <opensm/osm_madw.h>
 #include <opensm/osm_log.h>
-#include <vendor/osm_vendor_test.h>
+#include <opensm/osm_mad_pool.h>
 #include <vendor/osm_vendor_api.h>
+#include <vendor/osm_vendor_sa_api.h>
 
-void osm_vendor_construct(IN osm_vendor_t * const p_vend)
+#define OSM_TEST_DEFAULT_LATENCY	2
+#define OSM_TEST_DEFAULT_HOP_LATENCY	1
+#define OSM_TEST_DEFAULT_SW_DELAY	10
+#define OSM_TEST_LIN_CAP		0xC000
+#define OSM_TEST_MCAST_CAP		0x1000
+#define OSM_TEST_PARTITION_CAP		32
+#define OSM_TEST_VENDOR_ID		0x0002c9
+#define OSM_TEST_EVENT_SEQ_BITS		16
+#define OSM_TEST_LFT_BLOCK_SIZE		IB_SMP_DATA_SIZE
+
+/****s* OpenSM: Vendor Test/osm_test_port_t
+ * NAME
+ *   osm_test_port_t
+ *
+ * DESCRIPTION
+ *    A port of a simulated node.  Port 0 of a switch is the management
+ *    port and has no physical link.
+ *
+ * SYNOPSIS
+ */
+typedef struct _osm_test_port {
+	struct _osm_test_node *p_remote_node;
+	uint8_t remote_port_num;
+	ib_net64_t port_guid;
+	ib_port_info_t port_info;
+} osm_test_port_t;
+
+/****s* OpenSM: Vendor Test/osm_test_node_t
+ * NAME
+ *   osm_test_node_t
+ *
+ * DESCRIPTION
+ *    A simulated node with the SMA state OpenSM reads and writes.
+ *    The ports array holds num_ports + 1 entries.
+ *
+ * SYNOPSIS
+ */
+typedef struct _osm_test_node {
+	cl_map_item_t map_item;
+	ib_node_info_t node_info;
+	ib_node_desc_t node_desc;
+	ib_switch_info_t switch_info;
+	uint8_t **lft_blocks;
+	cl_qmap_t attr_tbl;
+	uint32_t delay;
+	uint64_t busy_until;
+	uint8_t num_ports;
+	osm_test_port_t ports[1];
+} osm_test_node_t;
+
+typedef struct _osm_test_attr {
+	cl_map_item_t map_item;
+	uint8_t data[IB_SMP_DATA_SIZE];
+} osm_test_attr_t;
+
+typedef struct _osm_test_bind_info {
+	osm_vendor_t *p_vend;
+	void *client_context;
+	osm_mad_pool_t *p_mad_pool;
+	osm_vend_mad_recv_callback_t mad_recv_callback;
+	osm_vend_mad_send_err_callback_t send_err_callback;
+	ib_net64_t port_guid;
+	uint8_t mad_class;
+	uint32_t timeout;
+	int max_retries;
+} osm_test_bind_info_t;
+
+typedef struct _osm_test_event {
+	cl_map_item_t map_item;
+	osm_madw_t *p_req_madw;
+	ib_api_status_t status;
+	osm_mad_addr_t mad_addr;
+	uint8_t mad[MAD_BLOCK_SIZE];
+} osm_test_event_t;
+
+/*
+ * Links and delays read from an ibnetdiscover file may refer to nodes
+ * defined further down, so they are resolved once the file is parsed.
+ */
+typedef struct _osm_test_pending {
+	uint64_t key;
+	uint8_t port_num;
+	uint64_t remote_key;
+	uint8_t remote_port_num;
+	ib_net64_t remote_port_guid;
+	uint32_t delay;
+	boolean_t is_delay;
+} osm_test_pending_t;
+
+typedef struct _osm_test_parser {
+	osm_vendor_t *p_vend;
+	const char *file_name;
+	unsigned line_num;
+	osm_test_node_t *p_cur_node;
+	uint64_t guid;
+	uint64_t port0_guid;
+	uint64_t sys_guid;
+	uint32_t vendor_id;
+	uint16_t device_id;
+	osm_test_pending_t *pending;
+	unsigned num_pending;
+	unsigned max_pending;
+} osm_test_parser_t;
+
+/**********************************************************************
+ * Fabric model
+ **********************************************************************/
+static inline boolean_t is_switch(IN const osm_test_node_t * p_node)
 {
-	memset(p_vend, 0, sizeof(*p_vend));
+	return p_node->node_info.node_type == IB_NODE_TYPE_SWITCH;
 }
 
-void osm_vendor_destroy(IN osm_vendor_t * const p_vend)
+static osm_test_node_t *get_node(IN osm_vendor_t * p_vend, IN uint64_t key)
 {
-	UNUSED_PARAM(p_vend);
+	cl_map_item_t *p_item = cl_qmap_get(&p_vend->node_tbl, key);
+
+	if (p_item == cl_qmap_end(&p_vend->node_tbl))
+		return NULL;
+	return (osm_test_node_t *) p_item;
 }
 
-void osm_vendor_delete(IN osm_vendor_t ** const pp_vend)
+static osm_test_node_t *new_node(IN osm_vendor_t * p_vend, IN uint64_t key,
+				 IN uint8_t node_type, IN uint8_t num_ports)
 {
-	CL_ASSERT(pp_vend);
+	osm_test_node_t *p_node;
 
-	osm_vendor_destroy(*pp_vend);
-	free(*pp_vend);
-	*pp_vend = NULL;
+	p_node = calloc(1, sizeof(*p_node) +
+			num_ports * sizeof(p_node->ports[0]));
+	if (!p_node)
+		return NULL;
+
+	p_node->num_ports = num_ports;
+	p_node->node_info.base_version = 1;
+	p_node->node_info.class_version = 1;
+	p_node->node_info.node_type = node_type;
+	p_node->node_info.num_ports = num_ports;
+	p_node->node_info.node_guid = cl_hton64(key);
+	p_node->node_info.sys_guid = cl_hton64(key);
+	p_node->node_info.partition_cap = cl_hton16(OSM_TEST_PARTITION_CAP);
+	p_node->node_info.revision = cl_hton32(1);
+	p_node->node_info.port_num_vendor_id = cl_hton32(OSM_TEST_VENDOR_ID);
+	cl_qmap_init(&p_node->attr_tbl);
+
+	if (node_type == IB_NODE_TYPE_SWITCH) {
+		ib_switch_info_t *p_si = &p_node->switch_info;
+
+		p_node->delay = p_vend->sw_delay;
+		p_si->lin_cap = cl_hton16(OSM_TEST_LIN_CAP);
+		p_si->mcast_cap = cl_hton16(OSM_TEST_MCAST_CAP);
+		p_si->def_mcast_pri_port = OSM_NO_PATH;
+		p_si->def_mcast_not_port = OSM_NO_PATH;
+		p_si->enforce_cap = cl_hton16(OSM_TEST_PARTITION_CAP);
+		ib_switch_info_set_life_time(p_si, 0x13);
+		ib_switch_info_state_change_set(p_si);
+	}
+
+	cl_qmap_insert(&p_vend->node_tbl, key, &p_node->map_item);
+	return p_node;
+}
+
+static void free_node(IN osm_test_node_t * p_node)
+{
+	cl_map_item_t *p_item;
+	unsigned i;
+
+	while ((p_item = cl_qmap_head(&p_node->attr_tbl)) !=
+	       cl_qmap_end(&p_node->attr_tbl)) {
+		cl_qmap_remove_item(&p_node->attr_tbl, p_item);
+		free(p_item);
+	}
+
+	if (p_node->lft_blocks) {
+		for (i = 0; i < OSM_TEST_LIN_CAP / OSM_TEST_LFT_BLOCK_SIZE; i++)
+			free(p_node->lft_blocks[i]);
+		free(p_node->lft_blocks);
+	}
+	free(p_node);
+}
+
+static inline uint8_t port_state(IN const osm_test_port_t * p_port)
+{
+	return ib_port_info_get_port_state(&p_port->port_info);
+}
+
+static inline uint8_t port_phys_state(IN const osm_test_port_t * p_port)
+{
+	return ib_port_info_get_port_phys_state(&p_port->port_info);
+}
+
+static boolean_t port_is_up(IN const osm_test_port_t * p_port)
+{
+	return p_port->p_remote_node &&
+	    port_phys_state(p_port) == IB_PORT_PHYS_STATE_LINKUP;
+}
+
+static inline osm_test_port_t *remote_port(IN const osm_test_port_t * p_port)
+{
+	return &p_port->p_remote_node->ports[p_port->remote_port_num];
+}
+
+static void set_state_change(IN osm_test_node_t * p_node)
+{
+	if (is_switch(p_node))
+		ib_switch_info_state_change_set(&p_node->switch_info);
+}
+
+static void set_link_state(IN osm_test_port_t * p_port, IN uint8_t state,
+			   IN uint8_t phys_state)
+{
+	ib_port_info_set_port_state(&p_port->port_info, state);
+	ib_port_info_set_port_phys_state(phys_state, &p_port->port_info);
+}
+
+/*
+ * Retrain the link of a port: it comes up in INIT unless either side
+ * is disabled or there is no peer.
+ */
+static void link_train(IN osm_test_node_t * p_node, IN uint8_t port_num)
+{
+	osm_test_port_t *p_port = &p_node->ports[port_num];
+	osm_test_port_t *p_remote;
+
+	if (port_phys_state(p_port) == IB_PORT_PHYS_STATE_DISABLED)
+		return;
+
+	if (!p_port->p_remote_node) {
+		set_link_state(p_port, IB_LINK_DOWN,
+			       IB_PORT_PHYS_STATE_POLLING);
+		return;
+	}
+
+	p_remote = remote_port(p_port);
+	if (port_phys_state(p_remote) == IB_PORT_PHYS_STATE_DISABLED) {
+		set_link_state(p_port, IB_LINK_DOWN,
+			       IB_PORT_PHYS_STATE_POLLING);
+		return;
+	}
+
+	set_link_state(p_port, IB_LINK_INIT, IB_PORT_PHYS_STATE_LINKUP);
+	set_link_state(p_remote, IB_LINK_INIT, IB_PORT_PHYS_STATE_LINKUP);
+	set_state_change(p_node);
+	set_state_change(p_port->p_remote_node);
+}
+
+static void link_down(IN osm_test_node_t * p_node, IN uint8_t port_num,
+		      IN uint8_t phys_state)
+{
+	osm_test_port_t *p_port = &p_node->ports[port_num];
+	osm_test_port_t *p_remote;
+
+	set_link_state(p_port, IB_LINK_DOWN, phys_state);
+	set_state_change(p_node);
+
+	if (!p_port->p_remote_node)
+		return;
+
+	p_remote = remote_port(p_port);
+	if (port_phys_state(p_remote) == IB_PORT_PHYS_STATE_LINKUP)
+		set_link_state(p_remote, IB_LINK_DOWN,
+			       IB_PORT_PHYS_STATE_POLLING);
+	set_state_change(p_port->p_remote_node);
+}
+
+static void init_port_info(IN osm_test_node_t * p_node, IN uint8_t port_num)
+{
+	osm_test_port_t *p_port = &p_node->ports[port_num];
+	ib_port_info_t *p_pi = &p_port->port_info;
+
+	memset(p_pi, 0, sizeof(*p_pi));
+	p_pi->subnet_prefix = IB_DEFAULT_SUBNET_PREFIX;
+	p_pi->local_port_num = port_num;
+	if (!is_switch(p_node) || port_num == 0)
+		p_pi->capability_mask = IB_PORT_CAP_HAS_NOTICE |
+		    IB_PORT_CAP_HAS_TRAP | IB_PORT_CAP_HAS_SL_MAP |
+		    IB_PORT_CAP_HAS_SYS_IMG_GUID;
+	p_pi->link_width_enabled = IB_LINK_WIDTH_ACTIVE_1X |
+	    IB_LINK_WIDTH_ACTIVE_4X;
+	p_pi->link_width_supported = p_pi->link_width_enabled;
+	p_pi->link_width_active = IB_LINK_WIDTH_ACTIVE_4X;
+	ib_port_info_set_link_speed_sup(IB_LINK_SPEED_2_5_5_OR_10, p_pi);
+	p_pi->link_speed = (IB_LINK_SPEED_ACTIVE_10 << IB_PORT_LINK_SPEED_SHIFT)
+	    | IB_LINK_SPEED_2_5_5_OR_10;
+	ib_port_info_set_link_down_def_state(p_pi,
+					     IB_PORT_PHYS_STATE_POLLING);
+	ib_port_info_set_neighbor_mtu(p_pi, IB_MTU_LEN_4096);
+	p_pi->mtu_cap = IB_MTU_LEN_4096;
+	p_pi->vl_cap = 4 << 4;	/* VL0-VL7 */
+	p_pi->vl_arb_high_cap = 8;
+	p_pi->vl_arb_low_cap = 8;
+	ib_port_info_set_op_vls(p_pi, 1);
+	p_pi->guid_cap = 1;
+	p_pi->resp_time_value = 0x12;
+
+	if (is_switch(p_node) && port_num == 0)
+		set_link_state(p_port, IB_LINK_INIT,
+			       IB_PORT_PHYS_STATE_LINKUP);
+	else if (p_port->p_remote_node)
+		set_link_state(p_port, IB_LINK_INIT,
+			       IB_PORT_PHYS_STATE_LINKUP);
+	else
+		set_link_state(p_port, IB_LINK_DOWN,
+			       IB_PORT_PHYS_STATE_POLLING);
+}
+
+static boolean_t lid_match(IN const osm_test_node_t * p_node,
+			   IN uint8_t port_num, IN uint16_t dlid)
+{
+	const ib_port_info_t *p_pi;
+	uint16_t base_lid;
+	uint8_t lmc;
+
+	p_pi = &p_node->ports[is_switch(p_node) ? 0 : port_num].port_info;
+	base_lid = cl_ntoh16(p_pi->base_lid);
+	if (!base_lid)
+		return FALSE;
+
+	lmc = ib_port_info_get_lmc(p_pi);
+	return (dlid & ~((1 << lmc) - 1)) == base_lid;
+}
+
+static uint8_t lft_get(IN const osm_test_node_t * p_node, IN uint16_t lid)
+{
+	uint8_t *p_block;
+
+	if (!p_node->lft_blocks || lid >= OSM_TEST_LIN_CAP ||
+	    lid > cl_ntoh16(p_node->switch_info.lin_top))
+		return OSM_NO_PATH;
+
+	p_block = p_node->lft_blocks[lid / OSM_TEST_LFT_BLOCK_SIZE];
+	return p_block ? p_block[lid % OSM_TEST_LFT_BLOCK_SIZE] : OSM_NO_PATH;
+}
+
+/*
+ * Walk a directed route from the SM port, filling in the return path
+ * the way the SMAs along the route would.  Only pure directed routes
+ * (permissive DrSLID and DrDLID) are simulated.
+ */
+static osm_test_node_t *route_dr(IN osm_vendor_t * p_vend,
+				 IN ib_smp_t * p_smp, OUT uint8_t * p_port_num,
+				 OUT unsigned *p_hops)
+{
+	osm_test_node_t *p_node = p_vend->p_sm_node;
+	osm_test_port_t *p_port;
+	uint8_t port_num = p_vend->sm_port_num, out;
+	unsigned hop;
+
+	if (p_smp->dr_slid != IB_LID_PERMISSIVE ||
+	    p_smp->dr_dlid != IB_LID_PERMISSIVE ||
+	    p_smp->hop_count >= IB_SUBNET_PATH_HOPS_MAX)
+		return NULL;
+
+	for (hop = 1; hop <= p_smp->hop_count; hop++) {
+		if (hop > 1 && !is_switch(p_node))
+			return NULL;
+		out = p_smp->initial_path[hop];
+		if (out == 0 || out > p_node->num_ports)
+			return NULL;
+		p_port = &p_node->ports[out];
+		if (!port_is_up(p_port))
+			return NULL;
+		port_num = p_port->remote_port_num;
+		p_node = p_port->p_remote_node;
+		p_smp->return_path[hop] = port_num;
+	}
+
+	*p_port_num = port_num;
+	*p_hops = p_smp->hop_count;
+	return p_node;
+}
+
+/*
+ * Forward a LID routed packet through the simulated LFTs.  Links are
+ * only crossed when both ends are at least in min_state.
+ */
+static osm_test_node_t *route_lid(IN osm_vendor_t * p_vend, IN uint16_t dlid,
+				  IN uint8_t min_state,
+				  OUT uint8_t * p_port_num, OUT unsigned *p_hops)
+{
+	osm_test_node_t *p_node = p_vend->p_sm_node;
+	osm_test_port_t *p_port;
+	uint8_t port_num = p_vend->sm_port_num, out;
+	unsigned hops = 0;
+
+	while (!lid_match(p_node, port_num, dlid)) {
+		if (is_switch(p_node))
+			out = lft_get(p_node, dlid);
+		else if (hops == 0)
+			out = port_num;
+		else
+			return NULL;
+
+		if (out == 0 || out > p_node->num_ports ||
+		    hops == IB_SUBNET_PATH_HOPS_MAX)
+			return NULL;
+
+		p_port = &p_node->ports[out];
+		if (!port_is_up(p_port) || port_state(p_port) < min_state ||
+		    port_state(remote_port(p_port)) < min_state)
+			return NULL;
+
+		port_num = p_port->remote_port_num;
+		p_node = p_port->p_remote_node;
+		hops++;
+	}
+
+	*p_port_num = port_num;
+	*p_hops = hops;
+	return p_node;
+}
+
+/**********************************************************************
+ * Subnet Management Agent
+ **********************************************************************/
+static uint8_t *attr_get_block(IN osm_test_node_t * p_node, IN uint64_t key,
+			       IN boolean_t create)
+{
+	cl_map_item_t *p_item = cl_qmap_get(&p_node->attr_tbl, key);
+	osm_test_attr_t *p_attr;
+
+	if (p_item != cl_qmap_end(&p_node->attr_tbl))
+		return ((osm_test_attr_t *) p_item)->data;
+
+	if (!create || !(p_attr = calloc(1, sizeof(*p_attr))))
+		return NULL;
+
+	cl_qmap_insert(&p_node->attr_tbl, key, &p_attr->map_item);
+	return p_attr->data;
+}
+
+/*
+ * Tables without simulated semantics are stored as written and read
+ * back unchanged; unwritten blocks return the power-on defaults.
+ */
+static ib_net16_t sma_opaque_attr(IN osm_test_node_t * p_node,
+				  IN uint8_t port_num, IN ib_smp_t * p_smp,
+				  IN boolean_t set)
+{
+	uint8_t port = is_switch(p_node) ? 0 : port_num;
+	uint64_t key = ((uint64_t) cl_ntoh16(p_smp->attr_id) << 40) |
+	    ((uint64_t) port << 32) | cl_ntoh32(p_smp->attr_mod);
+	uint8_t *p_block;
+
+	if (set) {
+		p_block = attr_get_block(p_node, key, TRUE);
+		if (!p_block)
+			return IB_MAD_STATUS_BUSY;
+		memcpy(p_block, p_smp->data, IB_SMP_DATA_SIZE);
+		return 0;
+	}
+
+	p_block = attr_get_block(p_node, key, FALSE);
+	if (p_block) {
+		memcpy(p_smp->data, p_block, IB_SMP_DATA_SIZE);
+		return 0;
+	}
+
+	memset(p_smp->data, 0, IB_SMP_DATA_SIZE);
+	if (p_smp->attr_mod)
+		return 0;
+
+	if (p_smp->attr_id == IB_MAD_ATTR_P_KEY_TABLE)
+		*(ib_net16_t *) p_smp->data = cl_hton16(IB_DEFAULT_PKEY);
+	else if (p_smp->attr_id == IB_MAD_ATTR_GUID_INFO)
+		*(ib_net64_t *) p_smp->data = p_node->ports[port].port_guid;
+	return 0;
+}
+
+static void sma_set_port_state(IN osm_test_node_t * p_node,
+			       IN uint8_t port_num, IN uint8_t state,
+			       IN uint8_t phys_state)
+{
+	osm_test_port_t *p_port = &p_node->ports[port_num];
+	uint8_t cur = port_state(p_port);
+
+	if (port_num != 0 || !is_switch(p_node)) {
+		if (phys_state == IB_PORT_PHYS_STATE_DISABLED) {
+			link_down(p_node, port_num, IB_PORT_PHYS_STATE_DISABLED);
+			return;
+		}
+		if (phys_state == IB_PORT_PHYS_STATE_POLLING &&
+		    port_phys_state(p_port) == IB_PORT_PHYS_STATE_DISABLED) {
+			set_link_state(p_port, IB_LINK_DOWN,
+				       IB_PORT_PHYS_STATE_POLLING);
+			link_train(p_node, port_num);
+			return;
+		}
+		if (state == IB_LINK_DOWN && port_is_up(p_port)) {
+			link_down(p_node, port_num, IB_PORT_PHYS_STATE_POLLING);
+			link_train(p_node, port_num);
+			return;
+		}
+	}
+
+	if ((state == IB_LINK_ARMED && cur == IB_LINK_INIT) ||
+	    (state == IB_LINK_ACTIVE && cur == IB_LINK_ARMED))
+		ib_port_info_set_port_state(&p_port->port_info, state);
+}
+
+static void sma_set_port_info(IN osm_test_node_t * p_node,
+			      IN uint8_t port_num,
+			      IN const ib_port_info_t * p_new)
+{
+	ib_port_info_t *p_pi = &p_node->ports[port_num].port_info;
+	uint8_t speed;
+
+	if (!is_switch(p_node) || port_num == 0) {
+		p_pi->m_key = p_new->m_key;
+		p_pi->subnet_prefix = p_new->subnet_prefix;
+		p_pi->base_lid = p_new->base_lid;
+		p_pi->master_sm_base_lid = p_new->master_sm_base_lid;
+		p_pi->m_key_lease_period = p_new->m_key_lease_period;
+		p_pi->mkey_lmc = p_new->mkey_lmc;
+		/* ClientReregister is not latched */
+		p_pi->subnet_timeout = p_new->subnet_timeout & 0x7F;
+		p_pi->mtu_smsl = (p_pi->mtu_smsl & 0xF0) |
+		    (p_new->mtu_smsl & 0x0F);
+	}
+
+	if (p_new->link_width_enabled == IB_LINK_WIDTH_SET_LWS)
+		p_pi->link_width_enabled = p_pi->link_width_supported;
+	else if (p_new->link_width_enabled)
+		p_pi->link_width_enabled = p_new->link_width_enabled;
+
+	speed = ib_port_info_get_link_speed_enabled(p_new);
+	if (speed == IB_LINK_SPEED_SET_LSS)
+		speed = ib_port_info_get_link_speed_sup(p_pi);
+	if (speed)
+		ib_port_info_set_link_speed_enabled(p_pi, speed);
+
+	if (ib_port_info_get_neighbor_mtu(p_new))
+		ib_port_info_set_neighbor_mtu(p_pi,
+					      ib_port_info_get_neighbor_mtu
+					      (p_new));
+	p_pi->vl_high_limit = p_new->vl_high_limit;
+	p_pi->vl_stall_life = p_new->vl_stall_life;
+	p_pi->vl_enforce = p_new->vl_enforce;
+	p_pi->error_threshold = p_new->error_threshold;
+	p_pi->link_speed_ext_enabled = p_new->link_speed_ext_enabled;
+	ib_port_info_set_link_down_def_state(p_pi,
+					     ib_port_info_get_link_down_def_state
+					     (p_new));
+
+	sma_set_port_state(p_node, port_num,
+			   ib_port_info_get_port_state(p_new),
+			   ib_port_info_get_port_phys_state(p_new));
+}
+
+static void sma_set_switch_info(IN osm_test_node_t * p_node,
+				IN const ib_switch_info_t * p_new)
+{
+	ib_switch_info_t *p_si = &p_node->switch_info;
+	uint16_t lin_top = cl_ntoh16(p_new->lin_top);
+
+	if (lin_top < OSM_TEST_LIN_CAP)
+		p_si->lin_top = p_new->lin_top;
+	p_si->def_port = p_new->def_port;
+	p_si->def_mcast_pri_port = p_new->def_mcast_pri_port;
+	p_si->def_mcast_not_port = p_new->def_mcast_not_port;
+	p_si->mcast_top = p_new->mcast_top;
+	ib_switch_info_set_life_time(p_si, p_new->life_state >> 3);
+	/* PortStateChange is cleared by writing one */
+	if (ib_switch_info_get_state_change(p_new))
+		ib_switch_info_clear_state_change(p_si);
+}
+
+static ib_net16_t sma_lft(IN osm_test_node_t * p_node, IN ib_smp_t * p_smp,
+			  IN boolean_t set)
+{
+	uint32_t block = cl_ntoh32(p_smp->attr_mod);
+
+	if (block >= OSM_TEST_LIN_CAP / OSM_TEST_LFT_BLOCK_SIZE)
+		return IB_MAD_STATUS_INVALID_FIELD;
+
+	if (set) {
+		if (!p_node->lft_blocks) {
+			p_node->lft_blocks =
+			    calloc(OSM_TEST_LIN_CAP / OSM_TEST_LFT_BLOCK_SIZE,
+				   sizeof(*p_node->lft_blocks));
+			if (!p_node->lft_blocks)
+				return IB_MAD_STATUS_BUSY;
+		}
+		if (!p_node->lft_blocks[block]) {
+			p_node->lft_blocks[block] =
+			    malloc(OSM_TEST_LFT_BLOCK_SIZE);
+			if (!p_node->lft_blocks[block])
+				return IB_MAD_STATUS_BUSY;
+		}
+		memcpy(p_node->lft_blocks[block], p_smp->data,
+		       OSM_TEST_LFT_BLOCK_SIZE);
+	}
+
+	if (p_node->lft_blocks && p_node->lft_blocks[block])
+		memcpy(p_smp->data, p_node->lft_blocks[block],
+		       OSM_TEST_LFT_BLOCK_SIZE);
+	else
+		memset(p_smp->data, OSM_NO_PATH, OSM_TEST_LFT_BLOCK_SIZE);
+	return 0;
+}
+
+/*
+ * Process an SMP arriving at port_num of p_node and turn it into the
+ * response in place.  Returns FALSE when no response is generated.
+ */
+static boolean_t sma_process(IN osm_vendor_t * p_vend,
+			     IN osm_test_node_t * p_node, IN uint8_t port_num,
+			     IN ib_smp_t * p_smp)
+{
+	ib_node_info_t *p_ni;
+	ib_port_info_t *p_pi;
+	ib_sm_info_t *p_smi;
+	uint32_t attr_mod = cl_ntoh32(p_smp->attr_mod);
+	ib_net16_t status = 0;
+	boolean_t set;
+	uint8_t port;
+
+	if (p_smp->method == IB_MAD_METHOD_GET)
+		set = FALSE;
+	else if (p_smp->method == IB_MAD_METHOD_SET)
+		set = TRUE;
+	else
+		return FALSE;
+
+	switch (p_smp->attr_id) {
+	case IB_MAD_ATTR_NODE_INFO:
+		if (set) {
+			status = IB_MAD_STATUS_UNSUP_METHOD_ATTR;
+			break;
+		}
+		p_ni = (ib_node_info_t *) p_smp->data;
+		memcpy(p_ni, &p_node->node_info, sizeof(*p_ni));
+		p_ni->port_guid =
+		    p_node->ports[is_switch(p_node) ? 0 : port_num].port_guid;
+		p_ni->port_num_vendor_id =
+		    (p_ni->port_num_vendor_id & IB_NODE_INFO_VEND_ID_MASK) |
+		    cl_hton32((uint32_t) port_num << 24);
+		break;
+
+	case IB_MAD_ATTR_NODE_DESC:
+		if (set)
+			status = IB_MAD_STATUS_UNSUP_METHOD_ATTR;
+		else
+			memcpy(p_smp->data, &p_node->node_desc,
+			       sizeof(p_node->node_desc));
+		break;
+
+	case IB_MAD_ATTR_PORT_INFO:
+		port = attr_mod & 0xFF;
+		if (!is_switch(p_node) && port == 0)
+			port = port_num;
+		if (port > p_node->num_ports) {
+			status = IB_MAD_STATUS_INVALID_FIELD;
+			break;
+		}
+		if (set)
+			sma_set_port_info(p_node, port,
+					  (ib_port_info_t *) p_smp->data);
+		p_pi = (ib_port_info_t *) p_smp->data;
+		memcpy(p_pi, &p_node->ports[port].port_info, sizeof(*p_pi));
+		p_pi->local_port_num = port_num;
+		break;
+
+	case IB_MAD_ATTR_SWITCH_INFO:
+		if (!is_switch(p_node)) {
+			status = IB_MAD_STATUS_UNSUP_METHOD_ATTR;
+			break;
+		}
+		if (set)
+			sma_set_switch_info(p_node,
+					    (ib_switch_info_t *) p_smp->data);
+		memcpy(p_smp->data, &p_node->switch_info,
+		       sizeof(p_node->switch_info));
+		break;
+
+	case IB_MAD_ATTR_LIN_FWD_TBL:
+		if (!is_switch(p_node))
+			status = IB_MAD_STATUS_UNSUP_METHOD_ATTR;
+		else
+			status = sma_lft(p_node, p_smp, set);
+		break;
+
+	case IB_MAD_ATTR_MCAST_FWD_TBL:
+		if (!is_switch(p_node))
+			status = IB_MAD_STATUS_UNSUP_METHOD_ATTR;
+		else if ((attr_mod & 0x1FF) >= OSM_TEST_MCAST_CAP / 32)
+			status = IB_MAD_STATUS_INVALID_FIELD;
+		else
+			status = sma_opaque_attr(p_node, port_num, p_smp, set);
+		break;
+
+	case IB_MAD_ATTR_P_KEY_TABLE:
+	case IB_MAD_ATTR_SLVL_TABLE:
+	case IB_MAD_ATTR_VL_ARBITRATION:
+	case IB_MAD_ATTR_GUID_INFO:
+		status = sma_opaque_attr(p_node, port_num, p_smp, set);
+		break;
+
+	case IB_MAD_ATTR_SM_INFO:
+		if (set)
+			break;
+		p_smi = (ib_sm_info_t *) p_smp->data;
+		memset(p_smi, 0, sizeof(*p_smi));
+		p_smi->guid =
+		    p_node->ports[is_switch(p_node) ? 0 : port_num].port_guid;
+		break;
+
+	default:
+		status = IB_MAD_STATUS_UNSUP_METHOD_ATTR;
+		break;
+	}
+
+	OSM_LOG(p_vend->p_log, OSM_LOG_DEBUG,
+		"%s attr 0x%X mod 0x%X node 0x%016" PRIx64 " port %u "
+		"status 0x%X\n", set ? "Set" : "Get",
+		cl_ntoh16(p_smp->attr_id), attr_mod,
+		cl_ntoh64(p_node->node_info.node_guid), port_num,
+		cl_ntoh16(status));
+
+	p_smp->method = IB_MAD_METHOD_GET_RESP;
+	p_smp->status = status;
+	if (p_smp->mgmt_class == IB_MCLASS_SUBN_DIR)
+		p_smp->status |= IB_SMP_DIRECTION;
+	return TRUE;
+}
+
+/*
+ * General services: PerfMgr counters always read zero, SA reports are
+ * acknowledged and any other Get/Set is rejected the way the MAD layer
+ * rejects classes without an agent.
+ */
+static boolean_t gsa_process(IN osm_test_node_t * p_node, IN ib_mad_t * p_mad)
+{
+	ib_perfmgt_mad_t *p_pm = (ib_perfmgt_mad_t *) p_mad;
+	ib_class_port_info_t *p_cpi;
+
+	if (p_mad->mgmt_class == IB_MCLASS_SUBN_ADM) {
+		if (p_mad->method != IB_MAD_METHOD_REPORT)
+			return FALSE;
+		p_mad->method = IB_MAD_METHOD_REPORT_RESP;
+		p_mad->status = 0;
+		return TRUE;
+	}
+
+	if (p_mad->method != IB_MAD_METHOD_GET &&
+	    p_mad->method != IB_MAD_METHOD_SET)
+		return FALSE;
+
+	p_mad->method = IB_MAD_METHOD_GET_RESP;
+	p_mad->status = 0;
+
+	if (p_mad->mgmt_class != IB_MCLASS_PERF) {
+		p_mad->status = IB_MAD_STATUS_UNSUP_CLASS_VER;
+		return TRUE;
+	}
+
+	switch (p_mad->attr_id) {
+	case IB_MAD_ATTR_CLASS_PORT_INFO:
+		p_cpi = (ib_class_port_info_t *) p_pm->data;
+		memset(p_cpi, 0, sizeof(*p_cpi));
+		p_cpi->base_ver = 1;
+		p_cpi->class_ver = 1;
+		p_cpi->cap_mask = IB_PM_ALL_PORT_SELECT |
+		    IB_PM_EXT_WIDTH_SUPPORTED;
+		ib_class_set_resp_time_val(p_cpi, 0x12);
+		break;
+	case IB_MAD_ATTR_PORT_CNTRS:
+		/* keep PortSelect and CounterSelect */
+		memset(p_pm->data + 4, 0, IB_PM_DATA_SIZE - 4);
+		break;
+	case IB_MAD_ATTR_PORT_CNTRS_EXT:
+		memset(p_pm->data + 8, 0, IB_PM_DATA_SIZE - 8);
+		break;
+	default:
+		p_mad->status = IB_MAD_STATUS_UNSUP_METHOD_ATTR;
+		break;
+	}
+	return TRUE;
+}
+
+/*
+ * Deliver a MAD to its destination and build the response in p_resp.
+ * Returns the time stamp the response reaches the SM port, or 0 if
+ * the destination is unreachable or does not respond.
+ */
+static uint64_t sim_transact(IN osm_vendor_t * p_vend,
+			     IN osm_madw_t * p_madw, IN uint8_t * p_resp,
+			     OUT osm_mad_addr_t * p_resp_addr)
+{
+	ib_mad_t *p_mad = (ib_mad_t *) p_resp;
+	osm_test_node_t *p_node;
+	osm_test_port_t *p_port;
+	uint64_t now, arrival, done, one_way;
+	uint16_t dlid = cl_ntoh16(p_madw->mad_addr.dest_lid);
+	uint8_t port_num;
+	unsigned hops;
+	boolean_t is_smp;
+
+	memcpy(p_resp, p_madw->p_mad, MIN(p_madw->mad_size, MAD_BLOCK_SIZE));
+	memset(p_resp_addr, 0, sizeof(*p_resp_addr));
+
+	switch (p_mad->mgmt_class) {
+	case IB_MCLASS_SUBN_DIR:
+		is_smp = TRUE;
+		p_node = route_dr(p_vend, (ib_smp_t *) p_resp, &port_num,
+				  &hops);
+		break;
+	case IB_MCLASS_SUBN_LID:
+		is_smp = TRUE;
+		p_node = route_lid(p_vend, dlid, IB_LINK_ARMED, &port_num,
+				   &hops);
+		break;
+	default:
+		is_smp = FALSE;
+		p_node = route_lid(p_vend, dlid, IB_LINK_ACTIVE, &port_num,
+				   &hops);
+		break;
+	}
+
+	if (!p_node) {
+		OSM_LOG(p_vend->p_log, OSM_LOG_DEBUG,
+			"Class 0x%X attr 0x%X TID 0x%" PRIx64
+			" (DLID %u) is unreachable\n", p_mad->mgmt_class,
+			cl_ntoh16(p_mad->attr_id), cl_ntoh64(p_mad->trans_id),
+			dlid);
+		return 0;
+	}
+
+	if (is_smp) {
+		if (!sma_process(p_vend, p_node, port_num, (ib_smp_t *) p_mad))
+			return 0;
+	} else if (!gsa_process(p_node, p_mad))
+		return 0;
+
+	p_port = &p_node->ports[is_switch(p_node) ? 0 : port_num];
+	if (p_mad->mgmt_class == IB_MCLASS_SUBN_DIR)
+		p_resp_addr->dest_lid = cl_hton16(IB_LID_PERMISSIVE);
+	else
+		p_resp_addr->dest_lid = p_port->port_info.base_lid;
+	if (is_smp) {
+		p_resp_addr->addr_type.smi.source_lid = p_resp_addr->dest_lid;
+		p_resp_addr->addr_type.smi.port_num = 255;
+	} else {
+		p_resp_addr->addr_type.gsi.remote_qp = CL_HTON32(1);
+		p_resp_addr->addr_type.gsi.remote_qkey =
+		    IB_QP1_WELL_KNOWN_Q_KEY;
+	}
+
+	/* SMAs process one SMP at a time */
+	now = cl_get_time_stamp();
+	one_way = p_vend->latency / 2 + (uint64_t) hops * p_vend->hop_latency;
+	/* switches forward directed route SMPs in firmware */
+	if (p_mad->mgmt_class == IB_MCLASS_SUBN_DIR && hops > 1)
+		one_way += (uint64_t) (hops - 1) * p_vend->dr_delay;
+	arrival = now + one_way;
+	if (is_smp) {
+		done = MAX(arrival, p_node->busy_until) + p_node->delay;
+		p_node->busy_until = done;
+	} else
+		done = arrival;
+
+	return done + one_way - p_vend->latency / 2 +
+	    p_vend->latency - p_vend->latency / 2;
+}
+
+static boolean_t sim_lost(IN osm_vendor_t * p_vend)
+{
+	return p_vend->loss &&
+	    (uint32_t) (rand_r(&p_vend->seed) % 1000000) < p_vend->loss;
+}
+
+static void queue_event(IN osm_vendor_t * p_vend, IN osm_test_event_t * p_ev,
+			IN uint64_t due)
+{
+	uint64_t key;
+	uint32_t count;
+
+	key = ((due > p_vend->start_time ? due - p_vend->start_time : 0)
+	       << OSM_TEST_EVENT_SEQ_BITS) | p_vend->event_seq++;
+	cl_qmap_insert(&p_vend->event_tbl, key, &p_ev->map_item);
+
+	count = cl_qmap_count(&p_vend->event_tbl);
+	if (count > p_vend->stats.max_pending)
+		p_vend->stats.max_pending = count;
+
+	if (cl_qmap_head(&p_vend->event_tbl) == &p_ev->map_item)
+		pthread_cond_signal(&p_vend->sim_cond);
+}
+
+static void deliver_event(IN osm_vendor_t * p_vend, IN osm_test_event_t * p_ev)
+{
+	osm_madw_t *p_req_madw = p_ev->p_req_madw;
+	osm_test_bind_info_t *p_bind = p_req_madw->h_bind;
+	osm_madw_t *p_madw;
+
+	if (p_ev->status != IB_SUCCESS) {
+		p_req_madw->status = p_ev->status;
+		pthread_mutex_lock(&p_vend->cb_mutex);
+		(*p_bind->send_err_callback) (p_bind->client_context,
+					      p_req_madw);
+		pthread_mutex_unlock(&p_vend->cb_mutex);
+		return;
+	}
+
+	p_madw = osm_mad_pool_get(p_bind->p_mad_pool, (osm_bind_handle_t)
+				  p_bind, MAD_BLOCK_SIZE, &p_ev->mad_addr);
+	if (!p_madw) {
+		OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 5601: "
+			"request for a new madw failed -- dropping response\n");
+		p_req_madw->status = IB_INSUFFICIENT_MEMORY;
+		pthread_mutex_lock(&p_vend->cb_mutex);
+		(*p_bind->send_err_callback) (p_bind->client_context,
+					      p_req_madw);
+		pthread_mutex_unlock(&p_vend->cb_mutex);
+		return;
+	}
+	memcpy(osm_madw_get_mad_ptr(p_madw), p_ev->mad, MAD_BLOCK_SIZE);
+
+	pthread_mutex_lock(&p_vend->cb_mutex);
+	(*p_bind->mad_recv_callback) (p_madw, p_bind->client_context,
+				      p_req_madw);
+	pthread_mutex_unlock(&p_vend->cb_mutex);
+}
+
+static void *test_receiver(void *p_ptr)
+{
+	osm_vendor_t *p_vend = p_ptr;
+	osm_test_event_t *p_ev;
+	struct timespec ts;
+	uint64_t due, now;
+
+	pthread_mutex_lock(&p_vend->sim_mutex);
+	while (!p_vend->exit_receiver) {
+		if (!cl_qmap_count(&p_vend->event_tbl)) {
+			pthread_cond_wait(&p_vend->sim_cond,
+					  &p_vend->sim_mutex);
+			continue;
+		}
+
+		p_ev = (osm_test_event_t *) cl_qmap_head(&p_vend->event_tbl);
+		due = p_vend->start_time +
+		    (cl_qmap_key(&p_ev->map_item) >> OSM_TEST_EVENT_SEQ_BITS);
+		now = cl_get_time_stamp();
+		if (due > now) {
+			ts.tv_sec = due / 1000000;
+			ts.tv_nsec = (due % 1000000) * 1000;
+			pthread_cond_timedwait(&p_vend->sim_cond,
+					       &p_vend->sim_mutex, &ts);
+			continue;
+		}
+
+		cl_qmap_remove_item(&p_vend->event_tbl, &p_ev->map_item);
+		if (p_ev->status == IB_SUCCESS)
+			p_vend->stats.responses++;
+		else
+			p_vend->stats.timeouts++;
+		pthread_mutex_unlock(&p_vend->sim_mutex);
+
+		deliver_event(p_vend, p_ev);
+		free(p_ev);
+
+		pthread_mutex_lock(&p_vend->sim_mutex);
+	}
+	pthread_mutex_unlock(&p_vend->sim_mutex);
+
+	return NULL;
+}
+
+/**********************************************************************
+ * Topology loading
+ **********************************************************************/
+static char *skip_ws(IN char *p)
+{
+	while (*p && isspace((unsigned char)*p))
+		p++;
+	return p;
+}
+
+static uint64_t fnv_hash(IN const char *str)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (*str) {
+		hash ^= (unsigned char)*str++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
 }
 
+/*
+ * ibnetdiscover names nodes S-<guid>, H-<guid> or R-<guid>; other
+ * names are hashed so arbitrary identifiers can be used as well.
+ */
+static uint64_t id_to_key(IN const char *id)
+{
+	const char *p = id;
+	char *end;
+	uint64_t key;
+
+	if ((p[0] == 'S' || p[0] == 'H' || p[0] == 'R') && p[1] == '-')
+		p += 2;
+	key = strtoull(p, &end, 16);
+	if (*p && !*end && key)
+		return key;
+	return fnv_hash(id);
+}
+
+static char *parse_quoted(IN char *p, OUT char *buf, IN size_t len)
+{
+	size_t n = 0;
+
+	p = skip_ws(p);
+	if (*p != '"')
+		return NULL;
+	for (p++; *p && *p != '"'; p++)
+		if (n + 1 < len)
+			buf[n++] = *p;
+	buf[n] = '\0';
+	return *p == '"' ? p + 1 : NULL;
+}
+
+static char *parse_port_num(IN char *p, OUT uint8_t * p_port_num)
+{
+	char *end;
+	unsigned long val;
+
+	p = skip_ws(p);
+	if (*p != '[')
+		return NULL;
+	val = strtoul(p + 1, &end, 10);
+	if (end == p + 1 || *end != ']' || val > 254)
+		return NULL;
+	*p_port_num = (uint8_t) val;
+	return end + 1;
+}
+
+static char *parse_port_guid(IN char *p, OUT uint64_t * p_guid)
+{
+	char *end;
+
+	*p_guid = 0;
+	if (*p != '(')
+		return p;
+	*p_guid = strtoull(p + 1, &end, 16);
+	return *end == ')' ? end + 1 : NULL;
+}
+
+static int add_pending(IN osm_test_parser_t * p_parser,
+		       IN const osm_test_pending_t * p_pending)
+{
+	osm_test_pending_t *p_new;
+
+	if (p_parser->num_pending == p_parser->max_pending) {
+		p_new = realloc(p_parser->pending,
+				(p_parser->max_pending * 2 + 64) *
+				sizeof(*p_new));
+		if (!p_new)
+			return -1;
+		p_parser->pending = p_new;
+		p_parser->max_pending = p_parser->max_pending * 2 + 64;
+	}
+	p_parser->pending[p_parser->num_pending++] = *p_pending;
+	return 0;
+}
+
+static int link_ports(IN osm_vendor_t * p_vend, IN osm_test_node_t * p_node,
+		      IN uint8_t port_num, IN osm_test_node_t * p_remote,
+		      IN uint8_t remote_port_num)
+{
+	osm_test_port_t *p_port, *p_rport;
+
+	if (port_num == 0 || port_num > p_node->num_ports ||
+	    remote_port_num == 0 || remote_port_num > p_remote->num_ports ||
+	    (p_node == p_remote && port_num == remote_port_num)) {
+		OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 5602: "
+			"invalid link 0x%016" PRIx64 "[%u] - 0x%016" PRIx64
+			"[%u]\n", cl_ntoh64(p_node->node_info.node_guid),
+			port_num, cl_ntoh64(p_remote->node_info.node_guid),
+			remote_port_num);
+		return -1;
+	}
+
+	p_port = &p_node->ports[port_num];
+	p_rport = &p_remote->ports[remote_port_num];
+	if ((p_port->p_remote_node &&
+	     (p_port->p_remote_node != p_remote ||
+	      p_port->remote_port_num != remote_port_num)) ||
+	    (p_rport->p_remote_node &&
+	     (p_rport->p_remote_node != p_node ||
+	      p_rport->remote_port_num != port_num))) {
+		OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 5603: "
+			"conflicting link 0x%016" PRIx64 "[%u] - 0x%016"
+			PRIx64 "[%u]\n",
+			cl_ntoh64(p_node->node_info.node_guid), port_num,
+			cl_ntoh64(p_remote->node_info.node_guid),
+			remote_port_num);
+		return -1;
+	}
+
+	p_port->p_remote_node = p_remote;
+	p_port->remote_port_num = remote_port_num;
+	p_rport->p_remote_node = p_node;
+	p_rport->remote_port_num = port_num;
+	return 0;
+}
+
+/*
+ * Node header of an ibnetdiscover file:
+ *	Switch	36 "S-0002c902004e0e48"	# "desc" ...
+ */
+static int parse_node_line(IN osm_test_parser_t * p_parser, IN char *line)
+{
+	osm_vendor_t *p_vend = p_parser->p_vend;
+	osm_test_node_t *p_node;
+	char id[128], desc[IB_NODE_DESCRIPTION_SIZE + 1];
+	char *desc_str = desc, *p, *end;
+	unsigned long num_ports;
+	uint8_t node_type;
+	uint64_t key;
+
+	if (!strncmp(line, "Switch", 6)) {
+		node_type = IB_NODE_TYPE_SWITCH;
+		p = line + 6;
+	} else if (!strncmp(line, "Ca", 2)) {
+		node_type = IB_NODE_TYPE_CA;
+		p = line + 2;
+	} else {
+		node_type = IB_NODE_TYPE_ROUTER;
+		p = line + 2;
+	}
+
+	num_ports = strtoul(p, &end, 10);
+	if (end == p || num_ports == 0 || num_ports > 254 ||
+	    !(p = parse_quoted(end, id, sizeof(id))))
+		return -1;
+
+	key = id_to_key(id);
+	if (get_node(p_vend, key)) {
+		OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 5604: "
+			"%s:%u: node %s defined twice\n",
+			p_parser->file_name, p_parser->line_num, id);
+		return -1;
+	}
+
+	p_node = new_node(p_vend, key, node_type, (uint8_t) num_ports);
+	if (!p_node)
+		return -1;
+
+	if (p_parser->guid)
+		p_node->node_info.node_guid = cl_hton64(p_parser->guid);
+	if (p_parser->sys_guid)
+		p_node->node_info.sys_guid = cl_hton64(p_parser->sys_guid);
+	if (p_parser->vendor_id)
+		p_node->node_info.port_num_vendor_id =
+		    cl_hton32(p_parser->vendor_id & 0xFFFFFF);
+	if (p_parser->device_id)
+		p_node->node_info.device_id = cl_hton16(p_parser->device_id);
+	if (node_type == IB_NODE_TYPE_SWITCH && p_parser->port0_guid)
+		p_node->ports[0].port_guid = cl_hton64(p_parser->port0_guid);
+
+	p = strchr(p, '#');
+	if (!p || !parse_quoted(p + 1, desc, sizeof(desc)))
+		desc_str = id;
+	memcpy(p_node->node_desc.description, desc_str,
+	       MIN(strlen(desc_str), IB_NODE_DESCRIPTION_SIZE));
+
+	p_parser->p_cur_node = p_node;
+	p_parser->guid = p_parser->port0_guid = p_parser->sys_guid = 0;
+	p_parser->vendor_id = p_parser->device_id = 0;
+	return 0;
+}
+
+/*
+ * Port of the current node in an ibnetdiscover file:
+ *	[1](2c9030009b5d9)	"S-0002c902004e0e48"[1]	# ...
+ */
+static int parse_port_line(IN osm_test_parser_t * p_parser, IN char *line)
+{
+	osm_test_node_t *p_node = p_parser->p_cur_node;
+	osm_test_pending_t pending;
+	char id[128];
+	uint64_t guid;
+	char *p;
+
+	if (!p_node)
+		return -1;
+
+	memset(&pending, 0, sizeof(pending));
+	pending.key = cl_qmap_key(&p_node->map_item);
+
+	if (!(p = parse_port_num(line, &pending.port_num)) ||
+	    !(p = parse_port_guid(p, &guid)) ||
+	    pending.port_num == 0 || pending.port_num > p_node->num_ports)
+		return -1;
+	if (guid)
+		p_node->ports[pending.port_num].port_guid = cl_hton64(guid);
+
+	if (!(p = parse_quoted(p, id, sizeof(id))) ||
+	    !(p = parse_port_num(p, &pending.remote_port_num)) ||
+	    !(p = parse_port_guid(p, &guid)))
+		return -1;
+
+	pending.remote_key = id_to_key(id);
+	pending.remote_port_guid = cl_hton64(guid);
+	return add_pending(p_parser, &pending);
+}
+
+/*
+ * Simulation extension:
+ *	delay "S-0002c902004e0e48" 50
+ */
+static int parse_delay_line(IN osm_test_parser_t * p_parser, IN char *line)
+{
+	osm_test_pending_t pending;
+	char id[128];
+	char *p = skip_ws(line + 5), *end;
+	size_t n;
+
+	memset(&pending, 0, sizeof(pending));
+	if (*p == '"') {
+		if (!(p = parse_quoted(p, id, sizeof(id))))
+			return -1;
+	} else {
+		for (n = 0; *p && !isspace((unsigned char)*p); p++)
+			if (n + 1 < sizeof(id))
+				id[n++] = *p;
+		id[n] = '\0';
+	}
+
+	pending.delay = strtoul(p, &end, 0);
+	if (end == p || !id[0])
+		return -1;
+	pending.key = id_to_key(id);
+	pending.is_delay = TRUE;
+	return add_pending(p_parser, &pending);
+}
+
+static osm_test_node_t *parse_lst_end(IN osm_test_parser_t * p_parser,
+				      IN char **pp, OUT uint8_t * p_port_num,
+				      OUT ib_net64_t * p_port_guid)
+{
+	osm_vendor_t *p_vend = p_parser->p_vend;
+	osm_test_node_t *p_node;
+	char type[8], *p = skip_ws(*pp), *desc, *desc_end;
+	unsigned num_ports, vendor_id, device_id, revision, lid, port_num;
+	uint64_t sys_guid, node_guid, port_guid;
+	uint8_t node_type;
+	int n = 0;
+
+	if (sscanf(p, "{ %7s Ports:%x SystemGUID:%" SCNx64 " NodeGUID:%"
+		   SCNx64 " PortGUID:%" SCNx64 " VenID:%x DevID:%x Rev:%x {%n",
+		   type, &num_ports, &sys_guid, &node_guid, &port_guid,
+		   &vendor_id, &device_id, &revision, &n) != 8 || !n)
+		return NULL;
+
+	desc = p + n;
+	if (!(desc_end = strstr(desc, "} LID:")))
+		return NULL;
+	n = 0;
+	if (sscanf(desc_end, "} LID:%x PN:%x }%n", &lid, &port_num, &n) != 2
+	    || !n || num_ports == 0 || num_ports > 254 || port_num > 254)
+		return NULL;
+	*pp = desc_end + n;
+
+	if (!strncmp(type, "SW", 2))
+		node_type = IB_NODE_TYPE_SWITCH;
+	else if (!strncmp(type, "CA", 2))
+		node_type = IB_NODE_TYPE_CA;
+	else if (!strncmp(type, "Rt", 2))
+		node_type = IB_NODE_TYPE_ROUTER;
+	else
+		return NULL;
+
+	p_node = get_node(p_vend, node_guid);
+	if (!p_node) {
+		p_node = new_node(p_vend, node_guid, node_type,
+				  (uint8_t) num_ports);
+		if (!p_node)
+			return NULL;
+		p_node->node_info.sys_guid = cl_hton64(sys_guid);
+		p_node->node_info.port_num_vendor_id =
+		    cl_hton32(vendor_id & 0xFFFFFF);
+		p_node->node_info.device_id = cl_hton16((uint16_t) device_id);
+		p_node->node_info.revision = cl_hton32(revision);
+		n = MIN(desc_end - desc, IB_NODE_DESCRIPTION_SIZE);
+		memcpy(p_node->node_desc.description, desc, n);
+	} else if (p_node->node_info.node_type != node_type ||
+		   p_node->num_ports != num_ports)
+		return NULL;
+
+	*p_port_num = (uint8_t) port_num;
+	*p_port_guid = cl_hton64(port_guid);
+	return p_node;
+}
+
+/*
+ * Link line of an opensm-subnet.lst dump:
+ *	{ SW Ports:.. NodeGUID:.. ... PN:01 } { CA ... PN:01 } PHY=.. ...
+ */
+static int parse_lst_line(IN osm_test_parser_t * p_parser, IN char *line)
+{
+	osm_test_node_t *p_node, *p_remote;
+	uint8_t port_num, remote_port_num;
+	ib_net64_t port_guid, remote_port_guid;
+	char *p = line;
+
+	if (!(p_node = parse_lst_end(p_parser, &p, &port_num, &port_guid)) ||
+	    !(p_remote = parse_lst_end(p_parser, &p, &remote_port_num,
+				       &remote_port_guid)))
+		return -1;
+
+	if (link_ports(p_parser->p_vend, p_node, port_num, p_remote,
+		       remote_port_num))
+		return -1;
+
+	p_node->ports[is_switch(p_node) ? 0 : port_num].port_guid = port_guid;
+	p_remote->ports[is_switch(p_remote) ? 0 : remote_port_num].port_guid =
+	    remote_port_guid;
+	return 0;
+}
+
+static int resolve_pending(IN osm_test_parser_t * p_parser)
+{
+	osm_vendor_t *p_vend = p_parser->p_vend;
+	osm_test_pending_t *p_pending;
+	osm_test_node_t *p_node, *p_remote;
+	osm_test_port_t *p_rport;
+	unsigned i;
+
+	for (i = 0; i < p_parser->num_pending; i++) {
+		p_pending = &p_parser->pending[i];
+		p_node = get_node(p_vend, p_pending->key);
+		if (p_pending->is_delay) {
+			if (!p_node) {
+				OSM_LOG(p_vend->p_log, OSM_LOG_ERROR,
+					"ERR 5605: delay for unknown node "
+					"0x%016" PRIx64 "\n", p_pending->key);
+				return -1;
+			}
+			p_node->delay = p_pending->delay;
+			continue;
+		}
+
+		p_remote = get_node(p_vend, p_pending->remote_key);
+		if (!p_remote) {
+			OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 5606: "
+				"link to unknown node 0x%016" PRIx64 "\n",
+				p_pending->remote_key);
+			return -1;
+		}
+		if (link_ports(p_vend, p_node, p_pending->port_num, p_remote,
+			       p_pending->remote_port_num))
+			return -1;
+
+		p_rport = &p_remote->ports[p_pending->remote_port_num];
+		if (!is_switch(p_remote) && !p_rport->port_guid)
+			p_rport->port_guid = p_pending->remote_port_guid;
+	}
+	return 0;
+}
+
+static int load_topology(IN osm_vendor_t * p_vend, IN const char *file_name)
+{
+	osm_test_parser_t parser;
+	char line[1024], *p;
+	FILE *f;
+	int ret = 0;
+
+	if (!(f = fopen(file_name, "r"))) {
+		OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 5607: "
+			"cannot open topology file \'%s\': %s\n",
+			file_name, strerror(errno));
+		return -1;
+	}
+
+	memset(&parser, 0, sizeof(parser));
+	parser.p_vend = p_vend;
+	parser.file_name = file_name;
+
+	while (!ret && fgets(line, sizeof(line), f)) {
+		parser.line_num++;
+		p = skip_ws(line);
+
+		if (*p == '\0' || *p == '#')
+			continue;
+		else if (*p == '{')
+			ret = parse_lst_line(&parser, p);
+		else if (*p == '[')
+			ret = parse_port_line(&parser, p);
+		else if (!strncmp(p, "Switch", 6) || !strncmp(p, "Ca", 2) ||
+			 !strncmp(p, "Rt", 2))
+			ret = parse_node_line(&parser, p);
+		else if (!strncmp(p, "switchguid=", 11)) {
+			parser.guid = strtoull(p + 11, &p, 16);
+			if (*p == '(')
+				parser.port0_guid = strtoull(p + 1, NULL, 16);
+		} else if (!strncmp(p, "caguid=", 7))
+			parser.guid = strtoull(p + 7, NULL, 16);
+		else if (!strncmp(p, "rtguid=", 7))
+			parser.guid = strtoull(p + 7, NULL, 16);
+		else if (!strncmp(p, "sysimgguid=", 11))
+			parser.sys_guid = strtoull(p + 11, NULL, 16);
+		else if (!strncmp(p, "vendid=", 7))
+			parser.vendor_id = strtoul(p + 7, NULL, 16);
+		else if (!strncmp(p, "devid=", 6))
+			parser.device_id = (uint16_t) strtoul(p + 6, NULL, 16);
+		else if (!strncmp(p, "delay", 5) && isspace((unsigned char)p[5]))
+			ret = parse_delay_line(&parser, p);
+
+		if (ret)
+			OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 5608: "
+				"%s:%u: cannot parse \'%s\'\n", file_name,
+				parser.line_num, p);
+	}
+	fclose(f);
+
+	if (!ret)
+		ret = resolve_pending(&parser);
+	free(parser.pending);
+	return ret;
+}
+
+/*
+ * Fill in the port GUIDs the topology did not name, bring up the
+ * linked ports and pick the SM port.
+ */
+static int setup_fabric(IN osm_vendor_t * p_vend)
+{
+	osm_test_node_t *p_node;
+	cl_map_item_t *p_item;
+	uint64_t node_guid, sm_port_guid = 0;
+	unsigned num_sw = 0, num_ca = 0, num_links = 0;
+	char *str;
+	uint8_t i;
+
+	if ((str = getenv("OSM_TEST_SM_PORT_GUID")) != NULL)
+		sm_port_guid = strtoull(str, NULL, 0);
+
+	for (p_item = cl_qmap_head(&p_vend->node_tbl);
+	     p_item != cl_qmap_end(&p_vend->node_tbl);
+	     p_item = cl_qmap_next(p_item)) {
+		p_node = (osm_test_node_t *) p_item;
+		node_guid = cl_ntoh64(p_node->node_info.node_guid);
+		if (is_switch(p_node)) {
+			num_sw++;
+			if (!p_node->ports[0].port_guid)
+				p_node->ports[0].port_guid =
+				    p_node->node_info.node_guid;
+		} else
+			num_ca++;
+
+		for (i = 0; i <= p_node->num_ports; i++) {
+			if (i > 0 && !is_switch(p_node) &&
+			    !p_node->ports[i].port_guid)
+				p_node->ports[i].port_guid =
+				    cl_hton64(node_guid + i);
+			if (i > 0 && p_node->ports[i].p_remote_node)
+				num_links++;
+			init_port_info(p_node, i);
+
+			if (p_vend->p_sm_node || (i == 0 && !is_switch(p_node)))
+				continue;
+			if (sm_port_guid ?
+			    cl_ntoh64(p_node->ports[i].port_guid) ==
+			    sm_port_guid : (!is_switch(p_node) &&
+					    p_node->ports[i].p_remote_node)) {
+				p_vend->p_sm_node = p_node;
+				p_vend->sm_port_num = i;
+			}
+		}
+	}
+
+	OSM_LOG(p_vend->p_log, OSM_LOG_INFO,
+		"Simulated fabric: %u switches, %u CAs/routers, %u links\n",
+		num_sw, num_ca, num_links / 2);
+
+	if (!p_vend->p_sm_node) {
+		OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 5609: "
+			"no SM port found in the simulated fabric\n");
+		return -1;
+	}
+
+	OSM_LOG(p_vend->p_log, OSM_LOG_INFO,
+		"SM attached to port 0x%016" PRIx64 " (%s port %u)\n",
+		cl_ntoh64(p_vend->p_sm_node->ports[p_vend->sm_port_num].
+			  port_guid),
+		p_vend->p_sm_node->node_desc.description, p_vend->sm_port_num);
+	return 0;
+}
+
+/*
+ * The SMA state of the nodes can be saved on exit and restored on
+ * start, so that a restarted OpenSM finds the fabric the way it left it.
+ * The file is only meant to be read back on the same host with the same
+ * topology: it holds the node keys, PortInfo and SwitchInfo as they are
+ * in memory, followed by the LFT blocks that were written.
+ */
+static void save_state(IN osm_vendor_t * p_vend, IN const char *file)
+{
+	osm_test_node_t *p_node;
+	cl_map_item_t *p_item;
+	uint64_t key;
+	uint16_t block, num_blocks;
+	FILE *f;
+	int err = 0;
+
+	if (!(f = fopen(file, "w"))) {
+		OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 5613: "
+			"cannot create %s: %s\n", file, strerror(errno));
+		return;
+	}
+
+	for (p_item = cl_qmap_head(&p_vend->node_tbl);
+	     p_item != cl_qmap_end(&p_vend->node_tbl);
+	     p_item = cl_qmap_next(p_item)) {
+		p_node = (osm_test_node_t *) p_item;
+		key = cl_qmap_key(p_item);
+		num_blocks = 0;
+		if (p_node->lft_blocks)
+			for (block = 0;
+			     block < OSM_TEST_LIN_CAP / OSM_TEST_LFT_BLOCK_SIZE;
+			     block++)
+				if (p_node->lft_blocks[block])
+					num_blocks++;
+		err |= fwrite(&key, sizeof(key), 1, f) != 1;
+		err |= fwrite(&p_node->num_ports, 1, 1, f) != 1;
+		err |= fwrite(&p_node->switch_info,
+			      sizeof(p_node->switch_info), 1, f) != 1;
+		for (block = 0; block <= p_node->num_ports; block++)
+			err |= fwrite(&p_node->ports[block].port_info,
+				      sizeof(ib_port_info_t), 1, f) != 1;
+		err |= fwrite(&num_blocks, sizeof(num_blocks), 1, f) != 1;
+		for (block = 0; num_blocks; block++) {
+			if (!p_node->lft_blocks[block])
+				continue;
+			err |= fwrite(&block, sizeof(block), 1, f) != 1;
+			err |= fwrite(p_node->lft_blocks[block],
+				      OSM_TEST_LFT_BLOCK_SIZE, 1, f) != 1;
+			num_blocks--;
+		}
+	}
+
+	if (fclose(f) || err)
+		OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 5613: "
+			"cannot write %s\n", file);
+	else
+		OSM_LOG(p_vend->p_log, OSM_LOG_VERBOSE,
+			"simulated fabric state saved to %s\n", file);
+}
+
+static int load_state(IN osm_vendor_t * p_vend, IN const char *file)
+{
+	osm_test_node_t *p_node;
+	ib_port_info_t pi;
+	uint64_t key;
+	uint16_t block, num_blocks;
+	uint8_t num_ports, i;
+	unsigned num_nodes = 0;
+	FILE *f;
+
+	if (!(f = fopen(file, "r"))) {
+		if (errno == ENOENT)
+			return 0;
+		OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 5614: "
+			"cannot open %s: %s\n", file, strerror(errno));
+		return -1;
+	}
+
+	while (fread(&key, sizeof(key), 1, f) == 1) {
+		if (fread(&num_ports, 1, 1, f) != 1)
+			goto Error;
+		p_node = (osm_test_node_t *) cl_qmap_get(&p_vend->node_tbl,
+							 key);
+		if (p_node == (osm_test_node_t *) cl_qmap_end(&p_vend->node_tbl)
+		    || p_node->num_ports != num_ports)
+			goto Error;
+		if (fread(&p_node->switch_info, sizeof(p_node->switch_info), 1,
+			  f) != 1)
+			goto Error;
+		for (i = 0; i <= num_ports; i++) {
+			if (fread(&pi, sizeof(pi), 1, f) != 1)
+				goto Error;
+			/* links keep the state of the new topology */
+			if (i == 0 || p_node->ports[i].p_remote_node)
+				p_node->ports[i].port_info = pi;
+		}
+		if (fread(&num_blocks, sizeof(num_blocks), 1, f) != 1)
+			goto Error;
+		if (num_blocks && !p_node->lft_blocks &&
+		    !(p_node->lft_blocks =
+		      calloc(OSM_TEST_LIN_CAP / OSM_TEST_LFT_BLOCK_SIZE,
+			     sizeof(uint8_t *))))
+			goto Error;
+		while (num_blocks--) {
+			if (fread(&block, sizeof(block), 1, f) != 1 ||
+			    block >= OSM_TEST_LIN_CAP / OSM_TEST_LFT_BLOCK_SIZE)
+				goto Error;
+			if (!p_node->lft_blocks[block] &&
+			    !(p_node->lft_blocks[block] =
+			      malloc(OSM_TEST_LFT_BLOCK_SIZE)))
+				goto Error;
+			if (fread(p_node->lft_blocks[block],
+				  OSM_TEST_LFT_BLOCK_SIZE, 1, f) != 1)
+				goto Error;
+		}
+		num_nodes++;
+	}
+
+	fclose(f);
+	OSM_LOG(p_vend->p_log, OSM_LOG_INFO,
+		"Restored the state of %u nodes from %s\n", num_nodes, file);
+	return 0;
+
+Error:
+	fclose(f);
+	OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 5614: "
+		"%s is corrupt or does not match the topology\n", file);
+	return -1;
+}
+
+static uint32_t getenv_uint(IN osm_vendor_t * p_vend, IN const char *name,
+			    IN uint32_t default_val)
+{
+	char *str, *end;
+	unsigned long val;
+
+	if (!(str = getenv(name)))
+		return default_val;
+
+	val = strtoul(str, &end, 0);
+	if (end == str || *end) {
+		OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 560A: "
+			"%s=%s is invalid\n", name, str);
+		return default_val;
+	}
+	return (uint32_t) val;
+}
+
+/**********************************************************************
+ * Vendor API
+ **********************************************************************/
 ib_api_status_t
 osm_vendor_init(IN osm_vendor_t * const p_vend,
 		IN osm_log_t * const p_log, IN const uint32_t timeout)
 {
+	ib_api_status_t status = IB_ERROR;
+	char *topo;
+
 	OSM_LOG_ENTER(p_log);
 
 	CL_ASSERT(p_vend);
@@ -84,175 +1722,398 @@ osm_vendor_init(IN osm_vendor_t * const p_vend,
 
 	p_vend->p_log = p_log;
 	p_vend->timeout = timeout;
-	OSM_LOG_EXIT(p_log);
-	return (IB_SUCCESS);
-}
+	p_vend->max_retries = OSM_DEFAULT_RETRY_COUNT;
+	cl_qmap_init(&p_vend->node_tbl);
+	cl_qmap_init(&p_vend->event_tbl);
+	pthread_mutex_init(&p_vend->sim_mutex, NULL);
+	pthread_mutex_init(&p_vend->cb_mutex, NULL);
+	pthread_cond_init(&p_vend->sim_cond, NULL);
 
-osm_vendor_t *osm_vendor_new(IN osm_log_t * const p_log,
-			     IN const uint32_t timeout)
-{
-	ib_api_status_t status;
-	osm_vendor_t *p_vend;
-	OSM_LOG_ENTER(p_log);
+	p_vend->latency = getenv_uint(p_vend, "OSM_TEST_LATENCY",
+				      OSM_TEST_DEFAULT_LATENCY);
+	p_vend->hop_latency = getenv_uint(p_vend, "OSM_TEST_HOP_LATENCY",
+					  OSM_TEST_DEFAULT_HOP_LATENCY);
+	p_vend->sw_delay = getenv_uint(p_vend, "OSM_TEST_SW_DELAY",
+				       OSM_TEST_DEFAULT_SW_DELAY);
+	p_vend->dr_delay = getenv_uint(p_vend, "OSM_TEST_DR_DELAY", 0);
+	p_vend->loss = getenv_uint(p_vend, "OSM_TEST_LOSS", 0);
+	p_vend->seed = getenv_uint(p_vend, "OSM_TEST_SEED", 1);
 
-	CL_ASSERT(p_log);
+	if (!(topo = getenv("OSM_TEST_TOPOLOGY"))) {
+		OSM_LOG(p_log, OSM_LOG_ERROR, "ERR 560B: "
+			"OSM_TEST_TOPOLOGY is not set\n");
+		goto Exit;
+	}
 
-	p_vend = malloc(sizeof(*p_vend));
-	if (p_vend != NULL) {
-		memset(p_vend, 0, sizeof(*p_vend));
+	p_vend->state_file = getenv("OSM_TEST_STATE");
+	if (load_topology(p_vend, topo) || setup_fabric(p_vend) ||
+	    (p_vend->state_file && load_state(p_vend, p_vend->state_file)))
+		goto Exit;
 
-		status = osm_vendor_init(p_vend, p_log, timeout);
-		if (status != IB_SUCCESS) {
-			osm_vendor_delete(&p_vend);
-		}
+	OSM_LOG(p_log, OSM_LOG_INFO, "latency %u usec, hop latency %u usec, "
+		"switch delay %u usec, DR forwarding delay %u usec, "
+		"loss %u ppm\n", p_vend->latency, p_vend->hop_latency,
+		p_vend->sw_delay, p_vend->dr_delay, p_vend->loss);
+
+	p_vend->start_time = cl_get_time_stamp();
+	if (pthread_create(&p_vend->receiver, NULL, test_receiver, p_vend)) {
+		OSM_LOG(p_log, OSM_LOG_ERROR, "ERR 560C: "
+			"cannot start the receiver thread\n");
+		goto Exit;
 	}
+	p_vend->receiver_running = TRUE;
+	status = IB_SUCCESS;
 
+Exit:
 	OSM_LOG_EXIT(p_log);
-	return (p_vend);
+	return status;
 }
 
-ib_mad_t *osm_vendor_get(IN osm_bind_handle_t h_bind,
-			 IN const uint32_t size,
-			 IN osm_vend_wrap_t * const p_vend_wrap)
+osm_vendor_t *osm_vendor_new(IN osm_log_t * const p_log,
+			     IN const uint32_t timeout)
 {
 	osm_vendor_t *p_vend;
-	ib_mad_t *p_mad;
-	OSM_LOG_ENTER(h_bind->p_vend->p_log);
 
-	UNUSED_PARAM(p_vend_wrap);
-
-	p_vend = h_bind->p_vend;
+	OSM_LOG_ENTER(p_log);
 
-	/*
-	   Simply malloc the MAD off the heap.
-	 */
-	p_mad = (ib_mad_t *) malloc(size);
+	p_vend = malloc(sizeof(*p_vend));
+	if (p_vend == NULL) {
+		OSM_LOG(p_log, OSM_LOG_ERROR, "ERR 560D: "
+			"Unable to allocate vendor object\n");
+		goto Exit;
+	}
 
-	osm_log(p_vend->p_log, OSM_LOG_VERBOSE,
-		"osm_vendor_get: " "MAD %p.\n", p_mad);
+	memset(p_vend, 0, sizeof(*p_vend));
 
-	if (p_mad)
-		memset(p_mad, 0, size);
+	if (osm_vendor_init(p_vend, p_log, timeout) != IB_SUCCESS)
+		osm_vendor_delete(&p_vend);
 
-	OSM_LOG_EXIT(p_vend->p_log);
-	return (p_mad);
+Exit:
+	OSM_LOG_EXIT(p_log);
+	return p_vend;
 }
 
-void
-osm_vendor_put(IN osm_bind_handle_t h_bind,
-	       IN osm_vend_wrap_t * const p_vend_wrap,
-	       IN ib_mad_t * const p_mad)
+void osm_vendor_delete(IN osm_vendor_t ** const pp_vend)
 {
-	osm_vendor_t *p_vend;
-
-	OSM_LOG_ENTER(h_bind->p_vend->p_log);
+	osm_vendor_t *p_vend = *pp_vend;
+	osm_test_stats_t *p_stats = &p_vend->stats;
+	cl_map_item_t *p_item;
 
-	UNUSED_PARAM(p_vend_wrap);
+	if (p_vend->receiver_running) {
+		pthread_mutex_lock(&p_vend->sim_mutex);
+		p_vend->exit_receiver = TRUE;
+		pthread_cond_signal(&p_vend->sim_cond);
+		pthread_mutex_unlock(&p_vend->sim_mutex);
+		pthread_join(p_vend->receiver, NULL);
+		if (p_vend->state_file)
+			save_state(p_vend, p_vend->state_file);
+	}
 
-	p_vend = h_bind->p_vend;
+	OSM_LOG(p_vend->p_log, OSM_LOG_VERBOSE,
+		"simulated fabric: %" PRIu64 " sent, %" PRIu64 " responses, %"
+		PRIu64 " timeouts, %" PRIu64 " lost, %" PRIu64
+		" unreachable, max pending %u\n", p_stats->sent,
+		p_stats->responses, p_stats->timeouts, p_stats->lost,
+		p_stats->unreachable, p_stats->max_pending);
 
-	osm_log(p_vend->p_log, OSM_LOG_VERBOSE,
-		"osm_vendor_put: " "MAD %p.\n", p_mad);
+	while ((p_item = cl_qmap_head(&p_vend->event_tbl)) !=
+	       cl_qmap_end(&p_vend->event_tbl)) {
+		cl_qmap_remove_item(&p_vend->event_tbl, p_item);
+		free(p_item);
+	}
 
-	/*
-	   Return the MAD to the heap.
-	 */
-	free(p_mad);
+	while ((p_item = cl_qmap_head(&p_vend->node_tbl)) !=
+	       cl_qmap_end(&p_vend->node_tbl)) {
+		cl_qmap_remove_item(&p_vend->node_tbl, p_item);
+		free_node((osm_test_node_t *) p_item);
+	}
 
-	OSM_LOG_EXIT(p_vend->p_log);
+	pthread_cond_destroy(&p_vend->sim_cond);
+	pthread_mutex_destroy(&p_vend->cb_mutex);
+	pthread_mutex_destroy(&p_vend->sim_mutex);
+	free(p_vend);
+	*pp_vend = NULL;
 }
 
 ib_api_status_t
-osm_vendor_send(IN osm_bind_handle_t h_bind,
-		IN osm_vend_wrap_t * const p_vend_wrap,
-		IN osm_mad_addr_t * const p_mad_addr,
-		IN ib_mad_t * const p_mad,
-		IN void *transaction_context, IN boolean_t const resp_expected)
+osm_vendor_get_all_port_attr(IN osm_vendor_t * const p_vend,
+			     IN ib_port_attr_t * const p_attr_array,
+			     IN uint32_t * const p_num_ports)
 {
-	osm_vendor_t *p_vend = h_bind->p_vend;
+	osm_test_port_t *p_port;
+	ib_port_attr_t *attr = p_attr_array;
+	ib_api_status_t status = IB_SUCCESS;
 
 	OSM_LOG_ENTER(p_vend->p_log);
 
-	UNUSED_PARAM(p_vend_wrap);
-	UNUSED_PARAM(p_mad_addr);
-	UNUSED_PARAM(transaction_context);
-	UNUSED_PARAM(resp_expected);
+	CL_ASSERT(p_vend && p_num_ports);
 
-	osm_log(p_vend->p_log, OSM_LOG_VERBOSE,
-		"osm_vendor_send: " "MAD %p.\n", p_mad);
+	if (!*p_num_ports) {
+		status = IB_INVALID_PARAMETER;
+		OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 560E: "
+			"Ports in should be > 0\n");
+		goto Exit;
+	}
+
+	if (!p_attr_array) {
+		status = IB_INSUFFICIENT_MEMORY;
+		*p_num_ports = 0;
+		goto Exit;
+	}
 
+	pthread_mutex_lock(&p_vend->sim_mutex);
+	p_port = &p_vend->p_sm_node->ports[p_vend->sm_port_num];
+	attr->port_guid = p_port->port_guid;
+	attr->lid = cl_ntoh16(p_port->port_info.base_lid);
+	attr->port_num = p_vend->sm_port_num;
+	attr->sm_lid = cl_ntoh16(p_port->port_info.master_sm_base_lid);
+	attr->link_state = port_state(p_port);
+	if (attr->num_pkeys && attr->p_pkey_table) {
+		attr->p_pkey_table[0] = cl_hton16(IB_DEFAULT_PKEY);
+		attr->num_pkeys = 1;
+	}
+	if (attr->num_gids && attr->p_gid_table) {
+		attr->p_gid_table[0].unicast.prefix =
+		    p_port->port_info.subnet_prefix;
+		attr->p_gid_table[0].unicast.interface_id = p_port->port_guid;
+		attr->num_gids = 1;
+	}
+	pthread_mutex_unlock(&p_vend->sim_mutex);
+	*p_num_ports = 1;
+
+Exit:
 	OSM_LOG_EXIT(p_vend->p_log);
-	return (IB_SUCCESS);
+	return status;
 }
 
 osm_bind_handle_t
 osm_vendor_bind(IN osm_vendor_t * const p_vend,
-		IN osm_bind_info_t * const p_bind_info,
+		IN osm_bind_info_t * const p_user_bind,
 		IN osm_mad_pool_t * const p_mad_pool,
 		IN osm_vend_mad_recv_callback_t mad_recv_callback,
+		IN osm_vend_mad_send_err_callback_t send_err_callback,
 		IN void *context)
 {
-	osm_bind_handle_t h_bind;
+	osm_test_bind_info_t *p_bind = NULL;
 
 	OSM_LOG_ENTER(p_vend->p_log);
 
-	CL_ASSERT(p_vend);
-	CL_ASSERT(p_bind_info);
+	CL_ASSERT(p_user_bind);
 	CL_ASSERT(p_mad_pool);
 	CL_ASSERT(mad_recv_callback);
-	CL_ASSERT(context);
-
-	UNUSED_PARAM(p_vend);
-	UNUSED_PARAM(p_mad_pool);
-	UNUSED_PARAM(mad_recv_callback);
-	UNUSED_PARAM(context);
-
-	h_bind = (osm_bind_handle_t) malloc(sizeof(*h_bind));
-	if (h_bind != NULL) {
-		memset(h_bind, 0, sizeof(*h_bind));
-		h_bind->p_vend = p_vend;
-		h_bind->port_guid = p_bind_info->port_guid;
-		h_bind->mad_class = p_bind_info->mad_class;
-		h_bind->class_version = p_bind_info->class_version;
-		h_bind->is_responder = p_bind_info->is_responder;
-		h_bind->is_trap_processor = p_bind_info->is_trap_processor;
-		h_bind->is_report_processor = p_bind_info->is_report_processor;
-		h_bind->send_q_size = p_bind_info->send_q_size;
-		h_bind->recv_q_size = p_bind_info->recv_q_size;
+	CL_ASSERT(send_err_callback);
+
+	OSM_LOG(p_vend->p_log, OSM_LOG_INFO,
+		"Mgmt class 0x%02x binding to port GUID 0x%" PRIx64 "\n",
+		p_user_bind->mad_class, cl_ntoh64(p_user_bind->port_guid));
+
+	if (p_user_bind->port_guid !=
+	    p_vend->p_sm_node->ports[p_vend->sm_port_num].port_guid) {
+		OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 560F: "
+			"Unable to open port 0x%" PRIx64 "\n",
+			cl_ntoh64(p_user_bind->port_guid));
+		goto Exit;
+	}
+
+	if (!(p_bind = malloc(sizeof(*p_bind)))) {
+		OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 5610: "
+			"Unable to allocate internal bind object\n");
+		goto Exit;
 	}
 
+	memset(p_bind, 0, sizeof(*p_bind));
+	p_bind->p_vend = p_vend;
+	p_bind->client_context = context;
+	p_bind->mad_recv_callback = mad_recv_callback;
+	p_bind->send_err_callback = send_err_callback;
+	p_bind->p_mad_pool = p_mad_pool;
+	p_bind->port_guid = p_user_bind->port_guid;
+	p_bind->mad_class = p_user_bind->mad_class;
+	p_bind->timeout = p_user_bind->timeout ? p_user_bind->timeout :
+	    p_vend->timeout;
+	p_bind->max_retries = p_user_bind->retries ? p_user_bind->retries :
+	    p_vend->max_retries;
+
+Exit:
 	OSM_LOG_EXIT(p_vend->p_log);
-	return (h_bind);
+	return (osm_bind_handle_t) p_bind;
 }
 
-ib_api_status_t
-osm_vendor_get_ports(IN osm_vendor_t * const p_vend,
-		     IN ib_net64_t * const p_guids,
-		     IN uint32_t * const num_guids)
+static void
+__osm_vendor_recv_dummy_cb(IN osm_madw_t * p_madw,
+			   IN void *bind_context, IN osm_madw_t * p_req_madw)
+{
+#ifdef _DEBUG_
+	fprintf(stderr,
+		"__osm_vendor_recv_dummy_cb: Ignoring received MAD after osm_vendor_unbind\n");
+#endif
+}
+
+static void
+__osm_vendor_send_err_dummy_cb(IN void *bind_context,
+			       IN osm_madw_t * p_req_madw)
+{
+#ifdef _DEBUG_
+	fprintf(stderr,
+		"__osm_vendor_send_err_dummy_cb: Ignoring send error after osm_vendor_unbind\n");
+#endif
+}
+
+void osm_vendor_unbind(IN osm_bind_handle_t h_bind)
 {
+	osm_test_bind_info_t *p_bind = h_bind;
+	osm_vendor_t *p_vend = p_bind->p_vend;
+
 	OSM_LOG_ENTER(p_vend->p_log);
 
-	*p_guids = CL_NTOH64(0x0000000000001234);
-	*num_guids = 1;
+	pthread_mutex_lock(&p_vend->cb_mutex);
+	p_bind->mad_recv_callback = __osm_vendor_recv_dummy_cb;
+	p_bind->send_err_callback = __osm_vendor_send_err_dummy_cb;
+	pthread_mutex_unlock(&p_vend->cb_mutex);
 
 	OSM_LOG_EXIT(p_vend->p_log);
-	return (IB_SUCCESS);
 }
 
-ib_api_status_t osm_vendor_local_lid_change(IN osm_bind_handle_t h_bind)
+ib_mad_t *osm_vendor_get(IN osm_bind_handle_t h_bind,
+			 IN const uint32_t mad_size,
+			 IN osm_vend_wrap_t * const p_vw)
 {
-	osm_vendor_t *p_vend = h_bind->p_vend;
+	CL_ASSERT(p_vw);
+
+	p_vw->size = mad_size;
+	p_vw->p_buf = calloc(1, mad_size);
+	p_vw->h_bind = h_bind;
+
+	return p_vw->p_buf;
+}
+
+void
+osm_vendor_put(IN osm_bind_handle_t h_bind, IN osm_vend_wrap_t * const p_vw)
+{
+	osm_madw_t *p_madw;
+
+	CL_ASSERT(p_vw);
+
+	free(p_vw->p_buf);
+	p_vw->p_buf = NULL;
+	p_madw = PARENT_STRUCT(p_vw, osm_madw_t, vend_wrap);
+	p_madw->p_mad = NULL;
+}
+
+ib_api_status_t
+osm_vendor_send(IN osm_bind_handle_t h_bind,
+		IN osm_madw_t * const p_madw, IN boolean_t const resp_expected)
+{
+	osm_test_bind_info_t *const p_bind = h_bind;
+	osm_vendor_t *const p_vend = p_bind->p_vend;
+	ib_mad_t *const p_mad = osm_madw_get_mad_ptr(p_madw);
+	osm_test_event_t *p_ev = NULL;
+	osm_mad_addr_t resp_addr;
+	uint8_t resp[MAD_BLOCK_SIZE];
+	uint64_t due, now, timeout;
+	int attempt, attempts;
 
 	OSM_LOG_ENTER(p_vend->p_log);
 
+	if (resp_expected && !(p_ev = malloc(sizeof(*p_ev)))) {
+		OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 5611: "
+			"Send p_madw = %p, Class 0x%x, Method 0x%X, "
+			"Attr 0x%X, TID 0x%" PRIx64 " failed: out of memory\n",
+			p_madw, p_mad->mgmt_class, p_mad->method,
+			cl_ntoh16(p_mad->attr_id), cl_ntoh64(p_mad->trans_id));
+		p_madw->status = IB_ERROR;
+		pthread_mutex_lock(&p_vend->cb_mutex);
+		(*p_bind->send_err_callback) (p_bind->client_context, p_madw);	/* cb frees madw */
+		pthread_mutex_unlock(&p_vend->cb_mutex);
+		goto Exit;
+	}
+
+	pthread_mutex_lock(&p_vend->sim_mutex);
+	p_vend->stats.sent++;
+	due = sim_transact(p_vend, p_madw, p_ev ? p_ev->mad : resp,
+			   p_ev ? &p_ev->mad_addr : &resp_addr);
+
+	if (p_ev) {
+		p_ev->p_req_madw = p_madw;
+		timeout = (uint64_t) (p_madw->timeout ? p_madw->timeout :
+				      p_bind->timeout) * 1000;
+		attempts = p_bind->max_retries + 1;
+
+		/* a transmission is lost on its way out or back */
+		for (attempt = 0; attempt < attempts; attempt++) {
+			if (!sim_lost(p_vend))
+				break;
+			p_vend->stats.lost++;
+		}
+
+		if (!due)
+			p_vend->stats.unreachable++;
+
+		if (due)
+			due += attempt * timeout;
+
+		/* a late response still matches one of the retries */
+		now = cl_get_time_stamp();
+		if (!due || attempt == attempts ||
+		    due > now + attempts * timeout) {
+			p_ev->status = IB_TIMEOUT;
+			due = now + attempts * timeout;
+		} else
+			p_ev->status = IB_SUCCESS;
+		queue_event(p_vend, p_ev, due);
+	}
+	pthread_mutex_unlock(&p_vend->sim_mutex);
+
+	if (!resp_expected)
+		osm_mad_pool_put(p_bind->p_mad_pool, p_madw);
+
+Exit:
 	OSM_LOG_EXIT(p_vend->p_log);
+	return IB_SUCCESS;
+}
 
-	return (IB_SUCCESS);
+ib_api_status_t osm_vendor_local_lid_change(IN osm_bind_handle_t h_bind)
+{
+	return IB_SUCCESS;
+}
+
+void osm_vendor_set_sm(IN osm_bind_handle_t h_bind, IN boolean_t is_sm_val)
+{
+	osm_test_bind_info_t *p_bind = h_bind;
+	osm_vendor_t *p_vend = p_bind->p_vend;
+	ib_port_info_t *p_pi;
+
+	pthread_mutex_lock(&p_vend->sim_mutex);
+	p_pi = &p_vend->p_sm_node->ports[p_vend->sm_port_num].port_info;
+	if (is_sm_val)
+		p_pi->capability_mask |= IB_PORT_CAP_IS_SM;
+	else
+		p_pi->capability_mask &= ~IB_PORT_CAP_IS_SM;
+	pthread_mutex_unlock(&p_vend->sim_mutex);
 }
 
 void osm_vendor_set_debug(IN osm_vendor_t * const p_vend, IN int32_t level)
 {
+}
+
+/*
+ * The simulated fabric has no SA of its own to query; the SA client
+ * API is provided so that osmtest still links.
+ */
+osm_bind_handle_t
+osmv_bind_sa(IN osm_vendor_t * const p_vend,
+	     IN osm_mad_pool_t * const p_mad_pool, IN ib_net64_t port_guid)
+{
+	OSM_LOG(p_vend->p_log, OSM_LOG_ERROR, "ERR 5612: "
+		"SA client queries are not supported by the test vendor\n");
+	return OSM_BIND_INVALID_HANDLE;
+}
 
+ib_api_status_t
+osmv_query_sa(IN osm_bind_handle_t h_bind,
+	      IN const osmv_query_req_t * const p_query_req)
+{
+	return IB_UNSUPPORTED;
 }
 
 #endif				/* OSM_VENDOR_INTF_TEST */
@@ -51,6 +51,7 @@
 #include <errno.h>
 #include <ctype.h>
 #include <sys/time.h>
+#include <time.h>
 #include <opensm/osm_file_ids.h>
 #define FILE_ID OSM_FILE_CONSOLE_C
 #include <opensm/osm_console.h>
@@ -443,6 +444,7 @@ static void dump_sms(osm_opensm_t * p_osm, FILE * out)
 
 static void print_status(osm_opensm_t * p_osm, FILE * out)
 {
+	osm_mad_pool_stats_t pool_stats;
 	cl_list_item_t *item;
 
 	if (out) {
@@ -487,6 +489,7 @@ static void print_status(osm_opensm_t * p_osm, FILE * out)
 			"   QP0 MADs sent                  : %u\n"
 			"   QP0 unicasts sent              : %u\n"
 			"   QP0 unknown MADs rcvd          : %u\n"
+			"   QP0 LID routed SMPs (failed)   : %u (%u)\n"
 			"   SA MADs outstanding            : %u\n"
 			"   SA MADs rcvd                   : %u\n"
 			"   SA MADs sent                   : %u\n"
@@ -498,11 +501,38 @@ static void print_status(osm_opensm_t * p_osm, FILE * out)
 			(uint32_t)p_osm->stats.qp0_mads_sent,
 			(uint32_t)p_osm->stats.qp0_unicasts_sent,
 			(uint32_t)p_osm->stats.qp0_mads_rcvd_unknown,
+			(uint32_t)p_osm->stats.qp0_lid_routed_sent,
+			(uint32_t)p_osm->stats.qp0_lid_routed_failed,
 			(uint32_t)p_osm->stats.sa_mads_outstanding,
 			(uint32_t)p_osm->stats.sa_mads_rcvd,
 			(uint32_t)p_osm->stats.sa_mads_sent,
 			(uint32_t)p_osm->stats.sa_mads_rcvd_unknown,
 			(uint32_t)p_osm->stats.sa_mads_ignored);
+#ifdef OSM_VENDOR_INTF_OPENIB
+		fprintf(out, "\n   Vendor match table\n"
+			"   ------------------\n"
+			"   Entries in use (max/size)      : %u (%u/%d)\n"
+			"   Inserts                        : %" PRIu64 "\n"
+			"   Lookups (hits)                 : %" PRIu64
+			" (%" PRIu64 ")\n"
+			"   Evictions                      : %" PRIu64 "\n",
+			p_osm->p_vendor->mtbl.stats.in_use,
+			p_osm->p_vendor->mtbl.stats.max_in_use,
+			p_osm->p_vendor->mtbl.max,
+			p_osm->p_vendor->mtbl.stats.inserts,
+			p_osm->p_vendor->mtbl.stats.lookups,
+			p_osm->p_vendor->mtbl.stats.hits,
+			p_osm->p_vendor->mtbl.stats.evictions);
+#endif
+		osm_mad_pool_get_stats(&p_osm->mad_pool, &pool_stats);
+		fprintf(out, "\n   MAD pool\n"
+			"   --------\n"
+			"   Wrappers out (max)             : %u (%u)\n"
+			"   Wrappers allocated             : %u\n"
+			"   Wrappers free (cached)         : %u (%u)\n",
+			pool_stats.mads_out, pool_stats.max_mads_out,
+			pool_stats.allocated, pool_stats.free,
+			pool_stats.cached);
 		fprintf(out, "\n   Subnet flags\n"
 			"   ------------\n"
 			"   Sweeping enabled               : %d\n"
@@ -1653,11 +1683,108 @@ static void help_version(FILE * out, int detail)
 	fprintf(out, "version -- print the OSM version\n");
 }
 
+static void help_smprtt(FILE * out, int detail)
+{
+	fprintf(out, "smprtt [clear]\n");
+	if (detail) {
+		fprintf(out, "   print the SMP round trip times measured per hop count\n");
+		fprintf(out, "   clear -- forget the measured round trip times\n");
+	}
+}
+
+static void help_sweepstats(FILE * out, int detail)
+{
+	fprintf(out, "sweepstats [all]\n");
+	if (detail) {
+		fprintf(out, "   print the time and SMPs spent in each phase of the last heavy sweep\n");
+		fprintf(out, "   all -- print the totals of the last %u heavy sweeps\n",
+			OSM_SWEEP_STATS_HISTORY);
+	}
+}
+
 static void version_parse(char **p_last, osm_opensm_t * p_osm, FILE * out)
 {
 	fprintf(out, "%s build %s %s\n", p_osm->osm_version, __DATE__, __TIME__);
 }
 
+static void smprtt_parse(char **p_last, osm_opensm_t * p_osm, FILE * out)
+{
+	char *p_cmd;
+
+	p_cmd = next_token(p_last);
+	if (p_cmd) {
+		if (strcmp(p_cmd, "clear") == 0) {
+			osm_vl15_clear_rtt(&p_osm->vl15);
+			fprintf(out, "SMP round trip times cleared\n");
+		} else
+			help_smprtt(out, 1);
+		return;
+	}
+	osm_vl15_print_rtt(&p_osm->vl15, out);
+}
+
+static void print_sweep_phase(FILE * out, const char *name,
+			      const osm_sweep_phase_stats_t * p_phase)
+{
+	fprintf(out, "%-14s %12.3f %12.3f %10u %10u %8u\n", name,
+		p_phase->wall_usec / 1000.0, p_phase->cpu_usec / 1000.0,
+		p_phase->smps_sent, p_phase->smps_rcvd,
+		p_phase->smps_timed_out);
+}
+
+static void sweepstats_parse(char **p_last, osm_opensm_t * p_osm, FILE * out)
+{
+	const osm_sweep_stats_t *p_sweep;
+	char *p_cmd, name[16];
+	uint32_t n, count;
+	int i;
+
+	p_cmd = next_token(p_last);
+	if (p_cmd && strcmp(p_cmd, "all")) {
+		help_sweepstats(out, 1);
+		return;
+	}
+
+	count = p_osm->stats.sweep_count;
+	if (!count) {
+		fprintf(out, "No heavy sweep recorded yet\n");
+		return;
+	}
+
+	p_sweep = &p_osm->stats.sweeps[(count - 1) % OSM_SWEEP_STATS_HISTORY];
+	if (!p_cmd)
+		fprintf(out, "Heavy sweep %u started %s", p_sweep->sweep_num,
+			ctime(&p_sweep->start_time));
+
+	fprintf(out, "%-14s %12s %12s %10s %10s %8s\n",
+		p_cmd ? "Sweep" : "Phase", "Wall (ms)", "CPU (ms)",
+		"SMPs sent", "SMPs rcvd", "Failed");
+
+	if (p_cmd) {
+		n = count > OSM_SWEEP_STATS_HISTORY ?
+		    count - OSM_SWEEP_STATS_HISTORY : 0;
+		for (; n < count; n++) {
+			p_sweep = &p_osm->stats.sweeps[n % OSM_SWEEP_STATS_HISTORY];
+			snprintf(name, sizeof(name), "%u%s", p_sweep->sweep_num,
+				 p_sweep->aborted < OSM_SWEEP_PHASE_MAX ?
+				 " (aborted)" : p_sweep->errors ?
+				 " (errors)" : "");
+			print_sweep_phase(out, name, &p_sweep->total);
+		}
+		return;
+	}
+
+	for (i = 0; i < OSM_SWEEP_PHASE_MAX; i++)
+		print_sweep_phase(out, osm_sweep_phase_str(i),
+				  &p_sweep->phase[i]);
+	print_sweep_phase(out, "total", &p_sweep->total);
+	if (p_sweep->aborted < OSM_SWEEP_PHASE_MAX)
+		fprintf(out, "The sweep was aborted in phase %s\n",
+			osm_sweep_phase_str(p_sweep->aborted));
+	else if (p_sweep->errors)
+		fprintf(out, "The sweep ended with errors\n");
+}
+
 /* more parse routines go here */
 typedef struct _regexp_list {
 	regex_t exp;
@@ -1783,6 +1910,8 @@ static const struct command console_cmds[] = {
 	{"dump_conf", &help_dump_conf, &dump_conf_parse},
 	{"update_desc", &help_update_desc, &update_desc_parse},
 	{"version", &help_version, &version_parse},
+	{"smprtt", &help_smprtt, &smprtt_parse},
+	{"sweepstats", &help_sweepstats, &sweepstats_parse},
 #ifdef ENABLE_OSM_PERF_MGR
 	{"perfmgr", &help_perfmgr, &perfmgr_parse},
 	{"pm", &help_pm, &perfmgr_parse},
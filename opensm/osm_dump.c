@@ -710,6 +710,54 @@ void osm_dump_mcast_routes(osm_opensm_t * osm)
 				      dump_mcast_routes, osm);
 }
 
+static void dump_sweep_phase(FILE * file, const osm_sweep_stats_t * p_sweep,
+			     const char *name,
+			     const osm_sweep_phase_stats_t * p_phase)
+{
+	fprintf(file, "%u %ld %d %s %" PRIu64 " %" PRIu64 " %u %u %u %s\n",
+		p_sweep->sweep_num, (long)p_sweep->start_time,
+		p_sweep->errors ? 1 : 0, name, p_phase->wall_usec,
+		p_phase->cpu_usec, p_phase->smps_sent, p_phase->smps_rcvd,
+		p_phase->smps_timed_out,
+		p_sweep->aborted < OSM_SWEEP_PHASE_MAX ?
+		osm_sweep_phase_str(p_sweep->aborted) : "-");
+}
+
+void osm_dump_sweep_stats(osm_opensm_t * osm)
+{
+	const osm_sweep_stats_t *p_sweep;
+	char path[1024];
+	FILE *file;
+	uint32_t n;
+	int i;
+
+	snprintf(path, sizeof(path), "%s/%s",
+		 osm->subn.opt.dump_files_dir, "opensm-sweep-stats.dump");
+
+	file = fopen(path, "w");
+	if (!file) {
+		OSM_LOG(&osm->log, OSM_LOG_ERROR,
+			"cannot create file \'%s\': %s\n",
+			path, strerror(errno));
+		return;
+	}
+
+	fprintf(file, "# sweep start_time errors phase wall_usec cpu_usec"
+		" smps_sent smps_rcvd smps_failed aborted_in\n");
+
+	n = osm->stats.sweep_count > OSM_SWEEP_STATS_HISTORY ?
+	    osm->stats.sweep_count - OSM_SWEEP_STATS_HISTORY : 0;
+	for (; n < osm->stats.sweep_count; n++) {
+		p_sweep = &osm->stats.sweeps[n % OSM_SWEEP_STATS_HISTORY];
+		for (i = 0; i < OSM_SWEEP_PHASE_MAX; i++)
+			dump_sweep_phase(file, p_sweep, osm_sweep_phase_str(i),
+					 &p_sweep->phase[i]);
+		dump_sweep_phase(file, p_sweep, "total", &p_sweep->total);
+	}
+
+	fclose(file);
+}
+
 void osm_dump_all(osm_opensm_t * osm)
 {
 	if (OSM_LOG_IS_ACTIVE_V2(&osm->log, OSM_LOG_ROUTING)) {
@@ -1035,6 +1035,7 @@ static int lid_mgr_set_physp_pi(IN osm_lid_mgr_t * p_mgr,
 	context.pi_context.set_method = TRUE;
 	context.pi_context.light_sweep = FALSE;
 	context.pi_context.active_transition = FALSE;
+	context.pi_context.next_link_state = IB_LINK_NO_CHANGE;
 
 	/*
 	  For ports supporting the ClientReregistration Vol1 (v1.2) p811 14.4.11:
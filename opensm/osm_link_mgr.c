@@ -88,8 +88,12 @@ static uint8_t link_mgr_get_smsl(IN osm_sm_t * sm, IN osm_physp_t * p_physp)
 	return sl;
 }
 
+static void link_mgr_pipeline_step(IN osm_sm_t * sm,
+				   IN osm_physp_t * p_physp,
+				   IN uint8_t link_state);
+
 static int link_mgr_set_physp_pi(osm_sm_t * sm, IN osm_physp_t * p_physp,
-				 IN uint8_t port_state)
+				 IN uint8_t port_state, IN uint8_t next_state)
 {
 	uint8_t payload[IB_SMP_DATA_SIZE], payload2[IB_SMP_DATA_SIZE];
 	ib_port_info_t *p_pi = (ib_port_info_t *) payload;
@@ -101,6 +105,7 @@ static int link_mgr_set_physp_pi(osm_sm_t * sm, IN osm_physp_t * p_physp,
 	ib_api_status_t status;
 	uint8_t port_num, mtu, op_vls, smsl = OSM_DEFAULT_SL;
 	boolean_t esp0 = FALSE, send_set = FALSE, send_set2 = FALSE;
+	boolean_t sent = FALSE;
 	osm_physp_t *p_remote_physp, *physp0 = NULL;
 	int issue_ext = 0, fdr10_change = 0;
 	int ret = 0;
@@ -461,6 +466,7 @@ Send:
 	context.pi_context.set_method = TRUE;
 	context.pi_context.light_sweep = FALSE;
 	context.pi_context.client_rereg = FALSE;
+	context.pi_context.next_link_state = next_state;
 
 	/* We need to send the PortInfoSet request with the new sm_lid
 	   in the following cases:
@@ -486,6 +492,8 @@ Send:
 			     0, CL_DISP_MSGID_NONE, &context);
 	if (status)
 		ret = -1;
+	else
+		sent = TRUE;
 
 	/* If we sent a new mkey above, update our guid2mkey map
 	   now, on the assumption that the SubnSet succeeds
@@ -497,6 +505,7 @@ Send:
 
 SEND_EPI:
 	if (send_set2) {
+		context.pi_context.next_link_state = IB_LINK_NO_CHANGE;
 		status = osm_req_set(sm, osm_physp_get_dr_path_ptr(p_physp),
 				     payload2, sizeof(payload2),
 				     IB_MAD_ATTR_MLNX_EXTENDED_PORT_INFO,
@@ -507,12 +516,58 @@ SEND_EPI:
 	}
 
 Exit:
+	/* nothing to wait for, so move on to the next stage right away */
+	if (!ret && !sent && next_state != IB_LINK_NO_CHANGE)
+		link_mgr_pipeline_step(sm, p_physp, next_state);
 	OSM_LOG_EXIT(sm->p_log);
 	return ret;
 }
 
+/**********************************************************************
+ Moves p_physp on to link_state if the pipeline allows it: ports are
+ set ARMED once their configuration has been acknowledged, and ACTIVE
+ once both ends of the link are ARMED and the pipeline was released
+ by osm_link_mgr_pipeline_activate().
+ The plock must be held before calling this function.
+**********************************************************************/
+static void link_mgr_pipeline_step(IN osm_sm_t * sm,
+				   IN osm_physp_t * p_physp,
+				   IN uint8_t link_state)
+{
+	osm_physp_t *p_remote_physp;
+	uint8_t current_state;
+
+	if (sm->link_pipeline_state == IB_LINK_NO_CHANGE)
+		return;
+
+	current_state = osm_physp_get_port_state(p_physp);
+	if (current_state == IB_LINK_DOWN)
+		return;
+
+	if (link_state == IB_LINK_ARMED) {
+		if (current_state < IB_LINK_ARMED) {
+			link_mgr_set_physp_pi(sm, p_physp, IB_LINK_ARMED,
+					      IB_LINK_ACTIVE);
+			return;
+		}
+		link_state = IB_LINK_ACTIVE;
+	}
+
+	if (link_state != IB_LINK_ACTIVE || current_state != IB_LINK_ARMED ||
+	    sm->link_pipeline_state < IB_LINK_ACTIVE)
+		return;
+
+	p_remote_physp = osm_physp_get_remote(p_physp);
+	if (p_remote_physp && osm_physp_is_valid(p_remote_physp) &&
+	    osm_physp_get_port_state(p_remote_physp) < IB_LINK_ARMED)
+		return;
+
+	link_mgr_set_physp_pi(sm, p_physp, IB_LINK_ACTIVE, IB_LINK_NO_CHANGE);
+}
+
 static int link_mgr_process_node(osm_sm_t * sm, IN osm_node_t * p_node,
-				 IN const uint8_t link_state)
+				 IN const uint8_t link_state,
+				 IN const uint8_t next_state)
 {
 	osm_physp_t *p_physp, *p_physp_remote;
 	uint32_t i, num_physp;
@@ -555,7 +610,8 @@ static int link_mgr_process_node(osm_sm_t * sm, IN osm_node_t * p_node,
 		if ((i != 0) && (!p_physp_remote ||
 		    !osm_physp_is_valid(p_physp_remote))) {
 			if (current_state != IB_LINK_INIT)
-				link_mgr_set_physp_pi(sm, p_physp, IB_LINK_DOWN);
+				link_mgr_set_physp_pi(sm, p_physp, IB_LINK_DOWN,
+						      IB_LINK_NO_CHANGE);
 			continue;
 		}
 
@@ -570,7 +626,8 @@ static int link_mgr_process_node(osm_sm_t * sm, IN osm_node_t * p_node,
 				"Physical port %u already %s. Skipping\n",
 				p_physp->port_num,
 				ib_get_port_state_str(current_state));
-		else if (link_mgr_set_physp_pi(sm, p_physp, link_state))
+		else if (link_mgr_set_physp_pi(sm, p_physp, link_state,
+					       next_state))
 			ret = -1;
 	}
 
@@ -593,7 +650,8 @@ int osm_link_mgr_process(osm_sm_t * sm, IN const uint8_t link_state)
 	for (p_node = (osm_node_t *) cl_qmap_head(p_node_guid_tbl);
 	     p_node != (osm_node_t *) cl_qmap_end(p_node_guid_tbl);
 	     p_node = (osm_node_t *) cl_qmap_next(&p_node->map_item))
-		if (link_mgr_process_node(sm, p_node, link_state))
+		if (link_mgr_process_node(sm, p_node, link_state,
+					  IB_LINK_NO_CHANGE))
 			ret = -1;
 
 	CL_PLOCK_RELEASE(sm->p_lock);
@@ -601,3 +659,85 @@ int osm_link_mgr_process(osm_sm_t * sm, IN const uint8_t link_state)
 	OSM_LOG_EXIT(sm->p_log);
 	return ret;
 }
+
+int osm_link_mgr_pipeline_start(osm_sm_t * sm)
+{
+	cl_qmap_t *p_node_guid_tbl;
+	osm_node_t *p_node;
+	int ret = 0;
+
+	OSM_LOG_ENTER(sm->p_log);
+
+	p_node_guid_tbl = &sm->p_subn->node_guid_tbl;
+
+	CL_PLOCK_EXCL_ACQUIRE(sm->p_lock);
+
+	sm->link_pipeline_state = IB_LINK_ARMED;
+
+	for (p_node = (osm_node_t *) cl_qmap_head(p_node_guid_tbl);
+	     p_node != (osm_node_t *) cl_qmap_end(p_node_guid_tbl);
+	     p_node = (osm_node_t *) cl_qmap_next(&p_node->map_item))
+		if (link_mgr_process_node(sm, p_node, IB_LINK_NO_CHANGE,
+					  IB_LINK_ARMED))
+			ret = -1;
+
+	CL_PLOCK_RELEASE(sm->p_lock);
+
+	OSM_LOG_EXIT(sm->p_log);
+	return ret;
+}
+
+void osm_link_mgr_pipeline_activate(osm_sm_t * sm)
+{
+	cl_qmap_t *p_node_guid_tbl;
+	osm_node_t *p_node;
+	osm_physp_t *p_physp;
+	uint32_t i;
+
+	OSM_LOG_ENTER(sm->p_log);
+
+	p_node_guid_tbl = &sm->p_subn->node_guid_tbl;
+
+	CL_PLOCK_EXCL_ACQUIRE(sm->p_lock);
+
+	sm->link_pipeline_state = IB_LINK_ACTIVE;
+
+	for (p_node = (osm_node_t *) cl_qmap_head(p_node_guid_tbl);
+	     p_node != (osm_node_t *) cl_qmap_end(p_node_guid_tbl);
+	     p_node = (osm_node_t *) cl_qmap_next(&p_node->map_item))
+		for (i = 0; i < osm_node_get_num_physp(p_node); i++) {
+			p_physp = osm_node_get_physp_ptr(p_node, i);
+			if (p_physp)
+				link_mgr_pipeline_step(sm, p_physp,
+						       IB_LINK_ACTIVE);
+		}
+
+	CL_PLOCK_RELEASE(sm->p_lock);
+
+	OSM_LOG_EXIT(sm->p_log);
+}
+
+void osm_link_mgr_pipeline_stop(osm_sm_t * sm)
+{
+	CL_PLOCK_EXCL_ACQUIRE(sm->p_lock);
+	sm->link_pipeline_state = IB_LINK_NO_CHANGE;
+	CL_PLOCK_RELEASE(sm->p_lock);
+}
+
+/**********************************************************************
+ Called for the successful PortInfo Set responses of the pipeline.
+ The plock must be held before calling this function.
+**********************************************************************/
+void osm_link_mgr_pipeline_advance(osm_sm_t * sm, IN osm_physp_t * p_physp,
+				   IN uint8_t link_state)
+{
+	osm_physp_t *p_remote_physp;
+
+	link_mgr_pipeline_step(sm, p_physp, link_state);
+
+	/* the neighbor may have been waiting for this port to be ARMED */
+	p_remote_physp = osm_physp_get_remote(p_physp);
+	if (link_state == IB_LINK_ACTIVE && p_remote_physp &&
+	    osm_physp_is_valid(p_remote_physp))
+		link_mgr_pipeline_step(sm, p_remote_physp, IB_LINK_ACTIVE);
+}
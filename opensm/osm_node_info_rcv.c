@@ -345,6 +345,7 @@ static void ni_rcv_get_port_info(IN osm_sm_t * sm, IN osm_node_t * node,
 	context.pi_context.light_sweep = FALSE;
 	context.pi_context.active_transition = FALSE;
 	context.pi_context.client_rereg = FALSE;
+	context.pi_context.next_link_state = IB_LINK_NO_CHANGE;
 
 	status = osm_req_get(sm, osm_physp_get_dr_path_ptr(physp),
 			     IB_MAD_ATTR_PORT_INFO, cl_hton32(port),
@@ -956,6 +957,7 @@ void osm_ni_rcv_process(IN void *context, IN void *data)
 	 */
 
 	CL_PLOCK_EXCL_ACQUIRE(sm->p_lock);
+	sm->p_subn->topology_gen++;
 	p_node = osm_get_node_by_guid(sm->p_subn, p_ni->node_guid);
 
 	osm_dump_node_info_v2(sm->p_log, p_ni, FILE_ID, OSM_LOG_DEBUG);
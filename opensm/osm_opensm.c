@@ -571,6 +571,7 @@ void osm_opensm_construct(IN osm_opensm_t * p_osm)
 	osm_subn_construct(&p_osm->subn);
 	osm_db_construct(&p_osm->db);
 	osm_log_construct(&p_osm->log);
+	osm_snapshot_construct(&p_osm->snapshot);
 }
 
 void osm_opensm_construct_finish(IN osm_opensm_t * p_osm)
@@ -665,6 +666,7 @@ void osm_opensm_destroy(IN osm_opensm_t * p_osm)
 	/* do the destruction in reverse order as init */
 	destroy_routing_engines(p_osm);
 	destroy_plugins(p_osm);
+	osm_snapshot_destroy(&p_osm->snapshot);
 	osm_sa_destroy(&p_osm->sa);
 	osm_sm_destroy(&p_osm->sm);
 	osm_routing_modules_destroy(p_osm);
@@ -679,11 +681,12 @@ void osm_opensm_destroy_finish(IN osm_opensm_t * p_osm)
 	osm_db_destroy(&p_osm->db);
 	if (p_osm->vl15_constructed && p_osm->mad_pool_constructed)
 		osm_vl15_destroy(&p_osm->vl15, &p_osm->mad_pool);
+	/* the vendor returns its outstanding MADs to the pool on delete */
+	osm_vendor_delete(&p_osm->p_vendor);
 	if (p_osm->mad_pool_constructed)
 		osm_mad_pool_destroy(&p_osm->mad_pool);
 	p_osm->vl15_constructed = FALSE;
 	p_osm->mad_pool_constructed = FALSE;
-	osm_vendor_delete(&p_osm->p_vendor);
 	osm_subn_destroy(&p_osm->subn);
 	cl_disp_destroy(&p_osm->disp);
 	if (p_osm->sa_set_disp_initialized)
@@ -760,6 +763,7 @@ ib_api_status_t osm_opensm_init(IN osm_opensm_t * p_osm,
 	if (status != IB_SUCCESS)
 		goto Exit;
 #endif
+	p_osm->stats.sweep_phase = OSM_SWEEP_PHASE_MAX;
 
 	if (p_opt->single_thread) {
 		OSM_LOG(&p_osm->log, OSM_LOG_INFO,
@@ -770,7 +774,12 @@ ib_api_status_t osm_opensm_init(IN osm_opensm_t * p_osm,
 		 * Normal behavior is to initialize the dispatcher with
 		 * one thread per CPU, as specified by a thread count of '0'.
 		 */
-		status = cl_disp_init(&p_osm->disp, 0, "opensm");
+		if (p_opt->disp_threads)
+			OSM_LOG(&p_osm->log, OSM_LOG_INFO,
+				"Using %u dispatcher threads\n",
+				p_opt->disp_threads);
+		status = cl_disp_init(&p_osm->disp, p_opt->disp_threads,
+				      "opensm");
 	}
 	if (status != IB_SUCCESS)
 		goto Exit;
@@ -821,7 +830,8 @@ ib_api_status_t osm_opensm_init_finish(IN osm_opensm_t * p_osm,
 	status = osm_vl15_init(&p_osm->vl15, p_osm->p_vendor,
 			       &p_osm->log, &p_osm->stats, &p_osm->subn,
 			       p_opt->max_wire_smps, p_opt->max_wire_smps2,
-			       p_opt->max_smps_timeout);
+			       p_opt->max_smps_timeout,
+			       p_opt->max_wire_smps_per_dest);
 	if (status != IB_SUCCESS)
 		goto Exit;
 
@@ -862,6 +872,8 @@ ib_api_status_t osm_opensm_init_finish(IN osm_opensm_t * p_osm,
 
 	p_osm->routing_engine_used = NULL;
 
+	osm_snapshot_load(p_osm);
+
 	p_osm->node_name_map = open_node_name_map(p_opt->node_name_map_name);
 
 Exit:
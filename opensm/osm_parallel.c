@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2004-2008 Voltaire, Inc. All rights reserved.
+ * Copyright (c) 2002-2005 Mellanox Technologies LTD. All rights reserved.
+ * Copyright (c) 1996-2003 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * Abstract:
+ *    Implementation of osm_parallel_for.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif				/* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <complib/cl_atomic.h>
+#include <complib/cl_thread.h>
+#include <opensm/osm_parallel.h>
+
+typedef struct parallel_ctx {
+	osm_parallel_fn_t func;
+	void *context;
+	unsigned count;
+	atomic32_t next;
+} parallel_ctx_t;
+
+typedef struct parallel_thread {
+	cl_thread_t thread;
+	parallel_ctx_t *ctx;
+	unsigned num;
+} parallel_thread_t;
+
+static void parallel_worker(IN void *context)
+{
+	parallel_thread_t *t = context;
+	parallel_ctx_t *ctx = t->ctx;
+	unsigned index;
+
+	while ((index = (unsigned)cl_atomic_inc(&ctx->next) - 1) < ctx->count)
+		ctx->func(ctx->context, index, t->num);
+}
+
+unsigned osm_parallel_threads(IN uint32_t configured)
+{
+	return configured ? configured : (unsigned)cl_proc_count();
+}
+
+void osm_parallel_for(IN unsigned num_threads, IN unsigned count,
+		      IN osm_parallel_fn_t func, IN void *context)
+{
+	parallel_ctx_t ctx;
+	parallel_thread_t self, *threads = NULL;
+	unsigned i, started = 0;
+
+	ctx.func = func;
+	ctx.context = context;
+	ctx.count = count;
+	ctx.next = 0;
+
+	if (num_threads > count)
+		num_threads = count;
+	if (num_threads > 1)
+		threads = malloc((num_threads - 1) * sizeof(*threads));
+	if (threads)
+		for (; started < num_threads - 1; started++) {
+			threads[started].ctx = &ctx;
+			threads[started].num = started + 1;
+			if (cl_thread_init(&threads[started].thread,
+					   parallel_worker, &threads[started],
+					   "osm parallel") != CL_SUCCESS)
+				break;
+		}
+
+	self.ctx = &ctx;
+	self.num = 0;
+	parallel_worker(&self);
+
+	for (i = 0; i < started; i++)
+		cl_thread_destroy(&threads[i].thread);
+	free(threads);
+}
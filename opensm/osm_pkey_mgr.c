@@ -304,6 +304,7 @@ pkey_mgr_enforce_partition(IN osm_log_t * p_log, osm_sm_t * sm,
 	context.pi_context.light_sweep = FALSE;
 	context.pi_context.active_transition = FALSE;
 	context.pi_context.client_rereg = FALSE;
+	context.pi_context.next_link_state = IB_LINK_NO_CHANGE;
 
 	status = osm_req_set(sm, osm_physp_get_dr_path_ptr(p_physp),
 			     payload, sizeof(payload),
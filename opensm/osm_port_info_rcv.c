@@ -236,6 +236,7 @@ static void pi_rcv_process_switch_port0(IN osm_sm_t * sm,
 	context.pi_context.light_sweep = FALSE;
 	context.pi_context.active_transition = FALSE;
 	context.pi_context.client_rereg = FALSE;
+	context.pi_context.next_link_state = IB_LINK_NO_CHANGE;
 
 	for (port = 1; port < num_ports; port++) {
 		status = osm_req_get(sm, osm_physp_get_dr_path_ptr(p_physp),
@@ -334,6 +335,7 @@ static void pi_rcv_process_switch_ext_port(IN osm_sm_t * sm,
 			context.pi_context.light_sweep = FALSE;
 			context.pi_context.active_transition = FALSE;
 			context.pi_context.client_rereg = FALSE;
+			context.pi_context.next_link_state = IB_LINK_NO_CHANGE;
 			status = osm_req_get(sm,
 					     osm_physp_get_dr_path_ptr(p_physp),
 					     IB_MAD_ATTR_MLNX_EXTENDED_PORT_INFO,
@@ -601,8 +603,12 @@ static void pi_rcv_process_set(IN osm_sm_t * sm, IN osm_node_t * p_node,
 		}
 		osm_dump_port_info_v2(sm->p_log, osm_node_get_node_guid(p_node),
 				      port_guid, port_num, p_pi, FILE_ID, level);
-	} else
+	} else {
 		osm_physp_set_port_info(p_physp, p_pi, sm);
+		if (p_context->next_link_state != IB_LINK_NO_CHANGE)
+			osm_link_mgr_pipeline_advance(sm, p_physp,
+						      p_context->next_link_state);
+	}
 
 	OSM_LOG(sm->p_log, OSM_LOG_DEBUG,
 		"Received logical SetResp() for GUID 0x%" PRIx64
@@ -706,6 +712,7 @@ void osm_pi_rcv_process(IN void *context, IN void *data)
 	}
 
 	CL_PLOCK_EXCL_ACQUIRE(sm->p_lock);
+	sm->p_subn->topology_gen++;
 	p_port = osm_get_port_by_guid(sm->p_subn, port_guid);
 	if (PF(!p_port)) {
 		CL_PLOCK_RELEASE(sm->p_lock);
@@ -764,9 +771,11 @@ void osm_pi_rcv_process(IN void *context, IN void *data)
 
 		/* Update the directed route path to this port
 		   in case the old path is no longer usable. */
-		p_dr_path = osm_physp_get_dr_path_ptr(p_physp);
-		osm_dr_path_init(p_dr_path, p_smp->hop_count,
-				 p_smp->initial_path);
+		if (p_smp->mgmt_class == IB_MCLASS_SUBN_DIR) {
+			p_dr_path = osm_physp_get_dr_path_ptr(p_physp);
+			osm_dr_path_init(p_dr_path, p_smp->hop_count,
+					 p_smp->initial_path);
+		}
 
 		p_physp->need_update = osm_pi_rcv_update_self(sm, p_physp, p_pi);
 
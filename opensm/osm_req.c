@@ -60,29 +60,19 @@
 #include <opensm/osm_db_pack.h>
 
 /**********************************************************************
+  Returns the physp through which a directed route with at least one
+  hop leaves its last node, or NULL if we don't know it.
   The plock must be held before calling this function.
 **********************************************************************/
-static ib_net64_t req_determine_mkey(IN osm_sm_t * sm,
-				     IN const osm_dr_path_t * p_path)
+static osm_physp_t *req_get_out_physp(IN osm_sm_t * sm,
+				      IN const osm_dr_path_t * p_path)
 {
 	osm_node_t *p_node;
 	osm_port_t *p_sm_port;
-	osm_physp_t *p_physp;
-	ib_net64_t dest_port_guid = 0, m_key;
+	osm_physp_t *p_physp = NULL;
 	uint8_t hop;
 
-	OSM_LOG_ENTER(sm->p_log);
-
-	p_physp = NULL;
-
 	p_sm_port = osm_get_port_by_guid(sm->p_subn, sm->p_subn->sm_port_guid);
-
-	/* hop_count == 0: destination port guid is SM */
-	if (p_path->hop_count == 0) {
-		dest_port_guid = sm->p_subn->sm_port_guid;
-		goto Remote_Guid;
-	}
-
 	if (p_sm_port) {
 		p_node = p_sm_port->p_node;
 		if (osm_node_get_type(p_node) == IB_NODE_TYPE_SWITCH)
@@ -100,6 +90,28 @@ static ib_net64_t req_determine_mkey(IN osm_sm_t * sm,
 		p_physp = osm_node_get_physp_ptr(p_node, p_path->path[hop]);
 	}
 
+	return p_physp;
+}
+
+/**********************************************************************
+  The plock must be held before calling this function.
+**********************************************************************/
+static ib_net64_t req_determine_mkey(IN osm_sm_t * sm,
+				     IN const osm_dr_path_t * p_path)
+{
+	osm_physp_t *p_physp;
+	ib_net64_t dest_port_guid = 0, m_key;
+
+	OSM_LOG_ENTER(sm->p_log);
+
+	/* hop_count == 0: destination port guid is SM */
+	if (p_path->hop_count == 0) {
+		dest_port_guid = sm->p_subn->sm_port_guid;
+		goto Remote_Guid;
+	}
+
+	p_physp = req_get_out_physp(sm, p_path);
+
 	/* At this point, p_physp points at the outgoing physp on the
 	   last hop, or NULL if we don't know it.
 	*/
@@ -149,6 +161,86 @@ Remote_Guid:
 	return m_key;
 }
 
+/**********************************************************************
+  Returns the LID to send an SMP for the destination of p_path to
+  LID routed, or 0 if it has to go directed route.
+  The plock must be held before calling this function.
+**********************************************************************/
+static ib_net16_t req_get_routed_lid(IN osm_sm_t * sm,
+				     IN const osm_dr_path_t * p_path,
+				     IN uint8_t method, IN ib_net16_t attr_id)
+{
+	osm_subn_t *p_subn = sm->p_subn;
+	osm_physp_t *p_physp;
+	osm_node_t *p_node;
+	ib_net16_t lid;
+
+	if (!p_subn->opt.lid_routed_smps || p_path->hop_count == 0 ||
+	    !p_subn->sm_base_lid ||
+	    !p_subn->lid_route_ok[cl_ntoh16(p_subn->sm_base_lid)])
+		return 0;
+
+	/*
+	   NodeInfo is what tells discovery which node sits at the end
+	   of a directed route, and setting PortInfo or SwitchInfo may
+	   change the LIDs and port states the route depends on.
+	 */
+	switch (attr_id) {
+	case IB_MAD_ATTR_NODE_INFO:
+		return 0;
+	case IB_MAD_ATTR_LIN_FWD_TBL:
+	case IB_MAD_ATTR_MCAST_FWD_TBL:
+	case IB_MAD_ATTR_P_KEY_TABLE:
+	case IB_MAD_ATTR_SLVL_TABLE:
+	case IB_MAD_ATTR_VL_ARBITRATION:
+		break;
+	default:
+		if (method != IB_MAD_METHOD_GET)
+			return 0;
+		break;
+	}
+
+	p_physp = req_get_out_physp(sm, p_path);
+	if (!p_physp || !(p_physp = p_physp->p_remote_physp))
+		return 0;
+
+	p_node = p_physp->p_node;
+	if (osm_node_get_type(p_node) == IB_NODE_TYPE_SWITCH)
+		lid = osm_node_get_base_lid(p_node, 0);
+	else
+		lid = osm_physp_get_base_lid(p_physp);
+
+	if (!lid || cl_ntoh16(lid) > IB_LID_UCAST_END_HO ||
+	    !p_subn->lid_route_ok[cl_ntoh16(lid)])
+		return 0;
+
+	return lid;
+}
+
+/**********************************************************************
+  Turns the directed route SMP in p_madw into a LID routed one,
+  keeping the route to resend it directed route if it fails.
+**********************************************************************/
+static void req_set_lid_routed(IN osm_sm_t * sm, IN osm_madw_t * p_madw,
+			       IN const osm_dr_path_t * p_path,
+			       IN ib_net16_t lid)
+{
+	ib_smp_t *p_smp = osm_madw_get_smp_ptr(p_madw);
+
+	p_smp->mgmt_class = IB_MCLASS_SUBN_LID;
+	p_smp->hop_count = 0;
+	p_smp->dr_slid = 0;
+	p_smp->dr_dlid = 0;
+	memset(p_smp->initial_path, 0, sizeof(p_smp->initial_path));
+
+	p_madw->mad_addr.dest_lid = lid;
+	p_madw->mad_addr.addr_type.smi.source_lid = sm->p_subn->sm_base_lid;
+	p_madw->dr_hop_count = p_path->hop_count;
+	memcpy(p_madw->dr_path, p_path->path, sizeof(p_madw->dr_path));
+
+	cl_atomic_inc(&sm->p_subn->p_osm->stats.qp0_lid_routed_sent);
+}
+
 /**********************************************************************
   The plock must be held before calling this function.
 **********************************************************************/
@@ -162,6 +254,7 @@ ib_api_status_t osm_req_get(IN osm_sm_t * sm, IN const osm_dr_path_t * p_path,
 	ib_api_status_t status = IB_SUCCESS;
 	ib_net64_t m_key_calc;
 	ib_net64_t tid;
+	ib_net16_t lid;
 
 	CL_ASSERT(sm);
 
@@ -216,6 +309,10 @@ ib_api_status_t osm_req_get(IN osm_sm_t * sm, IN const osm_dr_path_t * p_path,
 	p_madw->timeout = timeout;
 	p_madw->fail_msg = err_msg;
 
+	lid = req_get_routed_lid(sm, p_path, IB_MAD_METHOD_GET, attr_id);
+	if (lid)
+		req_set_lid_routed(sm, p_madw, p_path, lid);
+
 	/*
 	   Fill in the mad wrapper context for the recipient.
 	   In this case, the only thing the recipient needs is the
@@ -247,6 +344,7 @@ osm_madw_t *osm_prepare_req_set(IN osm_sm_t * sm, IN const osm_dr_path_t * p_pat
 	osm_madw_t *p_madw = NULL;
 	ib_net64_t m_key_calc;
 	ib_net64_t tid;
+	ib_net16_t lid;
 
 	CL_ASSERT(sm);
 
@@ -301,6 +399,10 @@ osm_madw_t *osm_prepare_req_set(IN osm_sm_t * sm, IN const osm_dr_path_t * p_pat
 	p_madw->timeout = timeout;
 	p_madw->fail_msg = err_msg;
 
+	lid = req_get_routed_lid(sm, p_path, IB_MAD_METHOD_SET, attr_id);
+	if (lid)
+		req_set_lid_routed(sm, p_madw, p_path, lid);
+
 	/*
 	   Fill in the mad wrapper context for the recipient.
 	   In this case, the only thing the recipient needs is the
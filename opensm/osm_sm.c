@@ -383,6 +383,14 @@ ib_api_status_t osm_sm_init(IN osm_sm_t * p_sm, IN osm_subn_t * p_subn,
 	if (p_sm->mlnx_epi_disp_h == CL_DISP_INVALID_HANDLE)
 		goto Exit;
 
+	/*
+	 * SMInfo and trap MADs drive the SM state machine and the trap
+	 * handling, so they are processed one at a time and in order.
+	 * Other receivers run in parallel and serialize on p_lock.
+	 */
+	cl_disp_set_conc_class(p_sm->sm_info_disp_h, CL_DISP_CONC_SERIAL);
+	cl_disp_set_conc_class(p_sm->trap_disp_h, CL_DISP_CONC_SERIAL);
+
 	p_subn->sm_state = p_subn->opt.sm_inactive ?
 	    IB_SMINFO_STATE_NOTACTIVE : IB_SMINFO_STATE_DISCOVERING;
 	osm_report_sm_state(p_sm);
@@ -145,10 +145,12 @@ static void sm_mad_ctrl_disp_done_callback(IN void *context, IN void *p_data)
  *
  * DESCRIPTION
  * Updates wire stats for outstanding MADs and calls the VL15 poller.
+ * p_req_madw is the request MAD that completed.
  *
  * SYNOPSIS
  */
-static void sm_mad_ctrl_update_wire_stats(IN osm_sm_mad_ctrl_t * p_ctrl)
+static void sm_mad_ctrl_update_wire_stats(IN osm_sm_mad_ctrl_t * p_ctrl,
+					  IN const osm_madw_t * p_req_madw)
 {
 	uint32_t mads_on_wire;
 
@@ -165,6 +167,7 @@ static void sm_mad_ctrl_update_wire_stats(IN osm_sm_mad_ctrl_t * p_ctrl)
 	   We can signal the VL15 controller to send another MAD
 	   if any are waiting for transmission.
 	 */
+	osm_vl15_mad_done(p_ctrl->p_vl15, p_req_madw);
 	osm_vl15_poll(p_ctrl->p_vl15);
 	OSM_LOG_EXIT(p_ctrl->p_log);
 }
@@ -203,7 +206,7 @@ static void sm_mad_ctrl_process_get_resp(IN osm_sm_mad_ctrl_t * p_ctrl,
 
 	p_old_madw = transaction_context;
 
-	sm_mad_ctrl_update_wire_stats(p_ctrl);
+	sm_mad_ctrl_update_wire_stats(p_ctrl, p_old_madw);
 
 	/*
 	   Copy the MAD Wrapper context from the requesting MAD
@@ -523,7 +526,8 @@ Exit:
  * SYNOPSIS
  */
 static void sm_mad_ctrl_process_trap_repress(IN osm_sm_mad_ctrl_t * p_ctrl,
-					     IN osm_madw_t * p_madw)
+					     IN osm_madw_t * p_madw,
+					     IN osm_madw_t * p_req_madw)
 {
 	ib_smp_t *p_smp;
 
@@ -537,7 +541,7 @@ static void sm_mad_ctrl_process_trap_repress(IN osm_sm_mad_ctrl_t * p_ctrl,
 	 */
 	switch (p_smp->attr_id) {
 	case IB_MAD_ATTR_NOTICE:
-		sm_mad_ctrl_update_wire_stats(p_ctrl);
+		sm_mad_ctrl_update_wire_stats(p_ctrl, p_req_madw);
 		sm_mad_ctrl_retire_trans_mad(p_ctrl, p_madw);
 		break;
 	default:
@@ -674,7 +678,7 @@ static void sm_mad_ctrl_rcv_callback(IN osm_madw_t * p_madw,
 		break;
 	case IB_MAD_METHOD_TRAP_REPRESS:
 		CL_ASSERT(p_req_madw != NULL);
-		sm_mad_ctrl_process_trap_repress(p_ctrl, p_madw);
+		sm_mad_ctrl_process_trap_repress(p_ctrl, p_madw, p_req_madw);
 		break;
 	case IB_MAD_METHOD_SEND:
 	case IB_MAD_METHOD_REPORT:
@@ -702,6 +706,62 @@ Exit:
  * SEE ALSO
  *********/
 
+/****f* opensm: SM/sm_mad_ctrl_resend_dr
+ * NAME
+ * sm_mad_ctrl_resend_dr
+ *
+ * DESCRIPTION
+ * Resends a failed LID routed SMP directed route, and stops sending
+ * LID routed SMPs to its destination until the subnet comes up again.
+ *
+ * SYNOPSIS
+ */
+static void sm_mad_ctrl_resend_dr(IN osm_sm_mad_ctrl_t * p_ctrl,
+				  IN osm_madw_t * p_madw)
+{
+	ib_smp_t *p_smp = osm_madw_get_smp_ptr(p_madw);
+	uint16_t lid = cl_ntoh16(p_madw->mad_addr.dest_lid);
+
+	OSM_LOG(p_ctrl->p_log, OSM_LOG_VERBOSE,
+		"LID routed %s(%s) to LID %u failed (%s), "
+		"resending directed route, TID 0x%" PRIx64 "\n",
+		ib_get_sm_method_str(p_smp->method),
+		ib_get_sm_attr_str(p_smp->attr_id), lid,
+		ib_get_err_str(p_madw->status), cl_ntoh64(p_smp->trans_id));
+
+	if (lid <= IB_LID_UCAST_END_HO)
+		p_ctrl->p_subn->lid_route_ok[lid] = 0;
+	cl_atomic_inc(&p_ctrl->p_stats->qp0_lid_routed_failed);
+
+	/* the wire slot was taken for the LID routed destination */
+	sm_mad_ctrl_update_wire_stats(p_ctrl, p_madw);
+
+	p_smp->mgmt_class = IB_MCLASS_SUBN_DIR;
+	p_smp->status = 0;
+	p_smp->hop_ptr = 0;
+	p_smp->hop_count = p_madw->dr_hop_count;
+	p_smp->dr_slid = IB_LID_PERMISSIVE;
+	p_smp->dr_dlid = IB_LID_PERMISSIVE;
+	memcpy(p_smp->initial_path, p_madw->dr_path,
+	       sizeof(p_smp->initial_path));
+	p_madw->mad_addr.dest_lid = IB_LID_PERMISSIVE;
+	p_madw->mad_addr.addr_type.smi.source_lid = IB_LID_PERMISSIVE;
+	p_madw->dr_hop_count = 0;
+	p_madw->status = IB_SUCCESS;
+	/* the round trip times of the LID route don't apply to this one */
+	if (p_madw->rtt_timeout) {
+		p_madw->timeout = 0;
+		p_madw->rtt_timeout = FALSE;
+	}
+
+	/*
+	   Post before releasing the outstanding count of the LID routed
+	   attempt, so the count does not drop to zero in between.
+	 */
+	osm_vl15_post(p_ctrl->p_vl15, p_madw);
+	osm_stats_dec_qp0_outstanding(p_ctrl->p_stats);
+}
+
 /****f* opensm: SM/sm_mad_ctrl_send_err_cb
  * NAME
  * sm_mad_ctrl_send_err_cb
@@ -722,7 +782,14 @@ static void sm_mad_ctrl_send_err_cb(IN void *context, IN osm_madw_t * p_madw)
 
 	CL_ASSERT(p_madw);
 
+	cl_atomic_inc(&p_ctrl->p_stats->qp0_mads_timeout);
+
 	p_smp = osm_madw_get_smp_ptr(p_madw);
+	if (p_smp->mgmt_class == IB_MCLASS_SUBN_LID && p_madw->dr_hop_count) {
+		sm_mad_ctrl_resend_dr(p_ctrl, p_madw);
+		goto Exit;
+	}
+
 	OSM_LOG(p_ctrl->p_log, OSM_LOG_ERROR, "ERR 3113: "
 		"MAD completed in error (%s): "
 		"%s(%s), attr_mod 0x%x, TID 0x%" PRIx64 "\n",
@@ -790,7 +857,7 @@ static void sm_mad_ctrl_send_err_cb(IN void *context, IN osm_madw_t * p_madw)
 	   An error occurred.  No response was received to a request MAD.
 	   Retire the original request MAD.
 	 */
-	sm_mad_ctrl_update_wire_stats(p_ctrl);
+	sm_mad_ctrl_update_wire_stats(p_ctrl, p_madw);
 
 	if (osm_madw_get_err_msg(p_madw) != CL_DISP_MSGID_NONE) {
 		OSM_LOG(p_ctrl->p_log, OSM_LOG_DEBUG,
@@ -810,6 +877,7 @@ static void sm_mad_ctrl_send_err_cb(IN void *context, IN osm_madw_t * p_madw)
 		 */
 		sm_mad_ctrl_retire_trans_mad(p_ctrl, p_madw);
 
+Exit:
 	OSM_LOG_EXIT(p_ctrl->p_log);
 }
 
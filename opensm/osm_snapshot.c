@@ -0,0 +1,766 @@
+/*
+ * Copyright (c) 2004-2008 Voltaire, Inc. All rights reserved.
+ * Copyright (c) 2002-2005 Mellanox Technologies LTD. All rights reserved.
+ * Copyright (c) 1996-2003 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * Abstract:
+ *    Implementation of osm_snapshot_t.
+ *    This object holds the binary fabric snapshot used to speed up
+ *    the first heavy sweep after a restart.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif				/* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <iba/ib_types.h>
+#include <complib/cl_qmap.h>
+#include <complib/cl_passivelock.h>
+#include <opensm/osm_file_ids.h>
+#define FILE_ID OSM_FILE_SNAPSHOT_C
+#include <opensm/osm_snapshot.h>
+#include <opensm/osm_opensm.h>
+#include <opensm/osm_switch.h>
+#include <opensm/osm_node.h>
+#include <opensm/osm_port.h>
+#include <opensm/osm_helper.h>
+
+/*
+ * File layout, all integers in network byte order:
+ *
+ *	magic		8 bytes, "OSMSNAP" and a NUL
+ *	version		32 bits
+ *	conf_hash	32 bits
+ *	routing_engine	32 bytes, NUL padded
+ *	num_switches	32 bits
+ *	num_ports	32 bits
+ *	switches	num_switches times:
+ *			node GUID (64), number of ports (8), LFT size (16),
+ *			for ports 1 .. number of ports - 1:
+ *			  peer node GUID (64), peer port (8),
+ *			LFT
+ *	ports		num_ports times:
+ *			port GUID (64), base LID (16), LMC (8)
+ *	checksum	32 bits, FNV-1a of everything above
+ */
+#define SNAPSHOT_MAGIC		"OSMSNAP"
+#define SNAPSHOT_VERSION	2
+#define SNAPSHOT_HASH_INIT	2166136261U
+
+typedef struct snapshot_buf {
+	uint8_t *data;
+	size_t len;
+	size_t size;
+	boolean_t failed;
+} snapshot_buf_t;
+
+static uint32_t snapshot_hash(uint32_t hash, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len--) {
+		hash ^= *p++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static uint32_t snapshot_hash_val(uint32_t hash, uint32_t val)
+{
+	val = cl_hton32(val);
+	return snapshot_hash(hash, &val, sizeof(val));
+}
+
+static uint32_t snapshot_hash_str(uint32_t hash, const char *str)
+{
+	return str ? snapshot_hash(hash, str, strlen(str) + 1) :
+	    snapshot_hash_val(hash, 0);
+}
+
+/* Hashes the name of the file and what it holds. */
+static uint32_t snapshot_hash_file(uint32_t hash, const char *file_name)
+{
+	uint8_t data[4096];
+	size_t len;
+	FILE *file;
+
+	hash = snapshot_hash_str(hash, file_name);
+	if (!file_name || !(file = fopen(file_name, "r")))
+		return hash;
+	while ((len = fread(data, 1, sizeof(data), file)) > 0)
+		hash = snapshot_hash(hash, data, len);
+	fclose(file);
+	return hash;
+}
+
+static uint32_t snapshot_hash_qos(uint32_t hash, osm_qos_options_t * opt)
+{
+	hash = snapshot_hash_val(hash, opt->max_vls);
+	hash = snapshot_hash_val(hash, opt->high_limit);
+	hash = snapshot_hash_str(hash, opt->vlarb_high);
+	hash = snapshot_hash_str(hash, opt->vlarb_low);
+	return snapshot_hash_str(hash, opt->sl2vl);
+}
+
+/*
+ * Only the options that change the routing or the LFTs are hashed, so
+ * that a different log file or dump directory does not invalidate the
+ * snapshot.  Files are hashed with their content.
+ */
+static uint32_t snapshot_conf_hash(osm_subn_opt_t * p_opt)
+{
+	uint32_t hash = SNAPSHOT_HASH_INIT;
+
+	hash = snapshot_hash_str(hash, p_opt->routing_engine_names);
+	hash = snapshot_hash_val(hash, p_opt->lmc);
+	hash = snapshot_hash_val(hash, p_opt->lmc_esp0);
+	hash = snapshot_hash_val(hash, p_opt->max_op_vls);
+	hash = snapshot_hash_val(hash, p_opt->port_profile_switch_nodes);
+	hash = snapshot_hash_val(hash, p_opt->avoid_throttled_links);
+	hash = snapshot_hash_val(hash, p_opt->connect_roots);
+	hash = snapshot_hash_val(hash, p_opt->port_shifting);
+	hash = snapshot_hash_val(hash, p_opt->scatter_ports);
+	hash = snapshot_hash_val(hash, p_opt->max_reverse_hops);
+	hash = snapshot_hash_val(hash, p_opt->guid_routing_order_no_scatter);
+	hash = snapshot_hash_val(hash, p_opt->do_mesh_analysis);
+	hash = snapshot_hash_val(hash, p_opt->dfsssp_batch_size);
+	hash = snapshot_hash_val(hash, p_opt->ftree_batch_size);
+	hash = snapshot_hash_val(hash, p_opt->nue_parallel_layers);
+	hash = snapshot_hash_val(hash, p_opt->nue_max_num_vls);
+	hash = snapshot_hash_val(hash, p_opt->nue_include_switches);
+	hash = snapshot_hash_val(hash, p_opt->lash_start_vl);
+	hash = snapshot_hash_val(hash, p_opt->quasi_ftree_indexing);
+
+	hash = snapshot_hash_file(hash, p_opt->port_prof_ignore_file);
+	hash = snapshot_hash_file(hash, p_opt->hop_weights_file);
+	hash = snapshot_hash_file(hash, p_opt->port_search_ordering_file);
+	hash = snapshot_hash_file(hash, p_opt->lid_matrix_dump_file);
+	hash = snapshot_hash_file(hash, p_opt->lfts_file);
+	hash = snapshot_hash_file(hash, p_opt->root_guid_file);
+	hash = snapshot_hash_file(hash, p_opt->cn_guid_file);
+	hash = snapshot_hash_file(hash, p_opt->io_guid_file);
+	hash = snapshot_hash_file(hash, p_opt->ids_guid_file);
+	hash = snapshot_hash_file(hash, p_opt->guid_routing_order_file);
+	hash = snapshot_hash_file(hash, p_opt->torus_conf_file);
+
+	hash = snapshot_hash_val(hash, p_opt->qos);
+	hash = snapshot_hash_file(hash, p_opt->qos_policy_file);
+	hash = snapshot_hash_qos(hash, &p_opt->qos_options);
+	hash = snapshot_hash_qos(hash, &p_opt->qos_ca_options);
+	hash = snapshot_hash_qos(hash, &p_opt->qos_sw0_options);
+	hash = snapshot_hash_qos(hash, &p_opt->qos_swe_options);
+	return snapshot_hash_qos(hash, &p_opt->qos_rtr_options);
+}
+
+static void buf_put(snapshot_buf_t * buf, const void *data, size_t len)
+{
+	uint8_t *p;
+	size_t size;
+
+	if (buf->failed)
+		return;
+
+	if (buf->len + len > buf->size) {
+		size = buf->size ? buf->size : 4096;
+		while (size < buf->len + len)
+			size *= 2;
+		p = realloc(buf->data, size);
+		if (!p) {
+			buf->failed = TRUE;
+			return;
+		}
+		buf->data = p;
+		buf->size = size;
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+static void buf_put8(snapshot_buf_t * buf, uint8_t val)
+{
+	buf_put(buf, &val, sizeof(val));
+}
+
+static void buf_put16(snapshot_buf_t * buf, uint16_t val)
+{
+	val = cl_hton16(val);
+	buf_put(buf, &val, sizeof(val));
+}
+
+static void buf_put32(snapshot_buf_t * buf, uint32_t val)
+{
+	val = cl_hton32(val);
+	buf_put(buf, &val, sizeof(val));
+}
+
+static void buf_put64(snapshot_buf_t * buf, uint64_t val)
+{
+	val = cl_hton64(val);
+	buf_put(buf, &val, sizeof(val));
+}
+
+static const uint8_t *buf_get(snapshot_buf_t * buf, size_t len)
+{
+	const uint8_t *p;
+
+	if (buf->failed || buf->len + len > buf->size) {
+		buf->failed = TRUE;
+		return NULL;
+	}
+	p = buf->data + buf->len;
+	buf->len += len;
+	return p;
+}
+
+static uint8_t buf_get8(snapshot_buf_t * buf)
+{
+	const uint8_t *p = buf_get(buf, 1);
+
+	return p ? *p : 0;
+}
+
+static uint16_t buf_get16(snapshot_buf_t * buf)
+{
+	const uint8_t *p = buf_get(buf, 2);
+	uint16_t val;
+
+	if (!p)
+		return 0;
+	memcpy(&val, p, sizeof(val));
+	return cl_ntoh16(val);
+}
+
+static uint32_t buf_get32(snapshot_buf_t * buf)
+{
+	const uint8_t *p = buf_get(buf, 4);
+	uint32_t val;
+
+	if (!p)
+		return 0;
+	memcpy(&val, p, sizeof(val));
+	return cl_ntoh32(val);
+}
+
+static uint64_t buf_get64(snapshot_buf_t * buf)
+{
+	const uint8_t *p = buf_get(buf, 8);
+	uint64_t val;
+
+	if (!p)
+		return 0;
+	memcpy(&val, p, sizeof(val));
+	return cl_ntoh64(val);
+}
+
+static void snapshot_link(osm_physp_t * p_physp, uint64_t * guid,
+			  uint8_t * port)
+{
+	osm_physp_t *p_remote;
+
+	*guid = 0;
+	*port = 0;
+	if (!p_physp || !osm_link_is_healthy(p_physp))
+		return;
+	p_remote = osm_physp_get_remote(p_physp);
+	if (!p_remote)
+		return;
+	*guid = cl_ntoh64(osm_node_get_node_guid(p_remote->p_node));
+	*port = osm_physp_get_port_num(p_remote);
+}
+
+void osm_snapshot_construct(IN osm_snapshot_t * p_snap)
+{
+	memset(p_snap, 0, sizeof(*p_snap));
+	cl_qmap_init(&p_snap->sw_tbl);
+	cl_qmap_init(&p_snap->port_tbl);
+}
+
+void osm_snapshot_destroy(IN osm_snapshot_t * p_snap)
+{
+	cl_map_item_t *item;
+
+	while ((item = cl_qmap_head(&p_snap->sw_tbl)) !=
+	       cl_qmap_end(&p_snap->sw_tbl)) {
+		cl_qmap_remove_item(&p_snap->sw_tbl, item);
+		free(item);
+	}
+	while ((item = cl_qmap_head(&p_snap->port_tbl)) !=
+	       cl_qmap_end(&p_snap->port_tbl)) {
+		cl_qmap_remove_item(&p_snap->port_tbl, item);
+		free(item);
+	}
+	p_snap->matched = FALSE;
+}
+
+static int snapshot_parse(osm_opensm_t * osm, snapshot_buf_t * buf)
+{
+	osm_snapshot_t *p_snap = &osm->snapshot;
+	osm_snapshot_sw_t *s;
+	osm_snapshot_port_t *p;
+	const uint8_t *data;
+	uint32_t num_sw, num_ports, i;
+	uint64_t guid;
+	uint8_t n, j;
+	uint16_t lft_size;
+
+	data = buf_get(buf, 8);
+	if (!data || memcmp(data, SNAPSHOT_MAGIC, 8)) {
+		OSM_LOG(&osm->log, OSM_LOG_ERROR, "ERR 5702: "
+			"%s is not a snapshot file\n",
+			osm->subn.opt.snapshot_file);
+		return -1;
+	}
+	if (buf_get32(buf) != SNAPSHOT_VERSION) {
+		OSM_LOG(&osm->log, OSM_LOG_ERROR, "ERR 5703: "
+			"Unsupported snapshot version in %s\n",
+			osm->subn.opt.snapshot_file);
+		return -1;
+	}
+	p_snap->conf_hash = buf_get32(buf);
+	data = buf_get(buf, sizeof(p_snap->routing_engine));
+	if (data) {
+		memcpy(p_snap->routing_engine, data,
+		       sizeof(p_snap->routing_engine));
+		p_snap->routing_engine[sizeof(p_snap->routing_engine) - 1] =
+		    '\0';
+	}
+	num_sw = buf_get32(buf);
+	num_ports = buf_get32(buf);
+
+	for (i = 0; i < num_sw && !buf->failed; i++) {
+		guid = buf_get64(buf);
+		n = buf_get8(buf);
+		lft_size = buf_get16(buf);
+		s = malloc(sizeof(*s) + n * (sizeof(ib_net64_t) + 1) +
+			   lft_size);
+		if (!s)
+			return -1;
+		memset(s, 0, sizeof(*s));
+		s->num_ports = n;
+		s->remote_guid = (ib_net64_t *) (s + 1);
+		s->remote_port = (uint8_t *) (s->remote_guid + n);
+		s->lft = s->remote_port + n;
+		s->lft_size = lft_size;
+		if (n) {
+			s->remote_guid[0] = 0;
+			s->remote_port[0] = 0;
+		}
+		for (j = 1; j < n; j++) {
+			s->remote_guid[j] = cl_hton64(buf_get64(buf));
+			s->remote_port[j] = buf_get8(buf);
+		}
+		data = buf_get(buf, lft_size);
+		if (data)
+			memcpy(s->lft, data, lft_size);
+		if (cl_qmap_insert(&p_snap->sw_tbl, cl_hton64(guid),
+				   &s->map_item) != &s->map_item) {
+			free(s);
+			buf->failed = TRUE;
+		}
+	}
+
+	for (i = 0; i < num_ports && !buf->failed; i++) {
+		p = malloc(sizeof(*p));
+		if (!p)
+			return -1;
+		guid = buf_get64(buf);
+		p->base_lid = buf_get16(buf);
+		p->lmc = buf_get8(buf);
+		if (cl_qmap_insert(&p_snap->port_tbl, cl_hton64(guid),
+				   &p->map_item) != &p->map_item) {
+			free(p);
+			buf->failed = TRUE;
+		}
+	}
+
+	if (buf->failed) {
+		OSM_LOG(&osm->log, OSM_LOG_ERROR, "ERR 5704: "
+			"Snapshot file %s is truncated\n",
+			osm->subn.opt.snapshot_file);
+		return -1;
+	}
+
+	return 0;
+}
+
+int osm_snapshot_load(IN osm_opensm_t * osm)
+{
+	const char *file_name = osm->subn.opt.snapshot_file;
+	snapshot_buf_t buf;
+	struct stat st;
+	uint32_t sum;
+	FILE *file;
+	int ret = -1;
+
+	if (!file_name)
+		return -1;
+
+	OSM_LOG_ENTER(&osm->log);
+
+	memset(&buf, 0, sizeof(buf));
+
+	file = fopen(file_name, "r");
+	if (!file) {
+		OSM_LOG(&osm->log, OSM_LOG_VERBOSE,
+			"No snapshot loaded from %s: %s\n", file_name,
+			strerror(errno));
+		goto Exit;
+	}
+
+	if (fstat(fileno(file), &st) || st.st_size < 12) {
+		OSM_LOG(&osm->log, OSM_LOG_ERROR, "ERR 5701: "
+			"Snapshot file %s is truncated\n", file_name);
+		goto Exit;
+	}
+
+	buf.size = st.st_size;
+	buf.data = malloc(buf.size);
+	if (!buf.data || fread(buf.data, buf.size, 1, file) != 1) {
+		OSM_LOG(&osm->log, OSM_LOG_ERROR, "ERR 5705: "
+			"Cannot read snapshot file %s\n", file_name);
+		goto Exit;
+	}
+
+	buf.size -= sizeof(sum);
+	memcpy(&sum, buf.data + buf.size, sizeof(sum));
+	if (cl_ntoh32(sum) != snapshot_hash(SNAPSHOT_HASH_INIT, buf.data,
+					    buf.size)) {
+		OSM_LOG(&osm->log, OSM_LOG_ERROR, "ERR 5706: "
+			"Snapshot file %s is corrupted\n", file_name);
+		goto Exit;
+	}
+
+	ret = snapshot_parse(osm, &buf);
+	if (ret) {
+		osm_snapshot_destroy(&osm->snapshot);
+		goto Exit;
+	}
+
+	OSM_LOG(&osm->log, OSM_LOG_INFO,
+		"Loaded snapshot of %u switches and %u ports from %s\n",
+		cl_qmap_count(&osm->snapshot.sw_tbl),
+		cl_qmap_count(&osm->snapshot.port_tbl), file_name);
+
+Exit:
+	if (file)
+		fclose(file);
+	free(buf.data);
+	OSM_LOG_EXIT(&osm->log);
+	return ret;
+}
+
+static void snapshot_put_switch(snapshot_buf_t * buf, osm_switch_t * p_sw)
+{
+	const uint8_t *lft;
+	uint64_t guid;
+	uint8_t port, i;
+
+	/* the tables computed by the last routing are stored */
+	lft = p_sw->new_lft ? p_sw->new_lft : p_sw->lft;
+
+	buf_put64(buf, cl_ntoh64(osm_node_get_node_guid(p_sw->p_node)));
+	buf_put8(buf, p_sw->num_ports);
+	buf_put16(buf, lft ? p_sw->lft_size : 0);
+	for (i = 1; i < p_sw->num_ports; i++) {
+		snapshot_link(osm_node_get_physp_ptr(p_sw->p_node, i), &guid,
+			      &port);
+		buf_put64(buf, guid);
+		buf_put8(buf, port);
+	}
+	if (lft)
+		buf_put(buf, lft, p_sw->lft_size);
+}
+
+int osm_snapshot_store(IN osm_opensm_t * osm)
+{
+	const char *file_name = osm->subn.opt.snapshot_file;
+	char engine[sizeof(osm->snapshot.routing_engine)];
+	snapshot_buf_t buf;
+	cl_map_item_t *item;
+	osm_port_t *p_port;
+	char *tmp_file_name;
+	uint32_t conf_hash;
+	FILE *file;
+	int ret = -1;
+
+	if (!file_name)
+		return 0;
+
+	OSM_LOG_ENTER(&osm->log);
+
+	memset(&buf, 0, sizeof(buf));
+	memset(engine, 0, sizeof(engine));
+
+	tmp_file_name = malloc(strlen(file_name) + 5);
+	if (!tmp_file_name)
+		goto Exit;
+	sprintf(tmp_file_name, "%s.tmp", file_name);
+
+	/* reads the files named by the options, so not under the lock */
+	conf_hash = snapshot_conf_hash(&osm->subn.opt);
+
+	CL_PLOCK_ACQUIRE(&osm->lock);
+
+	if (osm->routing_engine_used)
+		strncpy(engine, osm->routing_engine_used->name,
+			sizeof(engine) - 1);
+
+	buf_put(&buf, SNAPSHOT_MAGIC, 8);
+	buf_put32(&buf, SNAPSHOT_VERSION);
+	buf_put32(&buf, conf_hash);
+	buf_put(&buf, engine, sizeof(engine));
+	buf_put32(&buf, cl_qmap_count(&osm->subn.sw_guid_tbl));
+	buf_put32(&buf, cl_qmap_count(&osm->subn.port_guid_tbl));
+
+	for (item = cl_qmap_head(&osm->subn.sw_guid_tbl);
+	     item != cl_qmap_end(&osm->subn.sw_guid_tbl);
+	     item = cl_qmap_next(item))
+		snapshot_put_switch(&buf, (osm_switch_t *) item);
+
+	for (item = cl_qmap_head(&osm->subn.port_guid_tbl);
+	     item != cl_qmap_end(&osm->subn.port_guid_tbl);
+	     item = cl_qmap_next(item)) {
+		p_port = (osm_port_t *) item;
+		buf_put64(&buf, cl_ntoh64(osm_port_get_guid(p_port)));
+		buf_put16(&buf, cl_ntoh16(osm_port_get_base_lid(p_port)));
+		buf_put8(&buf, osm_port_get_lmc(p_port));
+	}
+
+	CL_PLOCK_RELEASE(&osm->lock);
+
+	buf_put32(&buf, snapshot_hash(SNAPSHOT_HASH_INIT, buf.data, buf.len));
+	if (buf.failed) {
+		OSM_LOG(&osm->log, OSM_LOG_ERROR, "ERR 5707: "
+			"Cannot allocate snapshot of the fabric\n");
+		goto Exit;
+	}
+
+	file = fopen(tmp_file_name, "w");
+	if (!file) {
+		OSM_LOG(&osm->log, OSM_LOG_ERROR, "ERR 5708: "
+			"Cannot create %s: %s\n", tmp_file_name,
+			strerror(errno));
+		goto Exit;
+	}
+	if (fwrite(buf.data, buf.len, 1, file) != 1 ||
+	    (osm->subn.opt.fsync_high_avail_files &&
+	     (fflush(file) || fsync(fileno(file))))) {
+		OSM_LOG(&osm->log, OSM_LOG_ERROR, "ERR 5709: "
+			"Cannot write %s: %s\n", tmp_file_name,
+			strerror(errno));
+		fclose(file);
+		unlink(tmp_file_name);
+		goto Exit;
+	}
+	fclose(file);
+
+	if (rename(tmp_file_name, file_name)) {
+		OSM_LOG(&osm->log, OSM_LOG_ERROR, "ERR 570A: "
+			"Cannot rename %s to %s: %s\n", tmp_file_name,
+			file_name, strerror(errno));
+		unlink(tmp_file_name);
+		goto Exit;
+	}
+
+	OSM_LOG(&osm->log, OSM_LOG_VERBOSE,
+		"Wrote snapshot of %u bytes to %s\n", (unsigned)buf.len,
+		file_name);
+	ret = 0;
+
+Exit:
+	free(tmp_file_name);
+	free(buf.data);
+	OSM_LOG_EXIT(&osm->log);
+	return ret;
+}
+
+/**********************************************************************
+ The plock must be held before calling this function.
+**********************************************************************/
+static boolean_t snapshot_match(osm_opensm_t * osm)
+{
+	osm_snapshot_t *p_snap = &osm->snapshot;
+	osm_snapshot_sw_t *s;
+	osm_snapshot_port_t *p;
+	osm_switch_t *p_sw;
+	osm_port_t *p_port;
+	cl_map_item_t *item;
+	uint64_t guid;
+	uint8_t port, i;
+
+	if (p_snap->conf_hash != snapshot_conf_hash(&osm->subn.opt)) {
+		OSM_LOG(&osm->log, OSM_LOG_INFO,
+			"Snapshot was taken with different routing options\n");
+		return FALSE;
+	}
+
+	if (cl_qmap_count(&p_snap->sw_tbl) !=
+	    cl_qmap_count(&osm->subn.sw_guid_tbl) ||
+	    cl_qmap_count(&p_snap->port_tbl) !=
+	    cl_qmap_count(&osm->subn.port_guid_tbl)) {
+		OSM_LOG(&osm->log, OSM_LOG_INFO,
+			"Snapshot has %u switches and %u ports, "
+			"fabric has %u and %u\n",
+			cl_qmap_count(&p_snap->sw_tbl),
+			cl_qmap_count(&p_snap->port_tbl),
+			cl_qmap_count(&osm->subn.sw_guid_tbl),
+			cl_qmap_count(&osm->subn.port_guid_tbl));
+		return FALSE;
+	}
+
+	for (item = cl_qmap_head(&osm->subn.sw_guid_tbl);
+	     item != cl_qmap_end(&osm->subn.sw_guid_tbl);
+	     item = cl_qmap_next(item)) {
+		p_sw = (osm_switch_t *) item;
+		s = (osm_snapshot_sw_t *) cl_qmap_get(&p_snap->sw_tbl,
+						      item->key);
+		if (s == (osm_snapshot_sw_t *) cl_qmap_end(&p_snap->sw_tbl) ||
+		    s->num_ports != p_sw->num_ports)
+			goto sw_changed;
+		for (i = 1; i < p_sw->num_ports; i++) {
+			snapshot_link(osm_node_get_physp_ptr(p_sw->p_node, i),
+				      &guid, &port);
+			if (cl_hton64(guid) != s->remote_guid[i] ||
+			    port != s->remote_port[i])
+				goto sw_changed;
+		}
+	}
+
+	for (item = cl_qmap_head(&osm->subn.port_guid_tbl);
+	     item != cl_qmap_end(&osm->subn.port_guid_tbl);
+	     item = cl_qmap_next(item)) {
+		p_port = (osm_port_t *) item;
+		p = (osm_snapshot_port_t *) cl_qmap_get(&p_snap->port_tbl,
+							item->key);
+		if (p == (osm_snapshot_port_t *) cl_qmap_end(&p_snap->port_tbl)
+		    || p->base_lid != cl_ntoh16(osm_port_get_base_lid(p_port))
+		    || p->lmc != osm_port_get_lmc(p_port)) {
+			OSM_LOG(&osm->log, OSM_LOG_INFO,
+				"Port 0x%016" PRIx64 " is not in the snapshot "
+				"or has a different LID\n",
+				cl_ntoh64(item->key));
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+
+sw_changed:
+	OSM_LOG(&osm->log, OSM_LOG_INFO,
+		"Switch 0x%016" PRIx64 " is not in the snapshot "
+		"or has different links\n", cl_ntoh64(item->key));
+	return FALSE;
+}
+
+boolean_t osm_snapshot_verify(IN osm_opensm_t * osm)
+{
+	osm_snapshot_t *p_snap = &osm->snapshot;
+
+	if (!cl_qmap_count(&p_snap->sw_tbl))
+		return FALSE;
+
+	OSM_LOG_ENTER(&osm->log);
+
+	CL_PLOCK_ACQUIRE(&osm->lock);
+	p_snap->matched = snapshot_match(osm);
+	CL_PLOCK_RELEASE(&osm->lock);
+
+	if (p_snap->matched)
+		OSM_LOG(&osm->log, OSM_LOG_VERBOSE,
+			"Snapshot matches the fabric\n");
+	else {
+		OSM_LOG(&osm->log, OSM_LOG_INFO,
+			"Snapshot does not match the fabric, not used\n");
+		osm_snapshot_destroy(p_snap);
+	}
+
+	OSM_LOG_EXIT(&osm->log);
+	return p_snap->matched;
+}
+
+int osm_snapshot_build_lfts(IN osm_opensm_t * osm,
+			    IN struct osm_routing_engine *r)
+{
+	osm_snapshot_t *p_snap = &osm->snapshot;
+	osm_snapshot_sw_t *s;
+	osm_switch_t *p_sw;
+	osm_port_t *p_port;
+	osm_physp_t *p_physp;
+	cl_map_item_t *item;
+	uint16_t lid, size;
+	uint8_t port;
+
+	if (!p_snap->matched || strcmp(p_snap->routing_engine, r->name) ||
+	    r->update_sl2vl || r->update_vlarb || r->path_sl ||
+	    r->mcast_build_stree || r->ucast_dump_tables)
+		return 1;
+
+	for (item = cl_qmap_head(&osm->subn.sw_guid_tbl);
+	     item != cl_qmap_end(&osm->subn.sw_guid_tbl);
+	     item = cl_qmap_next(item)) {
+		p_sw = (osm_switch_t *) item;
+		s = (osm_snapshot_sw_t *) cl_qmap_get(&p_snap->sw_tbl,
+						      item->key);
+		size = s->lft_size < p_sw->lft_size ?
+		    s->lft_size : p_sw->lft_size;
+		memcpy(p_sw->new_lft, s->lft, size);
+
+		/* keep the port profiles as the routing would */
+		for (lid = 1; lid < size; lid++) {
+			port = p_sw->new_lft[lid];
+			if (port == OSM_NO_PATH)
+				continue;
+			p_port = osm_get_port_by_lid_ho(&osm->subn, lid);
+			p_physp = osm_node_get_physp_ptr(p_sw->p_node, port);
+			if (!p_port || !p_physp || p_physp->is_prof_ignored ||
+			    (!osm->subn.opt.port_profile_switch_nodes &&
+			     osm_node_get_type(p_port->p_node) ==
+			     IB_NODE_TYPE_SWITCH))
+				continue;
+			osm_switch_count_path(p_sw, port);
+		}
+	}
+
+	OSM_LOG(&osm->log, OSM_LOG_INFO,
+		"Using the LFTs of the snapshot instead of computing them "
+		"with \'%s\'\n", r->name);
+
+	return 0;
+}
@@ -189,6 +189,7 @@ static void state_mgr_get_remote_port_info(IN osm_sm_t * sm,
 	mad_context.pi_context.light_sweep = TRUE;
 	mad_context.pi_context.active_transition = FALSE;
 	mad_context.pi_context.client_rereg = FALSE;
+	mad_context.pi_context.next_link_state = IB_LINK_NO_CHANGE;
 
 	/* note that with some negative logic - if the query failed it means
 	 * that there is no point in going to heavy sweep */
@@ -1258,6 +1259,159 @@ int wait_for_pending_transactions(osm_stats_t * stats)
 	return osm_exit_flag;
 }
 
+/**********************************************************************
+ Once the subnet is up, every assigned LID is reachable through the
+ LFTs, so SMPs to it can be sent LID routed.
+**********************************************************************/
+static void state_mgr_mark_lid_routes(IN osm_sm_t * sm)
+{
+	osm_subn_t *p_subn = sm->p_subn;
+	cl_map_item_t *p_next;
+	osm_port_t *p_port;
+	uint16_t lid;
+
+	memset(p_subn->lid_route_ok, 0, sizeof(p_subn->lid_route_ok));
+	if (!p_subn->opt.lid_routed_smps)
+		return;
+
+	CL_PLOCK_ACQUIRE(sm->p_lock);
+	for (p_next = cl_qmap_head(&p_subn->port_guid_tbl);
+	     p_next != cl_qmap_end(&p_subn->port_guid_tbl);
+	     p_next = cl_qmap_next(p_next)) {
+		p_port = (osm_port_t *) p_next;
+		lid = cl_ntoh16(osm_port_get_base_lid(p_port));
+		if (lid && lid <= IB_LID_UCAST_END_HO)
+			p_subn->lid_route_ok[lid] = 1;
+	}
+	CL_PLOCK_RELEASE(sm->p_lock);
+}
+
+static void state_mgr_phase(IN osm_sm_t * sm, IN osm_sweep_phase_t phase)
+{
+	osm_sweep_stats_phase(&sm->p_subn->p_osm->stats, phase);
+}
+
+/**********************************************************************
+ Logs and publishes the statistics of the heavy sweep that just ended.
+**********************************************************************/
+static void state_mgr_sweep_stats_report(IN osm_sm_t * sm,
+					 IN osm_sweep_stats_t * p_sweep)
+{
+	osm_opensm_t *p_osm = sm->p_subn->p_osm;
+
+	if (p_sweep->aborted < OSM_SWEEP_PHASE_MAX)
+		OSM_LOG(sm->p_log, OSM_LOG_VERBOSE,
+			"Heavy sweep %u aborted in phase %s\n",
+			p_sweep->sweep_num,
+			osm_sweep_phase_str(p_sweep->aborted));
+
+	OSM_LOG(sm->p_log, OSM_LOG_VERBOSE,
+		"Heavy sweep %u took %" PRIu64 " usec wall, %" PRIu64
+		" usec CPU, %u SMPs sent, %u received, %u failed\n",
+		p_sweep->sweep_num, p_sweep->total.wall_usec,
+		p_sweep->total.cpu_usec, p_sweep->total.smps_sent,
+		p_sweep->total.smps_rcvd, p_sweep->total.smps_timed_out);
+
+	osm_dump_sweep_stats(p_osm);
+	osm_opensm_report_event(p_osm, OSM_EVENT_ID_SWEEP_STATS, p_sweep);
+}
+
+static void state_mgr_sweep_stats_done(IN osm_sm_t * sm, IN boolean_t errors)
+{
+	osm_sweep_stats_t *p_sweep;
+
+	p_sweep = osm_sweep_stats_end(&sm->p_subn->p_osm->stats, errors);
+	if (p_sweep)
+		state_mgr_sweep_stats_report(sm, p_sweep);
+}
+
+/**********************************************************************
+ Records the phases of a heavy sweep that returned before its end.
+**********************************************************************/
+static void state_mgr_sweep_stats_abort(IN osm_sm_t * sm)
+{
+	osm_sweep_stats_t *p_sweep;
+
+	p_sweep = osm_sweep_stats_abort(&sm->p_subn->p_osm->stats);
+	if (p_sweep)
+		state_mgr_sweep_stats_report(sm, p_sweep);
+}
+
+/**********************************************************************
+ Configures multicast, alias GUIDs and port states one phase at a
+ time, waiting for the whole fabric between the phases.
+**********************************************************************/
+static int state_mgr_config_in_phases(IN osm_sm_t * sm)
+{
+	if (!sm->p_subn->opt.disable_multicast) {
+		state_mgr_phase(sm, OSM_SWEEP_PHASE_MCAST);
+		osm_mcast_mgr_process(sm, TRUE);
+		if (wait_for_pending_transactions(&sm->p_subn->p_osm->stats))
+			return -1;
+		OSM_LOG_MSG_BOX(sm->p_log, OSM_LOG_VERBOSE,
+				"SWITCHES CONFIGURED FOR MULTICAST");
+	}
+
+	state_mgr_phase(sm, OSM_SWEEP_PHASE_GUID);
+	osm_guid_mgr_process(sm);
+	if (wait_for_pending_transactions(&sm->p_subn->p_osm->stats))
+		return -1;
+	OSM_LOG_MSG_BOX(sm->p_log, OSM_LOG_VERBOSE, "ALIAS GUIDS CONFIGURED");
+
+	/*
+	 * The LINK_PORTS state is required since we cannot count on
+	 * the port state change MADs to succeed. This is an artifact
+	 * of the spec defining state change from state X to state X
+	 * as an error. The hardware then is not required to process
+	 * other parameters provided by the Set(PortInfo) Packet.
+	 */
+
+	state_mgr_phase(sm, OSM_SWEEP_PHASE_LINK_MGR);
+	osm_link_mgr_process(sm, IB_LINK_NO_CHANGE);
+	if (wait_for_pending_transactions(&sm->p_subn->p_osm->stats))
+		return -1;
+
+	OSM_LOG_MSG_BOX(sm->p_log, OSM_LOG_VERBOSE,
+			"LINKS PORTS CONFIGURED - SET LINKS TO ARMED STATE");
+
+	osm_link_mgr_process(sm, IB_LINK_ARMED);
+	if (wait_for_pending_transactions(&sm->p_subn->p_osm->stats))
+		return -1;
+
+	OSM_LOG_MSG_BOX(sm->p_log, OSM_LOG_VERBOSE,
+			"LINKS ARMED - SET LINKS TO ACTIVE STATE");
+
+	osm_link_mgr_process(sm, IB_LINK_ACTIVE);
+	return wait_for_pending_transactions(&sm->p_subn->p_osm->stats);
+}
+
+/**********************************************************************
+ Finishes a pipelined sweep once the LFTs are in place. Ports were
+ configured and ARMED while the LFTs were sent; now the multicast
+ tables are sent while every link that is ARMED on both ends goes
+ ACTIVE, each port as soon as its neighbor allows it.
+**********************************************************************/
+static int state_mgr_finish_pipeline(IN osm_sm_t * sm)
+{
+	if (!sm->p_subn->opt.disable_multicast) {
+		state_mgr_phase(sm, OSM_SWEEP_PHASE_MCAST);
+		osm_mcast_mgr_process(sm, TRUE);
+	}
+
+	state_mgr_phase(sm, OSM_SWEEP_PHASE_LINK_MGR);
+	osm_link_mgr_pipeline_activate(sm);
+	if (wait_for_pending_transactions(&sm->p_subn->p_osm->stats))
+		return -1;
+	osm_link_mgr_pipeline_stop(sm);
+
+	OSM_LOG_MSG_BOX(sm->p_log, OSM_LOG_VERBOSE,
+			"MULTICAST, ALIAS GUIDS AND LINKS CONFIGURED");
+
+	/* Ports whose neighbor did not make it to ARMED */
+	osm_link_mgr_process(sm, IB_LINK_ACTIVE);
+	return wait_for_pending_transactions(&sm->p_subn->p_osm->stats);
+}
+
 static void do_sweep(osm_sm_t * sm)
 {
 	ib_api_status_t status;
@@ -1295,6 +1449,10 @@ static void do_sweep(osm_sm_t * sm)
 		 */
 		state_mgr_clean_known_lids(sm);
 
+		/* and nothing is known about the LFTs either */
+		memset(sm->p_subn->lid_route_ok, 0,
+		       sizeof(sm->p_subn->lid_route_ok));
+
 		/*
 		 * Need to clean SA cache when state changes to STANDBY
 		 * after handover.
@@ -1396,6 +1554,7 @@ static void do_sweep(osm_sm_t * sm)
 
 	osm_opensm_report_event(sm->p_subn->p_osm,
 				OSM_EVENT_ID_HEAVY_SWEEP_START, NULL);
+	osm_sweep_stats_start(&sm->p_subn->p_osm->stats);
 
 	/* go to heavy sweep */
 repeat_discovery:
@@ -1420,6 +1579,7 @@ repeat_discovery:
 	if (sm->p_subn->sm_state != IB_SMINFO_STATE_MASTER)
 		sm->p_subn->need_update = 1;
 
+	state_mgr_phase(sm, OSM_SWEEP_PHASE_HOP_0);
 	status = state_mgr_sweep_hop_0(sm);
 	if (status != IB_SUCCESS ||
 	    wait_for_pending_transactions(&sm->p_subn->p_osm->stats))
@@ -1454,6 +1614,7 @@ repeat_discovery:
 		}
 	}
 
+	state_mgr_phase(sm, OSM_SWEEP_PHASE_DISCOVERY);
 	status = state_mgr_sweep_hop_1(sm);
 	if (status != IB_SUCCESS ||
 	    wait_for_pending_transactions(&sm->p_subn->p_osm->stats))
@@ -1487,7 +1648,9 @@ repeat_discovery:
 
 	OSM_LOG_MSG_BOX(sm->p_log, OSM_LOG_VERBOSE, "HEAVY SWEEP COMPLETE");
 
+	state_mgr_phase(sm, OSM_SWEEP_PHASE_DROP_MGR);
 	osm_drop_mgr_process(sm);
+	state_mgr_phase(sm, OSM_SWEEP_PHASE_OTHER);
 
 	/* If we are MASTER - get the highest remote_sm, and
 	 * see if it is higher than our local sm.
@@ -1540,6 +1703,7 @@ repeat_discovery:
 	if (wait_for_pending_transactions(&sm->p_subn->p_osm->stats))
 		return;
 
+	state_mgr_phase(sm, OSM_SWEEP_PHASE_PKEY);
 	osm_pkey_mgr_process(sm->p_subn->p_osm);
 
 	/* try to restore SA DB (this should be before lid_mgr
@@ -1553,6 +1717,7 @@ repeat_discovery:
 	OSM_LOG_MSG_BOX(sm->p_log, OSM_LOG_VERBOSE,
 			"PKEY setup completed - STARTING SM LID CONFIG");
 
+	state_mgr_phase(sm, OSM_SWEEP_PHASE_LID_MGR);
 	osm_lid_mgr_process_sm(&sm->lid_mgr);
 	if (wait_for_pending_transactions(&sm->p_subn->p_osm->stats))
 		return;
@@ -1574,11 +1739,21 @@ repeat_discovery:
 	OSM_LOG_MSG_BOX(sm->p_log, OSM_LOG_VERBOSE,
 			"LID ASSIGNMENT COMPLETE - STARTING SWITCH TABLE CONFIG");
 
+	/*
+	 * After a restart, check whether the snapshot still describes
+	 * the fabric so that its LFTs can be used instead of routing.
+	 */
+	if (sm->p_subn->first_time_master_sweep) {
+		state_mgr_phase(sm, OSM_SWEEP_PHASE_SNAPSHOT);
+		osm_snapshot_verify(sm->p_subn->p_osm);
+	}
+
 	/*
 	 * Proceed with unicast forwarding table configuration; if it fails
 	 * return early to wait for a trap or the next sweep interval.
 	 */
 
+	state_mgr_phase(sm, OSM_SWEEP_PHASE_FWD_TABLES);
 	if (!sm->ucast_mgr.cache_valid ||
 	    osm_ucast_cache_process(&sm->ucast_mgr)) {
 		if (osm_ucast_mgr_process(&sm->ucast_mgr)) {
@@ -1587,8 +1762,19 @@ repeat_discovery:
 		}
 	}
 
+	state_mgr_phase(sm, OSM_SWEEP_PHASE_QOS);
 	osm_qos_setup(sm->p_subn->p_osm);
 
+	/* Alias GUIDs and port configuration do not depend on the LFTs,
+	 * so they can proceed while the tables are being sent. */
+	if (sm->p_subn->opt.pipelined_sweep) {
+		state_mgr_phase(sm, OSM_SWEEP_PHASE_GUID);
+		osm_guid_mgr_process(sm);
+		state_mgr_phase(sm, OSM_SWEEP_PHASE_LINK_MGR);
+		osm_link_mgr_pipeline_start(sm);
+	}
+
+	state_mgr_phase(sm, OSM_SWEEP_PHASE_LFT_PUSH);
 	if (wait_for_pending_transactions(&sm->p_subn->p_osm->stats))
 		return;
 
@@ -1603,44 +1789,13 @@ repeat_discovery:
 				OSM_EVENT_ID_UCAST_ROUTING_DONE,
 				(void *) UCAST_ROUTING_HEAVY_SWEEP);
 
-	if (!sm->p_subn->opt.disable_multicast) {
-		osm_mcast_mgr_process(sm, TRUE);
-		if (wait_for_pending_transactions(&sm->p_subn->p_osm->stats))
+	if (sm->p_subn->opt.pipelined_sweep) {
+		if (state_mgr_finish_pipeline(sm))
 			return;
-		OSM_LOG_MSG_BOX(sm->p_log, OSM_LOG_VERBOSE,
-				"SWITCHES CONFIGURED FOR MULTICAST");
-	}
-
-	osm_guid_mgr_process(sm);
-	if (wait_for_pending_transactions(&sm->p_subn->p_osm->stats))
-		return;
-	OSM_LOG_MSG_BOX(sm->p_log, OSM_LOG_VERBOSE, "ALIAS GUIDS CONFIGURED");
-
-	/*
-	 * The LINK_PORTS state is required since we cannot count on
-	 * the port state change MADs to succeed. This is an artifact
-	 * of the spec defining state change from state X to state X
-	 * as an error. The hardware then is not required to process
-	 * other parameters provided by the Set(PortInfo) Packet.
-	 */
-
-	osm_link_mgr_process(sm, IB_LINK_NO_CHANGE);
-	if (wait_for_pending_transactions(&sm->p_subn->p_osm->stats))
+	} else if (state_mgr_config_in_phases(sm))
 		return;
 
-	OSM_LOG_MSG_BOX(sm->p_log, OSM_LOG_VERBOSE,
-			"LINKS PORTS CONFIGURED - SET LINKS TO ARMED STATE");
-
-	osm_link_mgr_process(sm, IB_LINK_ARMED);
-	if (wait_for_pending_transactions(&sm->p_subn->p_osm->stats))
-		return;
-
-	OSM_LOG_MSG_BOX(sm->p_log, OSM_LOG_VERBOSE,
-			"LINKS ARMED - SET LINKS TO ACTIVE STATE");
-
-	osm_link_mgr_process(sm, IB_LINK_ACTIVE);
-	if (wait_for_pending_transactions(&sm->p_subn->p_osm->stats))
-		return;
+	state_mgr_phase(sm, OSM_SWEEP_PHASE_OTHER);
 
 	/*
 	 * The sweep completed!
@@ -1665,6 +1820,7 @@ repeat_discovery:
 	/* in any case we zero this flag */
 	sm->p_subn->coming_out_of_standby = FALSE;
 	sm->p_subn->first_time_master_sweep = FALSE;
+	osm_snapshot_destroy(&sm->p_subn->p_osm->snapshot);
 
 	/* If there were errors - then the subnet is not really up */
 	if (sm->p_subn->subnet_initialization_error == TRUE) {
@@ -1674,7 +1830,9 @@ repeat_discovery:
 				"ERRORS DURING INITIALIZATION");
 	} else {
 		sm->p_subn->need_update = 0;
+		state_mgr_mark_lid_routes(sm);
 		osm_dump_all(sm->p_subn->p_osm);
+		osm_snapshot_store(sm->p_subn->p_osm);
 		state_mgr_up_msg(sm);
 
 		if ((OSM_LOG_IS_ACTIVE_V2(sm->p_log, OSM_LOG_VERBOSE) ||
@@ -1685,6 +1843,8 @@ repeat_discovery:
 						NULL);
 	}
 
+	state_mgr_sweep_stats_done(sm, sm->p_subn->subnet_initialization_error);
+
 	/*
 	 * Finally signal the subnet up event
 	 */
@@ -1737,8 +1897,11 @@ void osm_state_mgr_process(IN osm_sm_t * sm, IN osm_signal_t signal)
 				"ignoring signal %s in state %s\n",
 				osm_get_sm_signal_str(signal),
 				osm_get_sm_mgr_state_str(sm->p_subn->sm_state));
-		} else
+		} else {
 			do_sweep(sm);
+			/* a heavy sweep that returned early is still timed */
+			state_mgr_sweep_stats_abort(sm);
+		}
 		break;
 	case OSM_SIGNAL_IDLE_TIME_PROCESS_REQUEST:
 		do_process_mgrp_queue(sm);
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2004-2008 Voltaire, Inc. All rights reserved.
+ * Copyright (c) 2002-2005 Mellanox Technologies LTD. All rights reserved.
+ * Copyright (c) 1996-2003 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * Abstract:
+ *    Implementation of the heavy sweep statistics of osm_stats_t.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif				/* HAVE_CONFIG_H */
+
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <complib/cl_timer.h>
+#include <opensm/osm_stats.h>
+
+static const char *sweep_phase_str[] = {
+	"hop0",			/* OSM_SWEEP_PHASE_HOP_0 */
+	"discovery",		/* OSM_SWEEP_PHASE_DISCOVERY */
+	"drop_mgr",		/* OSM_SWEEP_PHASE_DROP_MGR */
+	"pkey",			/* OSM_SWEEP_PHASE_PKEY */
+	"lid_mgr",		/* OSM_SWEEP_PHASE_LID_MGR */
+	"snapshot",		/* OSM_SWEEP_PHASE_SNAPSHOT */
+	"lid_matrices",		/* OSM_SWEEP_PHASE_LID_MATRICES */
+	"fwd_tables",		/* OSM_SWEEP_PHASE_FWD_TABLES */
+	"lft_push",		/* OSM_SWEEP_PHASE_LFT_PUSH */
+	"qos",			/* OSM_SWEEP_PHASE_QOS */
+	"mcast",		/* OSM_SWEEP_PHASE_MCAST */
+	"guid",			/* OSM_SWEEP_PHASE_GUID */
+	"link_mgr",		/* OSM_SWEEP_PHASE_LINK_MGR */
+	"other",		/* OSM_SWEEP_PHASE_OTHER */
+	"UNKNOWN"
+};
+
+const char *osm_sweep_phase_str(IN osm_sweep_phase_t phase)
+{
+	if (phase > OSM_SWEEP_PHASE_MAX)
+		phase = OSM_SWEEP_PHASE_MAX;
+	return sweep_phase_str[phase];
+}
+
+static void sweep_stats_read(IN osm_stats_t * stats,
+			     OUT osm_sweep_phase_stats_t * p_now)
+{
+	struct rusage ru;
+
+	p_now->wall_usec = cl_get_time_stamp();
+	if (getrusage(RUSAGE_SELF, &ru))
+		p_now->cpu_usec = 0;
+	else
+		p_now->cpu_usec =
+		    (uint64_t) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) *
+		    1000000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+	p_now->smps_sent = stats->qp0_mads_sent;
+	p_now->smps_rcvd = stats->qp0_mads_rcvd;
+	p_now->smps_timed_out = stats->qp0_mads_timeout;
+}
+
+static void sweep_stats_add(IN OUT osm_sweep_phase_stats_t * p_sum,
+			    IN const osm_sweep_phase_stats_t * p_from,
+			    IN const osm_sweep_phase_stats_t * p_to)
+{
+	p_sum->wall_usec += p_to->wall_usec - p_from->wall_usec;
+	p_sum->cpu_usec += p_to->cpu_usec - p_from->cpu_usec;
+	p_sum->smps_sent += p_to->smps_sent - p_from->smps_sent;
+	p_sum->smps_rcvd += p_to->smps_rcvd - p_from->smps_rcvd;
+	p_sum->smps_timed_out += p_to->smps_timed_out - p_from->smps_timed_out;
+}
+
+void osm_sweep_stats_start(IN osm_stats_t * stats)
+{
+	memset(&stats->sweep_cur, 0, sizeof(stats->sweep_cur));
+	stats->sweep_cur.sweep_num = stats->sweep_count;
+	stats->sweep_cur.start_time = time(NULL);
+	stats->sweep_cur.aborted = OSM_SWEEP_PHASE_MAX;
+	sweep_stats_read(stats, &stats->sweep_mark);
+	stats->sweep_phase = OSM_SWEEP_PHASE_HOP_0;
+}
+
+void osm_sweep_stats_phase(IN osm_stats_t * stats, IN osm_sweep_phase_t phase)
+{
+	osm_sweep_phase_stats_t now;
+
+	if (stats->sweep_phase >= OSM_SWEEP_PHASE_MAX)
+		return;
+
+	sweep_stats_read(stats, &now);
+	sweep_stats_add(&stats->sweep_cur.phase[stats->sweep_phase],
+			&stats->sweep_mark, &now);
+	stats->sweep_mark = now;
+	stats->sweep_phase = phase;
+}
+
+osm_sweep_stats_t *osm_sweep_stats_end(IN osm_stats_t * stats,
+				       IN boolean_t errors)
+{
+	osm_sweep_stats_t *p_sweep;
+	int i;
+
+	if (stats->sweep_phase >= OSM_SWEEP_PHASE_MAX)
+		return NULL;
+
+	osm_sweep_stats_phase(stats, OSM_SWEEP_PHASE_OTHER);
+	stats->sweep_phase = OSM_SWEEP_PHASE_MAX;
+
+	stats->sweep_cur.errors = errors;
+	for (i = 0; i < OSM_SWEEP_PHASE_MAX; i++) {
+		stats->sweep_cur.total.wall_usec +=
+		    stats->sweep_cur.phase[i].wall_usec;
+		stats->sweep_cur.total.cpu_usec +=
+		    stats->sweep_cur.phase[i].cpu_usec;
+		stats->sweep_cur.total.smps_sent +=
+		    stats->sweep_cur.phase[i].smps_sent;
+		stats->sweep_cur.total.smps_rcvd +=
+		    stats->sweep_cur.phase[i].smps_rcvd;
+		stats->sweep_cur.total.smps_timed_out +=
+		    stats->sweep_cur.phase[i].smps_timed_out;
+	}
+
+	p_sweep = &stats->sweeps[stats->sweep_count % OSM_SWEEP_STATS_HISTORY];
+	*p_sweep = stats->sweep_cur;
+	stats->sweep_count++;
+
+	return p_sweep;
+}
+
+osm_sweep_stats_t *osm_sweep_stats_abort(IN osm_stats_t * stats)
+{
+	if (stats->sweep_phase >= OSM_SWEEP_PHASE_MAX)
+		return NULL;
+
+	stats->sweep_cur.aborted = stats->sweep_phase;
+	return osm_sweep_stats_end(stats, TRUE);
+}
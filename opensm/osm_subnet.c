@@ -188,9 +188,10 @@ static const char *module_name_str[] = {
 	"osm_ucast_dfsssp.c",
 	"osm_congestion_control.c",
 	"osm_ucast_nue.c",
+	"osm_vendor_test.c",
 	/* Add new module names here ... */
 	/* FILE_ID define in those modules must be identical to index here */
-	/* last FILE_ID is currently 90 */
+	/* last FILE_ID is currently 91 */
 };
 
 #define MOD_NAME_STR_UNKNOWN_VAL (ARR_SIZE(module_name_str))
@@ -771,12 +772,16 @@ static const opt_rec_t opt_tbl[] = {
 	{ "sweep_interval", OPT_OFFSET(sweep_interval), opts_parse_uint32, NULL, 1 },
 	{ "max_wire_smps", OPT_OFFSET(max_wire_smps), opts_parse_uint32, NULL, 1 },
 	{ "max_wire_smps2", OPT_OFFSET(max_wire_smps2), opts_parse_uint32, NULL, 1 },
+	{ "max_wire_smps_per_dest", OPT_OFFSET(max_wire_smps_per_dest), opts_parse_uint32, NULL, 0 },
 	{ "max_smps_timeout", OPT_OFFSET(max_smps_timeout), opts_parse_uint32, NULL, 1 },
 	{ "console", OPT_OFFSET(console), opts_parse_charp, NULL, 0 },
 	{ "console_port", OPT_OFFSET(console_port), opts_parse_uint16, NULL, 0 },
 	{ "transaction_timeout", OPT_OFFSET(transaction_timeout), opts_parse_uint32, NULL, 0 },
 	{ "transaction_retries", OPT_OFFSET(transaction_retries), opts_parse_uint32, NULL, 0 },
 	{ "long_transaction_timeout", OPT_OFFSET(long_transaction_timeout), opts_parse_uint32, NULL, 0 },
+	{ "adaptive_transaction_timeout", OPT_OFFSET(adaptive_transaction_timeout), opts_parse_boolean, NULL, 0 },
+	{ "min_transaction_timeout", OPT_OFFSET(min_transaction_timeout), opts_parse_uint32, NULL, 0 },
+	{ "lid_routed_smps", OPT_OFFSET(lid_routed_smps), opts_parse_boolean, NULL, 1 },
 	{ "max_msg_fifo_timeout", OPT_OFFSET(max_msg_fifo_timeout), opts_parse_uint32, NULL, 1 },
 	{ "sm_priority", OPT_OFFSET(sm_priority), opts_parse_uint8, opts_setup_sm_priority, 1 },
 	{ "lmc", OPT_OFFSET(lmc), opts_parse_uint8, NULL, 0 },
@@ -789,6 +794,7 @@ static const opt_rec_t opt_tbl[] = {
 	{ "reassign_lids", OPT_OFFSET(reassign_lids), opts_parse_boolean, NULL, 1 },
 	{ "ignore_other_sm", OPT_OFFSET(ignore_other_sm), opts_parse_boolean, NULL, 1 },
 	{ "single_thread", OPT_OFFSET(single_thread), opts_parse_boolean, NULL, 0 },
+	{ "disp_threads", OPT_OFFSET(disp_threads), opts_parse_uint32, NULL, 0 },
 	{ "disable_multicast", OPT_OFFSET(disable_multicast), opts_parse_boolean, NULL, 1 },
 	{ "subnet_timeout", OPT_OFFSET(subnet_timeout), opts_parse_uint8, NULL, 1 },
 	{ "packet_life_time", OPT_OFFSET(packet_life_time), opts_parse_uint8, NULL, 1 },
@@ -808,10 +814,17 @@ static const opt_rec_t opt_tbl[] = {
 	{ "port_search_ordering_file", OPT_OFFSET(port_search_ordering_file), opts_parse_charp, NULL, 0 },
 	{ "port_profile_switch_nodes", OPT_OFFSET(port_profile_switch_nodes), opts_parse_boolean, NULL, 1 },
 	{ "sweep_on_trap", OPT_OFFSET(sweep_on_trap), opts_parse_boolean, NULL, 1 },
+	{ "pipelined_sweep", OPT_OFFSET(pipelined_sweep), opts_parse_boolean, NULL, 1 },
 	{ "routing_engine", OPT_OFFSET(routing_engine_names), opts_parse_charp, NULL, 0 },
+	{ "routing_threads", OPT_OFFSET(routing_threads), opts_parse_uint32, NULL, 1 },
+	{ "lid_matrix_bfs", OPT_OFFSET(lid_matrix_bfs), opts_parse_boolean, NULL, 1 },
+	{ "dfsssp_batch_size", OPT_OFFSET(dfsssp_batch_size), opts_parse_uint32, NULL, 1 },
+	{ "ftree_batch_size", OPT_OFFSET(ftree_batch_size), opts_parse_uint32, NULL, 1 },
+	{ "ftree_incremental_reroute", OPT_OFFSET(ftree_incremental_reroute), opts_parse_boolean, NULL, 1 },
 	{ "avoid_throttled_links", OPT_OFFSET(avoid_throttled_links), opts_parse_boolean, NULL, 0 },
 	{ "connect_roots", OPT_OFFSET(connect_roots), opts_parse_boolean, NULL, 1 },
 	{ "use_ucast_cache", OPT_OFFSET(use_ucast_cache), opts_parse_boolean, NULL, 0 },
+	{ "snapshot_file", OPT_OFFSET(snapshot_file), opts_parse_charp, NULL, 0 },
 	{ "log_file", OPT_OFFSET(log_file), opts_parse_charp, NULL, 0 },
 	{ "log_max_size", OPT_OFFSET(log_max_size), opts_parse_uint32, opts_setup_log_max_size, 1 },
 	{ "log_flags", OPT_OFFSET(log_flags), opts_parse_uint8, opts_setup_log_flags, 1 },
@@ -920,6 +933,8 @@ static const opt_rec_t opt_tbl[] = {
 	{ "sm_sl", OPT_OFFSET(sm_sl), opts_parse_uint8, NULL, 1 },
 	{ "nue_max_num_vls", OPT_OFFSET(nue_max_num_vls), opts_parse_uint8, NULL, 1 },
 	{ "nue_include_switches", OPT_OFFSET(nue_include_switches), opts_parse_boolean, NULL, 0 },
+	{ "nue_parallel_layers", OPT_OFFSET(nue_parallel_layers), opts_parse_boolean, NULL, 1 },
+	{ "nue_incremental_reroute", OPT_OFFSET(nue_incremental_reroute), opts_parse_boolean, NULL, 1 },
 	{ "log_prefix", OPT_OFFSET(log_prefix), opts_parse_charp, NULL, 1 },
 	{ "per_module_logging_file", OPT_OFFSET(per_module_logging_file), opts_parse_charp, NULL, 0 },
 	{ "quasi_ftree_indexing", OPT_OFFSET(quasi_ftree_indexing), opts_parse_boolean, NULL, 1 },
@@ -1103,6 +1118,7 @@ static void subn_opt_destroy(IN osm_subn_opt_t * p_opt)
 	free(p_opt->part_enforce);
 	free(p_opt->lid_matrix_dump_file);
 	free(p_opt->lfts_file);
+	free(p_opt->snapshot_file);
 	free(p_opt->root_guid_file);
 	free(p_opt->cn_guid_file);
 	free(p_opt->io_guid_file);
@@ -1557,11 +1573,15 @@ void osm_subn_set_default_opt(IN osm_subn_opt_t * p_opt)
 	p_opt->sweep_interval = OSM_DEFAULT_SWEEP_INTERVAL_SECS;
 	p_opt->max_wire_smps = OSM_DEFAULT_SMP_MAX_ON_WIRE;
 	p_opt->max_wire_smps2 = p_opt->max_wire_smps;
+	p_opt->max_wire_smps_per_dest = 0;
 	p_opt->console = strdup(OSM_DEFAULT_CONSOLE);
 	p_opt->console_port = OSM_DEFAULT_CONSOLE_PORT;
 	p_opt->transaction_timeout = OSM_DEFAULT_TRANS_TIMEOUT_MILLISEC;
 	p_opt->transaction_retries = OSM_DEFAULT_RETRY_COUNT;
 	p_opt->long_transaction_timeout = OSM_DEFAULT_LONG_TRANS_TIMEOUT_MILLISEC;
+	p_opt->adaptive_transaction_timeout = FALSE;
+	p_opt->min_transaction_timeout = OSM_DEFAULT_MIN_TRANS_TIMEOUT_MILLISEC;
+	p_opt->lid_routed_smps = FALSE;
 	p_opt->max_smps_timeout = 1000 * p_opt->transaction_timeout *
 				  p_opt->transaction_retries;
 	/* by default we will consider waiting for 50x transaction timeout normal */
@@ -1577,6 +1597,7 @@ void osm_subn_set_default_opt(IN osm_subn_opt_t * p_opt)
 	p_opt->reassign_lids = FALSE;
 	p_opt->ignore_other_sm = FALSE;
 	p_opt->single_thread = FALSE;
+	p_opt->disp_threads = 0;
 	p_opt->disable_multicast = FALSE;
 	p_opt->force_log_flush = FALSE;
 	p_opt->subnet_timeout = OSM_DEFAULT_SUBNET_TIMEOUT;
@@ -1645,7 +1666,14 @@ void osm_subn_set_default_opt(IN osm_subn_opt_t * p_opt)
 	p_opt->port_search_ordering_file = NULL;
 	p_opt->port_profile_switch_nodes = FALSE;
 	p_opt->sweep_on_trap = TRUE;
+	p_opt->pipelined_sweep = FALSE;
+	p_opt->routing_threads = 0;
+	p_opt->lid_matrix_bfs = FALSE;
+	p_opt->dfsssp_batch_size = 1;
+	p_opt->ftree_batch_size = 1;
+	p_opt->ftree_incremental_reroute = FALSE;
 	p_opt->use_ucast_cache = FALSE;
+	p_opt->snapshot_file = NULL;
 	p_opt->routing_engine_names = NULL;
 	p_opt->avoid_throttled_links = FALSE;
 	p_opt->connect_roots = FALSE;
@@ -1676,6 +1704,8 @@ void osm_subn_set_default_opt(IN osm_subn_opt_t * p_opt)
 	p_opt->sm_sl = OSM_DEFAULT_SL;
 	p_opt->nue_max_num_vls = 1;
 	p_opt->nue_include_switches = FALSE;
+	p_opt->nue_parallel_layers = FALSE;
+	p_opt->nue_incremental_reroute = FALSE;
 	p_opt->log_prefix = NULL;
 	p_opt->per_module_logging_file = strdup(OSM_DEFAULT_PER_MOD_LOGGING_CONF_FILE);
 	subn_init_qos_options(&p_opt->qos_options, NULL);
@@ -2110,6 +2140,13 @@ int osm_subn_verify_config(IN osm_subn_opt_t * p_opts)
 		p_opts->long_transaction_timeout = p_opts->transaction_timeout;
 	}
 
+	if (p_opts->min_transaction_timeout > p_opts->transaction_timeout) {
+		log_report(" Invalid Cached Option Value: min_transaction_timeout = %u,"
+			   " Using transaction_timeout: %u",
+			   p_opts->min_transaction_timeout, p_opts->transaction_timeout);
+		p_opts->min_transaction_timeout = p_opts->transaction_timeout;
+	}
+
 	if (strcmp(p_opts->console, OSM_DISABLE_CONSOLE)
 	    && strcmp(p_opts->console, OSM_LOCAL_CONSOLE)
 #ifdef ENABLE_OSM_CONSOLE_LOOPBACK
@@ -2551,11 +2588,16 @@ void osm_subn_output_conf(FILE *out, IN osm_subn_opt_t * p_opts)
 		"force_heavy_sweep %s\n\n"
 		"# If TRUE every trap 128 and 144 will cause a heavy sweep.\n"
 		"# NOTE: successive identical traps (>10) are suppressed\n"
-		"sweep_on_trap %s\n\n",
+		"sweep_on_trap %s\n\n"
+		"# If TRUE the heavy sweep configures ports as a pipeline\n"
+		"# instead of waiting for the whole fabric between the\n"
+		"# forwarding table, alias GUID and port state stages\n"
+		"pipelined_sweep %s\n\n",
 		p_opts->sweep_interval,
 		p_opts->reassign_lids ? "TRUE" : "FALSE",
 		p_opts->force_heavy_sweep ? "TRUE" : "FALSE",
-		p_opts->sweep_on_trap ? "TRUE" : "FALSE");
+		p_opts->sweep_on_trap ? "TRUE" : "FALSE",
+		p_opts->pipelined_sweep ? "TRUE" : "FALSE");
 
 	fprintf(out,
 		"#\n# ROUTING OPTIONS\n#\n"
@@ -2589,6 +2631,36 @@ void osm_subn_output_conf(FILE *out, IN osm_subn_opt_t * p_opts)
 		"routing_engine %s\n\n", p_opts->routing_engine_names ?
 		p_opts->routing_engine_names : null_str);
 
+	fprintf(out,
+		"# Number of threads the routing engines may use to compute\n"
+		"# the routes (0 uses one thread per CPU)\n"
+		"routing_threads %u\n\n", p_opts->routing_threads);
+
+	fprintf(out,
+		"# Build the min hop tables with one shortest path search per\n"
+		"# switch instead of propagating them between neighbors\n"
+		"lid_matrix_bfs %s\n\n",
+		p_opts->lid_matrix_bfs ? "TRUE" : "FALSE");
+
+	fprintf(out,
+		"# Number of destinations the dfsssp and sssp routing engines\n"
+		"# route in parallel against the same link weights (larger is\n"
+		"# faster but balances the routes less evenly)\n"
+		"dfsssp_batch_size %u\n\n", p_opts->dfsssp_batch_size);
+
+	fprintf(out,
+		"# Number of destinations the ftree routing engine routes in\n"
+		"# parallel against the same port load counters (larger is\n"
+		"# faster but balances the routes less evenly)\n"
+		"ftree_batch_size %u\n\n", p_opts->ftree_batch_size);
+
+	fprintf(out,
+		"# If TRUE, then the ftree routing engine only reroutes the\n"
+		"# destinations whose routes used a failed switch-to-switch\n"
+		"# link, as long as nothing else changed since the last routing\n"
+		"ftree_incremental_reroute %s\n\n",
+		p_opts->ftree_incremental_reroute ? "TRUE" : "FALSE");
+
 	fprintf(out,
 		"# Routing engines will avoid throttled switch-to-switch links\n"
 		"# (supported by: nue, dfsssp, sssp; use FALSE if unsure)\n"
@@ -2605,6 +2677,13 @@ void osm_subn_output_conf(FILE *out, IN osm_subn_opt_t * p_opts)
 		"use_ucast_cache %s\n\n",
 		p_opts->use_ucast_cache ? "TRUE" : "FALSE");
 
+	fprintf(out,
+		"# Fabric snapshot file, written after every heavy sweep and\n"
+		"# used to avoid recomputing the LFTs after a restart if\n"
+		"# the fabric did not change\n"
+		"snapshot_file %s\n\n", p_opts->snapshot_file ?
+		p_opts->snapshot_file : null_str);
+
 	fprintf(out,
 		"# Lid matrix dump file name\n"
 		"lid_matrix_dump_file %s\n\n", p_opts->lid_matrix_dump_file ?
@@ -2682,6 +2761,20 @@ void osm_subn_output_conf(FILE *out, IN osm_subn_opt_t * p_opts)
 		"nue_include_switches %s\n\n",
 		p_opts->nue_include_switches ? "TRUE" : "FALSE");
 
+	fprintf(out,
+		"# If TRUE, then Nue routes its virtual layers concurrently on\n"
+		"# routing_threads; every layer is balanced against the link\n"
+		"# weights all layers start from\n"
+		"nue_parallel_layers %s\n\n",
+		p_opts->nue_parallel_layers ? "TRUE" : "FALSE");
+
+	fprintf(out,
+		"# If TRUE, then Nue only reroutes the destinations whose\n"
+		"# routes used a failed switch-to-switch link, as long as\n"
+		"# nothing else changed since the last routing\n"
+		"nue_incremental_reroute %s\n\n",
+		p_opts->nue_incremental_reroute ? "TRUE" : "FALSE");
+
 	fprintf(out,
 		"# Port Shifting (use FALSE if unsure)\n"
 		"port_shifting %s\n\n",
@@ -2743,6 +2836,10 @@ void osm_subn_output_conf(FILE *out, IN osm_subn_opt_t * p_opts)
 		"# The timeout in [usec] used for sending SMPs above max_wire_smps limit\n"
 		"# and below max_wire_smps2 limit\n"
 		"max_smps_timeout %u\n\n"
+		"# Maximum number of SMPs sent in parallel to a single destination\n"
+		"# (DR path or LID), so that slow nodes do not hold all of\n"
+		"# max_wire_smps (0 means no per destination limit)\n"
+		"max_wire_smps_per_dest %u\n\n"
 		"# The maximum time in [msec] allowed for a transaction to complete\n"
 		"transaction_timeout %u\n\n"
 		"# The maximum number of retries allowed for a transaction to complete\n"
@@ -2750,21 +2847,40 @@ void osm_subn_output_conf(FILE *out, IN osm_subn_opt_t * p_opts)
 		"# The maximum time in [msec] allowed for a \"long\" transacrion to complete\n"
 		"# Currently, long transaction is only set of optimized SL2VLMappingTable\n"
 		"long_transaction_timeout %u\n\n"
+		"# Derive the timeout of each SMP from the round trip times\n"
+		"# measured per destination and per hop count, between\n"
+		"# min_transaction_timeout and transaction_timeout\n"
+		"adaptive_transaction_timeout %s\n\n"
+		"# The minimal time in [msec] an adaptive SMP timeout can get\n"
+		"# It should exceed the time the slowest switch takes to answer\n"
+		"# the SMPs queued to it\n"
+		"min_transaction_timeout %u\n\n"
+		"# Send SMPs to nodes reachable through the LFTs LID routed\n"
+		"# instead of directed route once the subnet is up\n"
+		"lid_routed_smps %s\n\n"
 		"# Maximal time in [msec] a message can stay in the incoming message queue.\n"
 		"# If there is more than one message in the queue and the last message\n"
 		"# stayed in the queue more than this value, any SA request will be\n"
 		"# immediately be dropped but BUSY status is not currently returned.\n"
 		"max_msg_fifo_timeout %u\n\n"
 		"# Use a single thread for handling SA queries\n"
-		"single_thread %s\n\n",
+		"single_thread %s\n\n"
+		"# Number of dispatcher threads handling received SMPs\n"
+		"# and SA queries (0 means one thread per CPU)\n"
+		"disp_threads %u\n\n",
 		p_opts->max_wire_smps,
 		p_opts->max_wire_smps2,
 		p_opts->max_smps_timeout,
+		p_opts->max_wire_smps_per_dest,
 		p_opts->transaction_timeout,
 		p_opts->transaction_retries,
 		p_opts->long_transaction_timeout,
+		p_opts->adaptive_transaction_timeout ? "TRUE" : "FALSE",
+		p_opts->min_transaction_timeout,
+		p_opts->lid_routed_smps ? "TRUE" : "FALSE",
 		p_opts->max_msg_fifo_timeout,
-		p_opts->single_thread ? "TRUE" : "FALSE");
+		p_opts->single_thread ? "TRUE" : "FALSE",
+		p_opts->disp_threads);
 
 	fprintf(out,
 		"#\n# MISC OPTIONS\n#\n"
@@ -64,20 +64,18 @@ struct switch_port_path {
 cl_status_t osm_switch_set_hops(IN osm_switch_t * p_sw, IN uint16_t lid_ho,
 				IN uint8_t port_num, IN uint8_t num_hops)
 {
+	uint16_t row;
+
 	if (!lid_ho || lid_ho > p_sw->max_lid_ho)
 		return -1;
 	if (port_num >= p_sw->num_ports)
 		return -1;
-	if (!p_sw->hops[lid_ho]) {
-		p_sw->hops[lid_ho] = malloc(p_sw->num_ports);
-		if (!p_sw->hops[lid_ho])
-			return -1;
-		memset(p_sw->hops[lid_ho], OSM_NO_PATH, p_sw->num_ports);
-	}
+	if ((row = p_sw->hop_rows[lid_ho]) == OSM_NO_HOP_ROW)
+		return 0;
 
-	p_sw->hops[lid_ho][port_num] = num_hops;
-	if (p_sw->hops[lid_ho][0] > num_hops)
-		p_sw->hops[lid_ho][0] = num_hops;
+	p_sw->hops[port_num * p_sw->num_hops + row] = num_hops;
+	if (p_sw->hops[row] > num_hops)
+		p_sw->hops[row] = num_hops;
 
 	return 0;
 }
@@ -85,7 +83,6 @@ cl_status_t osm_switch_set_hops(IN osm_switch_t * p_sw, IN uint16_t lid_ho,
 void osm_switch_delete(IN OUT osm_switch_t ** pp_sw)
 {
 	osm_switch_t *p_sw = *pp_sw;
-	unsigned i;
 
 	osm_mcast_tbl_destroy(&p_sw->mcast_tbl);
 	if (p_sw->p_prof)
@@ -96,12 +93,8 @@ void osm_switch_delete(IN OUT osm_switch_t ** pp_sw)
 		free(p_sw->lft);
 	if (p_sw->new_lft)
 		free(p_sw->new_lft);
-	if (p_sw->hops) {
-		for (i = 0; i < p_sw->num_hops; i++)
-			if (p_sw->hops[i])
-				free(p_sw->hops[i]);
+	if (p_sw->hops)
 		free(p_sw->hops);
-	}
 	free(*pp_sw);
 	*pp_sw = NULL;
 }
@@ -594,11 +587,9 @@ uint8_t osm_switch_recommend_path(IN const osm_switch_t * p_sw,
 
 void osm_switch_clear_hops(IN osm_switch_t * p_sw)
 {
-	unsigned i;
-
-	for (i = 0; i < p_sw->num_hops; i++)
-		if (p_sw->hops[i])
-			memset(p_sw->hops[i], OSM_NO_PATH, p_sw->num_ports);
+	if (p_sw->hops)
+		memset(p_sw->hops, OSM_NO_PATH,
+		       p_sw->num_hops * p_sw->num_ports);
 }
 
 static int alloc_lft(IN osm_switch_t * p_sw, uint16_t lids)
@@ -620,9 +611,11 @@ static int alloc_lft(IN osm_switch_t * p_sw, uint16_t lids)
 	return 0;
 }
 
-int osm_switch_prepare_path_rebuild(IN osm_switch_t * p_sw, IN uint16_t max_lids)
+int osm_switch_prepare_path_rebuild(IN osm_switch_t * p_sw, IN uint16_t max_lids,
+				    IN const uint16_t * hop_rows,
+				    IN uint16_t num_hop_rows)
 {
-	uint8_t **hops;
+	uint8_t *hops;
 	uint8_t *new_lft;
 	unsigned i;
 
@@ -632,8 +625,6 @@ int osm_switch_prepare_path_rebuild(IN osm_switch_t * p_sw, IN uint16_t max_lids
 	for (i = 0; i < p_sw->num_ports; i++)
 		osm_port_prof_construct(&p_sw->p_prof[i]);
 
-	osm_switch_clear_hops(p_sw);
-
 	if (!(new_lft = realloc(p_sw->new_lft, p_sw->lft_size)))
 		return -1;
 
@@ -641,22 +632,16 @@ int osm_switch_prepare_path_rebuild(IN osm_switch_t * p_sw, IN uint16_t max_lids
 
 	memset(p_sw->new_lft, OSM_NO_PATH, p_sw->lft_size);
 
-	if (!p_sw->hops) {
-		hops = malloc((max_lids + 1) * sizeof(hops[0]));
+	if (num_hop_rows > p_sw->num_hops) {
+		hops = realloc(p_sw->hops, num_hop_rows * p_sw->num_ports);
 		if (!hops)
 			return -1;
-		memset(hops, 0, (max_lids + 1) * sizeof(hops[0]));
 		p_sw->hops = hops;
-		p_sw->num_hops = max_lids + 1;
-	} else if (max_lids + 1 > p_sw->num_hops) {
-		hops = realloc(p_sw->hops, (max_lids + 1) * sizeof(hops[0]));
-		if (!hops)
-			return -1;
-		memset(hops + p_sw->num_hops, 0,
-		       (max_lids + 1 - p_sw->num_hops) * sizeof(hops[0]));
-		p_sw->hops = hops;
-		p_sw->num_hops = max_lids + 1;
+		p_sw->num_hops = num_hop_rows;
 	}
+	osm_switch_clear_hops(p_sw);
+
+	p_sw->hop_rows = hop_rows;
 	p_sw->max_lid_ho = max_lids;
 
 	return 0;
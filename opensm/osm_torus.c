@@ -54,6 +54,7 @@
 #include <opensm/osm_switch.h>
 #include <opensm/osm_node.h>
 #include <opensm/osm_opensm.h>
+#include <opensm/osm_parallel.h>
 
 #define TORUS_MAX_DIM        3
 #define PORTGRP_MAX_PORTS    16
@@ -9160,17 +9161,46 @@ out:
 	return success;
 }
 
+struct route_torus_work {
+	struct torus *t;
+	bool stree_ok;
+	bool lft_failed;	/* written by all threads, only ever set */
+};
+
+/*
+ * Work item 0 builds the master spanning tree, the others the LFT of a
+ * switch.  torus_lft() only writes the LFT and the port group counters of
+ * its own switch, and the spanning tree only the to_stree_* links of the
+ * port groups, which torus_lft() does not look at, so they are all
+ * independent of each other.
+ */
+static
+void route_torus_item(void *context, unsigned index, unsigned thread)
+{
+	struct route_torus_work *w = context;
+
+	if (!index)
+		w->stree_ok = torus_master_stree(w->t);
+	else if (!torus_lft(w->t, w->t->sw_pool[index - 1]))
+		w->lft_failed = true;
+}
+
 int route_torus(struct torus *t)
 {
-	int s;
-	bool success = true;
+	struct route_torus_work w;
+	unsigned num_threads;
 
-	for (s = 0; s < (int)t->switch_cnt; s++)
-		success = torus_lft(t, t->sw_pool[s]) && success;
+	w.t = t;
+	w.stree_ok = false;
+	w.lft_failed = false;
 
-	success = success && torus_master_stree(t);
+	num_threads = osm_parallel_threads(t->osm->subn.opt.routing_threads);
+	osm_parallel_for(num_threads, t->switch_cnt + 1, route_torus_item, &w);
+	OSM_LOG(&t->osm->log, OSM_LOG_DEBUG,
+		"LFTs of %u switches built with %u threads\n",
+		(unsigned)t->switch_cnt, num_threads);
 
-	return success ? 0 : -1;
+	return (w.stree_ok && !w.lft_failed) ? 0 : -1;
 }
 
 uint8_t torus_path_sl(void *context, uint8_t path_sl_hint,
@@ -113,7 +113,8 @@ static uint64_t aging_tracker_callback(IN uint64_t key, IN uint32_t num_regs,
 	lid = (ib_net16_t) ((key & 0x0000FFFF00000000ULL) >> 32);
 	port_num = (uint8_t) ((key & 0x00FF000000000000ULL) >> 48);
 
-	CL_PLOCK_ACQUIRE(sm->p_lock);
+	/* the routing only holds the lock shared, see ucast_mgr_route */
+	CL_PLOCK_EXCL_ACQUIRE(sm->p_lock);
 
 	p_physp = get_physp_by_lid_and_num(sm, lid, port_num);
 	if (!p_physp)
@@ -129,6 +130,7 @@ static uint64_t aging_tracker_callback(IN uint64_t key, IN uint32_t num_regs,
 
 		/* Clear its health bit */
 		osm_physp_set_health(p_physp, TRUE);
+		sm->p_subn->topology_gen++;
 	}
 
 	CL_PLOCK_RELEASE(sm->p_lock);
@@ -242,6 +244,7 @@ static int disable_port(osm_sm_t *sm, osm_physp_t *p)
 	context.pi_context.light_sweep = FALSE;
 	context.pi_context.active_transition = FALSE;
 	context.pi_context.client_rereg = FALSE;
+	context.pi_context.next_link_state = IB_LINK_NO_CHANGE;
 	if (osm_node_get_type(p->p_node) == IB_NODE_TYPE_SWITCH &&
 	    osm_physp_get_port_num(p) != 0) {
 		physp0 = osm_node_get_physp_ptr(p->p_node, 0);
@@ -514,9 +517,19 @@ static void trap_rcv_process_request(IN osm_sm_t * sm,
 			 * we mark it as unhealthy.
 			 */
 			if (physp_change_trap == TRUE) {
-				int ret = shutup_noisy_port(sm, source_lid,
-							    port_num,
-							    num_received);
+				int ret;
+
+				/* the port health is an input of the routing */
+				CL_PLOCK_RELEASE(sm->p_lock);
+				CL_PLOCK_EXCL_ACQUIRE(sm->p_lock);
+				sm->p_subn->topology_gen++;
+				ret = shutup_noisy_port(sm, source_lid,
+							port_num, num_received);
+				CL_PLOCK_RELEASE(sm->p_lock);
+				CL_PLOCK_ACQUIRE(sm->p_lock);
+				p_physp = osm_get_physp_by_mad_addr(sm->p_log,
+								    sm->p_subn,
+								    &tmp_madw.mad_addr);
 				if (ret == 1) /* port disabled */
 					goto Exit;
 				else if (ret == 2) /* unhealthy - run sweep */
@@ -72,7 +72,7 @@ typedef struct cache_switch {
 	boolean_t dropped;
 	uint16_t max_lid_ho;
 	uint16_t num_hops;
-	uint8_t **hops;
+	uint8_t *hops;
 	uint8_t *lft;
 	uint8_t num_ports;
 	cache_port_t ports[0];
@@ -114,19 +114,13 @@ static cache_switch_t *cache_sw_new(uint16_t lid_ho, unsigned num_ports)
 
 static void cache_sw_destroy(cache_switch_t * p_sw)
 {
-	unsigned i;
-
 	if (!p_sw)
 		return;
 
 	if (p_sw->lft)
 		free(p_sw->lft);
-	if (p_sw->hops) {
-		for (i = 0; i < p_sw->num_hops; i++)
-			if (p_sw->hops[i])
-				free(p_sw->hops[i]);
+	if (p_sw->hops)
 		free(p_sw->hops);
-	}
 	free(p_sw);
 }
 
@@ -325,12 +319,15 @@ cache_restore_ucast_info(osm_ucast_mgr_t * p_mgr,
 	p_sw->new_lft = p_cache_sw->lft;
 	p_cache_sw->lft = NULL;
 
+	/* the hop rows cannot have changed, the cache is emptied
+	   before every full routing */
 	p_sw->num_hops = p_cache_sw->num_hops;
 	p_cache_sw->num_hops = 0;
 	if (p_sw->hops)
 		free(p_sw->hops);
 	p_sw->hops = p_cache_sw->hops;
 	p_cache_sw->hops = NULL;
+	p_sw->hop_rows = p_mgr->hop_rows;
 
 	p_sw->need_update = 2;
 }
@@ -49,6 +49,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <complib/cl_heap.h>
+#include <complib/cl_qmap.h>
 #include <opensm/osm_file_ids.h>
 #define FILE_ID OSM_FILE_UCAST_DFSSSP_C
 #include <opensm/osm_ucast_mgr.h>
@@ -56,10 +57,14 @@
 #include <opensm/osm_node.h>
 #include <opensm/osm_multicast.h>
 #include <opensm/osm_mcast_mgr.h>
+#include <opensm/osm_parallel.h>
 
 /* "infinity" for dijkstra */
 #define INF      0x7FFFFFFF
 
+/* no channel of the cdg */
+#define CDG_NONE 0xFFFFFFFF
+
 enum {
 	UNDISCOVERED = 0,
 	DISCOVERED
@@ -99,38 +104,89 @@ typedef struct vertex {
 	boolean_t dropped;	/* indicate dropped switches (w/ ucast cache) */
 } vertex_t;
 
+/* Apart from the link to its switch, the path from a source port to a
+   destination is the same for all source ports behind the same switch,
+   and so is in general the virtual lane.  The lane assignment is
+   therefore stored per source class (the switch a source is attached
+   to, or the source itself if it is a switch) and destination lid.  An entry of VLTABLE_SPLIT means the sources
+   of the class do not all use the same lane; their lanes are then
+   stored separately in split_tbl.  Paths between the lids of the same
+   port are never assigned a lane and always use OSM_DEFAULT_SL.
+*/
+#define VLTABLE_SPLIT		0xFF
+#define VLTABLE_NO_INDEX	0xFFFFFFFF
+
+typedef struct vltable_split {
+	cl_map_item_t map_item;	/* key: class * num_lids + dest lid index */
+	uint8_t vls[0];		/* lane of each source lid of the class */
+} vltable_split_t;
+
 typedef struct vltable {
 	uint64_t num_lids;	/* size of the lids array */
 	uint16_t *lids;		/* sorted array of all lids in the subnet */
-	uint8_t *vls;		/* matrix form assignment lid X lid -> virtual lane */
+	uint16_t max_lid_ho;	/* largest lid in lids */
+	uint32_t *lid_index;	/* index of each lid (host order) in lids */
+	uint32_t *port;		/* port number of each lid index */
+	uint32_t *port_size;	/* number of lids of each port */
+	uint32_t *src_class;	/* class of each lid index as source */
+	uint32_t *src_rank;	/* position of each lid index in its class */
+	uint32_t *class_start;	/* first entry of each class in class_lids */
+	uint32_t *class_lids;	/* lid indexes of the classes, ascending */
+	uint32_t num_classes;
+	uint8_t *vls;		/* matrix form assignment class X lid -> virtual lane */
+	cl_qmap_t split_tbl;	/* vltable_split_t of the split entries */
+	uint64_t split_size;	/* memory used by split_tbl */
 } vltable_t;
 
+/* edge of the cdg, i.e. the dependency of a channel on the next channel */
 typedef struct cdg_link {
-	struct cdg_node *node;
+	uint32_t node;		/* channel index of the adjazent node */
 	uint32_t num_pairs;	/* number of src->dest pairs incremented in path adding step */
 	uint32_t max_len;	/* length of the srcdest array */
 	uint32_t removed;	/* number of pairs removed in path deletion step */
 	uint32_t *srcdest_pairs;
-	struct cdg_link *next;
 } cdg_link_t;
 
-/* struct for a node of a binary tree with additional parent pointer */
+/* node of the cdg, i.e. a channel from a switch port to another switch */
 typedef struct cdg_node {
-	uint64_t channelID;	/* unique key consist of src lid + port + dest lid + port */
-	cdg_link_t *linklist;	/* edges to adjazent nodes */
+	uint32_t pre;		/* to save the path in cycle detection algorithm */
+	uint16_t num_links;	/* number of edges to adjazent nodes */
 	uint8_t status;		/* node status in cycle search to avoid recursive function */
-	uint8_t visited;	/* needed to traverse the binary tree */
-	struct cdg_node *pre;	/* to save the path in cycle detection algorithm */
-	struct cdg_node *left, *right, *parent;
+	uint8_t added;		/* channel is part of the cdg */
 } cdg_node_t;
 
+/* channel indexes of the fabric, shared by the cdgs of all VLs;
+   channel <switch, port> is first_channel[base lid of switch] + port,
+   and edges can only lead to the ports of the switch behind the channel,
+   so the edges of each channel get a fixed range of link_start (CSR)
+*/
+typedef struct cdg_index {
+	uint32_t *first_channel;	/* first channel of each switch, by base lid */
+	uint32_t *link_start;	/* first edge of each channel, num_channels + 1 */
+	uint32_t num_channels;
+	uint16_t max_lid;
+} cdg_index_t;
+
+typedef struct cdg {
+	const cdg_index_t *index;
+	cdg_node_t *nodes;	/* indexed by channel */
+	cdg_link_t *links;	/* edges of all nodes, see cdg_index_t */
+	uint32_t *order;	/* channels in the order they were added */
+	uint32_t num_nodes;
+} cdg_t;
+
 typedef struct dfsssp_context {
 	osm_routing_engine_type_t routing_type;
 	osm_ucast_mgr_t *p_mgr;
 	vertex_t *adj_list;
 	uint32_t adj_list_size;
+	uint64_t link_weight;	/* initial weight of the links between switches */
 	vltable_t *srcdest2vl_table;
 	uint8_t *vl_split_count;
+	/* the tables of the last published routing, get_dfsssp_sl answers
+	   from them while the next routing is built */
+	vltable_t *path_sl_table;
+	uint8_t *path_sl_split_count;
 } dfsssp_context_t;
 
 /**************** set initial values for structs **********************
@@ -161,18 +217,6 @@ static inline void set_default_vertex(vertex_t * vertex)
 	vertex->dropped = FALSE;
 }
 
-static inline void set_default_cdg_node(cdg_node_t * node)
-{
-	node->channelID = 0;
-	node->linklist = NULL;
-	node->status = UNKNOWN;
-	node->visited = 0;
-	node->pre = NULL;
-	node->left = NULL;
-	node->right = NULL;
-	node->parent = NULL;
-}
-
 /**********************************************************************
  **********************************************************************/
 
@@ -197,20 +241,140 @@ static inline void vltable_sort_lids(vltable_t * vltable)
 	qsort(vltable->lids, vltable->num_lids, sizeof(ib_net16_t), cmp_lids);
 }
 
-/* use stdlib to get index of key in lid array;
+/* get index of key in lid array;
    return -1 if lid isn't found in lids array
 */
 static inline int64_t vltable_get_lidindex(ib_net16_t * key, vltable_t * vltable)
 {
-	ib_net16_t *found_lid = NULL;
+	uint16_t lid_ho = cl_ntoh16(*key);
 
-	found_lid =
-	    (ib_net16_t *) bsearch(key, vltable->lids, vltable->num_lids,
-				   sizeof(ib_net16_t), cmp_lids);
-	if (found_lid)
-		return found_lid - vltable->lids;
-	else
+	if (lid_ho > vltable->max_lid_ho ||
+	    vltable->lid_index[lid_ho] == VLTABLE_NO_INDEX)
 		return -1;
+	return vltable->lid_index[lid_ho];
+}
+
+static inline uint32_t vltable_class_size(vltable_t * vltable,
+					  uint32_t class)
+{
+	return vltable->class_start[class + 1] - vltable->class_start[class];
+}
+
+static inline uint64_t vltable_split_key(vltable_t * vltable,
+					 uint64_t class, uint64_t ind2)
+{
+	return class * vltable->num_lids + ind2;
+}
+
+/* get the virtual lane of the lid index pair ind1 -> ind2 */
+static uint8_t vltable_get_by_index(vltable_t * vltable, uint64_t ind1,
+				    uint64_t ind2)
+{
+	uint32_t class = vltable->src_class[ind1];
+	uint8_t vl = vltable->vls[class * vltable->num_lids + ind2];
+	cl_map_item_t *item;
+
+	if (vltable->port[ind1] == vltable->port[ind2])
+		return OSM_DEFAULT_SL;
+	if (vl != VLTABLE_SPLIT)
+		return vl;
+
+	item = cl_qmap_get(&vltable->split_tbl,
+			   vltable_split_key(vltable, class, ind2));
+	return ((vltable_split_t *) item)->vls[vltable->src_rank[ind1]];
+}
+
+/* give each source lid of a class its own entry for lid index ind2;
+   return NULL if out of memory
+*/
+static vltable_split_t *vltable_split(vltable_t * vltable, uint32_t class,
+				      uint64_t ind2)
+{
+	uint8_t *vl = &vltable->vls[class * vltable->num_lids + ind2];
+	uint32_t size = vltable_class_size(vltable, class);
+	vltable_split_t *split;
+
+	if (*vl == VLTABLE_SPLIT)
+		return (vltable_split_t *)
+		    cl_qmap_get(&vltable->split_tbl,
+				vltable_split_key(vltable, class, ind2));
+
+	split = (vltable_split_t *) malloc(sizeof(vltable_split_t) + size);
+	if (!split)
+		return NULL;
+	memset(split->vls, *vl, size);
+	cl_qmap_insert(&vltable->split_tbl,
+		       vltable_split_key(vltable, class, ind2),
+		       &split->map_item);
+	vltable->split_size += sizeof(vltable_split_t) + size;
+	*vl = VLTABLE_SPLIT;
+
+	return split;
+}
+
+/* turn a split entry back into a single one if the source lids of the
+   class use the same lane again
+*/
+static void vltable_merge(vltable_t * vltable, uint32_t class, uint64_t ind2,
+			  vltable_split_t * split)
+{
+	uint32_t *lids = &vltable->class_lids[vltable->class_start[class]];
+	uint32_t i, size = vltable_class_size(vltable, class);
+	int vl = -1;
+
+	for (i = 0; i < size; i++) {
+		if (vltable->port[lids[i]] == vltable->port[ind2])
+			continue;
+		if (vl < 0)
+			vl = split->vls[i];
+		else if (vl != split->vls[i])
+			return;
+	}
+
+	vltable->vls[class * vltable->num_lids + ind2] =
+	    vl < 0 ? OSM_DEFAULT_SL : vl;
+	cl_qmap_remove_item(&vltable->split_tbl, &split->map_item);
+	vltable->split_size -= sizeof(vltable_split_t) + size;
+	free(split);
+}
+
+/* number of source lids of a class which have a lane for lid index ind2;
+   all lids of a port are in the same class
+*/
+static uint32_t vltable_class_pairs(vltable_t * vltable, uint32_t class,
+				    uint64_t ind2)
+{
+	uint32_t size = vltable_class_size(vltable, class);
+
+	if (vltable->src_class[ind2] == class)
+		size -= vltable->port_size[vltable->port[ind2]];
+	return size;
+}
+
+/* set the virtual lane of the lid index pair ind1 -> ind2;
+   return 1 if out of memory
+*/
+static int vltable_set_by_index(vltable_t * vltable, uint64_t ind1,
+				uint64_t ind2, uint8_t vl)
+{
+	uint32_t class = vltable->src_class[ind1];
+	uint8_t *entry = &vltable->vls[class * vltable->num_lids + ind2];
+	vltable_split_t *split;
+
+	if (*entry == vl || vltable->port[ind1] == vltable->port[ind2])
+		return 0;
+	if (*entry != VLTABLE_SPLIT &&
+	    vltable_class_pairs(vltable, class, ind2) == 1) {
+		*entry = vl;
+		return 0;
+	}
+
+	split = vltable_split(vltable, class, ind2);
+	if (!split)
+		return 1;
+	split->vls[vltable->src_rank[ind1]] = vl;
+	vltable_merge(vltable, class, ind2, split);
+	return 0;
 }
 
 /* get virtual lane from src lid X dest lid combination;
@@ -222,50 +386,108 @@ static int32_t vltable_get_vl(vltable_t * vltable, ib_net16_t slid, ib_net16_t d
 	int64_t ind2 = vltable_get_lidindex(&dlid, vltable);
 
 	if (ind1 > -1 && ind2 > -1)
-		return (int32_t) (vltable->
-				  vls[ind1 + ind2 * vltable->num_lids]);
+		return (int32_t) vltable_get_by_index(vltable, ind1, ind2);
 	else
 		return -1;
 }
 
-/* set a virtual lane in the matrix */
-static inline void vltable_insert(vltable_t * vltable, ib_net16_t slid,
-				  ib_net16_t dlid, uint8_t vl)
+/* set a virtual lane in the matrix;
+   return 1 if out of memory
+*/
+static inline int vltable_insert(vltable_t * vltable, ib_net16_t slid,
+				 ib_net16_t dlid, uint8_t vl)
 {
 	int64_t ind1 = vltable_get_lidindex(&slid, vltable);
 	int64_t ind2 = vltable_get_lidindex(&dlid, vltable);
 
 	if (ind1 > -1 && ind2 > -1)
-		vltable->vls[ind1 + ind2 * vltable->num_lids] = vl;
+		return vltable_set_by_index(vltable, ind1, ind2, vl);
+	return 0;
 }
 
-/* change a number of lanes from lane xy to lane yz */
-static void vltable_change_vl(vltable_t * vltable, uint8_t from, uint8_t to,
-			      uint64_t count)
+/* change a number of lanes from lane xy to lane yz;
+   the first count src/dest pairs on lane xy, ordered by src and then
+   dest lid index, are changed;
+   return 1 if out of memory
+*/
+static int vltable_change_vl(vltable_t * vltable, uint8_t from, uint8_t to,
+			     uint64_t count)
 {
-	uint64_t set = 0, stop = 0;
-	uint64_t ind1 = 0, ind2 = 0;
-
-	for (ind1 = 0; ind1 < vltable->num_lids; ind1++) {
-		for (ind2 = 0; ind2 < vltable->num_lids; ind2++) {
-			if (set == count) {
-				stop = 1;
-				break;
-			}
-			if (ind1 != ind2) {
-				if (vltable->
-				    vls[ind1 + ind2 * vltable->num_lids] ==
-				    from) {
-					vltable->vls[ind1 +
-						     ind2 * vltable->num_lids] =
-					    to;
+	uint64_t set = 0, total = 0;
+	uint64_t ind1 = 0, ind2 = 0, last1, last2;
+	uint64_t num_lids = vltable->num_lids;
+	uint32_t class, i, n, size, *lids;
+	uint8_t *entry;
+	vltable_split_t *split;
+	cl_map_item_t *item;
+
+	/* count the pairs on lane xy */
+	for (class = 0; class < vltable->num_classes; class++)
+		for (ind2 = 0; ind2 < num_lids; ind2++)
+			if (vltable->vls[class * num_lids + ind2] == from)
+				total += vltable_class_pairs(vltable, class,
+							     ind2);
+	for (item = cl_qmap_head(&vltable->split_tbl);
+	     item != cl_qmap_end(&vltable->split_tbl);
+	     item = cl_qmap_next(item)) {
+		class = cl_qmap_key(item) / num_lids;
+		ind2 = cl_qmap_key(item) % num_lids;
+		lids = &vltable->class_lids[vltable->class_start[class]];
+		for (i = 0; i < vltable_class_size(vltable, class); i++)
+			total += ((vltable_split_t *) item)->vls[i] == from &&
+			    vltable->port[lids[i]] != vltable->port[ind2];
+	}
+
+	/* find the last pair to change if not all of them are */
+	last1 = last2 = num_lids;
+	if (count < total) {
+		if (!count)
+			return 0;
+		for (ind1 = 0; ind1 < num_lids && set < count; ind1++)
+			for (ind2 = 0; ind2 < num_lids && set < count; ind2++)
+				if (vltable->port[ind1] != vltable->port[ind2]
+				    && vltable_get_by_index(vltable, ind1,
+							    ind2) == from) {
+					last1 = ind1;
+					last2 = ind2;
 					set++;
 				}
-			}
+	}
+
+#define VLTABLE_CHANGES(i1, i2) (vltable->port[i1] != vltable->port[i2] && \
+	((i1) < last1 || ((i1) == last1 && (i2) <= last2)))
+
+	for (class = 0; class < vltable->num_classes; class++) {
+		lids = &vltable->class_lids[vltable->class_start[class]];
+		size = vltable_class_size(vltable, class);
+
+		for (ind2 = 0; ind2 < num_lids; ind2++) {
+			entry = &vltable->vls[class * num_lids + ind2];
+			if (*entry == from) {
+				for (i = 0, n = 0; i < size; i++)
+					n += VLTABLE_CHANGES(lids[i], ind2);
+				if (n == vltable_class_pairs(vltable, class,
+							     ind2)) {
+					*entry = to;
+					continue;
+				} else if (!n)
+					continue;
+			} else if (*entry != VLTABLE_SPLIT)
+				continue;
+
+			split = vltable_split(vltable, class, ind2);
+			if (!split)
+				return 1;
+			for (i = 0; i < size; i++)
+				if (split->vls[i] == from &&
+				    VLTABLE_CHANGES(lids[i], ind2))
+					split->vls[i] = to;
+			vltable_merge(vltable, class, ind2, split);
 		}
-		if (stop)
-			break;
 	}
+
+#undef VLTABLE_CHANGES
+	return 0;
 }
 
 static void vltable_print(osm_ucast_mgr_t * p_mgr, vltable_t * vltable)
@@ -280,20 +502,43 @@ static void vltable_print(osm_ucast_mgr_t * p_mgr, vltable_t * vltable)
 					" to dest_lid=%" PRIu16 " on vl=%" PRIu8
 					"\n", cl_ntoh16(vltable->lids[ind1]),
 					cl_ntoh16(vltable->lids[ind2]),
-					vltable->vls[ind1 +
-						     ind2 * vltable->num_lids]);
+					vltable_get_by_index(vltable, ind1,
+							     ind2));
 			}
 		}
 	}
 }
 
+/* memory used by the VL table in bytes */
+static uint64_t vltable_size(vltable_t * vltable)
+{
+	return sizeof(vltable_t) +
+	    vltable->num_lids * (sizeof(vltable->lids[0]) +
+				 5 * sizeof(uint32_t)) +
+	    (vltable->max_lid_ho + 1) * sizeof(vltable->lid_index[0]) +
+	    (vltable->num_classes + 1) * sizeof(vltable->class_start[0]) +
+	    vltable->num_classes * vltable->num_lids + vltable->split_size;
+}
+
 static void vltable_dealloc(vltable_t ** vltable)
 {
+	cl_map_item_t *item;
+
 	if (*vltable) {
-		if ((*vltable)->lids)
-			free((*vltable)->lids);
-		if ((*vltable)->vls)
-			free((*vltable)->vls);
+		while ((item = cl_qmap_head(&(*vltable)->split_tbl)) !=
+		       cl_qmap_end(&(*vltable)->split_tbl)) {
+			cl_qmap_remove_item(&(*vltable)->split_tbl, item);
+			free(item);
+		}
+		free((*vltable)->lids);
+		free((*vltable)->lid_index);
+		free((*vltable)->port);
+		free((*vltable)->port_size);
+		free((*vltable)->src_class);
+		free((*vltable)->src_rank);
+		free((*vltable)->class_start);
+		free((*vltable)->class_lids);
+		free((*vltable)->vls);
 		free(*vltable);
 		*vltable = NULL;
 	}
@@ -302,17 +547,14 @@ static void vltable_dealloc(vltable_t ** vltable)
 static int vltable_alloc(vltable_t ** vltable, uint64_t size)
 {
 	/* allocate VL table and indexing array */
-	*vltable = (vltable_t *) malloc(sizeof(vltable_t));
+	*vltable = (vltable_t *) calloc(1, sizeof(vltable_t));
 	if (!(*vltable))
 		goto ERROR;
+	cl_qmap_init(&(*vltable)->split_tbl);
 	(*vltable)->num_lids = size;
 	(*vltable)->lids = (ib_net16_t *) malloc(size * sizeof(ib_net16_t));
 	if (!((*vltable)->lids))
 		goto ERROR;
-	(*vltable)->vls = (uint8_t *) malloc(size * size * sizeof(uint8_t));
-	if (!((*vltable)->vls))
-		goto ERROR;
-	memset((*vltable)->vls, OSM_DEFAULT_SL, size * size);
 
 	return 0;
 
@@ -322,6 +564,104 @@ ERROR:
 	return 1;
 }
 
+/* number the distinct keys in the order they are first seen;
+   items must have room for one entry per key
+*/
+static uint32_t vltable_number(cl_qmap_t * map, cl_map_item_t * items,
+			       uint32_t * num, uint64_t key)
+{
+	cl_map_item_t *item = cl_qmap_insert(map, key, &items[*num]);
+
+	if (item == &items[*num])
+		(*num)++;
+	return item - items;
+}
+
+/* index the sorted lids, group them into ports and classes and
+   allocate the (class X lid) matrix
+*/
+static int vltable_setup(vltable_t * vltable, osm_subn_t * p_subn)
+{
+	uint64_t num_lids = vltable->num_lids, i;
+	cl_map_item_t *items = NULL;
+	cl_qmap_t class_tbl, port_tbl, single_tbl;
+	osm_port_t *port;
+	osm_physp_t *p_rem_physp;
+	uint32_t class, num_ports = 0;
+	int ret = 1;
+
+	vltable->max_lid_ho = 0;
+	for (i = 0; i < num_lids; i++)
+		if (cl_ntoh16(vltable->lids[i]) > vltable->max_lid_ho)
+			vltable->max_lid_ho = cl_ntoh16(vltable->lids[i]);
+
+	vltable->lid_index = (uint32_t *) malloc((vltable->max_lid_ho + 1) *
+						 sizeof(uint32_t));
+	vltable->port = (uint32_t *) malloc(num_lids * sizeof(uint32_t));
+	vltable->port_size = (uint32_t *) calloc(num_lids, sizeof(uint32_t));
+	vltable->src_class = (uint32_t *) malloc(num_lids * sizeof(uint32_t));
+	vltable->src_rank = (uint32_t *) malloc(num_lids * sizeof(uint32_t));
+	vltable->class_start =
+	    (uint32_t *) calloc(num_lids + 1, sizeof(uint32_t));
+	vltable->class_lids = (uint32_t *) malloc(num_lids * sizeof(uint32_t));
+	items = (cl_map_item_t *) malloc(2 * num_lids * sizeof(*items));
+	if (!vltable->lid_index || !vltable->port || !vltable->port_size
+	    || !vltable->src_class
+	    || !vltable->src_rank || !vltable->class_start
+	    || !vltable->class_lids || !items)
+		goto Exit;
+
+	memset(vltable->lid_index, 0xFF,
+	       (vltable->max_lid_ho + 1) * sizeof(uint32_t));
+	cl_qmap_init(&class_tbl);
+	cl_qmap_init(&port_tbl);
+	cl_qmap_init(&single_tbl);
+	vltable->num_classes = 0;
+	for (i = 0; i < num_lids; i++) {
+		vltable->lid_index[cl_ntoh16(vltable->lids[i])] = i;
+
+		/* the lids are those of existing ports */
+		port = osm_get_port_by_lid(p_subn, vltable->lids[i]);
+		vltable->port[i] = vltable_number(&port_tbl, items, &num_ports,
+						  cl_ntoh64(port->guid));
+		vltable->port_size[vltable->port[i]]++;
+
+		/* a source is classed by the switch it is attached to;
+		   the paths of a switch do not start with a link to it,
+		   so they are a class of their own
+		 */
+		p_rem_physp = port->p_physp->p_remote_physp;
+		if (!port->p_node->sw && p_rem_physp && p_rem_physp->p_node->sw)
+			class = vltable_number(&class_tbl, items + num_lids,
+					       &vltable->num_classes,
+					       cl_ntoh64(osm_node_get_node_guid
+							 (p_rem_physp->p_node)));
+		else
+			class = vltable_number(&single_tbl, items + num_lids,
+					       &vltable->num_classes,
+					       cl_ntoh64(port->guid));
+		vltable->src_class[i] = class;
+		vltable->src_rank[i] = vltable->class_start[class + 1]++;
+	}
+
+	/* class_start[c + 1] holds the size of class c, make it the start */
+	for (class = 0; class < vltable->num_classes; class++)
+		vltable->class_start[class + 1] += vltable->class_start[class];
+	for (i = 0; i < num_lids; i++)
+		vltable->class_lids[vltable->class_start[vltable->src_class[i]] +
+				    vltable->src_rank[i]] = i;
+
+	vltable->vls = (uint8_t *) malloc(vltable->num_classes * num_lids);
+	if (!vltable->vls)
+		goto Exit;
+	memset(vltable->vls, OSM_DEFAULT_SL, vltable->num_classes * num_lids);
+	ret = 0;
+
+Exit:
+	free(items);
+	return ret;
+}
+
 /**********************************************************************
  **********************************************************************/
 
@@ -330,32 +670,30 @@ ERROR:
 /* update the srcdest array;
    realloc array (double the size) if size is not large enough
 */
-static void set_next_srcdest_pair(cdg_link_t * link, uint32_t srcdest)
+static int set_next_srcdest_pair(cdg_link_t * link, uint32_t srcdest)
 {
 	uint32_t new_size = 0, start_size = 2;
-	uint32_t *tmp = NULL, *tmp2 = NULL;
+	uint32_t *tmp = NULL;
 
 	if (link->num_pairs == 0) {
+		free(link->srcdest_pairs);
 		link->srcdest_pairs =
 		    (uint32_t *) malloc(start_size * sizeof(uint32_t));
-		link->srcdest_pairs[link->num_pairs] = srcdest;
+		if (!link->srcdest_pairs)
+			return 1;
 		link->max_len = start_size;
 		link->removed = 0;
 	} else if (link->num_pairs == link->max_len) {
 		new_size = link->max_len << 1;
-		tmp = (uint32_t *) malloc(new_size * sizeof(uint32_t));
-		tmp =
-		    memcpy(tmp, link->srcdest_pairs,
-			   link->max_len * sizeof(uint32_t));
-		tmp2 = link->srcdest_pairs;
+		tmp = (uint32_t *) realloc(link->srcdest_pairs,
+					   new_size * sizeof(uint32_t));
+		if (!tmp)
+			return 1;
 		link->srcdest_pairs = tmp;
-		link->srcdest_pairs[link->num_pairs] = srcdest;
-		free(tmp2);
 		link->max_len = new_size;
-	} else {
-		link->srcdest_pairs[link->num_pairs] = srcdest;
 	}
-	link->num_pairs++;
+	link->srcdest_pairs[link->num_pairs++] = srcdest;
+	return 0;
 }
 
 static inline uint32_t get_next_srcdest_pair(cdg_link_t * link, uint32_t index)
@@ -363,281 +701,294 @@ static inline uint32_t get_next_srcdest_pair(cdg_link_t * link, uint32_t index)
 	return link->srcdest_pairs[index];
 }
 
-/* traverse binary tree to find a node */
-static cdg_node_t *cdg_search(cdg_node_t * root, uint64_t channelID)
+static void cdg_index_dealloc(cdg_index_t * index)
 {
-	while (root) {
-		if (channelID < root->channelID)
-			root = root->left;
-		else if (channelID > root->channelID)
-			root = root->right;
-		else if (channelID == root->channelID)
-			return root;
-	}
-	return NULL;
+	free(index->first_channel);
+	free(index->link_start);
+	memset(index, 0, sizeof(*index));
 }
 
-/* insert new node into the binary tree */
-static void cdg_insert(cdg_node_t ** root, cdg_node_t * new_node)
+/* number the channels of all switches and reserve the range of edges
+   of each channel: one edge per port of the switch behind the channel
+*/
+static int cdg_index_init(cdg_index_t * index, osm_subn_t * p_subn)
 {
-	cdg_node_t *current = *root;
-
-	if (!current) {
-		current = new_node;
-		*root = current;
-		return;
+	osm_port_t *port = NULL;
+	osm_node_t *node = NULL, *remote_node = NULL;
+	uint32_t num_links = 0;
+	uint16_t lid = 0;
+	uint8_t port_num = 0;
+
+	memset(index, 0, sizeof(*index));
+	index->max_lid = p_subn->max_ucast_lid_ho;
+	index->first_channel = (uint32_t *) malloc((index->max_lid + 1) *
+						   sizeof(uint32_t));
+	if (!index->first_channel)
+		return 1;
+	for (lid = 0; lid <= index->max_lid; lid++) {
+		index->first_channel[lid] = CDG_NONE;
+		port = osm_get_port_by_lid_ho(p_subn, lid);
+		if (!port || !port->p_node->sw
+		    || cl_ntoh16(osm_port_get_base_lid(port)) != lid)
+			continue;
+		index->first_channel[lid] = index->num_channels;
+		index->num_channels += osm_node_get_num_physp(port->p_node);
 	}
 
-	while (current) {
-		if (new_node->channelID < current->channelID) {
-			if (current->left) {
-				current = current->left;
-			} else {
-				current->left = new_node;
-				new_node->parent = current;
-				break;
-			}
-		} else if (new_node->channelID > current->channelID) {
-			if (current->right) {
-				current = current->right;
-			} else {
-				current->right = new_node;
-				new_node->parent = current;
-				break;
-			}
-		} else if (new_node->channelID == current->channelID) {
-			/* not really possible, maybe programming error */
-			break;
+	index->link_start = (uint32_t *) malloc((index->num_channels + 1) *
+						sizeof(uint32_t));
+	if (!index->link_start) {
+		cdg_index_dealloc(index);
+		return 1;
+	}
+	for (lid = 0; lid <= index->max_lid; lid++) {
+		if (index->first_channel[lid] == CDG_NONE)
+			continue;
+		node = osm_get_port_by_lid_ho(p_subn, lid)->p_node;
+		for (port_num = 0; port_num < osm_node_get_num_physp(node);
+		     port_num++) {
+			index->link_start[index->first_channel[lid] +
+					  port_num] = num_links;
+			if (port_num == 0)
+				continue;
+			remote_node = osm_node_get_remote_node(node, port_num,
+							       NULL);
+			if (remote_node && remote_node->sw)
+				num_links +=
+				    osm_node_get_num_physp(remote_node) - 1;
 		}
 	}
+	index->link_start[index->num_channels] = num_links;
+
+	return 0;
 }
 
-static void cdg_node_dealloc(cdg_node_t * node)
+/* channel <local_node, local_port>; local_node is a switch */
+static inline uint32_t cdg_channel(const cdg_index_t * index,
+				   osm_node_t * local_node, uint8_t local_port)
 {
-	cdg_link_t *link = node->linklist, *tmp = NULL;
+	uint16_t lid = cl_ntoh16(osm_node_get_base_lid(local_node, 0));
 
-	/* dealloc linklist */
-	while (link) {
-		tmp = link;
-		link = link->next;
+	if (lid > index->max_lid || index->first_channel[lid] == CDG_NONE)
+		return CDG_NONE;
+	return index->first_channel[lid] + local_port;
+}
 
-		if (tmp->num_pairs)
-			free(tmp->srcdest_pairs);
-		free(tmp);
-	}
-	/* dealloc node */
-	free(node);
+static inline cdg_link_t *cdg_get_links(cdg_t * cdg, uint32_t channel)
+{
+	return cdg->links + cdg->index->link_start[channel];
 }
 
-static void cdg_dealloc(cdg_node_t ** root)
+/* the nodes of a cdg are allocated when the first path is added */
+static int cdg_alloc(cdg_t * cdg)
 {
-	cdg_node_t *current = *root;
+	const cdg_index_t *index = cdg->index;
+
+	cdg->nodes = (cdg_node_t *) calloc(index->num_channels,
+					   sizeof(cdg_node_t));
+	cdg->links = (cdg_link_t *) malloc(index->link_start
+					   [index->num_channels] *
+					   sizeof(cdg_link_t));
+	cdg->order = (uint32_t *) malloc(index->num_channels *
+					 sizeof(uint32_t));
+	if (!cdg->nodes || !cdg->links || !cdg->order)
+		return 1;
+	cdg->num_nodes = 0;
+	return 0;
+}
 
-	while (current) {
-		if (current->left) {
-			current = current->left;
-		} else if (current->right) {
-			current = current->right;
-		} else {
-			if (current->parent == NULL) {
-				cdg_node_dealloc(current);
-				*root = NULL;
-				break;
-			}
-			if (current->parent->left == current) {
-				current = current->parent;
-				cdg_node_dealloc(current->left);
-				current->left = NULL;
-			} else if (current->parent->right == current) {
-				current = current->parent;
-				cdg_node_dealloc(current->right);
-				current->right = NULL;
-			}
+static void cdg_dealloc(cdg_t * cdg)
+{
+	cdg_link_t *links = NULL;
+	uint32_t i = 0;
+	uint16_t j = 0;
+
+	if (cdg->nodes && cdg->links)
+		for (i = 0; i < cdg->num_nodes; i++) {
+			links = cdg_get_links(cdg, cdg->order[i]);
+			for (j = 0; j < cdg->nodes[cdg->order[i]].num_links;
+			     j++)
+				free(links[j].srcdest_pairs);
 		}
-	}
+	free(cdg->nodes);
+	free(cdg->links);
+	free(cdg->order);
+	cdg->nodes = NULL;
+	cdg->links = NULL;
+	cdg->order = NULL;
+	cdg->num_nodes = 0;
+}
+
+/* search the edge from channel to next_channel */
+static cdg_link_t *cdg_search_link(cdg_t * cdg, uint32_t channel,
+				   uint32_t next_channel)
+{
+	cdg_link_t *links = cdg_get_links(cdg, channel);
+	uint16_t i = 0;
+
+	for (i = 0; i < cdg->nodes[channel].num_links; i++)
+		if (links[i].node == next_channel)
+			return &links[i];
+	return NULL;
 }
 
-/* search for a edge in the cdg which should be removed to break a cycle */
-static cdg_link_t *get_weakest_link_in_cycle(cdg_node_t * cycle)
+/* add the src/dest pair to the edge from channel to next_channel;
+   the edge is appended to the edges of channel if it does not exist yet
+*/
+static int cdg_add_pair(cdg_t * cdg, uint32_t channel, uint32_t next_channel,
+			uint32_t srcdest)
 {
-	cdg_node_t *current = cycle, *node_with_weakest_link = NULL;
-	cdg_link_t *link = NULL, *weakest_link = NULL;
+	const cdg_index_t *index = cdg->index;
+	cdg_node_t *node = &cdg->nodes[channel];
+	cdg_link_t *link = cdg_search_link(cdg, channel, next_channel);
+
+	if (!link) {
+		/* sanity check: the edges of a channel lead to the ports
+		   of one switch, so its range is never exceeded */
+		if (index->link_start[channel] + node->num_links >=
+		    index->link_start[channel + 1])
+			return 1;
+		link = cdg_get_links(cdg, channel) + node->num_links++;
+		memset(link, 0, sizeof(*link));
+		link->node = next_channel;
+	}
+	return set_next_srcdest_pair(link, srcdest);
+}
 
-	link = current->linklist;
-	while (link) {
-		if (link->node->status == GRAY) {
-			weakest_link = link;
+/* search for a edge in the cdg which should be removed to break a cycle;
+   the edge is removed from the cdg and copied to weakest_link
+*/
+static int get_weakest_link_in_cycle(cdg_t * cdg, uint32_t cycle,
+				     cdg_link_t * weakest_link)
+{
+	cdg_node_t *nodes = cdg->nodes;
+	cdg_link_t *links = NULL, *weakest = NULL;
+	uint32_t current = cycle, node_with_weakest_link = CDG_NONE;
+	uint16_t i = 0;
+
+	links = cdg_get_links(cdg, current);
+	for (i = 0; i < nodes[current].num_links; i++)
+		if (nodes[links[i].node].status == GRAY) {
+			weakest = &links[i];
 			node_with_weakest_link = current;
-			current = link->node;
+			current = links[i].node;
 			break;
 		}
-		link = link->next;
-	}
+	if (!weakest)
+		return 1;
 
 	while (1) {
-		current->status = UNKNOWN;
-		link = current->linklist;
-		while (link) {
-			if (link->node->status == GRAY) {
-				if ((link->num_pairs - link->removed) <
-				    (weakest_link->num_pairs -
-				     weakest_link->removed)) {
-					weakest_link = link;
+		nodes[current].status = UNKNOWN;
+		links = cdg_get_links(cdg, current);
+		for (i = 0; i < nodes[current].num_links; i++)
+			if (nodes[links[i].node].status == GRAY) {
+				if ((links[i].num_pairs - links[i].removed) <
+				    (weakest->num_pairs - weakest->removed)) {
+					weakest = &links[i];
 					node_with_weakest_link = current;
 				}
-				current = link->node;
+				current = links[i].node;
 				break;
 			}
-			link = link->next;
-		}
 		/* if complete cycle is traversed */
 		if (current == cycle) {
-			current->status = UNKNOWN;
+			nodes[current].status = UNKNOWN;
 			break;
 		}
 	}
 
-	if (node_with_weakest_link->linklist == weakest_link) {
-		node_with_weakest_link->linklist = weakest_link->next;
-	} else {
-		link = node_with_weakest_link->linklist;
-		while (link) {
-			if (link->next == weakest_link) {
-				link->next = weakest_link->next;
-				break;
-			}
-			link = link->next;
-		}
-	}
+	/* remove the edge, the order of the remaining edges is kept */
+	*weakest_link = *weakest;
+	links = cdg_get_links(cdg, node_with_weakest_link);
+	i = nodes[node_with_weakest_link].num_links--;
+	memmove(weakest, weakest + 1,
+		(links + i - weakest - 1) * sizeof(cdg_link_t));
 
-	return weakest_link;
+	return 0;
 }
 
 /* search for nodes in the cdg not yet reached in the cycle search process;
    (some nodes are unreachable, e.g. a node is a source or the cdg has not connected parts)
 */
-static cdg_node_t *get_next_cdg_node(cdg_node_t * root)
+static uint32_t get_next_cdg_node(cdg_t * cdg)
 {
-	cdg_node_t *current = root, *res = NULL;
-
-	while (current) {
-		current->visited = 1;
-		if (current->status == UNKNOWN) {
-			res = current;
-			break;
-		}
-		if (current->left && !current->left->visited) {
-			current = current->left;
-		} else if (current->right && !current->right->visited) {
-			current = current->right;
-		} else {
-			if (current->left)
-				current->left->visited = 0;
-			if (current->right)
-				current->right->visited = 0;
-			if (current->parent == NULL)
-				break;
-			else
-				current = current->parent;
-		}
-	}
-
-	/* Clean up */
-	while (current) {
-		current->visited = 0;
-		if (current->left)
-			current->left->visited = 0;
-		if (current->right)
-			current->right->visited = 0;
-		current = current->parent;
-	}
+	uint32_t i = 0;
 
-	return res;
+	for (i = 0; i < cdg->num_nodes; i++)
+		if (cdg->nodes[cdg->order[i]].status == UNKNOWN)
+			return cdg->order[i];
+	return CDG_NONE;
 }
 
 /* make a DFS on the cdg to check for a cycle */
-static cdg_node_t *search_cycle_in_channel_dep_graph(cdg_node_t * cdg,
-						     cdg_node_t * start_node)
+static uint32_t search_cycle_in_channel_dep_graph(cdg_t * cdg,
+						  uint32_t start_node)
 {
-	cdg_node_t *cycle = NULL;
-	cdg_node_t *current = start_node, *next_node = NULL, *tmp = NULL;
-	cdg_link_t *link = NULL;
-
-	while (current) {
-		current->status = GRAY;
-		link = current->linklist;
-		next_node = NULL;
-		while (link) {
-			if (link->node->status == UNKNOWN) {
-				next_node = link->node;
+	cdg_node_t *nodes = cdg->nodes;
+	cdg_link_t *links = NULL;
+	uint32_t current = start_node, next_node = CDG_NONE, tmp = CDG_NONE;
+	uint16_t i = 0;
+
+	while (current != CDG_NONE) {
+		nodes[current].status = GRAY;
+		links = cdg_get_links(cdg, current);
+		next_node = CDG_NONE;
+		for (i = 0; i < nodes[current].num_links; i++) {
+			if (nodes[links[i].node].status == UNKNOWN) {
+				next_node = links[i].node;
 				break;
 			}
-			if (link->node->status == GRAY) {
-				cycle = link->node;
-				goto Exit;
-			}
-			link = link->next;
+			if (nodes[links[i].node].status == GRAY)
+				return links[i].node;
 		}
-		if (next_node) {
-			next_node->pre = current;
+		if (next_node != CDG_NONE) {
+			nodes[next_node].pre = current;
 			current = next_node;
 		} else {
 			/* found a sink in the graph, go to last node */
-			current->status = BLACK;
+			nodes[current].status = BLACK;
 
 			/* srcdest_pairs of this node aren't relevant, free the allocated memory */
-			link = current->linklist;
-			while (link) {
-				if (link->num_pairs)
-					free(link->srcdest_pairs);
-				link->srcdest_pairs = NULL;
-				link->num_pairs = 0;
-				link->removed = 0;
-				link = link->next;
+			for (i = 0; i < nodes[current].num_links; i++) {
+				free(links[i].srcdest_pairs);
+				links[i].srcdest_pairs = NULL;
+				links[i].num_pairs = 0;
+				links[i].removed = 0;
 			}
 
-			if (current->pre) {
+			if (nodes[current].pre != CDG_NONE) {
 				tmp = current;
-				current = current->pre;
-				tmp->pre = NULL;
+				current = nodes[current].pre;
+				nodes[tmp].pre = CDG_NONE;
 			} else {
 				/* search for other subgraphs in cdg */
 				current = get_next_cdg_node(cdg);
-				if (!current)
-					break;	/* all relevant nodes traversed, no more cycles found */
 			}
 		}
 	}
 
-Exit:
-	return cycle;
+	/* all relevant nodes traversed, no more cycles found */
+	return CDG_NONE;
 }
 
 /* calculate the path from source to destination port;
    new channels are added directly to the cdg
 */
-static int update_channel_dep_graph(cdg_node_t ** cdg_root,
-				    osm_port_t * src_port, uint16_t slid,
-				    osm_port_t * dest_port, uint16_t dlid)
+static int update_channel_dep_graph(cdg_t * cdg, osm_port_t * src_port,
+				    uint16_t slid, osm_port_t * dest_port,
+				    uint16_t dlid)
 {
 	osm_node_t *local_node = NULL, *remote_node = NULL;
-	uint16_t local_lid = 0, remote_lid = 0;
 	uint32_t srcdest = 0;
 	uint8_t local_port = 0, remote_port = 0;
-	uint64_t channelID = 0;
+	uint32_t channel = CDG_NONE, last_channel = CDG_NONE;
 
-	cdg_node_t *channel_head = NULL, *channel = NULL, *last_channel = NULL;
-	cdg_link_t *linklist = NULL;
+	if (!cdg->nodes && cdg_alloc(cdg))
+		return 1;
 
 	/* set the identifier for the src/dest pair to save this on each edge of the cdg */
 	srcdest = (((uint32_t) slid) << 16) + ((uint32_t) dlid);
 
-	channel_head = (cdg_node_t *) malloc(sizeof(cdg_node_t));
-	if (!channel_head)
-		goto ERROR;
-	set_default_cdg_node(channel_head);
-	last_channel = channel_head;
-
 	/* if src is a Hca, then the channel from Hca to switch would be a source in the graph
 	   sources can't be part of a cycle -> skip this channel
 	 */
@@ -650,11 +1001,7 @@ static int update_channel_dep_graph(cdg_node_t ** cdg_root,
 		local_port = local_node->sw->new_lft[dlid];
 		/* sanity check: local_port must be set or routing is broken */
 		if (local_port == OSM_NO_PATH)
-			goto ERROR;
-		local_lid = cl_ntoh16(osm_node_get_base_lid(local_node, 0));
-		/* each port belonging to a switch has lmc==0 -> get_base_lid is fine
-		   (local/remote port in this function are always part of a switch)
-		 */
+			return 1;
 
 		remote_node =
 		    osm_node_get_remote_node(local_node, local_port,
@@ -662,133 +1009,37 @@ static int update_channel_dep_graph(cdg_node_t ** cdg_root,
 		/* if remote_node is a Hca, then the last channel from switch to Hca would be a sink in the cdg -> skip */
 		if (!remote_node || !remote_node->sw)
 			break;
-		remote_lid = cl_ntoh16(osm_node_get_base_lid(remote_node, 0));
-
-		channelID =
-		    (((uint64_t) local_lid) << 48) +
-		    (((uint64_t) local_port) << 32) +
-		    (((uint64_t) remote_lid) << 16) + ((uint64_t) remote_port);
-		channel = cdg_search(*cdg_root, channelID);
-		if (channel) {
-			/* check whether last channel has connection to this channel, i.e. subpath already exists in cdg */
-			linklist = last_channel->linklist;
-			while (linklist && linklist->node != channel
-			       && linklist->next)
-				linklist = linklist->next;
-			/* if there is no connection, add one */
-			if (linklist) {
-				if (linklist->node == channel) {
-					set_next_srcdest_pair(linklist,
-							      srcdest);
-				} else {
-					linklist->next =
-					    (cdg_link_t *)
-					    malloc(sizeof(cdg_link_t));
-					if (!linklist->next)
-						goto ERROR;
-					linklist = linklist->next;
-					linklist->node = channel;
-					linklist->num_pairs = 0;
-					linklist->srcdest_pairs = NULL;
-					set_next_srcdest_pair(linklist,
-							      srcdest);
-					linklist->next = NULL;
-				}
-			} else {
-				/* either this is the first channel of the path, or the last channel was a new channel, or last channel was a sink */
-				last_channel->linklist =
-				    (cdg_link_t *) malloc(sizeof(cdg_link_t));
-				if (!last_channel->linklist)
-					goto ERROR;
-				last_channel->linklist->node = channel;
-				last_channel->linklist->num_pairs = 0;
-				last_channel->linklist->srcdest_pairs = NULL;
-				set_next_srcdest_pair(last_channel->linklist,
-						      srcdest);
-				last_channel->linklist->next = NULL;
-			}
-		} else {
+
+		channel = cdg_channel(cdg->index, local_node, local_port);
+		if (channel == CDG_NONE)
+			return 1;
+		if (!cdg->nodes[channel].added) {
 			/* create new channel */
-			channel = (cdg_node_t *) malloc(sizeof(cdg_node_t));
-			if (!channel)
-				goto ERROR;
-			set_default_cdg_node(channel);
-			channel->channelID = channelID;
-			cdg_insert(cdg_root, channel);
-
-			/* go to end of link list of last channel */
-			linklist = last_channel->linklist;
-			while (linklist && linklist->next)
-				linklist = linklist->next;
-			if (linklist) {
-				/* update last link of an existing channel */
-				linklist->next =
-				    (cdg_link_t *) malloc(sizeof(cdg_link_t));
-				if (!linklist->next)
-					goto ERROR;
-				linklist = linklist->next;
-				linklist->node = channel;
-				linklist->num_pairs = 0;
-				linklist->srcdest_pairs = NULL;
-				set_next_srcdest_pair(linklist, srcdest);
-				linklist->next = NULL;
-			} else {
-				/* either this is the first channel of the path, or the last channel was a new channel, or last channel was a sink */
-				last_channel->linklist =
-				    (cdg_link_t *) malloc(sizeof(cdg_link_t));
-				if (!last_channel->linklist)
-					goto ERROR;
-				last_channel->linklist->node = channel;
-				last_channel->linklist->num_pairs = 0;
-				last_channel->linklist->srcdest_pairs = NULL;
-				set_next_srcdest_pair(last_channel->linklist,
-						      srcdest);
-				last_channel->linklist->next = NULL;
-			}
+			cdg->nodes[channel].added = 1;
+			cdg->nodes[channel].pre = CDG_NONE;
+			cdg->order[cdg->num_nodes++] = channel;
 		}
+		/* the first channel of the path has no predecessor */
+		if (last_channel != CDG_NONE
+		    && cdg_add_pair(cdg, last_channel, channel, srcdest))
+			return 1;
 		last_channel = channel;
 	}
 
-	if (channel_head->linklist) {
-		if (channel_head->linklist->srcdest_pairs)
-			free(channel_head->linklist->srcdest_pairs);
-		free(channel_head->linklist);
-	}
-	free(channel_head);
-
 	return 0;
-
-ERROR:
-	/* cleanup data and exit */
-	if (channel_head) {
-		if (channel_head->linklist)
-			free(channel_head->linklist);
-		free(channel_head);
-	}
-
-	return 1;
 }
 
 /* calculate the path from source to destination port;
    the links in the cdg representing this path are decremented to simulate the removal
 */
-static int remove_path_from_cdg(cdg_node_t ** cdg_root, osm_port_t * src_port,
+static int remove_path_from_cdg(cdg_t * cdg, osm_port_t * src_port,
 				uint16_t slid, osm_port_t * dest_port,
 				uint16_t dlid)
 {
 	osm_node_t *local_node = NULL, *remote_node = NULL;
-	uint16_t local_lid = 0, remote_lid = 0;
 	uint8_t local_port = 0, remote_port = 0;
-	uint64_t channelID = 0;
-
-	cdg_node_t *channel_head = NULL, *channel = NULL, *last_channel = NULL;
-	cdg_link_t *linklist = NULL;
-
-	channel_head = (cdg_node_t *) malloc(sizeof(cdg_node_t));
-	if (!channel_head)
-		goto ERROR;
-	set_default_cdg_node(channel_head);
-	last_channel = channel_head;
+	uint32_t channel = CDG_NONE, last_channel = CDG_NONE;
+	cdg_link_t *link = NULL;
 
 	/* if src is a Hca, then the channel from Hca to switch would be a source in the graph
 	   sources can't be part of a cycle -> skip this channel
@@ -802,8 +1053,7 @@ static int remove_path_from_cdg(cdg_node_t ** cdg_root, osm_port_t * src_port,
 		local_port = local_node->sw->new_lft[dlid];
 		/* sanity check: local_port must be set or routing is broken */
 		if (local_port == OSM_NO_PATH)
-			goto ERROR;
-		local_lid = cl_ntoh16(osm_node_get_base_lid(local_node, 0));
+			return 1;
 
 		remote_node =
 		    osm_node_get_remote_node(local_node, local_port,
@@ -811,51 +1061,23 @@ static int remove_path_from_cdg(cdg_node_t ** cdg_root, osm_port_t * src_port,
 		/* if remote_node is a Hca, then the last channel from switch to Hca would be a sink in the cdg -> skip */
 		if (!remote_node || !remote_node->sw)
 			break;
-		remote_lid = cl_ntoh16(osm_node_get_base_lid(remote_node, 0));
-
-		channelID =
-		    (((uint64_t) local_lid) << 48) +
-		    (((uint64_t) local_port) << 32) +
-		    (((uint64_t) remote_lid) << 16) + ((uint64_t) remote_port);
-		channel = cdg_search(*cdg_root, channelID);
-		if (channel) {
-			/* check whether last channel has connection to this channel, i.e. subpath already exists in cdg */
-			linklist = last_channel->linklist;
-			while (linklist && linklist->node != channel
-			       && linklist->next)
-				linklist = linklist->next;
-			/* remove the srcdest from the link */
-			if (linklist) {
-				if (linklist->node == channel) {
-					linklist->removed++;
-				} else {
-					/* may happen if the link is missing (thru cycle detect algorithm) */
-				}
-			} else {
-				/* may happen if the link is missing (thru cycle detect algorithm or last_channel==channel_head (dummy channel)) */
-			}
-		} else {
-			/* must be an error, channels for the path are added before, so a missing channel would be a corrupt data structure */
-			goto ERROR;
+
+		channel = cdg_channel(cdg->index, local_node, local_port);
+		/* must be an error, channels for the path are added before, so a missing channel would be a corrupt data structure */
+		if (channel == CDG_NONE || !cdg->nodes
+		    || !cdg->nodes[channel].added)
+			return 1;
+		if (last_channel != CDG_NONE) {
+			/* remove the srcdest from the link;
+			   the link may be missing (thru cycle detect algorithm) */
+			link = cdg_search_link(cdg, last_channel, channel);
+			if (link)
+				link->removed++;
 		}
 		last_channel = channel;
 	}
 
-	if (channel_head->linklist)
-		free(channel_head->linklist);
-	free(channel_head);
-
 	return 0;
-
-ERROR:
-	/* cleanup data and exit */
-	if (channel_head) {
-		if (channel_head->linklist)
-			free(channel_head->linklist);
-		free(channel_head);
-	}
-
-	return 1;
 }
 
 /**********************************************************************
@@ -1191,6 +1413,8 @@ static int dfsssp_build_graph(void *context)
 		adj_list[i].links = head->next;
 		free(head);
 	}
+	dfsssp_ctx->link_weight = total_num_hca * total_num_hca;
+
 	/* connect the links with it's second adjacent node in the list */
 	for (i = 1; i < adj_list_size; i++) {
 		link = adj_list[i].links;
@@ -1777,8 +2001,10 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 	uint32_t i = 0, j = 0, err = 0;
 	uint8_t vl = 0, test_vl = 0, vl_avail = 0, vl_needed = 1;
 	double most_avg_paths = 0.0;
-	cdg_node_t **cdg = NULL, *start_here = NULL, *cycle = NULL;
-	cdg_link_t *weakest_link = NULL;
+	cdg_index_t cdg_index;
+	cdg_t *cdg = NULL;
+	uint32_t start_here = CDG_NONE, cycle = CDG_NONE;
+	cdg_link_t weakest_link;
 	uint32_t srcdest = 0;
 
 	vltable_t *srcdest2vl_table = NULL;
@@ -1806,15 +2032,22 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 	}
 	memset(paths_per_vl, 0, vl_avail * sizeof(uint64_t));
 
-	cdg = (cdg_node_t **) malloc(vl_avail * sizeof(cdg_node_t *));
+	if (cdg_index_init(&cdg_index, p_mgr->p_subn)) {
+		OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR,
+			"ERR AD23: cannot allocate memory for cdg\n");
+		free(paths_per_vl);
+		return 1;
+	}
+	cdg = (cdg_t *) calloc(vl_avail, sizeof(cdg_t));
 	if (!cdg) {
 		OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR,
 			"ERR AD23: cannot allocate memory for cdg\n");
+		cdg_index_dealloc(&cdg_index);
 		free(paths_per_vl);
 		return 1;
 	}
 	for (i = 0; i < vl_avail; i++)
-		cdg[i] = NULL;
+		cdg[i].index = &cdg_index;
 
 	count = 0;
 	/* count all ports (also multiple LIDs) of type CA or SP0 for size of VL table */
@@ -1864,6 +2097,12 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 	}
 	/* sort lids */
 	vltable_sort_lids(srcdest2vl_table);
+	err = vltable_setup(srcdest2vl_table, p_mgr->p_subn);
+	if (err) {
+		OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR,
+			"ERR AD26: cannot allocate memory for srcdest2vl_table\n");
+		goto ERROR;
+	}
 
 	test_vl = 0;
 	/* fill cdg[0] with routes from each src/dest port combination for all Hca/SP0 in the subnet */
@@ -1905,7 +2144,7 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 						/* try to add the path to cdg[0] */
 						err =
 						    update_channel_dep_graph
-						    (&(cdg[test_vl]),
+						    (&cdg[test_vl],
 						     src_port, slid,
 						     dest_port, dlid);
 						if (err) {
@@ -1916,11 +2155,18 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 							goto ERROR;
 						}
 						/* add the <s,d> combination / corresponding virtual lane to the VL table */
-						vltable_insert
+						err = vltable_insert
 						    (srcdest2vl_table,
 						     cl_hton16(slid),
 						     cl_hton16(dlid),
 						     test_vl);
+						if (err) {
+							OSM_LOG(p_mgr->
+								p_log,
+								OSM_LOG_ERROR,
+								"ERR AD2A: cannot allocate memory for srcdest2vl_table entry\n");
+							goto ERROR;
+						}
 						paths_per_vl[test_vl]++;
 
 					}
@@ -1934,18 +2180,19 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 
 	/* test all cdg for cycles and break the cycles by moving paths on the weakest link to the next cdg */
 	for (test_vl = 0; test_vl < vl_avail - 1; test_vl++) {
-		start_here = cdg[test_vl];
-		while (start_here) {
+		start_here = cdg[test_vl].num_nodes ?
+		    cdg[test_vl].order[0] : CDG_NONE;
+		while (start_here != CDG_NONE) {
 			cycle =
-			    search_cycle_in_channel_dep_graph(cdg[test_vl],
+			    search_cycle_in_channel_dep_graph(&cdg[test_vl],
 							      start_here);
 
-			if (cycle) {
+			if (cycle != CDG_NONE) {
 				vl_needed = test_vl + 2;
 
 				/* calc weakest link n cycle */
-				weakest_link = get_weakest_link_in_cycle(cycle);
-				if (!weakest_link) {
+				if (get_weakest_link_in_cycle
+				    (&cdg[test_vl], cycle, &weakest_link)) {
 					OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR,
 						"ERR AD27: something went wrong in get_weakest_link_in_cycle(...)\n");
 					err = 1;
@@ -1953,14 +2200,14 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 				}
 
 				paths_per_vl[test_vl] -=
-				    weakest_link->num_pairs;
+				    weakest_link.num_pairs;
 				paths_per_vl[test_vl + 1] +=
-				    weakest_link->num_pairs;
+				    weakest_link.num_pairs;
 
 				/* move all <s,d> paths on this link to the next cdg */
-				for (i = 0; i < weakest_link->num_pairs; i++) {
+				for (i = 0; i < weakest_link.num_pairs; i++) {
 					srcdest =
-					    get_next_srcdest_pair(weakest_link,
+					    get_next_srcdest_pair(&weakest_link,
 								  i);
 					slid = (uint16_t) (srcdest >> 16);
 					dlid =
@@ -1991,8 +2238,7 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 
 					/* remove path from current cdg / vl */
 					err =
-					    remove_path_from_cdg(&
-								 (cdg[test_vl]),
+					    remove_path_from_cdg(&cdg[test_vl],
 								 src_port, slid,
 								 dest_port,
 								 dlid);
@@ -2005,10 +2251,8 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 
 					/* add path to next cdg / vl */
 					err =
-					    update_channel_dep_graph(&
-								     (cdg
-								      [test_vl +
-								       1]),
+					    update_channel_dep_graph(&cdg
+								     [test_vl + 1],
 								     src_port,
 								     slid,
 								     dest_port,
@@ -2019,16 +2263,19 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 							"ERR AD14: cannot allocate memory for cdg node or link in update_channel_dep_graph(...)\n");
 						goto ERROR;
 					}
-					vltable_insert(srcdest2vl_table,
-						       cl_hton16(slid),
-						       cl_hton16(dlid),
-						       test_vl + 1);
+					err = vltable_insert(srcdest2vl_table,
+							     cl_hton16(slid),
+							     cl_hton16(dlid),
+							     test_vl + 1);
+					if (err) {
+						OSM_LOG(p_mgr->p_log,
+							OSM_LOG_ERROR,
+							"ERR AD2A: cannot allocate memory for srcdest2vl_table entry\n");
+						goto ERROR;
+					}
 				}
 
-				if (weakest_link->num_pairs)
-					free(weakest_link->srcdest_pairs);
-				if (weakest_link)
-					free(weakest_link);
+				free(weakest_link.srcdest_pairs);
 			}
 
 			start_here = cycle;
@@ -2038,12 +2285,12 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 	/* test the last avail cdg for a cycle;
 	   if there is one, than vl_needed > vl_avail
 	 */
-	start_here = cdg[vl_avail - 1];
-	if (start_here) {
+	if (cdg[vl_avail - 1].num_nodes) {
+		start_here = cdg[vl_avail - 1].order[0];
 		cycle =
-		    search_cycle_in_channel_dep_graph(cdg[vl_avail - 1],
+		    search_cycle_in_channel_dep_graph(&cdg[vl_avail - 1],
 						      start_here);
-		if (cycle) {
+		if (cycle != CDG_NONE) {
 			vl_needed = vl_avail + 1;
 		}
 	}
@@ -2105,7 +2352,13 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 			for (i = 0; i < from; i++)
 				to += split_count[i];
 			count = paths_per_vl[from];
-			vltable_change_vl(srcdest2vl_table, from, to, count);
+			err = vltable_change_vl(srcdest2vl_table, from, to,
+						count);
+			if (err) {
+				OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR,
+					"ERR AD2A: cannot allocate memory for srcdest2vl_table entry\n");
+				goto ERROR;
+			}
 			/* change also the information within the split_count
 			   array; this is important for fast calculation later
 			 */
@@ -2145,12 +2398,22 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 		}
 	}
 
+	OSM_LOG(p_mgr->p_log, OSM_LOG_VERBOSE,
+		"VL table: %" PRIu32 " source classes x %" PRIu64
+		" lids, %u split, %" PRIu64 " bytes (%" PRIu64
+		" as lid x lid matrix)\n",
+		srcdest2vl_table->num_classes, srcdest2vl_table->num_lids,
+		cl_qmap_count(&srcdest2vl_table->split_tbl),
+		vltable_size(srcdest2vl_table),
+		srcdest2vl_table->num_lids * srcdest2vl_table->num_lids);
+
 	free(paths_per_vl);
 
 	/* deallocate channel dependency graphs */
 	for (i = 0; i < vl_avail; i++)
 		cdg_dealloc(&cdg[i]);
 	free(cdg);
+	cdg_index_dealloc(&cdg_index);
 
 	OSM_LOG_EXIT(p_mgr->p_log);
 	return 0;
@@ -2161,6 +2424,7 @@ ERROR:
 	for (i = 0; i < vl_avail; i++)
 		cdg_dealloc(&cdg[i]);
 	free(cdg);
+	cdg_index_dealloc(&cdg_index);
 
 	vltable_dealloc(&srcdest2vl_table);
 	dfsssp_ctx->srcdest2vl_table = NULL;
@@ -2168,6 +2432,149 @@ ERROR:
 	return err;
 }
 
+/* a LID of a port, which the routes are computed for */
+typedef struct dijkstra_dest {
+	osm_port_t *port;
+	uint16_t lid;
+} dijkstra_dest_t;
+
+/* destinations of one batch, routed concurrently against the same link
+   weights; each destination has its own copy of the vertices of the
+   graph (the links are shared and not modified by dijkstra)
+*/
+typedef struct dijkstra_batch {
+	osm_ucast_mgr_t *p_mgr;
+	uint32_t adj_list_size;
+	vertex_t *graphs;	/* batch_size copies of adj_list */
+	cl_heap_t *heaps;	/* one heap per thread */
+	dijkstra_dest_t *dests;	/* destinations of the batch */
+	int *err;		/* result of dijkstra for each destination */
+} dijkstra_batch_t;
+
+static void dijkstra_batch_dest(void *context, unsigned index,
+				unsigned thread)
+{
+	dijkstra_batch_t *b = (dijkstra_batch_t *) context;
+
+	b->err[index] = dijkstra(b->p_mgr, &b->heaps[thread],
+				 b->graphs + index * b->adj_list_size,
+				 b->adj_list_size, b->dests[index].port,
+				 b->dests[index].lid);
+}
+
+/* write the routes from the last dijkstra step into the LFTs and
+   add them to the link weights
+*/
+static int apply_routes(osm_ucast_mgr_t * p_mgr, vertex_t * adj_list,
+			uint32_t adj_list_size, dijkstra_dest_t * dest)
+{
+	if (OSM_LOG_IS_ACTIVE_V2(p_mgr->p_log, OSM_LOG_DEBUG))
+		print_routes(p_mgr, adj_list, adj_list_size, dest->port);
+
+	/* make an update for the linear forwarding tables of the switches */
+	if (update_lft(p_mgr, adj_list, adj_list_size, dest->port, dest->lid))
+		return 1;
+
+	/* add weights for calculated routes to adjust the weights for the next cycle */
+	update_weights(p_mgr, adj_list, adj_list_size);
+
+	if (OSM_LOG_IS_ACTIVE_V2(p_mgr->p_log, OSM_LOG_DEBUG))
+		dfsssp_print_graph(p_mgr, adj_list, adj_list_size);
+
+	return 0;
+}
+
+/* route the destinations in batches of batch_size: the dijkstra steps of
+   a batch run in parallel and see the link weights from before the batch,
+   then the routes are applied in the order of the destinations;
+   the result only depends on batch_size, not on the number of threads
+*/
+static int dijkstra_batches(osm_ucast_mgr_t * p_mgr, vertex_t * adj_list,
+			    uint32_t adj_list_size, dijkstra_dest_t * dests,
+			    uint32_t num_dests, uint32_t batch_size,
+			    unsigned num_threads)
+{
+	dijkstra_batch_t b;
+	uint32_t i = 0, j = 0, n = 0;
+	int err = 1;
+
+	memset(&b, 0, sizeof(b));
+	b.p_mgr = p_mgr;
+	b.adj_list_size = adj_list_size;
+	b.graphs = (vertex_t *) malloc((size_t) batch_size * adj_list_size *
+				       sizeof(vertex_t));
+	b.heaps = (cl_heap_t *) malloc(num_threads * sizeof(cl_heap_t));
+	b.err = (int *) malloc(batch_size * sizeof(int));
+	if (!b.graphs || !b.heaps || !b.err) {
+		OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR,
+			"ERR AD15: cannot allocate memory for dijkstra batches\n");
+		goto Exit;
+	}
+	for (i = 0; i < num_threads; i++)
+		cl_heap_construct(&b.heaps[i]);
+	/* vertex 0 is the Hca source of a dijkstra step, each copy
+	   has its own link from it */
+	for (i = 0; i < batch_size; i++) {
+		memcpy(b.graphs + i * adj_list_size, adj_list,
+		       adj_list_size * sizeof(vertex_t));
+		set_default_vertex(&b.graphs[i * adj_list_size]);
+	}
+
+	for (i = 0; i < num_dests; i += n) {
+		n = num_dests - i < batch_size ? num_dests - i : batch_size;
+		b.dests = dests + i;
+		osm_parallel_for(num_threads, n, dijkstra_batch_dest, &b);
+		for (j = 0; j < n; j++)
+			if (b.err[j] || apply_routes(p_mgr,
+						     b.graphs +
+						     j * adj_list_size,
+						     adj_list_size,
+						     &b.dests[j]))
+				goto Exit;
+	}
+	err = 0;
+
+Exit:
+	if (b.heaps)
+		for (i = 0; i < num_threads; i++)
+			if (cl_is_heap_inited(&b.heaps[i]))
+				cl_heap_destroy(&b.heaps[i]);
+	if (b.graphs)
+		for (i = 0; i < batch_size; i++)
+			free(b.graphs[i * adj_list_size].links);
+	free(b.graphs);
+	free(b.heaps);
+	free(b.err);
+	return err;
+}
+
+/* log how evenly the routes are spread over the links between switches */
+static void print_route_balance(osm_ucast_mgr_t * p_mgr, vertex_t * adj_list,
+				uint32_t adj_list_size, uint64_t link_weight,
+				uint32_t num_dests, uint32_t batch_size,
+				uint64_t usec)
+{
+	uint64_t routes = 0, max_routes = 0, total = 0, num_links = 0;
+	link_t *link = NULL;
+	uint32_t i = 0;
+
+	for (i = 1; i < adj_list_size; i++)
+		for (link = adj_list[i].links; link; link = link->next) {
+			routes = link->weight - link_weight;
+			if (routes > max_routes)
+				max_routes = routes;
+			total += routes;
+			num_links++;
+		}
+
+	OSM_LOG(p_mgr->p_log, OSM_LOG_VERBOSE,
+		"Routed %" PRIu32 " destination LIDs in %" PRIu64
+		" usec (batch size %" PRIu32 "); routes per switch link:"
+		" max %" PRIu64 ", avg %.1f\n", num_dests, usec,
+		batch_size, max_routes,
+		num_links ? (double)total / num_links : 0.0);
+}
+
 /* meta function which calls subfunctions for dijkstra, update lft and weights,
    (and remove deadlocks) to calculate the routing for the subnet
 */
@@ -2181,7 +2588,9 @@ static int dfsssp_do_dijkstra_routing(void *context)
 
 	vertex_t **sw_list = NULL;
 	uint32_t sw_list_size = 0;
-	uint64_t guid = 0;
+	dijkstra_dest_t *dests = NULL;
+	uint32_t num_dests = 0, batch_size = 0;
+	uint64_t guid = 0, start = 0;
 	cl_qlist_t *qlist = NULL;
 	cl_list_item_t *qlist_item = NULL;
 
@@ -2357,16 +2766,32 @@ static int dfsssp_do_dijkstra_routing(void *context)
 	destroy_guid_map(&io_tbl);
 	io_nodes_provided = FALSE;
 
-	/* do the routing for the each Hca in the subnet and each switch
-	   in the subnet (to add the routes to base/enhanced SP0)
+	/* collect the LIDs of each Hca in the subnet and each switch in
+	   the subnet (to add the routes to base/enhanced SP0), in the order
+	   the routes are computed
 	 */
 	qlist = &p_mgr->port_order_list;
+	num_dests = 0;
+	for (qlist_item = cl_qlist_head(qlist);
+	     qlist_item != cl_qlist_end(qlist);
+	     qlist_item = cl_qlist_next(qlist_item)) {
+		port = (osm_port_t *)cl_item_obj(qlist_item, port, list_item);
+		osm_port_get_lid_range_ho(port, &min_lid_ho, &max_lid_ho);
+		num_dests += max_lid_ho - min_lid_ho + 1;
+	}
+	dests = (dijkstra_dest_t *) malloc(num_dests * sizeof(*dests));
+	if (!dests) {
+		OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR,
+			"ERR AD16: cannot allocate memory for the destinations in dfsssp_do_dijkstra_routing\n");
+		goto ERROR;
+	}
+	num_dests = 0;
 	for (qlist_item = cl_qlist_head(qlist);
 	     qlist_item != cl_qlist_end(qlist);
 	     qlist_item = cl_qlist_next(qlist_item)) {
 		port = (osm_port_t *)cl_item_obj(qlist_item, port, list_item);
 
-		/* calculate shortest path with dijkstra from node to all switches/Hca */
+		/* shortest paths are calculated from all switches/Hca to Hca and switches */
 		if (osm_node_get_type(port->p_node) == IB_NODE_TYPE_CA) {
 			OSM_LOG(p_mgr->p_log, OSM_LOG_DEBUG,
 				"Processing Hca with GUID 0x%" PRIx64 "\n",
@@ -2389,30 +2814,45 @@ static int dfsssp_do_dijkstra_routing(void *context)
 		osm_port_get_lid_range_ho(port, &min_lid_ho,
 					  &max_lid_ho);
 		for (lid = min_lid_ho; lid <= max_lid_ho; lid++) {
+			dests[num_dests].port = port;
+			dests[num_dests].lid = lid;
+			num_dests++;
+		}
+	}
+
+	start = cl_get_time_stamp();
+	batch_size = p_mgr->p_subn->opt.dfsssp_batch_size;
+	if (batch_size > num_dests)
+		batch_size = num_dests;
+	if (batch_size > 1) {
+		err = dijkstra_batches(p_mgr, adj_list, adj_list_size, dests,
+				       num_dests, batch_size,
+				       osm_parallel_threads(p_mgr->p_subn->
+							    opt.routing_threads));
+		if (err)
+			goto ERROR;
+	} else {
+		batch_size = 1;
+		for (i = 0; i < num_dests; i++) {
 			/* do dijkstra from this Hca/LID/SP0 to each switch */
 			err =
 			    dijkstra(p_mgr, &heap, adj_list, adj_list_size,
-				     port, lid);
+				     dests[i].port, dests[i].lid);
 			if (err)
 				goto ERROR;
-			if (OSM_LOG_IS_ACTIVE_V2(p_mgr->p_log, OSM_LOG_DEBUG))
-				print_routes(p_mgr, adj_list, adj_list_size,
-					     port);
-
-			/* make an update for the linear forwarding tables of the switches */
-			err =
-			    update_lft(p_mgr, adj_list, adj_list_size, port, lid);
+			err = apply_routes(p_mgr, adj_list, adj_list_size,
+					   &dests[i]);
 			if (err)
 				goto ERROR;
-
-			/* add weights for calculated routes to adjust the weights for the next cycle */
-			update_weights(p_mgr, adj_list, adj_list_size);
-
-			if (OSM_LOG_IS_ACTIVE_V2(p_mgr->p_log, OSM_LOG_DEBUG))
-				dfsssp_print_graph(p_mgr, adj_list,
-						   adj_list_size);
 		}
 	}
+	if (OSM_LOG_IS_ACTIVE_V2(p_mgr->p_log, OSM_LOG_VERBOSE))
+		print_route_balance(p_mgr, adj_list, adj_list_size,
+				    dfsssp_ctx->link_weight, num_dests,
+				    batch_size,
+				    cl_get_time_stamp() - start);
+	free(dests);
+	dests = NULL;
 
 	/* try deadlock removal only for the dfsssp routing (not for the sssp case, which is a subset of the dfsssp algorithm) */
 	if (dfsssp_ctx->routing_type == OSM_ROUTING_ENGINE_TYPE_DFSSSP) {
@@ -2467,6 +2907,7 @@ ERROR:
 		destroy_guid_map(&io_tbl);
 	if (sw_list)
 		free(sw_list);
+	free(dests);
 	if (cl_is_heap_inited(&heap))
 		cl_heap_destroy(&heap);
 	return -1;
@@ -2636,8 +3077,8 @@ static uint8_t get_dfsssp_sl(void *context, uint8_t hint_for_default_sl,
 	if (dfsssp_ctx
 	    && dfsssp_ctx->routing_type == OSM_ROUTING_ENGINE_TYPE_DFSSSP) {
 		p_mgr = (osm_ucast_mgr_t *) dfsssp_ctx->p_mgr;
-		srcdest2vl_table = (vltable_t *) (dfsssp_ctx->srcdest2vl_table);
-		vl_split_count = (uint8_t *) (dfsssp_ctx->vl_split_count);
+		srcdest2vl_table = (vltable_t *) (dfsssp_ctx->path_sl_table);
+		vl_split_count = (uint8_t *) (dfsssp_ctx->path_sl_split_count);
 	}
 	else
 		return hint_for_default_sl;
@@ -2684,6 +3125,8 @@ static dfsssp_context_t *dfsssp_context_create(osm_opensm_t * p_osm,
 		dfsssp_ctx->adj_list_size = 0;
 		dfsssp_ctx->srcdest2vl_table = NULL;
 		dfsssp_ctx->vl_split_count = NULL;
+		dfsssp_ctx->path_sl_table = NULL;
+		dfsssp_ctx->path_sl_split_count = NULL;
 	} else {
 		OSM_LOG(p_osm->sm.ucast_mgr.p_log, OSM_LOG_ERROR,
 			"ERR AD04: cannot allocate memory for dfsssp_ctx in dfsssp_context_create\n");
@@ -2714,8 +3157,7 @@ static void dfsssp_context_destroy(void *context)
 	dfsssp_ctx->adj_list_size = 0;
 
 	/* free srcdest2vl table and the split count information table
-	   (can be done, because dfsssp_context_destroy is called after
-	    osm_get_dfsssp_sl)
+	   (can be done, because get_dfsssp_sl only uses the published ones)
 	 */
 	vltable_dealloc(&(dfsssp_ctx->srcdest2vl_table));
 	dfsssp_ctx->srcdest2vl_table = NULL;
@@ -2726,12 +3168,35 @@ static void dfsssp_context_destroy(void *context)
 	}
 }
 
+/* hand the VL tables of the routing built last over to get_dfsssp_sl;
+   called with the subnet lock held exclusively
+ */
+static int dfsssp_publish(void *context)
+{
+	dfsssp_context_t *dfsssp_ctx = (dfsssp_context_t *) context;
+
+	vltable_dealloc(&(dfsssp_ctx->path_sl_table));
+	free(dfsssp_ctx->path_sl_split_count);
+
+	dfsssp_ctx->path_sl_table = dfsssp_ctx->srcdest2vl_table;
+	dfsssp_ctx->path_sl_split_count = dfsssp_ctx->vl_split_count;
+	dfsssp_ctx->srcdest2vl_table = NULL;
+	dfsssp_ctx->vl_split_count = NULL;
+
+	return 0;
+}
+
 static void delete(void *context)
 {
+	dfsssp_context_t *dfsssp_ctx = (dfsssp_context_t *) context;
+
 	if (!context)
 		return;
 	dfsssp_context_destroy(context);
 
+	vltable_dealloc(&(dfsssp_ctx->path_sl_table));
+	free(dfsssp_ctx->path_sl_split_count);
+
 	free(context);
 }
 
@@ -2750,6 +3215,7 @@ int osm_ucast_dfsssp_setup(struct osm_routing_engine *r, osm_opensm_t * p_osm)
 	r->ucast_build_fwd_tables = dfsssp_do_dijkstra_routing;
 	r->mcast_build_stree = dfsssp_do_mcast_routing;
 	r->path_sl = get_dfsssp_sl;
+	r->ucast_publish = dfsssp_publish;
 	r->destroy = delete;
 
 	/* we initialize with the current time to achieve a 'good' randomized
@@ -55,6 +55,7 @@
 #define FILE_ID OSM_FILE_UCAST_FTREE_C
 #include <opensm/osm_opensm.h>
 #include <opensm/osm_switch.h>
+#include <opensm/osm_parallel.h>
 
 /*
  * FatTree rank is bounded between 2 and 8:
@@ -124,8 +125,7 @@ typedef struct ftree_port_t_ {
 	cl_map_item_t map_item;
 	uint8_t port_num;	/* port number on the current node */
 	uint8_t remote_port_num;	/* port number on the remote node */
-	uint32_t counter_up;	/* number of allocated routes upwards */
-	uint32_t counter_down;	/* number of allocated routes downwards */
+	uint32_t counters_idx;	/* route counters in ftree_load_t */
 } ftree_port_t;
 
 /***************************************************
@@ -154,8 +154,7 @@ typedef struct ftree_port_group_t_ {
 	cl_ptr_vector_t ports;	/* vector of ports to the same lid */
 	boolean_t is_cn;	/* whether this port is a compute node */
 	boolean_t is_io;	/* whether this port is an I/O node */
-	uint32_t counter_down;	/* number of allocated routes downwards */
-	uint32_t counter_up;	/* number of allocated routes upwards */
+	uint32_t counters_idx;	/* route counters in ftree_load_t */
 } ftree_port_group_t;
 
 /***************************************************
@@ -177,11 +176,67 @@ typedef struct ftree_sw_t_ {
 	ftree_port_group_t **up_port_groups;
 	uint8_t up_port_groups_num;
 	boolean_t is_leaf;
-	unsigned down_port_groups_idx;
 	uint8_t *hops;
+	uint32_t load_idx;	/* index of the switch in ftree_load_t */
+	uint32_t counters_idx;	/* first route counter of the switch */
+	uint32_t counters_num;
+} ftree_sw_t;
+
+/***************************************************
+ **
+ **  ftree_load_t definition
+ **
+ ***************************************************/
+
+/* The route counters of a port or port group: the number of allocated
+   routes upwards and downwards */
+#define FTREE_COUNTER_UP(p_load, p) ((p_load)->counters[(p)->counters_idx])
+#define FTREE_COUNTER_DOWN(p_load, p) \
+	((p_load)->counters[(p)->counters_idx + 1])
+
+typedef struct ftree_sw_load_t_ {
+	ftree_port_group_t **down_port_groups;	/* in load order */
+	ftree_port_group_t **sibling_port_groups;	/* in load order */
+	ftree_port_group_t **up_port_groups;	/* in load order */
+	unsigned down_port_groups_idx;
 	uint32_t min_counter_down;
 	boolean_t counter_up_changed;
-} ftree_sw_t;
+	boolean_t touched;	/* changed by the current destination */
+} ftree_sw_load_t;
+
+/* The route counters and the load order of the port groups of all the
+   switches.  The sequential routing works on the load of the fabric, whose
+   group arrays are the ones of the switches.  With ftree_batch_size > 1
+   every routing thread routes on a copy of it that is reset after each
+   destination, and adds up the increments of the counters in delta. */
+typedef struct ftree_load_t_ {
+	uint32_t *counters;	/* indexed by counters_idx */
+	ftree_sw_load_t *sw;	/* indexed by load_idx */
+	/* copies only */
+	ftree_port_group_t **groups;	/* storage of the group arrays */
+	uint32_t *delta;	/* counter increments, like counters */
+	unsigned *idx_delta;	/* down_port_groups_idx increments */
+	uint32_t *touched;	/* load_idx of the touched switches */
+	uint32_t touched_num;
+	unsigned batch;		/* batch the copy was made for */
+} ftree_load_t;
+
+/* An upgoing port group and port of a main path */
+typedef struct ftree_hop_t_ {
+	ftree_port_group_t *p_group;
+	ftree_port_t *p_port;
+} ftree_hop_t;
+
+/* A destination whose forwarding entry on the switch it is attached to
+   is set, and that remains to be routed through the rest of the fabric */
+typedef struct ftree_target_t_ {
+	ftree_sw_t *p_sw;
+	uint16_t lid;
+	boolean_t is_main_path;
+	boolean_t is_target_a_sw;
+	uint8_t current_hops;
+	ftree_hop_t main_path[FAT_TREE_MAX_RANK];	/* if is_main_path */
+} ftree_target_t;
 
 /***************************************************
  **
@@ -221,6 +276,29 @@ typedef struct ftree_fabric_t_ {
 	uint16_t max_cn_per_leaf;
 	uint16_t lft_max_lid;
 	boolean_t fabric_built;
+	ftree_load_t load;
+	ftree_sw_t **load_sw;	/* switches by load_idx */
+	uint32_t load_sw_num;
+	uint32_t counters_num;
+	ftree_load_t *thread_loads;	/* one copy of load per thread */
+	unsigned num_threads;
+	ftree_target_t *batch;
+	uint32_t batch_size;
+	uint32_t batch_num;
+	unsigned batch_id;
+	/* ftree_incremental_reroute: the routes of the last routing */
+	boolean_t reroute_valid;
+	boolean_t incremental;	/* only the flagged LIDs are rerouted */
+	uint16_t reroute_max_lid;
+	uint16_t reroute_max_reverse_hops;
+	boolean_t reroute_connect_roots;
+	unsigned reroute_ca_ports;
+	uint8_t *lfts;		/* LFTs of all the switches, by load_idx */
+	uint8_t *reroute_lid;	/* LIDs routed through a failed link */
+	ftree_hop_t *main_paths;	/* FAT_TREE_MAX_RANK hops per LID */
+	uint8_t *main_path_len;	/* > FAT_TREE_MAX_RANK if hops were lost */
+	ftree_hop_t *old_main_paths;	/* of the flagged LIDs, on a reroute */
+	uint8_t *old_main_path_len;
 } ftree_fabric_t;
 
 static inline osm_subn_t *ftree_get_subnet(IN ftree_fabric_t * p_ftree)
@@ -2034,30 +2112,51 @@ static void set_sw_fwd_table(IN cl_map_item_t * const p_map_item,
 /***************************************************
  ***************************************************/
 
+/*
+ * Function: Returns the load state of a switch that is about to change
+ * Given   : A load and a switch
+ * On the copy of a routing thread, the switch is remembered so that
+ * its state can be reset once the destination is routed.
+ */
+static inline ftree_sw_load_t *sw_get_load(ftree_load_t * p_load,
+					   ftree_sw_t * p_sw)
+{
+	ftree_sw_load_t *p_sw_load = &p_load->sw[p_sw->load_idx];
+
+	if (p_load->touched && !p_sw_load->touched) {
+		p_sw_load->touched = TRUE;
+		p_load->touched[p_load->touched_num++] = p_sw->load_idx;
+	}
+	return p_sw_load;
+}
+
 /*
  * Function: Finds the least loaded port group and stores its counter
- * Given   : A switch
+ * Given   : A load and a switch
  */
-static inline void recalculate_min_counter_down(ftree_sw_t * p_sw)
+static inline void recalculate_min_counter_down(ftree_load_t * p_load,
+						ftree_sw_t * p_sw)
 {
 	uint32_t min = (1 << 30);
 	uint32_t i;
 	for (i = 0; i < p_sw->down_port_groups_num; i++) {
-		if (p_sw->down_port_groups[i]->counter_down < min) {
-			min = p_sw->down_port_groups[i]->counter_down;
+		if (FTREE_COUNTER_DOWN(p_load, p_sw->down_port_groups[i]) < min) {
+			min = FTREE_COUNTER_DOWN(p_load,
+						 p_sw->down_port_groups[i]);
 		}
 	}
-	p_sw->min_counter_down = min;
+	sw_get_load(p_load, p_sw)->min_counter_down = min;
 	return;
 }
 
 /*
  * Function: Return the counter value of the least loaded down port group
- * Given   : A switch
+ * Given   : A load and a switch
  */
-static inline uint32_t find_lowest_loaded_group_on_sw(ftree_sw_t * p_sw)
+static inline uint32_t find_lowest_loaded_group_on_sw(ftree_load_t * p_load,
+						      ftree_sw_t * p_sw)
 {
-	return p_sw->min_counter_down;
+	return p_load->sw[p_sw->load_idx].min_counter_down;
 }
 
 /*
@@ -2068,10 +2167,12 @@ static inline uint32_t find_lowest_loaded_group_on_sw(ftree_sw_t * p_sw)
  * This way, it prefers the switch from where it will be easier to go down (creating upward routes).
  * If both are equal, it picks the lowest INDEX to be deterministic.
  */
-static inline int port_group_compare_load_down(const ftree_port_group_t * p1,
+static inline int port_group_compare_load_down(ftree_load_t * p_load,
+					       const ftree_port_group_t * p1,
 					       const ftree_port_group_t * p2)
 {
-	int temp = p1->counter_down - p2->counter_down;
+	int temp = FTREE_COUNTER_DOWN(p_load, p1) -
+	    FTREE_COUNTER_DOWN(p_load, p2);
 	if (temp > 0)
 		return 1;
 	if (temp < 0)
@@ -2080,9 +2181,11 @@ static inline int port_group_compare_load_down(const ftree_port_group_t * p1,
 	/* Find the less loaded remote sw and choose this one */
 	do {
 		uint32_t load1 =
-		    find_lowest_loaded_group_on_sw(p1->remote_hca_or_sw.p_sw);
+		    find_lowest_loaded_group_on_sw(p_load,
+						   p1->remote_hca_or_sw.p_sw);
 		uint32_t load2 =
-		    find_lowest_loaded_group_on_sw(p2->remote_hca_or_sw.p_sw);
+		    find_lowest_loaded_group_on_sw(p_load,
+						   p2->remote_hca_or_sw.p_sw);
 		temp = load1 - load2;
 		if (temp > 0)
 			return 1;
@@ -2091,10 +2194,11 @@ static inline int port_group_compare_load_down(const ftree_port_group_t * p1,
 	return compare_port_groups_by_remote_switch_index(&p1, &p2);
 }
 
-static inline int port_group_compare_load_up(const ftree_port_group_t * p1,
+static inline int port_group_compare_load_up(ftree_load_t * p_load,
+                                             const ftree_port_group_t * p1,
                                              const ftree_port_group_t * p2)
 {
-        int temp = p1->counter_up - p2->counter_up;
+        int temp = FTREE_COUNTER_UP(p_load, p1) - FTREE_COUNTER_UP(p_load, p2);
         if (temp > 0)
                 return 1;
         if (temp < 0)
@@ -2106,7 +2210,8 @@ static inline int port_group_compare_load_up(const ftree_port_group_t * p1,
 
 /*
  * Function: Sorts an array of port group by up load order
- * Given   : A port group array and its length
+ * Given   : A load, the load state of the switch owning the port group
+ *           array, the array and its length
  * As the list is mostly sorted, we used a bubble sort instead of qsort
  * as it is much faster.
  *
@@ -2117,7 +2222,8 @@ static inline int port_group_compare_load_up(const ftree_port_group_t * p1,
  * and cost a great deal to performances.
  */
 static inline void
-bubble_sort_up(ftree_port_group_t ** p_group_array, uint32_t nmemb)
+bubble_sort_up(ftree_load_t * p_load, ftree_sw_load_t * p_sw_load,
+	       ftree_port_group_t ** p_group_array, uint32_t nmemb)
 {
 	uint32_t i = 0;
 	uint32_t j = 0;
@@ -2125,7 +2231,7 @@ bubble_sort_up(ftree_port_group_t ** p_group_array, uint32_t nmemb)
 
 	/* As this function is a great number of times, we only go into the loop
 	 * if one of the port counters has changed, thus saving some tests */
-	if (tmp->hca_or_sw.p_sw->counter_up_changed == FALSE) {
+	if (p_sw_load->counter_up_changed == FALSE) {
 		return;
 	}
 	/* While we did modifications on the array order */
@@ -2137,7 +2243,7 @@ bubble_sort_up(ftree_port_group_t ** p_group_array, uint32_t nmemb)
 		/* Comparing elements j and j-1 */
 		for (j = 1; j < (nmemb - i); j++) {
 			/* If they are the wrong way around */
-			if (port_group_compare_load_up(p_group_array[j],
+			if (port_group_compare_load_up(p_load, p_group_array[j],
 						       p_group_array[j - 1]) < 0) {
 				/* We invert them */
 				tmp = p_group_array[j - 1];
@@ -2150,11 +2256,12 @@ bubble_sort_up(ftree_port_group_t ** p_group_array, uint32_t nmemb)
 
 	/* We have reordered the array so as long noone changes the counter
 	 * it's not necessary to do it again */
-	p_group_array[0]->hca_or_sw.p_sw->counter_up_changed = FALSE;
+	p_sw_load->counter_up_changed = FALSE;
 }
 
 static inline void
-bubble_sort_siblings(ftree_port_group_t ** p_group_array, uint32_t nmemb)
+bubble_sort_siblings(ftree_load_t * p_load,
+		     ftree_port_group_t ** p_group_array, uint32_t nmemb)
 {
 	uint32_t i = 0;
 	uint32_t j = 0;
@@ -2169,7 +2276,7 @@ bubble_sort_siblings(ftree_port_group_t ** p_group_array, uint32_t nmemb)
 		/* Comparing elements j and j-1 */
 		for (j = 1; j < (nmemb - i); j++) {
 			/* If they are the wrong way around */
-			if (port_group_compare_load_up(p_group_array[j],
+			if (port_group_compare_load_up(p_load, p_group_array[j],
 						       p_group_array[j - 1]) < 0) {
 				/* We invert them */
 				tmp = p_group_array[j - 1];
@@ -2183,7 +2290,7 @@ bubble_sort_siblings(ftree_port_group_t ** p_group_array, uint32_t nmemb)
 /*
  * Function: Sorts an array of port group. Order is decide through
  * port_group_compare_load_down ( up counters, least load remote switch, biggest GUID)
- * Given   : A port group array and its length. Each port group points to a remote switch (not a HCA)
+ * Given   : A load, a port group array and its length. Each port group points to a remote switch (not a HCA)
  * As the list is mostly sorted, we used a bubble sort instead of qsort
  * as it is much faster.
  *
@@ -2194,7 +2301,8 @@ bubble_sort_siblings(ftree_port_group_t ** p_group_array, uint32_t nmemb)
  * and cost a great deal to performances.
  */
 static inline void
-bubble_sort_down(ftree_port_group_t ** p_group_array, uint32_t nmemb)
+bubble_sort_down(ftree_load_t * p_load,
+		 ftree_port_group_t ** p_group_array, uint32_t nmemb)
 {
 	uint32_t i = 0;
 	uint32_t j = 0;
@@ -2210,7 +2318,7 @@ bubble_sort_down(ftree_port_group_t ** p_group_array, uint32_t nmemb)
 		for (j = 1; j < (nmemb - i); j++) {
 			/* If they are the wrong way around */
 			if (port_group_compare_load_down
-			    (p_group_array[j], p_group_array[j - 1]) < 0) {
+			    (p_load, p_group_array[j], p_group_array[j - 1]) < 0) {
 				/* We invert them */
 				tmp = p_group_array[j - 1];
 				p_group_array[j - 1] = p_group_array[j];
@@ -2221,6 +2329,35 @@ bubble_sort_down(ftree_port_group_t ** p_group_array, uint32_t nmemb)
 	}
 }
 
+/*
+ * Function: Finds the port of a port group with the least downgoing routes
+ * Given   : A load and a port group
+ * The first of the least loaded ports in indexing order is returned.
+ */
+static inline ftree_port_t *port_group_get_min_port_down(ftree_load_t * p_load,
+							 ftree_port_group_t *
+							 p_group)
+{
+	ftree_port_t *p_port;
+	ftree_port_t *p_min_port = NULL;
+	uint16_t j, ports_num;
+
+	ports_num = (uint16_t) cl_ptr_vector_get_size(&p_group->ports);
+	for (j = 0; j < ports_num; j++) {
+		cl_ptr_vector_at(&p_group->ports, j, (void *)&p_port);
+		if (!p_min_port) {
+			/* first port that we're checking - use
+			   it as a port with the lowest load */
+			p_min_port = p_port;
+		} else if (FTREE_COUNTER_DOWN(p_load, p_port) <
+			   FTREE_COUNTER_DOWN(p_load, p_min_port)) {
+			/* this port is less loaded - use it as min */
+			p_min_port = p_port;
+		}
+	}
+	return p_min_port;
+}
+
 /***************************************************
  ***************************************************/
 
@@ -2239,6 +2376,7 @@ bubble_sort_down(ftree_port_group_t ** p_group_array, uint32_t nmemb)
 
 static boolean_t
 fabric_route_upgoing_by_going_down(IN ftree_fabric_t * p_ftree,
+				   IN ftree_load_t * p_load,
 				   IN ftree_sw_t * p_sw,
 				   IN ftree_sw_t * p_prev_sw,
 				   IN uint16_t target_lid,
@@ -2247,6 +2385,7 @@ fabric_route_upgoing_by_going_down(IN ftree_fabric_t * p_ftree,
 				   IN uint8_t current_hops)
 {
 	ftree_sw_t *p_remote_sw;
+	ftree_sw_load_t *p_sw_load;
 	uint16_t ports_num;
 	ftree_port_group_t *p_group;
 	ftree_port_t *p_port;
@@ -2261,11 +2400,14 @@ fabric_route_upgoing_by_going_down(IN ftree_fabric_t * p_ftree,
 	if (p_sw->down_port_groups_num == 0)
 		return FALSE;
 
+	p_sw_load = sw_get_load(p_load, p_sw);
+
 	/* foreach down-going port group (in load order) */
-	bubble_sort_up(p_sw->down_port_groups, p_sw->down_port_groups_num);
+	bubble_sort_up(p_load, p_sw_load, p_sw_load->down_port_groups,
+		       p_sw->down_port_groups_num);
 
 	if (p_sw->sibling_port_groups_num > 0)
-		bubble_sort_siblings(p_sw->sibling_port_groups,
+		bubble_sort_siblings(p_load, p_sw_load->sibling_port_groups,
 				     p_sw->sibling_port_groups_num);
 
 	for (k = 0;
@@ -2274,12 +2416,12 @@ fabric_route_upgoing_by_going_down(IN ftree_fabric_t * p_ftree,
 	      ((target_lid != 0) ? p_sw->sibling_port_groups_num : 0)); k++) {
 
 		if (k < p_sw->down_port_groups_num) {
-			p_group = p_sw->down_port_groups[k];
+			p_group = p_sw_load->down_port_groups[k];
 		} else {
 			p_group =
-			    p_sw->sibling_port_groups[k -
-						      p_sw->
-						      down_port_groups_num];
+			    p_sw_load->sibling_port_groups[k -
+							   p_sw->
+							   down_port_groups_num];
 		}
 
 		/* If this port group doesn't point to a switch, mark
@@ -2309,7 +2451,8 @@ fabric_route_upgoing_by_going_down(IN ftree_fabric_t * p_ftree,
 			/* first port that we're checking - set as port with the lowest load */
 			/* or this port is less loaded - use it as min */
 			if (!p_min_port ||
-			    p_port->counter_up < p_min_port->counter_up)
+			    FTREE_COUNTER_UP(p_load, p_port) <
+			    FTREE_COUNTER_UP(p_load, p_min_port))
 				p_min_port = p_port;
 		}
 		/* At this point we have selected a port in this group with the
@@ -2369,7 +2512,7 @@ fabric_route_upgoing_by_going_down(IN ftree_fabric_t * p_ftree,
 
 		/* Recursion step:
 		   Assign upgoing ports by stepping down, starting on REMOTE switch */
-		routed = fabric_route_upgoing_by_going_down(p_ftree, p_remote_sw,	/* remote switch - used as a route-upgoing alg. start point */
+		routed = fabric_route_upgoing_by_going_down(p_ftree, p_load, p_remote_sw,	/* remote switch - used as a route-upgoing alg. start point */
 							    NULL,	/* prev. position - NULL to mark that we went down and not up */
 							    target_lid,	/* LID that we're routing to */
 							    is_main_path,	/* whether this is path to HCA that should by tracked by counters */
@@ -2378,9 +2521,9 @@ fabric_route_upgoing_by_going_down(IN ftree_fabric_t * p_ftree,
 		created_route |= routed;
 		/* Counters are promoted only if a route toward a node is created */
 		if (routed) {
-			p_min_port->counter_up++;
-			p_group->counter_up++;
-			p_group->hca_or_sw.p_sw->counter_up_changed = TRUE;
+			FTREE_COUNTER_UP(p_load, p_min_port)++;
+			FTREE_COUNTER_UP(p_load, p_group)++;
+			p_sw_load->counter_up_changed = TRUE;
 		}
 	}
 	/* done scanning all the down-going port groups */
@@ -2389,7 +2532,8 @@ fabric_route_upgoing_by_going_down(IN ftree_fabric_t * p_ftree,
 	   indicates which group should we start with when
 	   going through all the downgoing groups */
 	if (created_route)
-		p_sw->down_port_groups_idx = (p_sw->down_port_groups_idx + 1)
+		p_sw_load->down_port_groups_idx =
+		    (p_sw_load->down_port_groups_idx + 1)
 		    % p_sw->down_port_groups_num;
 
 	return created_route;
@@ -2397,6 +2541,43 @@ fabric_route_upgoing_by_going_down(IN ftree_fabric_t * p_ftree,
 
 /***************************************************/
 
+/*
+ * Keeps the main path hops of a LID for ftree_incremental_reroute, which
+ * takes them off the counters when the LID is routed again.  A LID is
+ * only routed by one thread at a time.
+ */
+static void fabric_record_main_hop(IN ftree_fabric_t * p_ftree,
+				   IN uint16_t target_lid,
+				   IN ftree_port_group_t * p_group,
+				   IN ftree_port_t * p_port)
+{
+	ftree_hop_t *p_hop;
+	uint8_t *p_len;
+
+	if (!p_ftree->main_paths || target_lid == 0)
+		return;
+
+	p_len = &p_ftree->main_path_len[target_lid];
+	if (*p_len < FAT_TREE_MAX_RANK) {
+		p_hop = &p_ftree->main_paths[target_lid * FAT_TREE_MAX_RANK +
+					     *p_len];
+		p_hop->p_group = p_group;
+		p_hop->p_port = p_port;
+	}
+	if (*p_len <= FAT_TREE_MAX_RANK)
+		(*p_len)++;
+}
+
+/* for the counters of a LID that are not on a hop of its main path */
+static inline void fabric_lose_main_path(IN ftree_fabric_t * p_ftree,
+					 IN uint16_t target_lid)
+{
+	if (p_ftree->main_paths && target_lid != 0)
+		p_ftree->main_path_len[target_lid] = FAT_TREE_MAX_RANK + 1;
+}
+
+/***************************************************/
+
 /*
  * Function: assign-down-going-port-by-ascending-up
  * Given   : a switch and a LID
@@ -2410,6 +2591,7 @@ fabric_route_upgoing_by_going_down(IN ftree_fabric_t * p_ftree,
 
 static boolean_t
 fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
+				   IN ftree_load_t * p_load,
 				   IN ftree_sw_t * p_sw,
 				   IN ftree_sw_t * p_prev_sw,
 				   IN uint16_t target_lid,
@@ -2417,9 +2599,11 @@ fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
 				   IN boolean_t is_target_a_sw,
 				   IN uint16_t reverse_hop_credit,
 				   IN uint16_t reverse_hops,
-				   IN uint8_t current_hops)
+				   IN uint8_t current_hops,
+				   IN const ftree_hop_t * p_main_hop)
 {
 	ftree_sw_t *p_remote_sw;
+	ftree_sw_load_t *p_sw_load;
 	uint16_t ports_num;
 	ftree_port_group_t *p_group;
 	ftree_port_t *p_port;
@@ -2432,25 +2616,27 @@ fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
 
 
 	/* Assign upgoing ports by stepping down, starting on THIS switch */
-	created_route = fabric_route_upgoing_by_going_down(p_ftree, p_sw,	/* local switch - used as a route-upgoing alg. start point */
+	created_route = fabric_route_upgoing_by_going_down(p_ftree, p_load, p_sw,	/* local switch - used as a route-upgoing alg. start point */
 							   p_prev_sw,	/* switch that we went up from (NULL means that we went down) */
 							   target_lid,	/* LID that we're routing to */
 							   is_main_path,	/* whether this path to HCA should by tracked by counters */
 							   is_target_a_sw,	/* Whether target lid is a switch or not */
 							   current_hops);	/* Number of hops done up to this point */
 
+	p_sw_load = sw_get_load(p_load, p_sw);
+
 	/* recursion stop condition - if it's a root switch, */
 	if (p_sw->rank == 0) {
 		if (reverse_hop_credit > 0) {
 			/* We go up by going down as we have some reverse_hop_credit left */
 			/* We use the index to scatter a bit the reverse up routes */
-			p_sw->down_port_groups_idx =
-			    (p_sw->down_port_groups_idx +
+			p_sw_load->down_port_groups_idx =
+			    (p_sw_load->down_port_groups_idx +
 			     1) % p_sw->down_port_groups_num;
-			i = p_sw->down_port_groups_idx;
+			i = p_sw_load->down_port_groups_idx;
 			for (j = 0; j < p_sw->down_port_groups_num; j++) {
 
-				p_group = p_sw->down_port_groups[i];
+				p_group = p_sw_load->down_port_groups[i];
 				i = (i + 1) % p_sw->down_port_groups_num;
 
 				/* Skip this port group unless it points to a switch */
@@ -2459,7 +2645,7 @@ fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
 					continue;
 				p_remote_sw = p_group->remote_hca_or_sw.p_sw;
 
-				created_route |= fabric_route_downgoing_by_going_up(p_ftree, p_remote_sw,	/* remote switch - used as a route-downgoing alg. next step point */
+				created_route |= fabric_route_downgoing_by_going_up(p_ftree, p_load, p_remote_sw,	/* remote switch - used as a route-downgoing alg. next step point */
 										    p_sw,	/* this switch - prev. position switch for the function */
 										    target_lid,	/* LID that we're routing to */
 										    is_main_path,	/* whether this is path to HCA that should by tracked by counters */
@@ -2468,7 +2654,8 @@ fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
 										    reverse_hops + 1,	/* Number of reverse_hops done up to this point */
 										    current_hops
 										    +
-										    1);
+										    1,
+										    NULL);
 			}
 
 		}
@@ -2477,22 +2664,18 @@ fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
 
 	/* We should generate a list of port sorted by load so we can find easily the least
 	 * going port and explore the other pots on secondary routes more easily (and quickly) */
-	bubble_sort_down(p_sw->up_port_groups, p_sw->up_port_groups_num);
-
-	p_min_group = p_sw->up_port_groups[0];
-	/* Find the least loaded upgoing port in the selected group */
-	p_min_port = NULL;
-	ports_num = (uint16_t) cl_ptr_vector_get_size(&p_min_group->ports);
-	for (j = 0; j < ports_num; j++) {
-		cl_ptr_vector_at(&p_min_group->ports, j, (void *)&p_port);
-		if (!p_min_port) {
-			/* first port that we're checking - use
-			   it as a port with the lowest load */
-			p_min_port = p_port;
-		} else if (p_port->counter_down < p_min_port->counter_down) {
-			/* this port is less loaded - use it as min */
-			p_min_port = p_port;
-		}
+	bubble_sort_down(p_load, p_sw_load->up_port_groups,
+			 p_sw->up_port_groups_num);
+
+	if (p_main_hop) {
+		/* the main path was chosen when the target was queued,
+		   see fabric_plan_main_path() */
+		p_min_group = p_main_hop->p_group;
+		p_min_port = p_main_hop->p_port;
+	} else {
+		p_min_group = p_sw_load->up_port_groups[0];
+		/* Find the least loaded upgoing port in the selected group */
+		p_min_port = port_group_get_min_port_down(p_load, p_min_group);
 	}
 
 	/* At this point we have selected a group and port with the
@@ -2535,16 +2718,20 @@ fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
 				tuple_to_str(p_remote_sw->tuple));
 		}
 		/* The number of downgoing routes is tracked in the
-		   p_group->counter_down p_port->counter_down counters of the
-		   group and port that belong to the lower side of the link
+		   FTREE_COUNTER_DOWN counters of the group and port
+		   that belong to the lower side of the link
 		   (on switch with higher rank) */
-		p_min_group->counter_down++;
-		p_min_port->counter_down++;
-		if (p_min_group->counter_down ==
-		    (p_min_group->remote_hca_or_sw.p_sw->min_counter_down +
+		FTREE_COUNTER_DOWN(p_load, p_min_group)++;
+		FTREE_COUNTER_DOWN(p_load, p_min_port)++;
+		fabric_record_main_hop(p_ftree, target_lid, p_min_group,
+				       p_min_port);
+		if (FTREE_COUNTER_DOWN(p_load, p_min_group) ==
+		    (find_lowest_loaded_group_on_sw(p_load,
+						    p_min_group->
+						    remote_hca_or_sw.p_sw) +
 		     1)) {
 			recalculate_min_counter_down
-			    (p_min_group->remote_hca_or_sw.p_sw);
+			    (p_load, p_min_group->remote_hca_or_sw.p_sw);
 		}
 
 		/* This LID may already be in the LFT in the reverse_hop feature is used */
@@ -2572,7 +2759,7 @@ fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
 						      is_target_a_sw);
 		}
 	/* Recursion step: Assign downgoing ports by stepping up, starting on REMOTE switch. */
-	created_route |= fabric_route_downgoing_by_going_up(p_ftree,
+	created_route |= fabric_route_downgoing_by_going_up(p_ftree, p_load,
 							    p_remote_sw,	/* remote switch - used as a route-downgoing alg. next step point */
 							    p_sw,		/* this switch - prev. position switch for the function */
 							    target_lid,		/* LID that we're routing to */
@@ -2580,7 +2767,8 @@ fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
 							    is_target_a_sw,	/* Whether target lid is a switch or not */
 							    reverse_hop_credit,	/* Remaining reverse_hops allowed */
 							    reverse_hops,	/* Number of reverse_hops done up to this point */
-							    current_hops + 1);
+							    current_hops + 1,
+							    p_main_hop ? p_main_hop + 1 : NULL);	/* Rest of the chosen main path */
 	}
 
 	/* What's left to do at this point:
@@ -2615,10 +2803,14 @@ fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
 	 *         - go UP(TRUE,FALSE) to the remote switch
 	 */
 
-	for (i = is_main_path ? 1 : 0; i < p_sw->up_port_groups_num; i++) {
-		p_group = p_sw->up_port_groups[i];
+	for (i = 0; i < p_sw->up_port_groups_num; i++) {
+		p_group = p_sw_load->up_port_groups[i];
 		p_remote_sw = p_group->remote_hca_or_sw.p_sw;
 
+		/* skip the main path */
+		if (is_main_path && p_group == p_min_group)
+			continue;
+
 		/* skip if target lid has been already set on remote switch fwd tbl (with a bigger hop count) */
 		if (p_remote_sw->p_osm_sw->new_lft[target_lid] != OSM_NO_PATH)
 			if (current_hops + 1 >=
@@ -2648,8 +2840,8 @@ fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
 				/* first port that we're checking - use
 				   it as a port with the lowest load */
 				p_min_port = p_port;
-			} else if (p_port->counter_down <
-				   p_min_port->counter_down) {
+			} else if (FTREE_COUNTER_DOWN(p_load, p_port) <
+				   FTREE_COUNTER_DOWN(p_load, p_min_port)) {
 				/* this port is less loaded - use it as min */
 				p_min_port = p_port;
 			}
@@ -2667,24 +2859,25 @@ fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
 
 		/* Recursion step:
 		   Assign downgoing ports by stepping up, starting on REMOTE switch. */
-		routed = fabric_route_downgoing_by_going_up(p_ftree, p_remote_sw,	/* remote switch - used as a route-downgoing alg. next step point */
+		routed = fabric_route_downgoing_by_going_up(p_ftree, p_load, p_remote_sw,	/* remote switch - used as a route-downgoing alg. next step point */
 							    p_sw,	/* this switch - prev. position switch for the function */
 							    target_lid,	/* LID that we're routing to */
 							    FALSE,	/* whether this is path to HCA that should by tracked by counters */
 							    is_target_a_sw,	/* Whether target lid is a switch or not */
 							    reverse_hop_credit,	/* Remaining reverse_hops allowed */
 							    reverse_hops,	/* Number of reverse_hops done up to this point */
-							    current_hops + 1);
+							    current_hops + 1,
+							    NULL);
 		created_route |= routed;
 	}
 
 	/* Now doing the same thing with horizontal links */
 	if (p_sw->sibling_port_groups_num > 0)
-		bubble_sort_down(p_sw->sibling_port_groups,
+		bubble_sort_down(p_load, p_sw_load->sibling_port_groups,
 				 p_sw->sibling_port_groups_num);
 
 	for (i = 0; i < p_sw->sibling_port_groups_num; i++) {
-		p_group = p_sw->sibling_port_groups[i];
+		p_group = p_sw_load->sibling_port_groups[i];
 		p_remote_sw = p_group->remote_hca_or_sw.p_sw;
 
 		/* skip if target lid has been already set on remote switch fwd tbl (with a bigger hop count) */
@@ -2715,8 +2908,8 @@ fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
 				/* first port that we're checking - use
 				   it as a port with the lowest load */
 				p_min_port = p_port;
-			} else if (p_port->counter_down <
-				   p_min_port->counter_down) {
+			} else if (FTREE_COUNTER_DOWN(p_load, p_port) <
+				   FTREE_COUNTER_DOWN(p_load, p_min_port)) {
 				/* this port is less loaded - use it as min */
 				p_min_port = p_port;
 			}
@@ -2734,18 +2927,20 @@ fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
 
 		/* Recursion step:
 		   Assign downgoing ports by stepping up, starting on REMOTE switch. */
-		routed = fabric_route_downgoing_by_going_up(p_ftree, p_remote_sw,	/* remote switch - used as a route-downgoing alg. next step point */
+		routed = fabric_route_downgoing_by_going_up(p_ftree, p_load, p_remote_sw,	/* remote switch - used as a route-downgoing alg. next step point */
 							    p_sw,	/* this switch - prev. position switch for the function */
 							    target_lid,	/* LID that we're routing to */
 							    FALSE,	/* whether this is path to HCA that should by tracked by counters */
 							    is_target_a_sw,	/* Whether target lid is a switch or not */
 							    reverse_hop_credit,	/* Remaining reverse_hops allowed */
 							    reverse_hops,	/* Number of reverse_hops done up to this point */
-							    current_hops + 1);
+							    current_hops + 1,
+							    NULL);
 		created_route |= routed;
 		if (routed) {
-			p_min_group->counter_down++;
-			p_min_port->counter_down++;
+			FTREE_COUNTER_DOWN(p_load, p_min_group)++;
+			FTREE_COUNTER_DOWN(p_load, p_min_port)++;
+			fabric_lose_main_path(p_ftree, target_lid);
 		}
 	}
 
@@ -2761,7 +2956,7 @@ fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
 	/* They already have a route to us from the upgoing_by_going_down started earlier */
 	/* This is only so it'll continue exploring up, after this step backwards */
 	for (i = 0; i < p_sw->down_port_groups_num; i++) {
-		p_group = p_sw->down_port_groups[i];
+		p_group = p_sw_load->down_port_groups[i];
 		p_remote_sw = p_group->remote_hca_or_sw.p_sw;
 
 		/* Skip this port group unless it points to a switch */
@@ -2770,7 +2965,7 @@ fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
 
 		/* Recursion step:
 		   Assign downgoing ports by stepping up, fter doing one step down starting on REMOTE switch. */
-		created_route |= fabric_route_downgoing_by_going_up(p_ftree, p_remote_sw,	/* remote switch - used as a route-downgoing alg. next step point */
+		created_route |= fabric_route_downgoing_by_going_up(p_ftree, p_load, p_remote_sw,	/* remote switch - used as a route-downgoing alg. next step point */
 								    p_sw,	/* this switch - prev. position switch for the function */
 								    target_lid,	/* LID that we're routing to */
 								    TRUE,	/* whether this is path to HCA that should by tracked by counters */
@@ -2778,7 +2973,8 @@ fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
 								    reverse_hop_credit - 1,	/* Remaining reverse_hops allowed */
 								    reverse_hops + 1,	/* Number of reverse_hops done up to this point */
 								    current_hops
-								    + 1);
+								    + 1,
+								    NULL);
 	}
 	return created_route;
 
@@ -2786,6 +2982,490 @@ fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
 
 /***************************************************/
 
+static void load_destroy(IN ftree_load_t * p_load)
+{
+	free(p_load->counters);
+	free(p_load->sw);
+	free(p_load->groups);
+	free(p_load->delta);
+	free(p_load->idx_delta);
+	free(p_load->touched);
+	memset(p_load, 0, sizeof(*p_load));
+}
+
+/***************************************************/
+
+/*
+ * Allocates a copy of the load of the fabric for a routing thread.
+ * The group arrays of the copy point into its own storage; everything
+ * else is filled in when the copy is synchronized with the fabric.
+ */
+static int load_create_copy(IN ftree_fabric_t * p_ftree,
+			    IN ftree_load_t * p_copy)
+{
+	ftree_sw_t *p_sw;
+	ftree_sw_load_t *p_sw_load;
+	uint32_t i, groups_num = 0;
+
+	for (i = 0; i < p_ftree->load_sw_num; i++) {
+		p_sw = p_ftree->load_sw[i];
+		groups_num += p_sw->down_port_groups_num +
+		    p_sw->sibling_port_groups_num + p_sw->up_port_groups_num;
+	}
+
+	p_copy->counters = malloc(p_ftree->counters_num * sizeof(uint32_t));
+	p_copy->delta = calloc(p_ftree->counters_num, sizeof(uint32_t));
+	p_copy->sw = calloc(p_ftree->load_sw_num, sizeof(ftree_sw_load_t));
+	p_copy->idx_delta = calloc(p_ftree->load_sw_num, sizeof(unsigned));
+	p_copy->touched = malloc(p_ftree->load_sw_num * sizeof(uint32_t));
+	p_copy->groups = malloc((groups_num + 1) *
+				sizeof(ftree_port_group_t *));
+	if (!p_copy->counters || !p_copy->delta || !p_copy->sw ||
+	    !p_copy->idx_delta || !p_copy->touched || !p_copy->groups) {
+		load_destroy(p_copy);
+		return -1;
+	}
+
+	groups_num = 0;
+	for (i = 0; i < p_ftree->load_sw_num; i++) {
+		p_sw = p_ftree->load_sw[i];
+		p_sw_load = &p_copy->sw[i];
+		p_sw_load->down_port_groups = p_copy->groups + groups_num;
+		groups_num += p_sw->down_port_groups_num;
+		p_sw_load->sibling_port_groups = p_copy->groups + groups_num;
+		groups_num += p_sw->sibling_port_groups_num;
+		p_sw_load->up_port_groups = p_copy->groups + groups_num;
+		groups_num += p_sw->up_port_groups_num;
+	}
+	p_copy->batch = p_ftree->batch_id - 1;
+	return 0;
+}
+
+/***************************************************/
+
+/*
+ * Sets the load state of a switch in a copy back to the one of the
+ * fabric.
+ */
+static void load_reset_sw(IN ftree_fabric_t * p_ftree,
+			  IN ftree_load_t * p_copy, IN uint32_t load_idx)
+{
+	ftree_sw_t *p_sw = p_ftree->load_sw[load_idx];
+	ftree_sw_load_t *p_sw_load = &p_copy->sw[load_idx];
+	ftree_sw_load_t *p_orig = &p_ftree->load.sw[load_idx];
+
+	memcpy(p_copy->counters + p_sw->counters_idx,
+	       p_ftree->load.counters + p_sw->counters_idx,
+	       p_sw->counters_num * sizeof(uint32_t));
+	memcpy(p_sw_load->down_port_groups, p_orig->down_port_groups,
+	       p_sw->down_port_groups_num * sizeof(ftree_port_group_t *));
+	memcpy(p_sw_load->sibling_port_groups, p_orig->sibling_port_groups,
+	       p_sw->sibling_port_groups_num * sizeof(ftree_port_group_t *));
+	memcpy(p_sw_load->up_port_groups, p_orig->up_port_groups,
+	       p_sw->up_port_groups_num * sizeof(ftree_port_group_t *));
+	p_sw_load->down_port_groups_idx = p_orig->down_port_groups_idx;
+	p_sw_load->min_counter_down = p_orig->min_counter_down;
+	p_sw_load->counter_up_changed = p_orig->counter_up_changed;
+	p_sw_load->touched = FALSE;
+}
+
+/***************************************************/
+
+/*
+ * Adds what the last destination routed on a copy changed to its
+ * increments, and resets the switches it touched.
+ */
+static void load_collect_copy(IN ftree_fabric_t * p_ftree,
+			      IN ftree_load_t * p_copy)
+{
+	ftree_sw_t *p_sw;
+	uint32_t i, c, load_idx;
+
+	for (i = 0; i < p_copy->touched_num; i++) {
+		load_idx = p_copy->touched[i];
+		p_sw = p_ftree->load_sw[load_idx];
+
+		for (c = p_sw->counters_idx;
+		     c < p_sw->counters_idx + p_sw->counters_num; c++)
+			p_copy->delta[c] += p_copy->counters[c] -
+			    p_ftree->load.counters[c];
+		if (p_sw->down_port_groups_num)
+			p_copy->idx_delta[load_idx] +=
+			    (p_copy->sw[load_idx].down_port_groups_idx +
+			     p_sw->down_port_groups_num -
+			     p_ftree->load.sw[load_idx].down_port_groups_idx) %
+			    p_sw->down_port_groups_num;
+		load_reset_sw(p_ftree, p_copy, load_idx);
+	}
+	p_copy->touched_num = 0;
+}
+
+/***************************************************/
+
+/*
+ * Adds (or, with a negative count, removes) a downgoing route on an
+ * upgoing port group and port to the route counters.
+ */
+static void load_add_hop(IN ftree_load_t * p_load,
+			 IN const ftree_hop_t * p_hop, IN int count)
+{
+	ftree_sw_t *p_remote_sw = p_hop->p_group->remote_hca_or_sw.p_sw;
+
+	sw_get_load(p_load, p_hop->p_group->hca_or_sw.p_sw);
+	FTREE_COUNTER_DOWN(p_load, p_hop->p_group) += count;
+	FTREE_COUNTER_DOWN(p_load, p_hop->p_port) += count;
+	if (count < 0 ||
+	    FTREE_COUNTER_DOWN(p_load, p_hop->p_group) ==
+	    find_lowest_loaded_group_on_sw(p_load, p_remote_sw) + 1)
+		recalculate_min_counter_down(p_load, p_remote_sw);
+}
+
+/***************************************************/
+
+static void load_add_main_path(IN ftree_load_t * p_load,
+			       IN const ftree_target_t * p_target,
+			       IN int count)
+{
+	const ftree_hop_t *p_hop;
+
+	for (p_hop = p_target->main_path;
+	     p_hop < p_target->main_path + FAT_TREE_MAX_RANK && p_hop->p_group;
+	     p_hop++)
+		load_add_hop(p_load, p_hop, count);
+}
+
+/***************************************************/
+
+static void fabric_route_batch_target(IN void *context, IN unsigned index,
+				      IN unsigned thread)
+{
+	ftree_fabric_t *p_ftree = context;
+	ftree_load_t *p_copy = &p_ftree->thread_loads[thread];
+	ftree_target_t *p_target = &p_ftree->batch[index];
+	uint32_t i;
+
+	/* the first destination of a batch on this thread brings the copy
+	   up to date with the counters the previous batches added up */
+	if (p_copy->batch != p_ftree->batch_id) {
+		for (i = 0; i < p_ftree->load_sw_num; i++)
+			load_reset_sw(p_ftree, p_copy, i);
+		p_copy->batch = p_ftree->batch_id;
+	}
+
+	/* let the target see the main paths of the targets queued before
+	   it, as if they had been routed already */
+	for (i = 0; i < index; i++)
+		if (p_ftree->batch[i].is_main_path)
+			load_add_main_path(p_copy, &p_ftree->batch[i], 1);
+
+	fabric_route_downgoing_by_going_up(p_ftree, p_copy, p_target->p_sw,
+					   NULL, p_target->lid,
+					   p_target->is_main_path,
+					   p_target->is_target_a_sw, 0, 0,
+					   p_target->current_hops,
+					   p_target->is_main_path ?
+					   p_target->main_path : NULL);
+
+	for (i = 0; i < index; i++)
+		if (p_ftree->batch[i].is_main_path)
+			load_add_main_path(p_copy, &p_ftree->batch[i], -1);
+
+	load_collect_copy(p_ftree, p_copy);
+}
+
+/***************************************************/
+
+/*
+ * Routes the queued destinations of a batch concurrently, and adds the
+ * route counter increments of all of them to the load of the fabric.
+ * Each destination is routed against the load from before the batch plus
+ * the main paths of the destinations queued before it, and the increments
+ * are added up regardless of the thread that collected them, so the routes
+ * only depend on the batch size.
+ */
+static void fabric_route_batch(IN ftree_fabric_t * p_ftree)
+{
+	ftree_load_t *p_load = &p_ftree->load;
+	ftree_load_t *p_copy;
+	ftree_sw_t *p_sw;
+	ftree_sw_load_t *p_sw_load;
+	unsigned num_threads = p_ftree->num_threads;
+	unsigned t;
+	uint32_t i, j, c;
+
+	if (!p_ftree->batch_num)
+		return;
+
+	/* the main paths were only added while they were planned */
+	for (i = p_ftree->batch_num; i > 0; i--)
+		if (p_ftree->batch[i - 1].is_main_path)
+			load_add_main_path(p_load, &p_ftree->batch[i - 1], -1);
+
+	/* tuple_to_str() formats into static buffers */
+	if (osm_log_is_active_v2(&p_ftree->p_osm->log, OSM_LOG_DEBUG,
+				 FILE_ID))
+		num_threads = 1;
+
+	osm_parallel_for(num_threads, p_ftree->batch_num,
+			 fabric_route_batch_target, p_ftree);
+	p_ftree->batch_num = 0;
+
+	for (t = 0; t < p_ftree->num_threads; t++) {
+		p_copy = &p_ftree->thread_loads[t];
+		if (p_copy->batch != p_ftree->batch_id)
+			continue;
+		for (i = 0; i < p_ftree->load_sw_num; i++) {
+			p_sw = p_ftree->load_sw[i];
+			for (j = 0; j < p_sw->down_port_groups_num; j++)
+				if (p_copy->delta[p_sw->down_port_groups[j]->
+						  counters_idx]) {
+					p_load->sw[i].counter_up_changed = TRUE;
+					break;
+				}
+		}
+		for (c = 0; c < p_ftree->counters_num; c++) {
+			p_load->counters[c] += p_copy->delta[c];
+			p_copy->delta[c] = 0;
+		}
+		for (i = 0; i < p_ftree->load_sw_num; i++) {
+			p_sw = p_ftree->load_sw[i];
+			if (p_sw->down_port_groups_num)
+				p_load->sw[i].down_port_groups_idx =
+				    (p_load->sw[i].down_port_groups_idx +
+				     p_copy->idx_delta[i]) %
+				    p_sw->down_port_groups_num;
+			p_copy->idx_delta[i] = 0;
+		}
+	}
+
+	/* Bring the load order up to date with the counters, so that
+	   the copies do not all have to sort it again */
+	for (i = 0; i < p_ftree->load_sw_num; i++)
+		recalculate_min_counter_down(p_load, p_ftree->load_sw[i]);
+	for (i = 0; i < p_ftree->load_sw_num; i++) {
+		p_sw = p_ftree->load_sw[i];
+		p_sw_load = &p_load->sw[i];
+		if (p_sw->down_port_groups_num)
+			bubble_sort_up(p_load, p_sw_load,
+				       p_sw_load->down_port_groups,
+				       p_sw->down_port_groups_num);
+		if (p_sw->sibling_port_groups_num)
+			bubble_sort_siblings(p_load,
+					     p_sw_load->sibling_port_groups,
+					     p_sw->sibling_port_groups_num);
+		if (p_sw->up_port_groups_num)
+			bubble_sort_down(p_load, p_sw_load->up_port_groups,
+					 p_sw->up_port_groups_num);
+	}
+
+	p_ftree->batch_id++;
+}
+
+/***************************************************/
+
+/*
+ * Chooses the upgoing port groups and ports of the main path of a
+ * target the way fabric_route_downgoing_by_going_up() would.  The main
+ * path decides which ports the other switches use to reach the target,
+ * so the targets of a batch choose theirs one after the other: the path
+ * is added to the load of the fabric until the batch is routed.
+ */
+static void fabric_plan_main_path(IN ftree_fabric_t * p_ftree,
+				  IN ftree_target_t * p_target)
+{
+	ftree_load_t *p_load = &p_ftree->load;
+	ftree_sw_t *p_sw = p_target->p_sw;
+	ftree_sw_load_t *p_sw_load;
+	ftree_hop_t *p_hop;
+
+	memset(p_target->main_path, 0, sizeof(p_target->main_path));
+	for (p_hop = p_target->main_path;
+	     p_sw->rank != 0 && p_hop < p_target->main_path + FAT_TREE_MAX_RANK;
+	     p_hop++) {
+		p_sw_load = &p_load->sw[p_sw->load_idx];
+		bubble_sort_down(p_load, p_sw_load->up_port_groups,
+				 p_sw->up_port_groups_num);
+		p_hop->p_group = p_sw_load->up_port_groups[0];
+		p_hop->p_port = port_group_get_min_port_down(p_load,
+							     p_hop->p_group);
+		load_add_hop(p_load, p_hop, 1);
+		p_sw = p_hop->p_group->remote_hca_or_sw.p_sw;
+	}
+}
+
+/***************************************************/
+/*
+ * Routes a destination whose LFT entry on the switch it is attached to
+ * (or, for a switch, on the switch itself) is already set, through the
+ * rest of the fabric.  With ftree_batch_size > 1 the destination is only
+ * queued; fabric_route_batch() has to be called before the counters are
+ * used by anything else.
+ */
+static void fabric_route_target(IN ftree_fabric_t * p_ftree,
+				IN ftree_sw_t * p_sw, IN uint16_t target_lid,
+				IN boolean_t is_main_path,
+				IN boolean_t is_target_a_sw,
+				IN uint16_t reverse_hop_credit,
+				IN uint8_t current_hops)
+{
+	ftree_target_t *p_target;
+
+	/* Routes with reverse hops have more than one main path, so they
+	   are routed one at a time on the load of the fabric */
+	if (p_ftree->batch && reverse_hop_credit)
+		fabric_route_batch(p_ftree);
+
+	if (!p_ftree->batch || reverse_hop_credit) {
+		fabric_route_downgoing_by_going_up(p_ftree, &p_ftree->load, p_sw,	/* local switch - used as a route-downgoing alg. start point */
+						   NULL,	/* prev. position switch */
+						   target_lid,	/* LID that we're routing to */
+						   is_main_path,	/* whether this path to HCA should by tracked by counters */
+						   is_target_a_sw,	/* whether target lid is a switch or not */
+						   reverse_hop_credit,	/* Number of reverse hops allowed */
+						   0,	/* Number of reverse hops done yet */
+						   current_hops,	/* Number of hops done yet */
+						   NULL);	/* main path - choose it on the way */
+		/* the copies of the routing threads are outdated */
+		p_ftree->batch_id++;
+		return;
+	}
+
+	p_target = &p_ftree->batch[p_ftree->batch_num++];
+	p_target->p_sw = p_sw;
+	p_target->lid = target_lid;
+	p_target->is_main_path = is_main_path;
+	p_target->is_target_a_sw = is_target_a_sw;
+	p_target->current_hops = current_hops;
+	if (is_main_path)
+		fabric_plan_main_path(p_ftree, p_target);
+
+	if (p_ftree->batch_num == p_ftree->batch_size)
+		fabric_route_batch(p_ftree);
+}
+
+/***************************************************/
+
+/*
+ * Numbers the switches and the route counters of their ports and port
+ * groups, and sets up the load the routing works on.
+ */
+static int fabric_init_load(IN ftree_fabric_t * p_ftree)
+{
+	osm_subn_t *p_subn = &p_ftree->p_osm->subn;
+	ftree_sw_t *p_sw;
+	ftree_port_group_t *p_group;
+	ftree_port_t *p_port;
+	ftree_port_group_t **groups[3];
+	uint8_t groups_num[3];
+	uint32_t i, j, k, l;
+
+	p_ftree->load_sw_num = cl_qmap_count(&p_ftree->sw_tbl);
+	p_ftree->load_sw = malloc((p_ftree->load_sw_num + 1) *
+				  sizeof(ftree_sw_t *));
+	p_ftree->load.sw = calloc(p_ftree->load_sw_num + 1,
+				  sizeof(ftree_sw_load_t));
+	if (!p_ftree->load_sw || !p_ftree->load.sw)
+		goto ERROR;
+
+	p_ftree->counters_num = 0;
+	i = 0;
+	for (p_sw = (ftree_sw_t *) cl_qmap_head(&p_ftree->sw_tbl);
+	     p_sw != (ftree_sw_t *) cl_qmap_end(&p_ftree->sw_tbl);
+	     p_sw = (ftree_sw_t *) cl_qmap_next(&p_sw->map_item)) {
+		p_sw->load_idx = i;
+		p_sw->counters_idx = p_ftree->counters_num;
+		p_ftree->load_sw[i] = p_sw;
+		p_ftree->load.sw[i].down_port_groups = p_sw->down_port_groups;
+		p_ftree->load.sw[i].sibling_port_groups =
+		    p_sw->sibling_port_groups;
+		p_ftree->load.sw[i].up_port_groups = p_sw->up_port_groups;
+
+		groups[0] = p_sw->down_port_groups;
+		groups_num[0] = p_sw->down_port_groups_num;
+		groups[1] = p_sw->sibling_port_groups;
+		groups_num[1] = p_sw->sibling_port_groups_num;
+		groups[2] = p_sw->up_port_groups;
+		groups_num[2] = p_sw->up_port_groups_num;
+		for (j = 0; j < 3; j++)
+			for (k = 0; k < groups_num[j]; k++) {
+				p_group = groups[j][k];
+				p_group->counters_idx = p_ftree->counters_num;
+				p_ftree->counters_num += 2;
+				for (l = 0;
+				     l < cl_ptr_vector_get_size(&p_group->ports);
+				     l++) {
+					cl_ptr_vector_at(&p_group->ports, l,
+							 (void *)&p_port);
+					p_port->counters_idx =
+					    p_ftree->counters_num;
+					p_ftree->counters_num += 2;
+				}
+			}
+		p_sw->counters_num = p_ftree->counters_num - p_sw->counters_idx;
+		i++;
+	}
+
+	p_ftree->load.counters = calloc(p_ftree->counters_num + 1,
+					sizeof(uint32_t));
+	if (!p_ftree->load.counters)
+		goto ERROR;
+
+	p_ftree->batch_size = p_subn->opt.ftree_batch_size;
+	if (p_ftree->batch_size <= 1)
+		return 0;
+
+	p_ftree->num_threads = osm_parallel_threads(p_subn->opt.routing_threads);
+	p_ftree->batch_id = 1;
+	p_ftree->batch = malloc(p_ftree->batch_size * sizeof(ftree_target_t));
+	p_ftree->thread_loads = calloc(p_ftree->num_threads,
+				       sizeof(ftree_load_t));
+	if (!p_ftree->batch || !p_ftree->thread_loads)
+		goto ERROR;
+	for (i = 0; i < p_ftree->num_threads; i++)
+		if (load_create_copy(p_ftree, &p_ftree->thread_loads[i]))
+			goto ERROR;
+	return 0;
+
+ERROR:
+	OSM_LOG(&p_ftree->p_osm->log, OSM_LOG_ERROR, "ERR AB34: "
+		"Cannot allocate memory for the route counters\n");
+	return -1;
+}
+
+/***************************************************/
+
+static void fabric_destroy_batch(IN ftree_fabric_t * p_ftree)
+{
+	unsigned i;
+
+	if (p_ftree->thread_loads) {
+		for (i = 0; i < p_ftree->num_threads; i++)
+			load_destroy(&p_ftree->thread_loads[i]);
+		free(p_ftree->thread_loads);
+		p_ftree->thread_loads = NULL;
+	}
+	free(p_ftree->batch);
+	p_ftree->batch = NULL;
+	p_ftree->batch_num = 0;
+	p_ftree->num_threads = 0;
+}
+
+/***************************************************/
+
+static void fabric_destroy_load(IN ftree_fabric_t * p_ftree)
+{
+	fabric_destroy_batch(p_ftree);
+	/* the group arrays of the fabric's load belong to the switches */
+	free(p_ftree->load.counters);
+	free(p_ftree->load.sw);
+	memset(&p_ftree->load, 0, sizeof(p_ftree->load));
+	free(p_ftree->load_sw);
+	p_ftree->load_sw = NULL;
+	p_ftree->load_sw_num = 0;
+}
+
+/***************************************************/
+
 /*
  * Pseudo code:
  *    foreach leaf switch (in indexing order)
@@ -2859,14 +3539,12 @@ static void fabric_route_to_cns(IN ftree_fabric_t * p_ftree)
 			/* Assign downgoing ports by stepping up.
 			   Since we're routing here only CNs, we're routing it as REAL
 			   LID and updating fat-tree balancing counters. */
-			fabric_route_downgoing_by_going_up(p_ftree, p_sw,	/* local switch - used as a route-downgoing alg. start point */
-							   NULL,	/* prev. position switch */
-							   hca_lid,	/* LID that we're routing to */
-							   TRUE,	/* whether this path to HCA should by tracked by counters */
-							   FALSE,	/* whether target lid is a switch or not */
-							   0,	/* Number of reverse hops allowed */
-							   0,	/* Number of reverse hops done yet */
-							   1);	/* Number of hops done yet */
+			fabric_route_target(p_ftree, p_sw,	/* local switch - used as a route-downgoing alg. start point */
+					    hca_lid,	/* LID that we're routing to */
+					    TRUE,	/* whether this path to HCA should by tracked by counters */
+					    FALSE,	/* whether target lid is a switch or not */
+					    0,	/* Number of reverse hops allowed */
+					    1);	/* Number of hops done yet */
 
 			/* count how many real targets have been routed from this leaf switch */
 			routed_targets_on_leaf++;
@@ -2876,6 +3554,9 @@ static void fabric_route_to_cns(IN ftree_fabric_t * p_ftree)
 		   Now route the dummy HCAs that are missing or that are non-CNs.
 		   When routing to dummy HCAs we don't fill lid matrices. */
 		if (p_ftree->max_cn_per_leaf > routed_targets_on_leaf) {
+			/* all the dummy HCAs share LID 0, so they are routed
+			   one at a time on the load of the fabric */
+			fabric_route_batch(p_ftree);
 			OSM_LOG(&p_ftree->p_osm->log, OSM_LOG_DEBUG,
 				"Routing %u dummy CAs\n",
 				p_ftree->max_cn_per_leaf -
@@ -2886,14 +3567,15 @@ static void fabric_route_to_cns(IN ftree_fabric_t * p_ftree)
 				ftree_sw_t *p_next_sw, *p_ftree_sw;
 				sw_set_hops(p_sw, 0, 0xFF, 1, FALSE);
 				/* assign downgoing ports by stepping up */
-				fabric_route_downgoing_by_going_up(p_ftree, p_sw,	/* local switch - used as a route-downgoing alg. start point */
+				fabric_route_downgoing_by_going_up(p_ftree, &p_ftree->load, p_sw,	/* local switch - used as a route-downgoing alg. start point */
 								   NULL,	/* prev. position switch */
 								   0,	/* LID that we're routing to - ignored for dummy HCA */
 								   TRUE,	/* whether this path to HCA should by tracked by counters */
 								   FALSE,	/* Whether the target LID is a switch or not */
 								   0,	/* Number of reverse hops allowed */
 								   0,	/* Number of reverse hops done yet */
-								   1);	/* Number of hops done yet */
+								   1,	/* Number of hops done yet */
+								   NULL);	/* main path - choose it on the way */
 
 				p_next_sw = (ftree_sw_t *) cl_qmap_head(&p_ftree->sw_tbl);
 				/* need to clean the LID 0 hops for dummy node */
@@ -2905,9 +3587,12 @@ static void fabric_route_to_cns(IN ftree_fabric_t * p_ftree)
 				}
 
 			}
+			/* the copies of the routing threads are outdated */
+			p_ftree->batch_id++;
 		}
 	}
 	/* done going through all the leaf switches */
+	fabric_route_batch(p_ftree);
 	OSM_LOG_EXIT(&p_ftree->p_osm->log);
 }				/* fabric_route_to_cns() */
 
@@ -2982,17 +3667,16 @@ static void fabric_route_to_non_cns(IN ftree_fabric_t * p_ftree)
 			   We're routing REAL targets. They are not CNs and not included
 			   in the leafs array, but we treat them as MAIN path to allow load
 			   leveling, which means that the counters will be updated. */
-			fabric_route_downgoing_by_going_up(p_ftree, p_sw,	/* local switch - used as a route-downgoing alg. start point */
-							   NULL,	/* prev. position switch */
-							   hca_lid,	/* LID that we're routing to */
-							   TRUE,	/* whether this path to HCA should by tracked by counters */
-							   FALSE,	/* Whether the target LID is a switch or not */
-							   p_hca_port_group->is_io ? p_ftree->p_osm->subn.opt.max_reverse_hops : 0,	/* Number or reverse hops allowed */
-							   0,	/* Number or reverse hops done yet */
-							   1);	/* Number of hops done yet */
+			fabric_route_target(p_ftree, p_sw,	/* local switch - used as a route-downgoing alg. start point */
+					    hca_lid,	/* LID that we're routing to */
+					    TRUE,	/* whether this path to HCA should by tracked by counters */
+					    FALSE,	/* Whether the target LID is a switch or not */
+					    p_hca_port_group->is_io ? p_ftree->p_osm->subn.opt.max_reverse_hops : 0,	/* Number or reverse hops allowed */
+					    1);	/* Number of hops done yet */
 		}
 		/* done with all the port groups of this HCA - go to next HCA */
 	}
+	fabric_route_batch(p_ftree);
 
 	OSM_LOG_EXIT(&p_ftree->p_osm->log);
 }				/* fabric_route_to_non_cns() */
@@ -3034,15 +3718,14 @@ static void fabric_route_to_switches(IN ftree_fabric_t * p_ftree)
 		sw_set_hops(p_sw, p_sw->lid, 0,	/* port_num */
 			    0, TRUE);	/* hops     */
 
-		fabric_route_downgoing_by_going_up(p_ftree, p_sw,	/* local switch - used as a route-downgoing alg. start point */
-						   NULL,	/* prev. position switch */
-						   p_sw->lid,	/* LID that we're routing to */
-						   FALSE,	/* whether this path to HCA should by tracked by counters */
-						   TRUE,	/* Whether the target LID is a switch or not */
-						   0,	/* Number of reverse hops allowed */
-						   0,	/* Number of reverse hops done yet */
-						   0);	/* Number of hops done yet */
+		fabric_route_target(p_ftree, p_sw,	/* local switch - used as a route-downgoing alg. start point */
+				    p_sw->lid,	/* LID that we're routing to */
+				    FALSE,	/* whether this path to HCA should by tracked by counters */
+				    TRUE,	/* Whether the target LID is a switch or not */
+				    0,	/* Number of reverse hops allowed */
+				    0);	/* Number of hops done yet */
 	}
+	fabric_route_batch(p_ftree);
 
 	OSM_LOG_EXIT(&p_ftree->p_osm->log);
 }				/* fabric_route_to_switches() */
@@ -3131,47 +3814,916 @@ static void fabric_route_roots(IN ftree_fabric_t * p_ftree)
 	OSM_LOG_EXIT(&p_ftree->p_osm->log);
 }				/* fabric_route_roots() */
 
-/***************************************************/
+/***************************************************
+ ***************************************************/
 
-static int fabric_populate_nodes(IN ftree_fabric_t * p_ftree)
+/*
+ * Incremental reroute (ftree_incremental_reroute):
+ * After a full routing, the ranked and indexed fabric, the route counters
+ * and the LFTs are kept.  If the only change of the subnet until the next
+ * routing are failed switch-to-switch links that leave a valid fat tree,
+ * the failed ports are removed from their port groups, and only the LIDs
+ * whose routes used one of them are routed again, balanced against the
+ * counters of all the kept routes.
+ * The hops of the main paths are kept as well, so that the downgoing
+ * routes of a LID can be taken off the counters before it is rerouted.
+ */
+
+static void fabric_destroy_old_main_paths(IN ftree_fabric_t * p_ftree)
 {
-	osm_node_t *p_osm_node;
-	osm_node_t *p_next_osm_node;
+	free(p_ftree->old_main_paths);
+	p_ftree->old_main_paths = NULL;
+	free(p_ftree->old_main_path_len);
+	p_ftree->old_main_path_len = NULL;
+}
 
-	OSM_LOG_ENTER(&p_ftree->p_osm->log);
+/***************************************************/
 
-	p_next_osm_node =
-	    (osm_node_t *) cl_qmap_head(&p_ftree->p_osm->subn.node_guid_tbl);
-	while (p_next_osm_node !=
-	       (osm_node_t *) cl_qmap_end(&p_ftree->p_osm->
-					  subn.node_guid_tbl)) {
-		p_osm_node = p_next_osm_node;
-		p_next_osm_node =
-		    (osm_node_t *) cl_qmap_next(&p_osm_node->map_item);
-		switch (osm_node_get_type(p_osm_node)) {
-		case IB_NODE_TYPE_CA:
-			fabric_add_hca(p_ftree, p_osm_node);
-			break;
-		case IB_NODE_TYPE_ROUTER:
-			break;
-		case IB_NODE_TYPE_SWITCH:
-			fabric_add_sw(p_ftree, p_osm_node->sw);
-			break;
-		default:
-			OSM_LOG(&p_ftree->p_osm->log, OSM_LOG_ERROR,
-				"ERR AB0E: " "Node GUID 0x%016" PRIx64
-				" - Unknown node type: %s\n",
-				cl_ntoh64(osm_node_get_node_guid(p_osm_node)),
-				ib_get_node_type_str(osm_node_get_type
-						     (p_osm_node)));
-			OSM_LOG_EXIT(&p_ftree->p_osm->log);
-			return -1;
-		}
-	}
+static void fabric_destroy_reroute_state(IN ftree_fabric_t * p_ftree)
+{
+	free(p_ftree->lfts);
+	p_ftree->lfts = NULL;
+	free(p_ftree->reroute_lid);
+	p_ftree->reroute_lid = NULL;
+	free(p_ftree->main_paths);
+	p_ftree->main_paths = NULL;
+	free(p_ftree->main_path_len);
+	p_ftree->main_path_len = NULL;
+	fabric_destroy_old_main_paths(p_ftree);
+	p_ftree->reroute_valid = FALSE;
+	p_ftree->incremental = FALSE;
+	fabric_destroy_load(p_ftree);
+}
 
-	OSM_LOG_EXIT(&p_ftree->p_osm->log);
-	return 0;
-}				/* fabric_populate_nodes() */
+/***************************************************/
+
+static unsigned fabric_count_ca_ports(IN ftree_fabric_t * p_ftree)
+{
+	cl_qmap_t *p_port_tbl = &p_ftree->p_osm->subn.port_guid_tbl;
+	cl_map_item_t *p_item;
+	unsigned count = 0;
+
+	for (p_item = cl_qmap_head(p_port_tbl);
+	     p_item != cl_qmap_end(p_port_tbl); p_item = cl_qmap_next(p_item))
+		if (osm_node_get_type(((osm_port_t *) p_item)->p_node) ==
+		    IB_NODE_TYPE_CA)
+			count++;
+	return count;
+}
+
+/***************************************************/
+
+/*
+ * Starts to keep the main paths of a full routing.  Without them the
+ * routing works as before, but can't be kept for the next one.
+ */
+static void fabric_init_main_paths(IN ftree_fabric_t * p_ftree)
+{
+	size_t lft_len = p_ftree->lft_max_lid + 1;
+
+	free(p_ftree->main_paths);
+	free(p_ftree->main_path_len);
+	p_ftree->main_paths = malloc(lft_len * FAT_TREE_MAX_RANK *
+				     sizeof(ftree_hop_t));
+	p_ftree->main_path_len = calloc(lft_len, sizeof(uint8_t));
+	if (!p_ftree->main_paths || !p_ftree->main_path_len) {
+		free(p_ftree->main_paths);
+		p_ftree->main_paths = NULL;
+		free(p_ftree->main_path_len);
+		p_ftree->main_path_len = NULL;
+	}
+}
+
+/***************************************************/
+
+/*
+ * Keeps the LFTs of a successful routing for the next one.  The load of
+ * the fabric and the main paths that make it up have to be kept as well.
+ */
+static void fabric_save_routes(IN ftree_fabric_t * p_ftree)
+{
+	osm_subn_t *p_subn = &p_ftree->p_osm->subn;
+	size_t lft_len = p_ftree->lft_max_lid + 1;
+	uint32_t i;
+	uint16_t lid;
+
+	if (!p_ftree->main_paths) {
+		osm_log_v2(&p_ftree->p_osm->log, OSM_LOG_INFO, FILE_ID,
+			   "Main paths were not kept - "
+			   "the next routing won't be incremental\n");
+		fabric_destroy_reroute_state(p_ftree);
+		return;
+	}
+
+	/* reverse hops and sibling links count routes off the main path */
+	for (lid = 1; lid <= p_ftree->lft_max_lid; lid++)
+		if (p_ftree->main_path_len[lid] > FAT_TREE_MAX_RANK) {
+			osm_log_v2(&p_ftree->p_osm->log, OSM_LOG_INFO, FILE_ID,
+				   "The counted routes of LID %u can't be "
+				   "tracked - the next routing won't be "
+				   "incremental\n", lid);
+			fabric_destroy_reroute_state(p_ftree);
+			return;
+		}
+
+	if (!p_ftree->lfts) {
+		p_ftree->lfts = malloc(p_ftree->load_sw_num * lft_len);
+		p_ftree->reroute_lid = malloc(lft_len);
+		if (!p_ftree->lfts || !p_ftree->reroute_lid) {
+			osm_log_v2(&p_ftree->p_osm->log, OSM_LOG_INFO, FILE_ID,
+				   "Cannot allocate memory to keep the routes - "
+				   "the next routing won't be incremental\n");
+			fabric_destroy_reroute_state(p_ftree);
+			return;
+		}
+	}
+
+	for (i = 0; i < p_ftree->load_sw_num; i++)
+		memcpy(p_ftree->lfts + i * lft_len,
+		       p_ftree->load_sw[i]->p_osm_sw->new_lft, lft_len);
+
+	p_ftree->reroute_max_lid = p_subn->max_ucast_lid_ho;
+	p_ftree->reroute_max_reverse_hops = p_subn->opt.max_reverse_hops;
+	p_ftree->reroute_connect_roots = p_subn->opt.connect_roots;
+	p_ftree->reroute_ca_ports = fabric_count_ca_ports(p_ftree);
+	p_ftree->reroute_valid = TRUE;
+}
+
+/***************************************************/
+
+static ftree_port_group_t *sw_get_port_group_by_port(IN ftree_sw_t * p_sw,
+						     IN uint8_t port_num,
+						     OUT ftree_port_t ** pp_port)
+{
+	ftree_port_group_t **groups[3];
+	uint8_t groups_num[3];
+	ftree_port_group_t *p_group;
+	uint32_t j, k, l;
+
+	groups[0] = p_sw->down_port_groups;
+	groups_num[0] = p_sw->down_port_groups_num;
+	groups[1] = p_sw->sibling_port_groups;
+	groups_num[1] = p_sw->sibling_port_groups_num;
+	groups[2] = p_sw->up_port_groups;
+	groups_num[2] = p_sw->up_port_groups_num;
+	for (j = 0; j < 3; j++)
+		for (k = 0; k < groups_num[j]; k++) {
+			p_group = groups[j][k];
+			for (l = 0; l < cl_ptr_vector_get_size(&p_group->ports);
+			     l++) {
+				cl_ptr_vector_at(&p_group->ports, l,
+						 (void *)pp_port);
+				if ((*pp_port)->port_num == port_num)
+					return p_group;
+			}
+		}
+	return NULL;
+}
+
+/***************************************************/
+
+/*
+ * Removes a failed port from its port group, and the group from the
+ * switch if that was its last port.  The routes that the port's counters
+ * counted are gone from the counters of the group as well.
+ * Returns TRUE if the port group was removed.
+ */
+static boolean_t sw_remove_port(IN ftree_fabric_t * p_ftree,
+				IN ftree_sw_t * p_sw, IN uint8_t port_num)
+{
+	ftree_load_t *p_load = &p_ftree->load;
+	ftree_sw_load_t *p_sw_load = &p_load->sw[p_sw->load_idx];
+	ftree_port_group_t **groups[3];
+	uint8_t *p_groups_num[3];
+	ftree_port_group_t *p_group;
+	ftree_port_t *p_port;
+	boolean_t removed = FALSE;
+	uint32_t j, k, l;
+
+	groups[0] = p_sw->down_port_groups;
+	p_groups_num[0] = &p_sw->down_port_groups_num;
+	groups[1] = p_sw->sibling_port_groups;
+	p_groups_num[1] = &p_sw->sibling_port_groups_num;
+	groups[2] = p_sw->up_port_groups;
+	p_groups_num[2] = &p_sw->up_port_groups_num;
+	for (j = 0; j < 3; j++)
+		for (k = 0; k < *p_groups_num[j]; k++) {
+			p_group = groups[j][k];
+			for (l = 0; l < cl_ptr_vector_get_size(&p_group->ports);
+			     l++) {
+				cl_ptr_vector_at(&p_group->ports, l,
+						 (void *)&p_port);
+				if (p_port->port_num != port_num)
+					continue;
+
+				FTREE_COUNTER_UP(p_load, p_group) -=
+				    FTREE_COUNTER_UP(p_load, p_port);
+				FTREE_COUNTER_DOWN(p_load, p_group) -=
+				    FTREE_COUNTER_DOWN(p_load, p_port);
+				cl_ptr_vector_remove(&p_group->ports, l);
+				port_destroy(p_port);
+				if (!cl_ptr_vector_get_size(&p_group->ports)) {
+					memmove(groups[j] + k, groups[j] + k + 1,
+						(*p_groups_num[j] - k - 1) *
+						sizeof(ftree_port_group_t *));
+					(*p_groups_num[j])--;
+					port_group_destroy(p_group);
+					removed = TRUE;
+				}
+
+				/* the order of the down-going groups and
+				   the group to start with may change */
+				if (j == 0) {
+					p_sw_load->counter_up_changed = TRUE;
+					if (p_sw->down_port_groups_num)
+						p_sw_load->down_port_groups_idx
+						    %= p_sw->
+						    down_port_groups_num;
+					else
+						p_sw_load->
+						    down_port_groups_idx = 0;
+				}
+				recalculate_min_counter_down(p_load, p_sw);
+				return removed;
+			}
+		}
+	return FALSE;
+}
+
+/***************************************************/
+
+/*
+ * Returns the node at the other end of a switch port if the port would
+ * be part of a port group, see fabric_construct_sw_ports().
+ */
+static osm_node_t *sw_get_linked_node(IN ftree_sw_t * p_sw,
+				      IN uint8_t port_num,
+				      OUT uint8_t * p_remote_port_num)
+{
+	osm_node_t *p_node = p_sw->p_osm_sw->p_node;
+	osm_physp_t *p_osm_port = osm_node_get_physp_ptr(p_node, port_num);
+	osm_node_t *p_remote_node;
+
+	if (!p_osm_port || !osm_link_is_healthy(p_osm_port) ||
+	    !osm_physp_get_remote(p_osm_port))
+		return NULL;
+
+	p_remote_node =
+	    osm_node_get_remote_node(p_node, port_num, p_remote_port_num);
+	if (!p_remote_node || p_remote_node == p_node ||
+	    osm_node_get_type(p_remote_node) == IB_NODE_TYPE_ROUTER)
+		return NULL;
+	return p_remote_node;
+}
+
+/***************************************************/
+
+/*
+ * Checks that the switches and the CA ports of the subnet are still the
+ * ones the kept LFTs were built for, and attached to the same ports.
+ */
+static boolean_t fabric_nodes_unchanged(IN ftree_fabric_t * p_ftree)
+{
+	osm_subn_t *p_subn = &p_ftree->p_osm->subn;
+	size_t lft_len = p_ftree->lft_max_lid + 1;
+	cl_map_item_t *p_item;
+	ftree_sw_t *p_sw;
+	ftree_hca_t *p_hca;
+	osm_port_t *p_port;
+	osm_node_t *p_remote_node;
+	unsigned ca_ports = 0;
+	uint16_t lid;
+	uint8_t port_num;
+
+	if (cl_qmap_count(&p_subn->sw_guid_tbl) !=
+	    cl_qmap_count(&p_ftree->sw_tbl))
+		return FALSE;
+
+	for (p_sw = (ftree_sw_t *) cl_qmap_head(&p_ftree->sw_tbl);
+	     p_sw != (ftree_sw_t *) cl_qmap_end(&p_ftree->sw_tbl);
+	     p_sw = (ftree_sw_t *) cl_qmap_next(&p_sw->map_item)) {
+		/* compare the pointers first, the old switch may be gone */
+		if (osm_get_switch_by_guid(p_subn,
+					   cl_qmap_key(&p_sw->map_item)) !=
+		    p_sw->p_osm_sw ||
+		    cl_ntoh16(osm_node_get_base_lid(p_sw->p_osm_sw->p_node, 0))
+		    != p_sw->lid)
+			return FALSE;
+	}
+
+	for (p_item = cl_qmap_head(&p_subn->port_guid_tbl);
+	     p_item != cl_qmap_end(&p_subn->port_guid_tbl);
+	     p_item = cl_qmap_next(p_item)) {
+		p_port = (osm_port_t *) p_item;
+		if (osm_node_get_type(p_port->p_node) != IB_NODE_TYPE_CA)
+			continue;
+		ca_ports++;
+
+		p_hca = fabric_get_hca_by_guid(p_ftree,
+					       osm_node_get_node_guid(p_port->
+								      p_node));
+		if (!p_hca || p_hca->p_osm_node != p_port->p_node)
+			return FALSE;
+
+		p_remote_node = osm_node_get_remote_node(p_port->p_node,
+							 p_port->p_physp->
+							 port_num, &port_num);
+		if (!p_remote_node || !p_remote_node->sw)
+			return FALSE;
+		p_sw = fabric_get_sw_by_guid(p_ftree,
+					     osm_node_get_node_guid
+					     (p_remote_node));
+
+		/* the kept LFT of the switch delivers the LID to the port */
+		lid = cl_ntoh16(osm_port_get_base_lid(p_port));
+		if (!p_sw || !lid || lid > p_ftree->lft_max_lid ||
+		    p_ftree->lfts[p_sw->load_idx * lft_len + lid] != port_num)
+			return FALSE;
+	}
+
+	return (ca_ports == p_ftree->reroute_ca_ports);
+}
+
+/***************************************************/
+
+/*
+ * Compares the port groups of the switches with the links of the subnet.
+ * Returns the number of switch ports whose switch-to-switch link failed,
+ * or -1 if any link changed in another way.
+ */
+static int fabric_count_failed_ports(IN ftree_fabric_t * p_ftree)
+{
+	ftree_sw_t *p_sw;
+	ftree_port_group_t *p_group;
+	ftree_port_t *p_port;
+	osm_node_t *p_remote_node;
+	uint8_t port_num, remote_port_num;
+	int num_failed = 0;
+
+	for (p_sw = (ftree_sw_t *) cl_qmap_head(&p_ftree->sw_tbl);
+	     p_sw != (ftree_sw_t *) cl_qmap_end(&p_ftree->sw_tbl);
+	     p_sw = (ftree_sw_t *) cl_qmap_next(&p_sw->map_item)) {
+		for (port_num = 1;
+		     port_num < osm_node_get_num_physp(p_sw->p_osm_sw->p_node);
+		     port_num++) {
+			p_group = sw_get_port_group_by_port(p_sw, port_num,
+							    &p_port);
+			p_remote_node = sw_get_linked_node(p_sw, port_num,
+							   &remote_port_num);
+			if (p_remote_node) {
+				if (!p_group ||
+				    p_group->remote_node_guid !=
+				    osm_node_get_node_guid(p_remote_node) ||
+				    p_port->remote_port_num != remote_port_num)
+					return -1;
+			} else if (p_group) {
+				if (p_group->remote_node_type !=
+				    IB_NODE_TYPE_SWITCH)
+					return -1;
+				num_failed++;
+			}
+		}
+	}
+
+	return num_failed;
+}
+
+/***************************************************/
+
+/* flags the LIDs that the kept LFT of a switch routes through a port */
+static uint32_t fabric_flag_lids_through_port(IN ftree_fabric_t * p_ftree,
+					      IN ftree_sw_t * p_sw,
+					      IN uint8_t port_num)
+{
+	const uint8_t *lft = p_ftree->lfts +
+	    p_sw->load_idx * (size_t) (p_ftree->lft_max_lid + 1);
+	uint32_t num_lids = 0;
+	uint16_t lid;
+
+	for (lid = 1; lid <= p_ftree->lft_max_lid; lid++) {
+		if (lft[lid] != port_num || p_ftree->reroute_lid[lid])
+			continue;
+		p_ftree->reroute_lid[lid] = TRUE;
+		num_lids++;
+	}
+	return num_lids;
+}
+
+/***************************************************/
+
+/* the two ports of a failed switch-to-switch link */
+typedef struct ftree_failed_link_t_ {
+	ftree_sw_t *p_sw[2];
+	ftree_port_t *p_port[2];
+} ftree_failed_link_t;
+
+static boolean_t link_has_port(IN const ftree_failed_link_t * links,
+			       IN unsigned num_links,
+			       IN const ftree_port_t * p_port)
+{
+	unsigned i;
+
+	for (i = 0; i < num_links; i++)
+		if (links[i].p_port[0] == p_port || links[i].p_port[1] == p_port)
+			return TRUE;
+	return FALSE;
+}
+
+/***************************************************/
+
+/*
+ * Checks whether the subnet only changed by failed switch-to-switch links
+ * since the last routing.  If so, flags the LIDs whose routes used them,
+ * takes the main paths of the flagged LIDs off the counters, removes the
+ * links from the port groups and checks that the fabric is still a fat
+ * tree.
+ * Returns 0 if only the flagged LIDs have to be routed, or -1 if the
+ * fabric has to be built again.
+ */
+static int fabric_prepare_incremental_reroute(IN ftree_fabric_t * p_ftree)
+{
+	osm_subn_t *p_subn = &p_ftree->p_osm->subn;
+	ftree_sw_t *p_sw;
+	ftree_sw_t *p_remote_sw;
+	ftree_port_group_t *p_group;
+	ftree_port_t *p_port;
+	ftree_port_t *p_remote_port;
+	ftree_failed_link_t *links = NULL;
+	ftree_hop_t *p_path, *p_old_path;
+	const char *reason;
+	uint32_t num_lids = 0;
+	unsigned num_links = 0, i, j;
+	uint16_t lid;
+	uint8_t port_num, remote_port_num;
+	boolean_t group_removed = FALSE;
+	int num_failed;
+
+	OSM_LOG_ENTER(&p_ftree->p_osm->log);
+
+	if (!p_ftree->reroute_valid) {
+		OSM_LOG_EXIT(&p_ftree->p_osm->log);
+		return -1;
+	}
+	p_ftree->reroute_valid = FALSE;
+
+	if (p_subn->opt.lmc > 0 ||
+	    p_subn->max_ucast_lid_ho != p_ftree->reroute_max_lid ||
+	    p_subn->opt.max_reverse_hops != p_ftree->reroute_max_reverse_hops ||
+	    p_subn->opt.connect_roots != p_ftree->reroute_connect_roots) {
+		reason = "configuration changed";
+		goto FULL_REROUTE;
+	}
+
+	if (!fabric_nodes_unchanged(p_ftree)) {
+		reason = "switches or CA ports changed";
+		goto FULL_REROUTE;
+	}
+
+	num_failed = fabric_count_failed_ports(p_ftree);
+	if (num_failed < 0) {
+		reason = "links changed";
+		goto FULL_REROUTE;
+	}
+	if (num_failed == 0) {
+		reason = "no failed links";
+		goto FULL_REROUTE;
+	}
+
+	links = malloc(num_failed * sizeof(*links));
+	p_ftree->old_main_paths = malloc((p_ftree->lft_max_lid + 1) *
+					 FAT_TREE_MAX_RANK *
+					 sizeof(ftree_hop_t));
+	p_ftree->old_main_path_len = calloc(p_ftree->lft_max_lid + 1,
+					    sizeof(uint8_t));
+	if (!links || !p_ftree->old_main_paths ||
+	    !p_ftree->old_main_path_len) {
+		reason = "out of memory";
+		goto FULL_REROUTE;
+	}
+
+	memset(p_ftree->reroute_lid, 0, p_ftree->lft_max_lid + 1);
+	for (p_sw = (ftree_sw_t *) cl_qmap_head(&p_ftree->sw_tbl);
+	     p_sw != (ftree_sw_t *) cl_qmap_end(&p_ftree->sw_tbl);
+	     p_sw = (ftree_sw_t *) cl_qmap_next(&p_sw->map_item)) {
+		for (port_num = 1;
+		     port_num < osm_node_get_num_physp(p_sw->p_osm_sw->p_node);
+		     port_num++) {
+			p_group = sw_get_port_group_by_port(p_sw, port_num,
+							    &p_port);
+			if (!p_group ||
+			    sw_get_linked_node(p_sw, port_num,
+					       &remote_port_num))
+				continue;
+
+			/* a link that is down on one side is removed on
+			   both sides, but only once */
+			for (i = 0; i < num_links; i++)
+				if (links[i].p_port[1] == p_port)
+					break;
+			if (i < num_links)
+				continue;
+
+			p_remote_sw = p_group->remote_hca_or_sw.p_sw;
+			remote_port_num = p_port->remote_port_num;
+			if (!sw_get_port_group_by_port(p_remote_sw,
+						       remote_port_num,
+						       &p_remote_port)) {
+				reason = "links changed";
+				goto FULL_REROUTE;
+			}
+			OSM_LOG(&p_ftree->p_osm->log, OSM_LOG_VERBOSE,
+				"Removing failed link between switch %s port %u"
+				" and switch %s port %u\n",
+				tuple_to_str(p_sw->tuple), port_num,
+				tuple_to_str(p_remote_sw->tuple),
+				remote_port_num);
+			num_lids += fabric_flag_lids_through_port(p_ftree, p_sw,
+								  port_num);
+			num_lids +=
+			    fabric_flag_lids_through_port(p_ftree, p_remote_sw,
+							  remote_port_num);
+			links[num_links].p_sw[0] = p_sw;
+			links[num_links].p_port[0] = p_port;
+			links[num_links].p_sw[1] = p_remote_sw;
+			links[num_links].p_port[1] = p_remote_port;
+			num_links++;
+		}
+	}
+
+	/* a main path through a failed link is routed again as well, and
+	   the downgoing routes of all the flagged LIDs come off the counters
+	   while their ports are still there */
+	for (lid = 1; lid <= p_ftree->lft_max_lid; lid++) {
+		p_path = p_ftree->main_paths + lid * FAT_TREE_MAX_RANK;
+		for (j = 0; j < p_ftree->main_path_len[lid] &&
+		     !p_ftree->reroute_lid[lid]; j++)
+			if (link_has_port(links, num_links, p_path[j].p_port)) {
+				p_ftree->reroute_lid[lid] = TRUE;
+				num_lids++;
+			}
+		if (!p_ftree->reroute_lid[lid])
+			continue;
+
+		p_old_path = p_ftree->old_main_paths + lid * FAT_TREE_MAX_RANK;
+		for (j = 0; j < p_ftree->main_path_len[lid]; j++) {
+			load_add_hop(&p_ftree->load, &p_path[j], -1);
+			if (!link_has_port(links, num_links, p_path[j].p_port))
+				p_old_path[p_ftree->old_main_path_len[lid]++] =
+				    p_path[j];
+		}
+		p_ftree->main_path_len[lid] = 0;
+	}
+
+	for (i = 0; i < num_links; i++) {
+		if (sw_remove_port(p_ftree, links[i].p_sw[0],
+				   links[i].p_port[0]->port_num))
+			group_removed = TRUE;
+		if (sw_remove_port(p_ftree, links[i].p_sw[1],
+				   links[i].p_port[1]->port_num))
+			group_removed = TRUE;
+	}
+	free(links);
+	links = NULL;
+
+	/*
+	 * The routes kept here are only as good as those of a full routing
+	 * if the fabric is still a fat tree.  Otherwise the full routing
+	 * falls back to another engine, while the kept routes would leave
+	 * the pairs routed through a lost port group unreachable.
+	 */
+	if (group_removed) {
+		reason = "switches lost all their links to each other";
+		goto FULL_REROUTE;
+	}
+	if (!fabric_validate_topology(p_ftree)) {
+		reason = "the fabric is no longer a fat tree";
+		goto FULL_REROUTE;
+	}
+
+	osm_log_v2(&p_ftree->p_osm->log, OSM_LOG_INFO, FILE_ID,
+		   "Rerouting %u LIDs around %u failed links incrementally\n",
+		   num_lids, num_links);
+	p_ftree->incremental = TRUE;
+	OSM_LOG_EXIT(&p_ftree->p_osm->log);
+	return 0;
+
+FULL_REROUTE:
+	free(links);
+	osm_log_v2(&p_ftree->p_osm->log, OSM_LOG_INFO, FILE_ID,
+		   "Incremental reroute not possible (%s) - "
+		   "rebuilding the fabric\n", reason);
+	OSM_LOG_EXIT(&p_ftree->p_osm->log);
+	return -1;
+}
+
+/***************************************************/
+
+static void fabric_reroute_ca_port(IN ftree_fabric_t * p_ftree,
+				   IN ftree_port_group_t * p_hca_port_group)
+{
+	ftree_sw_t *p_sw = p_hca_port_group->remote_hca_or_sw.p_sw;
+	ftree_port_t *p_hca_port;
+	uint16_t hca_lid = p_hca_port_group->lid;
+	uint8_t port_num_on_switch;
+
+	cl_ptr_vector_at(&p_hca_port_group->ports, 0, (void *)&p_hca_port);
+	port_num_on_switch = p_hca_port->remote_port_num;
+	p_sw->p_osm_sw->new_lft[hca_lid] = port_num_on_switch;
+	sw_set_hops(p_sw, hca_lid, port_num_on_switch, 1, FALSE);
+
+	/* I/O nodes may use reverse hops, as in fabric_route_to_non_cns() */
+	fabric_route_target(p_ftree, p_sw, hca_lid, TRUE, FALSE,
+			    (!p_hca_port_group->is_cn &&
+			     p_hca_port_group->is_io) ?
+			    p_ftree->p_osm->subn.opt.max_reverse_hops : 0, 1);
+}
+
+/***************************************************/
+
+/*
+ * Returns whether the kept route of a switch to a LID still reaches it,
+ * following the kept LFTs without a failed link.  state[] caches the
+ * answer per switch: 0 - not known yet, 1 - being followed, 2 - intact,
+ * 3 - broken.
+ */
+static boolean_t sw_kept_route_intact(IN ftree_fabric_t * p_ftree,
+				      IN ftree_sw_t * p_sw, IN uint16_t lid,
+				      IN OUT uint8_t * state)
+{
+	ftree_port_group_t *p_group;
+	ftree_port_t *p_port;
+	uint8_t port_num;
+	boolean_t intact;
+
+	if (state[p_sw->load_idx] > 1)
+		return (state[p_sw->load_idx] == 2);
+	if (state[p_sw->load_idx] == 1)
+		return FALSE;	/* a loop in the kept LFTs */
+	state[p_sw->load_idx] = 1;
+
+	port_num = p_ftree->lfts[p_sw->load_idx *
+				 (size_t) (p_ftree->lft_max_lid + 1) + lid];
+	if (port_num == 0)
+		intact = (p_sw->lid == lid);
+	else if (port_num == OSM_NO_PATH ||
+		 !(p_group = sw_get_port_group_by_port(p_sw, port_num,
+						       &p_port)))
+		intact = FALSE;
+	else if (p_group->remote_node_type != IB_NODE_TYPE_SWITCH)
+		intact = (p_group->remote_lid == lid);
+	else
+		intact = sw_kept_route_intact(p_ftree,
+					      p_group->remote_hca_or_sw.p_sw,
+					      lid, state);
+
+	state[p_sw->load_idx] = intact ? 2 : 3;
+	return intact;
+}
+
+/***************************************************/
+
+/*
+ * The rerouted LIDs got new ports on most switches, since the counters
+ * they were balanced against are not the ones of the full routing.
+ * Puts the kept port back wherever the kept route still reaches the LID,
+ * so that only the switches whose route used a failed link get a new
+ * LFT entry.  The rest of a kept route is kept as well, and a new route
+ * only goes down on the ancestors of the LID, which route it down
+ * either way, so the routes stay up/down.
+ */
+static void fabric_keep_intact_routes(IN ftree_fabric_t * p_ftree)
+{
+	size_t lft_len = p_ftree->lft_max_lid + 1;
+	uint8_t *state;
+	ftree_sw_t *p_sw;
+	uint32_t i;
+	uint16_t lid;
+
+	state = malloc(p_ftree->load_sw_num);
+	if (!state)
+		return;
+
+	for (lid = 1; lid <= p_ftree->lft_max_lid; lid++) {
+		if (!p_ftree->reroute_lid[lid])
+			continue;
+		memset(state, 0, p_ftree->load_sw_num);
+		for (i = 0; i < p_ftree->load_sw_num; i++) {
+			p_sw = p_ftree->load_sw[i];
+			if (sw_kept_route_intact(p_ftree, p_sw, lid, state))
+				p_sw->p_osm_sw->new_lft[lid] =
+				    p_ftree->lfts[i * lft_len + lid];
+		}
+	}
+
+	free(state);
+}
+
+/***************************************************/
+
+static boolean_t main_hop_in_lft(IN const ftree_hop_t * p_hop,
+				 IN uint16_t lid)
+{
+	ftree_sw_t *p_remote_sw = p_hop->p_group->remote_hca_or_sw.p_sw;
+
+	return (p_remote_sw->p_osm_sw->new_lft[lid] ==
+		p_hop->p_port->remote_port_num);
+}
+
+/*
+ * Once the kept LFT entries are back, the main path hops of a rerouted
+ * LID are the ones of its new and of its old main path whose upper
+ * switch still routes the LID down the hop.  Takes the other new hops
+ * off the counters, and counts the old ones that are kept.
+ */
+static void fabric_count_kept_main_paths(IN ftree_fabric_t * p_ftree)
+{
+	ftree_hop_t *p_path, *p_old_path;
+	uint8_t *p_len;
+	uint32_t i, j, n;
+	uint16_t lid;
+
+	for (lid = 1; lid <= p_ftree->lft_max_lid; lid++) {
+		if (!p_ftree->reroute_lid[lid])
+			continue;
+		p_path = p_ftree->main_paths + lid * FAT_TREE_MAX_RANK;
+		p_old_path = p_ftree->old_main_paths + lid * FAT_TREE_MAX_RANK;
+		p_len = &p_ftree->main_path_len[lid];
+		/* the counted routes of the LID can't be tracked anymore,
+		   fabric_save_routes() won't keep them */
+		if (*p_len > FAT_TREE_MAX_RANK)
+			continue;
+
+		for (i = 0, n = 0; i < *p_len; i++) {
+			if (main_hop_in_lft(&p_path[i], lid))
+				p_path[n++] = p_path[i];
+			else
+				load_add_hop(&p_ftree->load, &p_path[i], -1);
+		}
+
+		for (i = 0; i < p_ftree->old_main_path_len[lid]; i++) {
+			if (!main_hop_in_lft(&p_old_path[i], lid))
+				continue;
+			for (j = 0; j < n; j++)
+				if (p_path[j].p_port == p_old_path[i].p_port)
+					break;
+			if (j < n)
+				continue;
+			load_add_hop(&p_ftree->load, &p_old_path[i], 1);
+			if (n == FAT_TREE_MAX_RANK) {
+				n = FAT_TREE_MAX_RANK + 1;
+				break;
+			}
+			p_path[n++] = p_old_path[i];
+		}
+		*p_len = n;
+	}
+}
+
+/***************************************************/
+
+/*
+ * Starts the LFTs from the kept ones, and routes the flagged LIDs again
+ * in the order of the full routing: compute nodes, other CA ports and
+ * switches.  The dummy CAs don't have to be routed again, since their
+ * routes are only in the counters.
+ * The upgoing counters are set back to the ones from before: most of the
+ * upgoing entries of a rerouted LID are put back by
+ * fabric_keep_intact_routes(), and they are still counted.
+ */
+static void fabric_route_flagged_lids(IN ftree_fabric_t * p_ftree)
+{
+	const uint8_t *reroute_lid = p_ftree->reroute_lid;
+	size_t lft_len = p_ftree->lft_max_lid + 1;
+	ftree_sw_t *p_sw;
+	ftree_hca_t *p_hca;
+	ftree_port_group_t *p_group;
+	ftree_port_group_t *p_hca_port_group;
+	uint32_t *counters;
+	uint32_t i, j;
+	uint16_t lid;
+
+	OSM_LOG_ENTER(&p_ftree->p_osm->log);
+
+	counters = malloc(p_ftree->counters_num * sizeof(uint32_t));
+	if (counters)
+		memcpy(counters, p_ftree->load.counters,
+		       p_ftree->counters_num * sizeof(uint32_t));
+
+	for (i = 0; i < p_ftree->load_sw_num; i++) {
+		p_sw = p_ftree->load_sw[i];
+		memcpy(p_sw->p_osm_sw->new_lft, p_ftree->lfts + i * lft_len,
+		       lft_len);
+		for (lid = 1; lid <= p_ftree->lft_max_lid; lid++)
+			if (reroute_lid[lid]) {
+				p_sw->p_osm_sw->new_lft[lid] = OSM_NO_PATH;
+				p_sw->hops[lid] = OSM_NO_PATH;
+			}
+	}
+
+	for (i = 0; i < p_ftree->leaf_switches_num; i++) {
+		p_sw = p_ftree->leaf_switches[i];
+		for (j = 0; j < p_sw->down_port_groups_num; j++) {
+			p_group = p_sw->down_port_groups[j];
+			if (p_group->remote_node_type != IB_NODE_TYPE_CA ||
+			    !reroute_lid[p_group->remote_lid])
+				continue;
+			p_hca_port_group =
+			    hca_get_port_group_by_lid(p_group->remote_hca_or_sw.
+						      p_hca,
+						      p_group->remote_lid);
+			if (p_hca_port_group && p_hca_port_group->is_cn)
+				fabric_reroute_ca_port(p_ftree,
+						       p_hca_port_group);
+		}
+	}
+
+	for (p_hca = (ftree_hca_t *) cl_qmap_head(&p_ftree->hca_tbl);
+	     p_hca != (ftree_hca_t *) cl_qmap_end(&p_ftree->hca_tbl);
+	     p_hca = (ftree_hca_t *) cl_qmap_next(&p_hca->map_item))
+		for (j = 0; j < p_hca->up_port_groups_num; j++) {
+			p_hca_port_group = p_hca->up_port_groups[j];
+			if (!p_hca_port_group->is_cn &&
+			    p_hca_port_group->remote_node_type ==
+			    IB_NODE_TYPE_SWITCH &&
+			    reroute_lid[p_hca_port_group->lid])
+				fabric_reroute_ca_port(p_ftree,
+						       p_hca_port_group);
+		}
+
+	for (p_sw = (ftree_sw_t *) cl_qmap_head(&p_ftree->sw_tbl);
+	     p_sw != (ftree_sw_t *) cl_qmap_end(&p_ftree->sw_tbl);
+	     p_sw = (ftree_sw_t *) cl_qmap_next(&p_sw->map_item)) {
+		if (!reroute_lid[p_sw->lid])
+			continue;
+		p_sw->p_osm_sw->new_lft[p_sw->lid] = 0;
+		sw_set_hops(p_sw, p_sw->lid, 0, 0, TRUE);
+		fabric_route_target(p_ftree, p_sw, p_sw->lid, FALSE, TRUE, 0,
+				    0);
+	}
+
+	if (p_ftree->p_osm->subn.opt.connect_roots)
+		fabric_route_roots(p_ftree);
+
+	fabric_keep_intact_routes(p_ftree);
+	fabric_count_kept_main_paths(p_ftree);
+	fabric_destroy_old_main_paths(p_ftree);
+
+	if (counters) {
+		/* FTREE_COUNTER_UP() are the even ones */
+		for (i = 0; i < p_ftree->counters_num; i += 2)
+			p_ftree->load.counters[i] = counters[i];
+		for (i = 0; i < p_ftree->load_sw_num; i++)
+			p_ftree->load.sw[i].counter_up_changed = TRUE;
+		free(counters);
+	} else
+		for (lid = 1; lid <= p_ftree->lft_max_lid; lid++)
+			if (reroute_lid[lid])
+				fabric_lose_main_path(p_ftree, lid);
+
+	OSM_LOG_EXIT(&p_ftree->p_osm->log);
+}				/* fabric_route_flagged_lids() */
+
+/***************************************************/
+
+static int fabric_populate_nodes(IN ftree_fabric_t * p_ftree)
+{
+	osm_node_t *p_osm_node;
+	osm_node_t *p_next_osm_node;
+
+	OSM_LOG_ENTER(&p_ftree->p_osm->log);
+
+	p_next_osm_node =
+	    (osm_node_t *) cl_qmap_head(&p_ftree->p_osm->subn.node_guid_tbl);
+	while (p_next_osm_node !=
+	       (osm_node_t *) cl_qmap_end(&p_ftree->p_osm->
+					  subn.node_guid_tbl)) {
+		p_osm_node = p_next_osm_node;
+		p_next_osm_node =
+		    (osm_node_t *) cl_qmap_next(&p_osm_node->map_item);
+		switch (osm_node_get_type(p_osm_node)) {
+		case IB_NODE_TYPE_CA:
+			fabric_add_hca(p_ftree, p_osm_node);
+			break;
+		case IB_NODE_TYPE_ROUTER:
+			break;
+		case IB_NODE_TYPE_SWITCH:
+			fabric_add_sw(p_ftree, p_osm_node->sw);
+			break;
+		default:
+			OSM_LOG(&p_ftree->p_osm->log, OSM_LOG_ERROR,
+				"ERR AB0E: " "Node GUID 0x%016" PRIx64
+				" - Unknown node type: %s\n",
+				cl_ntoh64(osm_node_get_node_guid(p_osm_node)),
+				ib_get_node_type_str(osm_node_get_type
+						     (p_osm_node)));
+			OSM_LOG_EXIT(&p_ftree->p_osm->log);
+			return -1;
+		}
+	}
+
+	OSM_LOG_EXIT(&p_ftree->p_osm->log);
+	return 0;
+}				/* fabric_populate_nodes() */
 
 /***************************************************
  ***************************************************/
@@ -4069,6 +5621,15 @@ static int construct_fabric(IN void *context)
 
 	OSM_LOG_ENTER(&p_ftree->p_osm->log);
 
+	if (p_ftree->p_osm->subn.opt.ftree_incremental_reroute &&
+	    fabric_prepare_incremental_reroute(p_ftree) == 0) {
+		/* the fabric is kept, but the lid matrices are rebuilt */
+		osm_ucast_mgr_build_lid_matrices(&p_ftree->p_osm->sm.ucast_mgr);
+		OSM_LOG_EXIT(&p_ftree->p_osm->log);
+		return 0;
+	}
+
+	fabric_destroy_reroute_state(p_ftree);
 	fabric_clear(p_ftree);
 
 	if (p_ftree->p_osm->subn.opt.lmc > 0) {
@@ -4276,9 +5837,24 @@ static int do_routing(IN void *context)
 		goto Exit;
 	}
 
+	if (p_ftree->incremental) {
+		OSM_LOG(&p_ftree->p_osm->log, OSM_LOG_VERBOSE,
+			"Rerouting the LIDs routed through failed links\n");
+		fabric_route_flagged_lids(p_ftree);
+		goto Done;
+	}
+
 	OSM_LOG(&p_ftree->p_osm->log, OSM_LOG_VERBOSE,
 		"Starting FatTree routing\n");
 
+	if (fabric_init_load(p_ftree)) {
+		status = -1;
+		goto Exit;
+	}
+
+	if (p_ftree->p_osm->subn.opt.ftree_incremental_reroute)
+		fabric_init_main_paths(p_ftree);
+
 	OSM_LOG(&p_ftree->p_osm->log, OSM_LOG_VERBOSE,
 		"Filling switch forwarding tables for Compute Nodes\n");
 	fabric_route_to_cns(p_ftree);
@@ -4298,16 +5874,26 @@ static int do_routing(IN void *context)
 		fabric_route_roots(p_ftree);
 	}
 
+	/* write out hca ordering file */
+	fabric_dump_hca_ordering(p_ftree);
+
+Done:
 	/* for each switch, set its fwd table */
 	cl_qmap_apply_func(&p_ftree->sw_tbl, set_sw_fwd_table, (void *)p_ftree);
 
-	/* write out hca ordering file */
-	fabric_dump_hca_ordering(p_ftree);
+	/* keep the fabric's load and the LFTs for an incremental reroute */
+	if (p_ftree->p_osm->subn.opt.ftree_incremental_reroute) {
+		fabric_destroy_batch(p_ftree);
+		fabric_save_routes(p_ftree);
+	}
 
 	OSM_LOG(&p_ftree->p_osm->log, OSM_LOG_VERBOSE,
 		"FatTree routing is done\n");
 
 Exit:
+	if (!p_ftree->reroute_valid)
+		fabric_destroy_load(p_ftree);
+	p_ftree->incremental = FALSE;
 	OSM_LOG_EXIT(&p_ftree->p_osm->log);
 	return status;
 }
@@ -4319,6 +5905,7 @@ static void delete(IN void *context)
 {
 	if (!context)
 		return;
+	fabric_destroy_reroute_state((ftree_fabric_t *) context);
 	fabric_destroy((ftree_fabric_t *) context);
 }
 
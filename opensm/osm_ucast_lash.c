@@ -65,6 +65,14 @@ typedef struct _reachable_dest {
 	struct _reachable_dest *next;
 } reachable_dest_t;
 
+/*
+ * virtual_location holds a byte per pair of switches: the lane the pair
+ * is routed on, with LANE_TRIED set once balance_virtual_lanes() failed
+ * to move the pair out of it.
+ */
+#define NO_LANE		0x7f
+#define LANE_TRIED	0x80
+
 static void connect_switches(lash_t * p_lash, int sw1, int sw2, int phy_port_1)
 {
 	osm_log_t *p_log = &p_lash->p_osm->log;
@@ -126,8 +134,29 @@ static osm_switch_t *get_osm_switch_from_port(const osm_port_t * port)
 	return NULL;
 }
 
-static int cycle_exists(cdg_vertex_t * start, cdg_vertex_t * current,
-			cdg_vertex_t * prev, int visit_num)
+/*
+ * The channel dependency graph has a vertex per lane and channel, a
+ * channel being a link out of a switch.  A channel only depends on the
+ * channels out of the switch it leads to.
+ */
+static inline cdg_vertex_t **get_cdg_vertex(lash_t * p_lash, int lane,
+					    int sw, int link)
+{
+	return &p_lash->cdg_vertices[lane * p_lash->num_channels +
+				     p_lash->switches[sw]->first_channel +
+				     link];
+}
+
+static inline uint8_t *get_virtual_location(lash_t * p_lash, int src,
+					    int dest)
+{
+	return &p_lash->virtual_location[(size_t) src * p_lash->num_switches +
+					 dest];
+}
+
+static int cycle_exists(lash_t * p_lash, cdg_vertex_t * start,
+			cdg_vertex_t * current, cdg_vertex_t * prev,
+			int visit_num)
 {
 	int i, new_visit_num;
 	int cycle_found = 0;
@@ -142,6 +171,10 @@ static int cycle_exists(cdg_vertex_t * start, cdg_vertex_t * current,
 			CL_ASSERT(prev == NULL);
 		}
 
+		/* a start vertex may already be recorded by an earlier search */
+		if (current->visiting_number == 0)
+			p_lash->cdg_visited[p_lash->num_cdg_visited++] =
+			    current;
 		current->visiting_number = visit_num;
 
 		if (prev != NULL) {
@@ -154,8 +187,8 @@ static int cycle_exists(cdg_vertex_t * start, cdg_vertex_t * current,
 
 		for (i = 0; i < current->num_deps; i++) {
 			cycle_found =
-			    cycle_exists(start, current->deps[i].v, current,
-					 new_visit_num);
+			    cycle_exists(p_lash, start, current->deps[i].v,
+					 current, new_visit_num);
 			if (cycle_found == 1)
 				i = current->num_deps;
 		}
@@ -168,6 +201,18 @@ static int cycle_exists(cdg_vertex_t * start, cdg_vertex_t * current,
 	return cycle_found;
 }
 
+/* clears the marks cycle_exists() left on the vertices it visited */
+static void reset_cdg_visits(lash_t * p_lash)
+{
+	int i;
+
+	for (i = 0; i < p_lash->num_cdg_visited; i++) {
+		p_lash->cdg_visited[i]->visiting_number = 0;
+		p_lash->cdg_visited[i]->seen = 0;
+	}
+	p_lash->num_cdg_visited = 0;
+}
+
 static inline int get_next_switch(lash_t *p_lash, int sw, int link)
 {
 	return p_lash->switches[sw]->node->links[link]->switch_id;
@@ -177,9 +222,7 @@ static void remove_semipermanent_depend_for_sp(lash_t * p_lash, int sw,
 					       int dest_switch, int lane)
 {
 	switch_t **switches = p_lash->switches;
-	cdg_vertex_t ****cdg_vertex_matrix = p_lash->cdg_vertex_matrix;
-	int i_next_switch, output_link, i, next_link, i_next_next_switch,
-	    depend = 0;
+	int i_next_switch, output_link, i, next_link, depend = 0;
 	cdg_vertex_t *v;
 	int __attribute__((unused)) found;
 
@@ -187,12 +230,12 @@ static void remove_semipermanent_depend_for_sp(lash_t * p_lash, int sw,
 	i_next_switch = get_next_switch(p_lash, sw, output_link);
 
 	while (sw != dest_switch) {
-		v = cdg_vertex_matrix[lane][sw][i_next_switch];
+		v = *get_cdg_vertex(p_lash, lane, sw, output_link);
 		CL_ASSERT(v != NULL);
 
 		if (v->num_using_vertex == 1) {
 
-			cdg_vertex_matrix[lane][sw][i_next_switch] = NULL;
+			*get_cdg_vertex(p_lash, lane, sw, output_link) = NULL;
 
 			free(v);
 		} else {
@@ -200,13 +243,13 @@ static void remove_semipermanent_depend_for_sp(lash_t * p_lash, int sw,
 			if (i_next_switch != dest_switch) {
 				next_link =
 				    switches[i_next_switch]->routing_table[dest_switch].out_link;
-				i_next_next_switch = get_next_switch(p_lash, i_next_switch, next_link);
 				found = 0;
 
 				for (i = 0; i < v->num_deps; i++)
 					if (v->deps[i].v ==
-					    cdg_vertex_matrix[lane][i_next_switch]
-					    [i_next_next_switch]) {
+					    *get_cdg_vertex(p_lash, lane,
+							    i_next_switch,
+							    next_link)) {
 						found = 1;
 						depend = i;
 					}
@@ -327,27 +370,29 @@ static int generate_routing_func_for_mst(lash_t * p_lash, int sw_id,
 static int generate_cdg_for_sp(lash_t * p_lash, int sw, int dest_switch,
 			       int lane)
 {
-	unsigned num_switches = p_lash->num_switches;
 	switch_t **switches = p_lash->switches;
-	cdg_vertex_t ****cdg_vertex_matrix = p_lash->cdg_vertex_matrix;
 	int next_switch, output_link, j, exists;
-	cdg_vertex_t *v, *prev = NULL;
+	cdg_vertex_t **p_v, *v, *prev = NULL;
 
 	output_link = switches[sw]->routing_table[dest_switch].out_link;
 	next_switch = get_next_switch(p_lash, sw, output_link);
 
 	while (sw != dest_switch) {
 
-		if (cdg_vertex_matrix[lane][sw][next_switch] == NULL) {
-			v = calloc(1, sizeof(*v) + (num_switches - 1) * sizeof(v->deps[0]));
+		p_v = get_cdg_vertex(p_lash, lane, sw, output_link);
+		if (*p_v == NULL) {
+			/* room for a dependency on each channel out of next_switch */
+			v = calloc(1, sizeof(*v) +
+				   switches[next_switch]->node->num_links *
+				   sizeof(v->deps[0]));
 			if (!v)
 				return -1;
 			v->from = sw;
 			v->to = next_switch;
 			v->temp = 1;
-			cdg_vertex_matrix[lane][sw][next_switch] = v;
+			*p_v = v;
 		} else
-			v = cdg_vertex_matrix[lane][sw][next_switch];
+			v = *p_v;
 
 		v->num_using_vertex++;
 
@@ -365,7 +410,8 @@ static int generate_cdg_for_sp(lash_t * p_lash, int sw, int dest_switch,
 				prev->deps[prev->num_deps].num_used++;
 				prev->num_deps++;
 
-				CL_ASSERT(prev->num_deps < (int)num_switches);
+				CL_ASSERT(prev->num_deps <=
+					  (int)switches[prev->to]->node->num_links);
 
 				if (prev->temp == 0)
 					prev->num_temp_depend++;
@@ -390,7 +436,6 @@ static void set_temp_depend_to_permanent_for_sp(lash_t * p_lash, int sw,
 						int dest_switch, int lane)
 {
 	switch_t **switches = p_lash->switches;
-	cdg_vertex_t ****cdg_vertex_matrix = p_lash->cdg_vertex_matrix;
 	int next_switch, output_link;
 	cdg_vertex_t *v;
 
@@ -398,7 +443,7 @@ static void set_temp_depend_to_permanent_for_sp(lash_t * p_lash, int sw,
 	next_switch = get_next_switch(p_lash, sw, output_link);
 
 	while (sw != dest_switch) {
-		v = cdg_vertex_matrix[lane][sw][next_switch];
+		v = *get_cdg_vertex(p_lash, lane, sw, output_link);
 		CL_ASSERT(v != NULL);
 
 		if (v->temp == 1)
@@ -419,7 +464,6 @@ static void remove_temp_depend_for_sp(lash_t * p_lash, int sw, int dest_switch,
 				      int lane)
 {
 	switch_t **switches = p_lash->switches;
-	cdg_vertex_t ****cdg_vertex_matrix = p_lash->cdg_vertex_matrix;
 	int next_switch, output_link, i;
 	cdg_vertex_t *v;
 
@@ -427,11 +471,11 @@ static void remove_temp_depend_for_sp(lash_t * p_lash, int sw, int dest_switch,
 	next_switch = get_next_switch(p_lash, sw, output_link);
 
 	while (sw != dest_switch) {
-		v = cdg_vertex_matrix[lane][sw][next_switch];
+		v = *get_cdg_vertex(p_lash, lane, sw, output_link);
 		CL_ASSERT(v != NULL);
 
 		if (v->temp == 1) {
-			cdg_vertex_matrix[lane][sw][next_switch] = NULL;
+			*get_cdg_vertex(p_lash, lane, sw, output_link) = NULL;
 			free(v);
 		} else {
 			CL_ASSERT(v->num_temp_depend <= v->num_deps);
@@ -439,7 +483,8 @@ static void remove_temp_depend_for_sp(lash_t * p_lash, int sw, int dest_switch,
 			v->num_temp_depend = 0;
 			v->num_using_vertex--;
 
-			for (i = v->num_deps; i < p_lash->num_switches - 1; i++)
+			for (i = v->num_deps;
+			     i < (int)switches[v->to]->node->num_links; i++)
 				v->deps[i].num_used = 0;
 		}
 
@@ -455,15 +500,13 @@ static void remove_temp_depend_for_sp(lash_t * p_lash, int sw, int dest_switch,
 static int balance_virtual_lanes(lash_t * p_lash, unsigned lanes_needed)
 {
 	unsigned num_switches = p_lash->num_switches;
-	cdg_vertex_t ****cdg_vertex_matrix = p_lash->cdg_vertex_matrix;
 	int *num_mst_in_lane = p_lash->num_mst_in_lane;
-	int ***virtual_location = p_lash->virtual_location;
+	uint8_t *virtual_location = p_lash->virtual_location;
 	int min_filled_lane, max_filled_lane, trials;
 	int old_min_filled_lane, old_max_filled_lane, new_num_min_lane,
 	    new_num_max_lane;
-	unsigned int i, j;
-	int src, dest, start, next_switch, output_link;
-	int next_switch2, output_link2;
+	unsigned int i;
+	int src, dest, start, output_link, output_link2;
 	int stop = 0, cycle_found;
 	int cycle_found2;
 	unsigned start_vl = p_lash->p_osm->subn.opt.lash_start_vl;
@@ -479,7 +522,8 @@ static int balance_virtual_lanes(lash_t * p_lash, unsigned lanes_needed)
 		src = abs(rand()) % (num_switches);
 		dest = abs(rand()) % (num_switches);
 
-		while (virtual_location[src][dest][max_filled_lane] != 1) {
+		while (*get_virtual_location(p_lash, src, dest) !=
+		       max_filled_lane) {
 			start = dest;
 			if (dest == num_switches - 1)
 				dest = 0;
@@ -487,15 +531,16 @@ static int balance_virtual_lanes(lash_t * p_lash, unsigned lanes_needed)
 				dest++;
 
 			while (dest != start
-			       && virtual_location[src][dest][max_filled_lane]
-			       != 1) {
+			       && *get_virtual_location(p_lash, src, dest)
+			       != max_filled_lane) {
 				if (dest == num_switches - 1)
 					dest = 0;
 				else
 					dest++;
 			}
 
-			if (virtual_location[src][dest][max_filled_lane] != 1) {
+			if (*get_virtual_location(p_lash, src, dest) !=
+			    max_filled_lane) {
 				if (src == num_switches - 1)
 					src = 0;
 				else
@@ -508,35 +553,26 @@ static int balance_virtual_lanes(lash_t * p_lash, unsigned lanes_needed)
 			return -1;
 
 		output_link = p_lash->switches[src]->routing_table[dest].out_link;
-		next_switch = get_next_switch(p_lash, src, output_link);
-
 		output_link2 = p_lash->switches[dest]->routing_table[src].out_link;
-		next_switch2 = get_next_switch(p_lash, dest, output_link2);
 
-		CL_ASSERT(cdg_vertex_matrix[min_filled_lane][src][next_switch] != NULL);
-		CL_ASSERT(cdg_vertex_matrix[min_filled_lane][dest][next_switch2] != NULL);
+		CL_ASSERT(*get_cdg_vertex(p_lash, min_filled_lane, src, output_link) != NULL);
+		CL_ASSERT(*get_cdg_vertex(p_lash, min_filled_lane, dest, output_link2) != NULL);
 
 		cycle_found =
-		    cycle_exists(cdg_vertex_matrix[min_filled_lane][src][next_switch], NULL, NULL,
-				 1);
+		    cycle_exists(p_lash, *get_cdg_vertex(p_lash, min_filled_lane, src,
+							 output_link), NULL, NULL, 1);
 		cycle_found2 =
-		    cycle_exists(cdg_vertex_matrix[min_filled_lane][dest][next_switch2], NULL, NULL,
-				 1);
-
-		for (i = 0; i < num_switches; i++)
-			for (j = 0; j < num_switches; j++)
-				if (cdg_vertex_matrix[min_filled_lane][i][j] != NULL) {
-					cdg_vertex_matrix[min_filled_lane][i][j]->visiting_number =
-					    0;
-					cdg_vertex_matrix[min_filled_lane][i][j]->seen = 0;
-				}
+		    cycle_exists(p_lash, *get_cdg_vertex(p_lash, min_filled_lane, dest,
+							 output_link2), NULL, NULL, 1);
+
+		reset_cdg_visits(p_lash);
 
 		if (cycle_found == 1 || cycle_found2 == 1) {
 			remove_temp_depend_for_sp(p_lash, src, dest, min_filled_lane);
 			remove_temp_depend_for_sp(p_lash, dest, src, min_filled_lane);
 
-			virtual_location[src][dest][max_filled_lane] = 2;
-			virtual_location[dest][src][max_filled_lane] = 2;
+			*get_virtual_location(p_lash, src, dest) |= LANE_TRIED;
+			*get_virtual_location(p_lash, dest, src) |= LANE_TRIED;
 			trials--;
 			trials--;
 		} else {
@@ -550,10 +586,8 @@ static int balance_virtual_lanes(lash_t * p_lash, unsigned lanes_needed)
 
 			remove_semipermanent_depend_for_sp(p_lash, src, dest, max_filled_lane);
 			remove_semipermanent_depend_for_sp(p_lash, dest, src, max_filled_lane);
-			virtual_location[src][dest][max_filled_lane] = 0;
-			virtual_location[dest][src][max_filled_lane] = 0;
-			virtual_location[src][dest][min_filled_lane] = 1;
-			virtual_location[dest][src][min_filled_lane] = 1;
+			*get_virtual_location(p_lash, src, dest) = min_filled_lane;
+			*get_virtual_location(p_lash, dest, src) = min_filled_lane;
 			p_lash->switches[src]->routing_table[dest].lane = min_filled_lane + start_vl;
 			p_lash->switches[dest]->routing_table[src].lane = min_filled_lane + start_vl;
 		}
@@ -587,18 +621,16 @@ static int balance_virtual_lanes(lash_t * p_lash, unsigned lanes_needed)
 
 		if (old_min_filled_lane != min_filled_lane) {
 			trials = num_mst_in_lane[max_filled_lane];
-			for (i = 0; i < num_switches; i++)
-				for (j = 0; j < num_switches; j++)
-					if (virtual_location[i][j][max_filled_lane] == 2)
-						virtual_location[i][j][max_filled_lane] = 1;
+			for (i = 0; i < num_switches * num_switches; i++)
+				if (virtual_location[i] == (max_filled_lane | LANE_TRIED))
+					virtual_location[i] = max_filled_lane;
 		}
 
 		if (old_max_filled_lane != max_filled_lane) {
 			trials = num_mst_in_lane[max_filled_lane];
-			for (i = 0; i < num_switches; i++)
-				for (j = 0; j < num_switches; j++)
-					if (virtual_location[i][j][old_max_filled_lane] == 2)
-						virtual_location[i][j][old_max_filled_lane] = 1;
+			for (i = 0; i < num_switches * num_switches; i++)
+				if (virtual_location[i] == (old_max_filled_lane | LANE_TRIED))
+					virtual_location[i] = old_max_filled_lane;
 		}
 	}
 	return 0;
@@ -660,41 +692,32 @@ static void delete_mesh_switches(lash_t *p_lash)
 
 static void free_lash_structures(lash_t * p_lash)
 {
-	unsigned int i, j, k;
-	unsigned num_switches = p_lash->num_switches;
+	int i;
 	osm_log_t *p_log = &p_lash->p_osm->log;
 
 	OSM_LOG_ENTER(p_log);
 
 	delete_mesh_switches(p_lash);
 
-	/* free cdg_vertex_matrix */
-	for (i = 0; i < p_lash->vl_min; i++) {
-		for (j = 0; j < num_switches; j++) {
-			for (k = 0; k < num_switches; k++)
-				if (p_lash->cdg_vertex_matrix[i][j][k])
-					free(p_lash->cdg_vertex_matrix[i][j][k]);
-			if (p_lash->cdg_vertex_matrix[i][j])
-				free(p_lash->cdg_vertex_matrix[i][j]);
-		}
-		if (p_lash->cdg_vertex_matrix[i])
-			free(p_lash->cdg_vertex_matrix[i]);
+	/* free cdg_vertices */
+	if (p_lash->cdg_vertices) {
+		for (i = 0; i < p_lash->vl_min * p_lash->num_channels; i++)
+			if (p_lash->cdg_vertices[i])
+				free(p_lash->cdg_vertices[i]);
+		free(p_lash->cdg_vertices);
+		p_lash->cdg_vertices = NULL;
 	}
 
-	if (p_lash->cdg_vertex_matrix)
-		free(p_lash->cdg_vertex_matrix);
+	if (p_lash->cdg_visited) {
+		free(p_lash->cdg_visited);
+		p_lash->cdg_visited = NULL;
+	}
 
 	/* free virtual_location */
-	for (i = 0; i < num_switches; i++) {
-		for (j = 0; j < num_switches; j++) {
-			if (p_lash->virtual_location[i][j])
-				free(p_lash->virtual_location[i][j]);
-		}
-		if (p_lash->virtual_location[i])
-			free(p_lash->virtual_location[i]);
-	}
-	if (p_lash->virtual_location)
+	if (p_lash->virtual_location) {
 		free(p_lash->virtual_location);
+		p_lash->virtual_location = NULL;
+	}
 
 	OSM_LOG_EXIT(p_log);
 }
@@ -705,63 +728,39 @@ static int init_lash_structures(lash_t * p_lash)
 	unsigned num_switches = p_lash->num_switches;
 	osm_log_t *p_log = &p_lash->p_osm->log;
 	int status = 0;
-	unsigned int i, j, k;
+	unsigned int i;
 
 	OSM_LOG_ENTER(p_log);
 
-	/* initialise cdg_vertex_matrix[num_layers][num_switches][num_switches] */
-	p_lash->cdg_vertex_matrix =
-	    (cdg_vertex_t ****) malloc(vl_min * sizeof(cdg_vertex_t ***));
-	if (p_lash->cdg_vertex_matrix == NULL)
-		goto Exit_Mem_Error;
-	for (i = 0; i < vl_min; i++) {
-		p_lash->cdg_vertex_matrix[i] =
-		    (cdg_vertex_t ***) malloc(num_switches *
-					      sizeof(cdg_vertex_t **));
-
-		if (p_lash->cdg_vertex_matrix[i] == NULL)
-			goto Exit_Mem_Error;
+	/* number the channels, a channel per link out of a switch */
+	p_lash->num_channels = 0;
+	for (i = 0; i < num_switches; i++) {
+		p_lash->switches[i]->first_channel = p_lash->num_channels;
+		p_lash->num_channels += p_lash->switches[i]->node->num_links;
 	}
 
-	for (i = 0; i < vl_min; i++) {
-		for (j = 0; j < num_switches; j++) {
-			p_lash->cdg_vertex_matrix[i][j] =
-			    (cdg_vertex_t **) malloc(num_switches *
-						     sizeof(cdg_vertex_t *));
-			if (p_lash->cdg_vertex_matrix[i][j] == NULL)
-				goto Exit_Mem_Error;
-
-			for (k = 0; k < num_switches; k++)
-				p_lash->cdg_vertex_matrix[i][j][k] = NULL;
-		}
-	}
+	/* initialise cdg_vertices[num_layers][num_channels] */
+	p_lash->cdg_vertices = calloc((size_t) vl_min * p_lash->num_channels,
+				      sizeof(cdg_vertex_t *));
+	if (p_lash->cdg_vertices == NULL)
+		goto Exit_Mem_Error;
+
+	/* a search visits each vertex of a lane at most once */
+	p_lash->cdg_visited = malloc(p_lash->num_channels *
+				     sizeof(cdg_vertex_t *));
+	if (p_lash->cdg_visited == NULL)
+		goto Exit_Mem_Error;
+	p_lash->num_cdg_visited = 0;
 
 	/*
-	 * initialise virtual_location[num_switches][num_switches][num_layers],
-	 * default value = 0
+	 * initialise virtual_location[num_switches][num_switches],
+	 * default value = NO_LANE
 	 */
-	p_lash->virtual_location =
-	    (int ***)malloc(num_switches * sizeof(int ***));
+	p_lash->virtual_location = malloc((size_t) num_switches * num_switches);
 	if (p_lash->virtual_location == NULL)
 		goto Exit_Mem_Error;
-
-	for (i = 0; i < num_switches; i++) {
-		p_lash->virtual_location[i] =
-		    (int **)malloc(num_switches * sizeof(int **));
-		if (p_lash->virtual_location[i] == NULL)
-			goto Exit_Mem_Error;
-	}
-
-	for (i = 0; i < num_switches; i++) {
-		for (j = 0; j < num_switches; j++) {
-			p_lash->virtual_location[i][j] =
-			    (int *)malloc(vl_min * sizeof(int *));
-			if (p_lash->virtual_location[i][j] == NULL)
-				goto Exit_Mem_Error;
-			for (k = 0; k < vl_min; k++)
-				p_lash->virtual_location[i][j][k] = 0;
-		}
-	}
+	memset(p_lash->virtual_location, NO_LANE,
+	       (size_t) num_switches * num_switches);
 
 	/* initialise num_mst_in_lane[num_switches], default 0 */
 	memset(p_lash->num_mst_in_lane, 0,
@@ -786,15 +785,14 @@ static int lash_core(lash_t * p_lash)
 	unsigned num_switches = p_lash->num_switches;
 	switch_t **switches = p_lash->switches;
 	unsigned lanes_needed = 1;
-	unsigned int i, j, k, dest_switch = 0;
+	unsigned int i, j, dest_switch = 0;
 	reachable_dest_t *dests, *idest;
 	int cycle_found = 0;
 	unsigned v_lane;
-	int stop = 0, output_link, i_next_switch;
-	int output_link2, i_next_switch2;
+	int stop = 0, output_link;
+	int output_link2;
 	int cycle_found2 = 0;
 	int status = -1;
-	int *switch_bitmap = NULL;	/* Bitmap to check if we have processed this pair */
 	unsigned start_vl = p_lash->p_osm->subn.opt.lash_start_vl;
 
 	OSM_LOG_ENTER(p_log);
@@ -826,16 +824,10 @@ static int lash_core(lash_t * p_lash)
 		}
 	}
 
-	switch_bitmap = calloc(num_switches * num_switches, sizeof(int));
-	if (!switch_bitmap) {
-		OSM_LOG(p_log, OSM_LOG_ERROR, "ERR 4D04: "
-			"Failed allocating switch_bitmap - out of memory\n");
-		goto Exit;
-	}
-
+	/* each pair is processed once, both directions at a time */
 	for (i = 0; i < num_switches; i++) {
 		for (dest_switch = 0; dest_switch < num_switches; dest_switch++)
-			if (dest_switch != i && switch_bitmap[i * num_switches + dest_switch] == 0) {
+			if (dest_switch > i) {
 				v_lane = 0;
 				stop = 0;
 				while (v_lane < lanes_needed && stop == 0) {
@@ -851,37 +843,24 @@ static int lash_core(lash_t * p_lash)
 					output_link2 =
 					    switches[dest_switch]->routing_table[i].out_link;
 
-					i_next_switch = get_next_switch(p_lash, i, output_link);
-					i_next_switch2 = get_next_switch(p_lash, dest_switch, output_link2);
-
-					CL_ASSERT(p_lash->
-						  cdg_vertex_matrix[v_lane][i][i_next_switch] !=
-						  NULL);
-					CL_ASSERT(p_lash->
-						  cdg_vertex_matrix[v_lane][dest_switch]
-						  [i_next_switch2] != NULL);
+					CL_ASSERT(*get_cdg_vertex(p_lash, v_lane, i,
+								  output_link) != NULL);
+					CL_ASSERT(*get_cdg_vertex(p_lash, v_lane, dest_switch,
+								  output_link2) != NULL);
 
 					cycle_found =
-					    cycle_exists(p_lash->
-							 cdg_vertex_matrix[v_lane][i]
-							 [i_next_switch], NULL, NULL, 1);
+					    cycle_exists(p_lash,
+							 *get_cdg_vertex(p_lash, v_lane, i,
+									 output_link),
+							 NULL, NULL, 1);
 					cycle_found2 =
-					    cycle_exists(p_lash->
-							 cdg_vertex_matrix[v_lane][dest_switch]
-							 [i_next_switch2], NULL, NULL, 1);
-
-					for (j = 0; j < num_switches; j++)
-						for (k = 0; k < num_switches; k++)
-							if (p_lash->
-							    cdg_vertex_matrix[v_lane][j][k] !=
-							    NULL) {
-								p_lash->
-								    cdg_vertex_matrix[v_lane][j]
-								    [k]->visiting_number = 0;
-								p_lash->
-								    cdg_vertex_matrix[v_lane][j]
-								    [k]->seen = 0;
-							}
+					    cycle_exists(p_lash,
+							 *get_cdg_vertex(p_lash, v_lane,
+									 dest_switch,
+									 output_link2),
+							 NULL, NULL, 1);
+
+					reset_cdg_visits(p_lash);
 
 					if (cycle_found == 1 || cycle_found2 == 1) {
 						remove_temp_depend_for_sp(p_lash, i, dest_switch,
@@ -924,11 +903,8 @@ static int lash_core(lash_t * p_lash)
 					p_lash->num_mst_in_lane[v_lane]++;
 					p_lash->num_mst_in_lane[v_lane]++;
 				}
-				p_lash->virtual_location[i][dest_switch][v_lane] = 1;
-				p_lash->virtual_location[dest_switch][i][v_lane] = 1;
-
-				switch_bitmap[i * num_switches + dest_switch] = 1;
-				switch_bitmap[dest_switch * num_switches + i] = 1;
+				*get_virtual_location(p_lash, i, dest_switch) = v_lane;
+				*get_virtual_location(p_lash, dest_switch, i) = v_lane;
 			}
 	}
 
@@ -957,8 +933,6 @@ Error_Not_Enough_Lanes:
 		" with starting lane (%d)\n",
 		lanes_needed, p_lash->vl_min, start_vl);
 Exit:
-	if (switch_bitmap)
-		free(switch_bitmap);
 	OSM_LOG_EXIT(p_log);
 	return status;
 }
@@ -1230,12 +1204,12 @@ static int lash_process(void *context)
 	if (status)
 		goto Exit;
 
+	process_switches(p_lash);
+
 	status = init_lash_structures(p_lash);
 	if (status)
 		goto Exit;
 
-	process_switches(p_lash);
-
 	status = lash_core(p_lash);
 	if (status)
 		goto Exit;
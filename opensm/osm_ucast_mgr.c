@@ -61,6 +61,8 @@
 #include <opensm/osm_helper.h>
 #include <opensm/osm_msgdef.h>
 #include <opensm/osm_opensm.h>
+#include <opensm/osm_parallel.h>
+#include <opensm/osm_relax_hops.h>
 
 void osm_ucast_mgr_construct(IN osm_ucast_mgr_t * p_mgr)
 {
@@ -76,9 +78,22 @@ void osm_ucast_mgr_destroy(IN osm_ucast_mgr_t * p_mgr)
 	if (p_mgr->cache_valid)
 		osm_ucast_cache_invalidate(p_mgr);
 
+	free(p_mgr->hop_rows);
+
 	OSM_LOG_EXIT(p_mgr->p_log);
 }
 
+static osm_relax_hops_fn_t relax_hops;
+
+static void ucast_mgr_select_relax_hops(IN osm_ucast_mgr_t * p_mgr)
+{
+	const char *name;
+
+	relax_hops = osm_relax_hops_select(&name);
+	OSM_LOG(p_mgr->p_log, OSM_LOG_VERBOSE,
+		"Using %s min hop relaxation\n", name);
+}
+
 ib_api_status_t osm_ucast_mgr_init(IN osm_ucast_mgr_t * p_mgr, IN osm_sm_t * sm)
 {
 	ib_api_status_t status = IB_SUCCESS;
@@ -95,6 +110,8 @@ ib_api_status_t osm_ucast_mgr_init(IN osm_ucast_mgr_t * p_mgr, IN osm_sm_t * sm)
 	if (sm->p_subn->opt.use_ucast_cache)
 		cl_qmap_init(&p_mgr->cache_sw_tbl);
 
+	ucast_mgr_select_relax_hops(p_mgr);
+
 	OSM_LOG_EXIT(p_mgr->p_log);
 	return status;
 }
@@ -133,10 +150,6 @@ static void ucast_mgr_process_neighbor(IN osm_ucast_mgr_t * p_mgr,
 				       IN uint8_t port_num,
 				       IN uint8_t remote_port_num)
 {
-	osm_switch_t *p_sw;
-	cl_map_item_t *item;
-	uint16_t lid_ho;
-	uint16_t hops;
 	osm_physp_t *p;
 
 	OSM_LOG_ENTER(p_mgr->p_log);
@@ -150,27 +163,11 @@ static void ucast_mgr_process_neighbor(IN osm_ucast_mgr_t * p_mgr,
 
 	p = osm_node_get_physp_ptr(p_this_sw->p_node, port_num);
 
-	for (item = cl_qmap_head(&p_mgr->p_subn->sw_guid_tbl);
-	     item != cl_qmap_end(&p_mgr->p_subn->sw_guid_tbl);
-	     item = cl_qmap_next(item)) {
-		p_sw = (osm_switch_t *) item;
-		lid_ho = cl_ntoh16(osm_node_get_base_lid(p_sw->p_node, 0));
-		hops = osm_switch_get_least_hops(p_remote_sw, lid_ho);
-		if (hops == OSM_NO_PATH)
-			continue;
-		hops += p->hop_wf;
-		if (hops <
-		    osm_switch_get_hop_count(p_this_sw, lid_ho, port_num)) {
-			if (osm_switch_set_hops
-			    (p_this_sw, lid_ho, port_num, (uint8_t) hops) != 0)
-				OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR, "ERR 3A03: "
-					"cannot set hops for lid %u at switch 0x%"
-					PRIx64 "\n", lid_ho,
-					cl_ntoh64(osm_node_get_node_guid
-						  (p_this_sw->p_node)));
-			p_mgr->some_hop_count_set = TRUE;
-		}
-	}
+	if (relax_hops(osm_switch_get_port_hops(p_this_sw, port_num),
+		       osm_switch_get_port_hops(p_this_sw, 0),
+		       osm_switch_get_port_hops(p_remote_sw, 0),
+		       p_mgr->num_hop_rows, p->hop_wf))
+		p_mgr->some_hop_count_set = TRUE;
 
 	OSM_LOG_EXIT(p_mgr->p_log);
 }
@@ -303,7 +300,8 @@ static void ucast_mgr_process_port(IN osm_ucast_mgr_t * p_mgr,
 	if (!is_ignored_by_port_prof) {
 		struct osm_remote_node *rem_node_used;
 		osm_switch_count_path(p_sw, port);
-		if (port > 0 && p_port->priv &&
+		/* priv only holds the remote systems for LMC aware routing */
+		if (port > 0 && p_mgr->p_subn->opt.lmc && p_port->priv &&
 		    (rem_node_used = find_and_add_remote_sys(p_sw, port,
 							     p_mgr->is_dor,
 							     p_port->priv)))
@@ -372,7 +370,9 @@ static void ucast_mgr_process_tbl(IN cl_map_item_t * p_map_item,
 	/* Initialize LIDs in buffer to invalid port number. */
 	memset(p_sw->new_lft, OSM_NO_PATH, p_sw->max_lid_ho + 1);
 
-	alloc_ports_priv(p_mgr);
+	/* the remote systems are only tracked for LMC aware routing */
+	if (p_mgr->p_subn->opt.lmc)
+		alloc_ports_priv(p_mgr);
 
 	/*
 	   Iterate through every port setting LID routes for each
@@ -389,11 +389,60 @@ static void ucast_mgr_process_tbl(IN cl_map_item_t * p_map_item,
 		}
 	}
 
-	free_ports_priv(p_mgr);
+	if (p_mgr->p_subn->opt.lmc)
+		free_ports_priv(p_mgr);
 
 	OSM_LOG_EXIT(p_mgr->p_log);
 }
 
+typedef struct lft_build {
+	osm_ucast_mgr_t *p_mgr;
+	osm_switch_t **sws;
+} lft_build_t;
+
+static void lft_build_switch(IN void *context, IN unsigned index,
+			     IN unsigned thread)
+{
+	lft_build_t *b = context;
+
+	ucast_mgr_process_tbl(&b->sws[index]->map_item, b->p_mgr);
+}
+
+/*
+ * The LFT of a switch only depends on its own hop tables and port
+ * profiles, so the switches can be done in parallel.  The LMC aware
+ * routing tracks the remote systems of a port in the port itself and
+ * scatter_ports draws from the global random() sequence, so those are
+ * done in order to keep the results the same.
+ */
+static void ucast_mgr_process_tbls(IN osm_ucast_mgr_t * p_mgr)
+{
+	cl_qmap_t *p_sw_guid_tbl = &p_mgr->p_subn->sw_guid_tbl;
+	lft_build_t b;
+	cl_map_item_t *item;
+	unsigned num_threads, i = 0;
+
+	num_threads =
+	    osm_parallel_threads(p_mgr->p_subn->opt.routing_threads);
+	if (num_threads < 2 || p_mgr->p_subn->opt.lmc ||
+	    p_mgr->p_subn->opt.scatter_ports ||
+	    !(b.sws = malloc(cl_qmap_count(p_sw_guid_tbl) * sizeof(*b.sws)))) {
+		cl_qmap_apply_func(p_sw_guid_tbl, ucast_mgr_process_tbl, p_mgr);
+		return;
+	}
+
+	for (item = cl_qmap_head(p_sw_guid_tbl);
+	     item != cl_qmap_end(p_sw_guid_tbl); item = cl_qmap_next(item))
+		b.sws[i++] = (osm_switch_t *) item;
+	b.p_mgr = p_mgr;
+
+	osm_parallel_for(num_threads, i, lft_build_switch, &b);
+	OSM_LOG(p_mgr->p_log, OSM_LOG_DEBUG,
+		"LFTs of %u switches built with %u threads\n", i, num_threads);
+
+	free(b.sws);
+}
+
 static void ucast_mgr_process_neighbors(IN cl_map_item_t * p_map_item,
 					IN void *context)
 {
@@ -593,6 +642,240 @@ static int set_search_ordering_ports(void *ctx, uint64_t guid, char *p)
 	return 0;
 }
 
+/*
+ * Flat copy of the switch graph the min hop tables are built from
+ * when lid_matrix_bfs is set.  Switches are numbered in sw_guid_tbl
+ * order and the links of switch i are out[out_first[i]] up to
+ * out[out_first[i + 1]].  in[] holds the same links grouped by the
+ * switch they lead to, with sw being the switch they start from.
+ */
+typedef struct lid_matrix_link {
+	unsigned sw;
+	uint8_t port;
+	uint8_t hop_wf;
+	boolean_t healthy;
+} lid_matrix_link_t;
+
+typedef struct lid_matrix_graph {
+	osm_ucast_mgr_t *p_mgr;
+	unsigned num_sws;
+	osm_switch_t **sws;
+	uint64_t *keys;
+	unsigned *out_first;
+	lid_matrix_link_t *out;
+	unsigned *in_first;
+	lid_matrix_link_t *in;
+	uint8_t *dist;
+	unsigned *queue;
+	uint8_t *queued;
+} lid_matrix_graph_t;
+
+static unsigned lid_matrix_sw_index(IN lid_matrix_graph_t * g,
+				    IN osm_switch_t * p_sw)
+{
+	uint64_t key = cl_qmap_key(&p_sw->map_item);
+	unsigned lo = 0, hi = g->num_sws, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (g->keys[mid] < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int lid_matrix_graph_build(IN lid_matrix_graph_t * g,
+				  IN unsigned num_threads)
+{
+	cl_qmap_t *p_sw_guid_tbl = &g->p_mgr->p_subn->sw_guid_tbl;
+	cl_map_item_t *item;
+	osm_switch_t *p_sw;
+	osm_node_t *p_remote_node;
+	osm_physp_t *p;
+	lid_matrix_link_t *l;
+	unsigned i, j, num_links = 0;
+	uint8_t port, remote_port;
+
+	g->num_sws = cl_qmap_count(p_sw_guid_tbl);
+	g->sws = malloc(g->num_sws * sizeof(*g->sws));
+	g->keys = malloc(g->num_sws * sizeof(*g->keys));
+	g->out_first = calloc(g->num_sws + 1, sizeof(*g->out_first));
+	g->in_first = calloc(g->num_sws + 2, sizeof(*g->in_first));
+	g->dist = malloc(num_threads * g->num_sws);
+	g->queue = malloc(num_threads * g->num_sws * sizeof(*g->queue));
+	g->queued = malloc(num_threads * g->num_sws);
+	if (!g->sws || !g->keys || !g->out_first || !g->in_first ||
+	    !g->dist || !g->queue || !g->queued)
+		return -1;
+
+	for (i = 0, item = cl_qmap_head(p_sw_guid_tbl);
+	     item != cl_qmap_end(p_sw_guid_tbl);
+	     i++, item = cl_qmap_next(item)) {
+		g->sws[i] = (osm_switch_t *) item;
+		g->keys[i] = cl_qmap_key(item);
+		num_links += g->sws[i]->num_ports;
+	}
+
+	g->out = malloc(num_links * sizeof(*g->out));
+	g->in = malloc(num_links * sizeof(*g->in));
+	if (num_links && (!g->out || !g->in))
+		return -1;
+
+	for (i = 0, l = g->out; i < g->num_sws; i++) {
+		p_sw = g->sws[i];
+		g->out_first[i] = l - g->out;
+		for (port = 1; port < p_sw->num_ports; port++) {
+			p_remote_node = osm_node_get_remote_node(p_sw->p_node,
+								 port,
+								 &remote_port);
+			if (!p_remote_node || !p_remote_node->sw ||
+			    p_remote_node == p_sw->p_node)
+				continue;
+			p = osm_node_get_physp_ptr(p_sw->p_node, port);
+			if (!p)
+				continue;
+			l->sw = lid_matrix_sw_index(g, p_remote_node->sw);
+			l->port = port;
+			l->hop_wf = p->hop_wf;
+			l->healthy = osm_link_is_healthy(p);
+			g->in_first[l->sw + 2]++;
+			l++;
+		}
+	}
+	g->out_first[g->num_sws] = l - g->out;
+
+	/* counting sort of the links by the switch they lead to */
+	for (i = 2; i <= g->num_sws + 1; i++)
+		g->in_first[i] += g->in_first[i - 1];
+	for (i = 0; i < g->num_sws; i++)
+		for (j = g->out_first[i]; j < g->out_first[i + 1]; j++) {
+			l = &g->in[g->in_first[g->out[j].sw + 1]++];
+			*l = g->out[j];
+			l->sw = i;
+		}
+
+	return 0;
+}
+
+static void lid_matrix_graph_destroy(IN lid_matrix_graph_t * g)
+{
+	free(g->sws);
+	free(g->keys);
+	free(g->out_first);
+	free(g->out);
+	free(g->in_first);
+	free(g->in);
+	free(g->dist);
+	free(g->queue);
+	free(g->queued);
+}
+
+/*
+ * Computes the hop counts of all switches towards switch 'index'
+ * and stores them in its LID row of their min hop tables.  The
+ * search runs backwards from the destination and uses the hop weight
+ * of the port a link starts from.  Like the neighbor propagation, a
+ * link that is not healthy only counts as the last hop and a path of
+ * OSM_NO_PATH hops or more is no path.  ucast_mgr_process_hop_0_1 has
+ * already set the entries of the direct links.
+ */
+static void lid_matrix_search(IN void *context, IN unsigned index,
+			      IN unsigned thread)
+{
+	lid_matrix_graph_t *g = context;
+	uint8_t *dist = g->dist + thread * g->num_sws;
+	unsigned *queue = g->queue + thread * g->num_sws;
+	uint8_t *queued = g->queued + thread * g->num_sws;
+	unsigned head = 0, count = 1, i, j, hops;
+	lid_matrix_link_t *l;
+	osm_switch_t *p_sw;
+	uint16_t lid_ho;
+
+	lid_ho = cl_ntoh16(osm_node_get_base_lid(g->sws[index]->p_node, 0));
+	if (!lid_ho)
+		return;
+
+	memset(dist, OSM_NO_PATH, g->num_sws);
+	memset(queued, 0, g->num_sws);
+	dist[index] = 0;
+	queue[0] = index;
+	queued[index] = 1;
+
+	while (count) {
+		i = queue[head];
+		head = (head + 1) % g->num_sws;
+		count--;
+		queued[i] = 0;
+		for (j = g->in_first[i]; j < g->in_first[i + 1]; j++) {
+			l = &g->in[j];
+			if (!l->healthy && i != index)
+				continue;
+			hops = dist[i] + l->hop_wf;
+			if (hops >= dist[l->sw])
+				continue;
+			dist[l->sw] = (uint8_t) hops;
+			if (!queued[l->sw]) {
+				queue[(head + count) % g->num_sws] = l->sw;
+				queued[l->sw] = 1;
+				count++;
+			}
+		}
+	}
+
+	for (i = 0; i < g->num_sws; i++) {
+		p_sw = g->sws[i];
+		for (j = g->out_first[i]; j < g->out_first[i + 1]; j++) {
+			l = &g->out[j];
+			if (!l->healthy || dist[l->sw] == OSM_NO_PATH)
+				continue;
+			hops = dist[l->sw] + l->hop_wf;
+			if (hops >= OSM_NO_PATH)
+				continue;
+			if (osm_switch_set_hops(p_sw, lid_ho, l->port,
+						(uint8_t) hops) != 0)
+				OSM_LOG(g->p_mgr->p_log, OSM_LOG_ERROR,
+					"ERR 3A03: cannot set hops for lid %u "
+					"at switch 0x%" PRIx64 "\n", lid_ho,
+					cl_ntoh64(osm_node_get_node_guid
+						  (p_sw->p_node)));
+		}
+	}
+}
+
+static int ucast_mgr_search_lid_matrices(IN osm_ucast_mgr_t * p_mgr)
+{
+	lid_matrix_graph_t g;
+	unsigned num_threads;
+	int ret = -1;
+
+	if (!cl_qmap_count(&p_mgr->p_subn->sw_guid_tbl))
+		return 0;
+
+	memset(&g, 0, sizeof(g));
+	g.p_mgr = p_mgr;
+	num_threads =
+	    osm_parallel_threads(p_mgr->p_subn->opt.routing_threads);
+
+	if (lid_matrix_graph_build(&g, num_threads)) {
+		OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR, "ERR 3A11: "
+			"cannot allocate the switch graph, propagating "
+			"the min hop tables instead\n");
+		goto Exit;
+	}
+
+	osm_parallel_for(num_threads, g.num_sws, lid_matrix_search, &g);
+	OSM_LOG(p_mgr->p_log, OSM_LOG_DEBUG,
+		"Min-hop tables of %u switches built with %u threads\n",
+		g.num_sws, num_threads);
+	ret = 0;
+
+Exit:
+	lid_matrix_graph_destroy(&g);
+	return ret;
+}
+
 int osm_ucast_mgr_build_lid_matrices(IN osm_ucast_mgr_t * p_mgr)
 {
 	uint32_t i;
@@ -626,6 +909,10 @@ int osm_ucast_mgr_build_lid_matrices(IN osm_ucast_mgr_t * p_mgr)
 	 */
 	cl_qmap_apply_func(p_sw_guid_tbl, ucast_mgr_process_hop_0_1, p_mgr);
 
+	if (p_mgr->p_subn->opt.lid_matrix_bfs &&
+	    !ucast_mgr_search_lid_matrices(p_mgr))
+		return 0;
+
 	/*
 	   Get the switch matrices for each switch's neighbors.
 	   This process requires a number of iterations equal to
@@ -674,22 +961,72 @@ int osm_ucast_mgr_build_lid_matrices(IN osm_ucast_mgr_t * p_mgr)
 	return 0;
 }
 
-static int ucast_mgr_setup_all_switches(osm_subn_t * p_subn)
+/*
+ * Give each switch LID a row in the hops tables.  The array is
+ * allocated once for all unicast LIDs, so the pointer the switches
+ * keep to it stays valid.
+ */
+static int ucast_mgr_setup_hop_rows(IN osm_ucast_mgr_t * p_mgr,
+				    IN uint16_t lids)
 {
+	cl_qmap_t *p_sw_guid_tbl = &p_mgr->p_subn->sw_guid_tbl;
+	osm_switch_t *p_sw;
+	uint16_t lid, min_lid_ho, max_lid_ho;
+
+	if (!p_mgr->hop_rows &&
+	    !(p_mgr->hop_rows = malloc((IB_LID_UCAST_END_HO + 1) *
+				       sizeof(p_mgr->hop_rows[0]))))
+		return -1;
+
+	memset(p_mgr->hop_rows, 0xFF,
+	       (IB_LID_UCAST_END_HO + 1) * sizeof(p_mgr->hop_rows[0]));
+	p_mgr->num_hop_rows = 0;
+
+	for (p_sw = (osm_switch_t *) cl_qmap_head(p_sw_guid_tbl);
+	     p_sw != (osm_switch_t *) cl_qmap_end(p_sw_guid_tbl);
+	     p_sw = (osm_switch_t *) cl_qmap_next(&p_sw->map_item)) {
+		min_lid_ho = cl_ntoh16(osm_node_get_base_lid(p_sw->p_node, 0));
+		max_lid_ho = min_lid_ho +
+		    (1 << osm_node_get_lmc(p_sw->p_node, 0)) - 1;
+		for (lid = min_lid_ho; lid && lid <= max_lid_ho && lid <= lids;
+		     lid++)
+			if (p_mgr->hop_rows[lid] == OSM_NO_HOP_ROW)
+				p_mgr->hop_rows[lid] = p_mgr->num_hop_rows++;
+	}
+
+	return 0;
+}
+
+static int ucast_mgr_setup_all_switches(osm_ucast_mgr_t * p_mgr)
+{
+	osm_subn_t *p_subn = p_mgr->p_subn;
 	osm_switch_t *p_sw;
 	uint16_t lids;
 
 	lids = (uint16_t) cl_ptr_vector_get_size(&p_subn->port_lid_tbl);
 	lids = lids ? lids - 1 : 0;
 
+	if (ucast_mgr_setup_hop_rows(p_mgr, lids)) {
+		OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR, "ERR 3A12: "
+			"cannot allocate the hop table rows\n");
+		return -1;
+	}
+
 	for (p_sw = (osm_switch_t *) cl_qmap_head(&p_subn->sw_guid_tbl);
 	     p_sw != (osm_switch_t *) cl_qmap_end(&p_subn->sw_guid_tbl);
 	     p_sw = (osm_switch_t *) cl_qmap_next(&p_sw->map_item)) {
-		if (osm_switch_prepare_path_rebuild(p_sw, lids)) {
+		if (osm_switch_prepare_path_rebuild(p_sw, lids, p_mgr->hop_rows,
+						    p_mgr->num_hop_rows)) {
 			OSM_LOG(&p_subn->p_osm->log, OSM_LOG_ERROR, "ERR 3A0B: "
 				"cannot setup switch 0x%016" PRIx64 "\n",
 				cl_ntoh64(osm_node_get_node_guid
 					  (p_sw->p_node)));
+			/* the rows changed, hide the stale tables */
+			for (; p_sw != (osm_switch_t *)
+			     cl_qmap_end(&p_subn->sw_guid_tbl);
+			     p_sw = (osm_switch_t *)
+			     cl_qmap_next(&p_sw->map_item))
+				p_sw->max_lid_ho = 0;
 			return -1;
 		}
 		if (p_sw->search_ordering_ports) {
@@ -888,8 +1225,7 @@ static int ucast_mgr_build_lfts(osm_ucast_mgr_t * p_mgr)
 	cl_qmap_apply_func(&p_mgr->p_subn->port_guid_tbl,
 			   add_port_to_order_list, p_mgr);
 
-	cl_qmap_apply_func(&p_mgr->p_subn->sw_guid_tbl, ucast_mgr_process_tbl,
-			   p_mgr);
+	ucast_mgr_process_tbls(p_mgr);
 
 	cl_qlist_remove_all(&p_mgr->port_order_list);
 
@@ -1057,17 +1393,16 @@ void osm_ucast_mgr_set_fwd_tables(osm_ucast_mgr_t * p_mgr)
 	ucast_mgr_pipeline_fwd_tbl(p_mgr);
 }
 
-static int ucast_mgr_route(struct osm_routing_engine *r, osm_opensm_t * osm)
+static int ucast_mgr_build_routing(struct osm_routing_engine *r,
+				   osm_opensm_t * osm)
 {
 	int ret;
 
-	OSM_LOG(&osm->log, OSM_LOG_VERBOSE,
-		"building routing with \'%s\' routing algorithm...\n", r->name);
-
 	/* Set the before each lft build to keep the routes in place between sweeps */
 	if (osm->subn.opt.scatter_ports)
 		srandom(osm->subn.opt.scatter_ports);
 
+	osm_sweep_stats_phase(&osm->stats, OSM_SWEEP_PHASE_LID_MATRICES);
 	if (!r->build_lid_matrices ||
 	    (ret = r->build_lid_matrices(r->context)) > 0)
 		ret = osm_ucast_mgr_build_lid_matrices(&osm->sm.ucast_mgr);
@@ -1078,18 +1413,72 @@ static int ucast_mgr_route(struct osm_routing_engine *r, osm_opensm_t * osm)
 		return ret;
 	}
 
-	if (!r->ucast_build_fwd_tables ||
-	    (ret = r->ucast_build_fwd_tables(r->context)) > 0)
+	osm_sweep_stats_phase(&osm->stats, OSM_SWEEP_PHASE_FWD_TABLES);
+	ret = osm_snapshot_build_lfts(osm, r);
+	if (ret > 0 && (!r->ucast_build_fwd_tables ||
+	    (ret = r->ucast_build_fwd_tables(r->context)) > 0))
 		ret = ucast_mgr_build_lfts(&osm->sm.ucast_mgr);
 
-	if (ret < 0) {
+	if (ret < 0)
 		OSM_LOG(&osm->log, OSM_LOG_ERROR,
 			"%s: cannot build fwd tables\n", r->name);
+
+	return ret;
+}
+
+/*
+ * The lid matrices and forwarding tables are built into the switches'
+ * hop tables and new_lft, which SA and the other threads never look at,
+ * so the subnet lock is only held shared meanwhile: SA queries keep
+ * being answered from the current LFTs and the path SLs of the routing
+ * engine in use.  A receiver can still take the lock exclusively while
+ * it is released and change the subnet the routing is built from, so
+ * the routing is discarded if topology_gen changed in the meantime.
+ * Routing engines that rebuild their path SL tables in place are run
+ * with the lock held exclusively.
+ * Returns 0 if the routing was published, 1 if it was discarded because
+ * the subnet changed, or a negative value if the routing engine failed.
+ */
+static int ucast_mgr_route(struct osm_routing_engine *r, osm_opensm_t * osm)
+{
+	boolean_t shared = !r->path_sl || r->ucast_publish;
+	unsigned gen = osm->subn.topology_gen;
+	int ret;
+
+	OSM_LOG(&osm->log, OSM_LOG_VERBOSE,
+		"building routing with \'%s\' routing algorithm...\n", r->name);
+
+	if (shared) {
+		CL_PLOCK_RELEASE(&osm->lock);
+		CL_PLOCK_ACQUIRE(&osm->lock);
+	}
+
+	ret = ucast_mgr_build_routing(r, osm);
+
+	if (shared) {
+		CL_PLOCK_RELEASE(&osm->lock);
+		CL_PLOCK_EXCL_ACQUIRE(&osm->lock);
+	}
+
+	if (gen != osm->subn.topology_gen) {
+		OSM_LOG(&osm->log, OSM_LOG_INFO,
+			"Subnet changed while routing with \'%s\', "
+			"routing discarded\n", r->name);
+		return 1;
+	}
+
+	if (ret < 0)
 		return ret;
+
+	if (r->ucast_publish && r->ucast_publish(r->context)) {
+		OSM_LOG(&osm->log, OSM_LOG_ERROR,
+			"%s: cannot publish routing\n", r->name);
+		return -1;
 	}
 
 	osm->routing_engine_used = r;
 
+	osm_sweep_stats_phase(&osm->stats, OSM_SWEEP_PHASE_LFT_PUSH);
 	osm_ucast_mgr_set_fwd_tables(&osm->sm.ucast_mgr);
 
 	return 0;
@@ -1114,25 +1503,27 @@ int osm_ucast_mgr_process(IN osm_ucast_mgr_t * p_mgr)
 	   If there are no switches in the subnet, we are done.
 	 */
 	if (cl_qmap_count(p_sw_guid_tbl) == 0 ||
-	    ucast_mgr_setup_all_switches(p_mgr->p_subn) < 0)
+	    ucast_mgr_setup_all_switches(p_mgr) < 0)
 		goto Exit;
 
 	failed = -1;
-	p_osm->routing_engine_used = NULL;
 	while (p_routing_eng) {
 		failed = ucast_mgr_route(p_routing_eng, p_osm);
-		if (!failed)
+		if (failed >= 0)
 			break;
 		p_routing_eng = p_routing_eng->next;
 	}
 
-	if (!p_osm->routing_engine_used &&
-	    p_osm->no_fallback_routing_engine != TRUE) {
+	if (failed < 0 && p_osm->no_fallback_routing_engine != TRUE) {
 		/* If configured routing algorithm failed, use default MinHop */
 		failed = ucast_mgr_route(p_osm->default_routing_engine, p_osm);
 	}
 
-	if (p_osm->routing_engine_used) {
+	if (failed > 0) {
+		/* the current LFTs stay until the next heavy sweep */
+		p_mgr->p_subn->force_heavy_sweep = TRUE;
+		osm_sm_signal(&p_osm->sm, OSM_SIGNAL_SWEEP);
+	} else if (!failed) {
 		OSM_LOG(p_mgr->p_log, OSM_LOG_INFO,
 			"%s tables configured on all switches\n",
 			osm_routing_engine_type_str(p_osm->
@@ -1141,6 +1532,7 @@ int osm_ucast_mgr_process(IN osm_ucast_mgr_t * p_mgr)
 		if (p_mgr->p_subn->opt.use_ucast_cache)
 			p_mgr->cache_valid = TRUE;
 	} else {
+		p_osm->routing_engine_used = NULL;
 		p_mgr->p_subn->subnet_initialization_error = TRUE;
 		OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR,
 			"No routing engine able to successfully configure "
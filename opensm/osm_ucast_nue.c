@@ -68,6 +68,7 @@
 #include <opensm/osm_node.h>
 #include <opensm/osm_multicast.h>
 #include <opensm/osm_mcast_mgr.h>
+#include <opensm/osm_parallel.h>
 #if defined (ENABLE_METIS_FOR_NUE)
 #include <metis.h>
 #endif
@@ -108,6 +109,7 @@ typedef struct network_link {
 	struct network_node *to_network_node;	/*!< Points to remote switch. */
 	struct ccdg_node *corresponding_ccdg_node;	/*!< cCDG equivalent. */
 	uint64_t weight;	/*!< Link weigths needed for path balancing. */
+	boolean_t failed;	/*!< Link went down after the last routing. */
 } network_link_t;
 
 /*! \struct network_node
@@ -215,6 +217,26 @@ typedef struct backtracking_candidate {
 	ccdg_node_t *orig_used_ccdg_node_for_adj_netw_node;
 } backtracking_candidate_t;
 
+/*! \struct nue_reroute_state
+ *  \brief Outcome of the last routing, which is needed to reroute only the
+ *         destinations affected by failed switch-to-switch links.
+ */
+typedef struct nue_reroute_state {
+	boolean_t valid;	/*!< TRUE if the last routing was successful. */
+	boolean_t incremental;	/*!< TRUE if this routing is incremental. */
+	boolean_t include_switches;	/*!< Switches were traffic sinks. */
+	uint16_t max_lid_ho;	/*!< Highest unicast LID of the last routing. */
+	uint16_t num_base_lids;	/*!< Number of routed destination ports. */
+	uint32_t num_lids;	/*!< Number of routed destination LIDs. */
+	uint32_t num_colors;	/*!< Number of cCDG nodes plus cCDG edges. */
+	uint16_t *colors[IB_MAX_NUM_VLS];	/*!< cCDG coloring per layer. */
+	int32_t next_color[IB_MAX_NUM_VLS];	/*!< First unused color. */
+	network_link_t **escape_paths[IB_MAX_NUM_VLS];	/*!< Per layer. */
+	boolean_t broken_escape_paths[IB_MAX_NUM_VLS];	/*!< Use failed links. */
+	uint8_t *lfts;		/*!< LFTs of all switches (in node order). */
+	uint8_t *reroute_lid;	/*!< Flags LIDs routed thru failed links. */
+} nue_reroute_state_t;
+
 /*! \struct nue_context
  *  \brief Primary structure for Nue (storing graph, cCDG, destinations, etc).
  */
@@ -230,8 +252,24 @@ typedef struct nue_context {
 	uint8_t max_vl;		/*!< Highest common #VL supported by all. */
 	uint8_t max_lmc;	/*!< Highest supported LMC across fabric. */
 	uint8_t *dlid_to_vl_mapping;	/*!< Store VLs to serve path_sl requ. */
+	nue_reroute_state_t reroute;	/*!< For nue_incremental_reroute. */
+	/* published parts (read by SA threads) */
+	uint8_t *path_sl_mapping;	/*!< Published dlid_to_vl_mapping. */
+	uint16_t path_sl_mapping_size;	/*!< Number of LIDs in the above. */
 } nue_context_t;
 
+/*! \struct nue_layer_routing
+ *  \brief Shared state of the threads which route the virtual layers of Nue
+ *         concurrently on private copies of the network and the cCDG.
+ */
+typedef struct nue_layer_routing {
+	nue_context_t *nue_ctx;	/*!< Context with the unmodified graphs. */
+	boolean_t include_switches;	/*!< Switches are traffic sinks. */
+	uint32_t num_links;	/*!< Number of links in the network. */
+	uint64_t *weight_increase;	/*!< Link weight added per layer/link. */
+	int err[IB_MAX_NUM_VLS];	/*!< Result of the routing per layer. */
+} nue_layer_routing_t;
+
 #if defined (ENABLE_METIS_FOR_NUE)
 /*! \struct metis_context
  *  \brief Complete information about fabric graph to perform partitioning.
@@ -246,6 +284,23 @@ typedef struct metis_context {
 	idx_t objval[1];	/*!< Stores the edge-cut of the partitioning. */
 	idx_t *part;		/*!< Stores partitioning vector of the graph. */
 } metis_context_t;
+#else
+/*! \struct partition_graph
+ *  \brief Weighted graph of the destinations in compressed sparse row format
+ *         for the built-in multilevel graph partitioner, with a link to the
+ *         next coarser version of the graph.
+ */
+typedef struct partition_graph {
+	uint32_t num_vertices;	/*!< Number of vertices in the graph. */
+	uint32_t *xadj;		/*!< Start of the adjacency list per vertex. */
+	uint32_t *adjncy;	/*!< Adjacency lists of all vertices. */
+	uint32_t *adjwgt;	/*!< Weights of the edges in adjncy. */
+	uint32_t *vwgt;		/*!< Weight of each vertex. */
+	uint32_t total_vwgt;	/*!< Sum of all vertex weights. */
+	uint32_t *cmap;		/*!< Vertex in the coarser graph per vertex. */
+	struct partition_graph *coarser;	/*!< Next coarser graph or NULL. */
+	struct partition_graph *finer;	/*!< Previous finer graph or NULL. */
+} partition_graph_t;
 #endif
 
 /*************** predefine all internal functions *********************
@@ -388,6 +443,28 @@ build_complete_cdg(const osm_ucast_mgr_t *,
 		   ccdg_t *,
 		   const uint32_t);
 
+#if !defined (ENABLE_METIS_FOR_NUE)
+/*! \fn build_partition_graph(nue_context_t *,
+ *                            const ib_net16_t *,
+ *                            const uint16_t,
+ *                            const boolean_t)
+ *  \brief Builds the graph of all destinations and their links for the
+ *         built-in graph partitioner.
+ *
+ *  \param[in] nue_ctx    Nue's context storing graph, cCDG, destinations, etc.
+ *  \param[in] desti_arr  Sorted array of all destination (base) LIDs.
+ *  \param[in] num_desti  Number of elements in desti_arr.
+ *  \param[in] include_sw Whether or not to consider switches as destinations;
+ *                        only destinations are weighted for the balancing.
+ *  \return Pointer to the new graph, or NULL in case of an error.
+ */
+static partition_graph_t *
+build_partition_graph(nue_context_t *,
+		      const ib_net16_t *,
+		      const uint16_t,
+		      const boolean_t);
+#endif
+
 /*! \fn calculate_convex_subnetwork(const osm_ucast_mgr_t *,
  *                                  const network_t *,
  *                                  ib_net16_t *,
@@ -453,6 +530,24 @@ change_fake_ccdg_node_color(const ccdg_t *,
 			    ccdg_node_t *,
 			    const int32_t);
 
+#if !defined (ENABLE_METIS_FOR_NUE)
+/*! \fn coarsen_partition_graph(partition_graph_t *,
+ *                              const uint32_t,
+ *                              uint32_t *)
+ *  \brief Matches adjacent vertices with heavy edges, or leaves of the same
+ *         vertex, and contracts them into the vertices of a coarser graph.
+ *
+ *  \param[in,out] graph    The graph to coarsen; its cmap is filled.
+ *  \param[in]     max_vwgt Upper bound for the weights of coarse vertices.
+ *  \param[in,out] seed     State of the pseudo random number generator.
+ *  \return Pointer to the coarser graph, or NULL in case of an error.
+ */
+static partition_graph_t *
+coarsen_partition_graph(partition_graph_t *,
+			const uint32_t,
+			uint32_t *);
+#endif
+
 /*! \fn compare_backtracking_candidates_by_distance(const void *,
  *                                                  const void *)
  *  \brief Comparator for backtracking candidates of cCDG vertices w.r.t their
@@ -585,6 +680,100 @@ construct_network(network_t *);
 static inline void
 construct_network_node(network_node_t *);
 
+/*! \fn copy_network_and_ccdg(const osm_ucast_mgr_t *,
+ *                            const network_t *,
+ *                            const ccdg_t *,
+ *                            network_t *,
+ *                            ccdg_t *)
+ *  \brief Creates a private copy of the network and the cCDG, with all
+ *         pointers between nodes, links and channels redirected into it.
+ *
+ *  The colors of the copy are not preserved, because each virtual layer
+ *  resets them before it is routed.
+ *
+ *  \param[in]  mgr         The management object of OpenSM.
+ *  \param[in]  in_network  Nue's network object storing the subnet.
+ *  \param[in]  in_ccdg     Nue's internal object storing the complete CDG.
+ *  \param[out] out_network The copy of the network.
+ *  \param[out] out_ccdg    The copy of the complete CDG.
+ *  \return Integer 0 if the copy was created sucessfully, or any integer
+ *          unequal to 0 otherwise.
+ */
+static int
+copy_network_and_ccdg(const osm_ucast_mgr_t *,
+		      const network_t *,
+		      const ccdg_t *,
+		      network_t *,
+		      ccdg_t *);
+
+/*! \fn count_destination_lids(const osm_ucast_mgr_t *,
+ *                             uint16_t *)
+ *  \brief Counts the destination ports and LIDs of the subnet the same way as
+ *         get_base_lids_and_number_of_lids, but leaves the destinations as
+ *         they are.
+ *
+ *  \param[in]  mgr           The management object of OpenSM.
+ *  \param[out] num_base_lids Number of destination ports.
+ *  \return Number of destination LIDs (with LMC>0 more than one per port).
+ */
+static uint32_t
+count_destination_lids(const osm_ucast_mgr_t *,
+		       uint16_t *);
+
+/*! \fn count_lids_to_reroute(const nue_context_t *,
+ *                            const uint8_t,
+ *                            const boolean_t)
+ *  \brief Counts the destination LIDs of a virtual layer which are flagged
+ *         to be rerouted incrementally.
+ *
+ *  \param[in] nue_ctx          Nue's context storing destinations, etc.
+ *  \param[in] vl               The virtual layer.
+ *  \param[in] include_switches Switches are destinations of the layer.
+ *  \return Number of flagged LIDs of the virtual layer.
+ */
+static uint32_t
+count_lids_to_reroute(const nue_context_t *,
+		      const uint8_t,
+		      const boolean_t);
+
+/*! \fn count_path_thru_port(const osm_ucast_mgr_t *,
+ *                           osm_switch_t *,
+ *                           const osm_port_t *,
+ *                           const uint8_t)
+ *  \brief Increases the number of paths thru a port of a switch, unless the
+ *         port or the destination is ignored by the port profiling.
+ *
+ *  \param[in]     mgr       The management object of OpenSM.
+ *  \param[in,out] sw        OpenSM's internal switch object.
+ *  \param[in]     dest_port OpenSM's internal port object for the destination.
+ *  \param[in]     exit_port Port of sw used to reach the destination.
+ *  \return NONE
+ */
+static inline void
+count_path_thru_port(const osm_ucast_mgr_t *,
+		     osm_switch_t *,
+		     const osm_port_t *,
+		     const uint8_t);
+
+/*! \fn count_paths_towards_destination(const osm_ucast_mgr_t *,
+ *                                      const network_t *,
+ *                                      const osm_port_t *,
+ *                                      const ib_net16_t)
+ *  \brief Updates the path counts of all switches for the routes towards a
+ *         destination LID, which are read from the new LFTs.
+ *
+ *  \param[in] mgr       The management object of OpenSM.
+ *  \param[in] network   Nue's network object storing the subnet.
+ *  \param[in] dest_port OpenSM's internal port object for the destination.
+ *  \param[in] dlid      Destination LID whose routes are already in the LFTs.
+ *  \return NONE
+ */
+static void
+count_paths_towards_destination(const osm_ucast_mgr_t *,
+				const network_t *,
+				const osm_port_t *,
+				const ib_net16_t);
+
 /*! \fn create_context(nue_context_t *)
  *  \brief This fn calls the constructors for the network and ccdg structs, as
  *         well as allocates arrays to store destinations and VL mappings.
@@ -596,6 +785,20 @@ construct_network_node(network_node_t *);
 static int
 create_context(nue_context_t *);
 
+#if !defined (ENABLE_METIS_FOR_NUE)
+/*! \fn create_partition_graph(const uint32_t,
+ *                             const uint32_t)
+ *  \brief Allocates a graph for the built-in graph partitioner.
+ *
+ *  \param[in] num_vertices Number of vertices of the graph.
+ *  \param[in] num_adj      Total length of all adjacency lists.
+ *  \return Pointer to the new graph, or NULL in case of an error.
+ */
+static partition_graph_t *
+create_partition_graph(const uint32_t,
+		       const uint32_t);
+#endif
+
 /*! \fn destroy_ccdg(ccdg_t *)
  *  \brief All allocated memory within the ccdg_t struct is freed, and
  *         cl_heap_destroy is called for the heap element in the struct.
@@ -654,6 +857,38 @@ destroy_network(network_t *);
 static inline void
 destroy_network_node(network_node_t *);
 
+#if !defined (ENABLE_METIS_FOR_NUE)
+/*! \fn destroy_partition_graph(partition_graph_t *)
+ *  \brief Frees a graph of the built-in graph partitioner and all its coarser
+ *         versions.
+ *
+ *  \param[in,out] graph The finest graph, or NULL.
+ *  \return NONE
+ */
+static void
+destroy_partition_graph(partition_graph_t *);
+#endif
+
+/*! \fn destroy_reroute_state(nue_reroute_state_t *)
+ *  \brief All allocated memory within the nue_reroute_state_t struct is freed.
+ *
+ *  \param[in,out] state Outcome of the last routing.
+ *  \return NONE
+ */
+static void
+destroy_reroute_state(nue_reroute_state_t *);
+
+/*! \fn detect_failed_links(nue_context_t *)
+ *  \brief Compares the switch-to-switch links of the network with the links
+ *         of the subnet, and marks the links which went down as failed.
+ *
+ *  \param[in,out] nue_ctx Nue's context storing graph, cCDG, etc.
+ *  \return Number of newly failed links, or -1 if switches or links changed
+ *          in any other way.
+ */
+static int
+detect_failed_links(nue_context_t *);
+
 /*! \fn determine_num_adj_terminals_in_convex_hull(const osm_ucast_mgr_t *,
  *                                                 const network_t *,
  *                                                 ib_net16_t *,
@@ -679,7 +914,7 @@ determine_num_adj_terminals_in_convex_hull(const osm_ucast_mgr_t *,
  *
  *  Function description: The fn is redirecting the distribution of routing
  *  destination to either distribute_lids_with_metis if METIS was found during
- *  OpenSM installation, or distribute_lids_semi_randomly otherwise.
+ *  OpenSM installation, or distribute_lids_with_partitioner otherwise.
  *
  *  \param[in] nue_ctx    Nue's context storing graph, cCDG, destinations, etc.
  *  \param[in] include_sw Whether or not to consider switches as destinations.
@@ -705,9 +940,11 @@ static int
 distribute_lids_with_metis(nue_context_t *,
 			   const boolean_t);
 #else
-/*! \fn distribute_lids_semi_randomly(nue_context_t *,
- *                                    const boolean_t)
- *  \brief This fn randomly assigns destination to different virtual layers.
+/*! \fn distribute_lids_with_partitioner(nue_context_t *,
+ *                                       const boolean_t)
+ *  \brief This fn uses the built-in multilevel graph partitioner to split the
+ *         subnet into #VL parts and then assigns LIDs to different layers
+ *         according to the partitioning.
  *
  *  \param[in] nue_ctx    Nue's context storing graph, cCDG, destinations, etc.
  *  \param[in] include_sw Whether or not to consider switches as destinations.
@@ -715,8 +952,8 @@ distribute_lids_with_metis(nue_context_t *,
  *          otherwise.
  */
 static int
-distribute_lids_semi_randomly(nue_context_t *,
-			      const boolean_t);
+distribute_lids_with_partitioner(nue_context_t *,
+				 const boolean_t);
 #endif
 
 /*! \fn dry_ccdg_edge_color_betw_nodes(const ccdg_t *,
@@ -787,6 +1024,16 @@ fix_ccdg_edge_color(ccdg_edge_t *);
 static inline void
 fix_ccdg_node_color(ccdg_node_t *);
 
+/*! \fn flag_lids_to_reroute(nue_context_t *)
+ *  \brief Checks that the destinations of the last routing didn't change, and
+ *         flags all destination LIDs which were routed thru a failed link.
+ *
+ *  \param[in,out] nue_ctx Nue's context storing graph, cCDG, etc.
+ *  \return Number of flagged LIDs, or -1 if the destinations changed.
+ */
+static int32_t
+flag_lids_to_reroute(nue_context_t *);
+
 /*! \fn found_path_between_ccdg_nodes_in_subgraph(const osm_ucast_mgr_t *,
  *                                                const ccdg_t *,
  *                                                ccdg_node_t *,
@@ -984,6 +1231,30 @@ static inline network_node_t *
 get_network_node_by_lid(const network_t *,
 			const ib_net16_t);
 
+#if !defined (ENABLE_METIS_FOR_NUE)
+/*! \fn get_partition_edge_cut(const partition_graph_t *,
+ *                             const uint32_t *)
+ *  \brief Sums up the weights of all edges between different parts.
+ *
+ *  \param[in] graph The partitioned graph.
+ *  \param[in] part  Part of each vertex.
+ *  \return The edge cut of the partitioning.
+ */
+static uint32_t
+get_partition_edge_cut(const partition_graph_t *,
+		       const uint32_t *);
+
+/*! \fn get_random_number(uint32_t *)
+ *  \brief Small xorshift pseudo random number generator, which makes the
+ *         built-in graph partitioner deterministic.
+ *
+ *  \param[in,out] seed State of the generator; must not be 0.
+ *  \return The next pseudo random number.
+ */
+static inline uint32_t
+get_random_number(uint32_t *);
+#endif
+
 /*! \fn get_switch_lid(const osm_ucast_mgr_t *,
  *                     const ib_net16_t)
  *  \brief The fn returns the input LID, assuming it belongs to a subnet switch,
@@ -997,6 +1268,32 @@ static inline ib_net16_t
 get_switch_lid(const osm_ucast_mgr_t *,
 	       const ib_net16_t);
 
+#if !defined (ENABLE_METIS_FOR_NUE)
+/*! \fn grow_initial_partition(const partition_graph_t *,
+ *                             const uint8_t,
+ *                             uint32_t *,
+ *                             uint32_t *,
+ *                             uint32_t *)
+ *  \brief Greedily grows one part after the other from a random seed vertex,
+ *         always adding the vertex with the heaviest edges into the part,
+ *         until each part has its share of the total vertex weight.
+ *
+ *  \param[in]     graph  The (coarsest) graph to partition.
+ *  \param[in]     nparts Number of parts.
+ *  \param[out]    part   Part of each vertex.
+ *  \param[out]    conn   Buffer for the edge weight of each vertex into the
+ *                        growing part.
+ *  \param[in,out] seed   State of the pseudo random number generator.
+ *  \return NONE
+ */
+static void
+grow_initial_partition(const partition_graph_t *,
+		       const uint8_t,
+		       uint32_t *,
+		       uint32_t *,
+		       uint32_t *);
+#endif
+
 /*! \fn init_ccdg_colors(const ccdg_t *)
  *  \brief Iterates over all cCDG vertices and edges to set the color ID/Ptr
  *         into the UNUSED state.
@@ -1190,6 +1487,26 @@ init_network_node(network_node_t *,
 		  network_link_t *,
 		  osm_switch_t *);
 
+/*! \fn init_reroute_state(nue_context_t *)
+ *  \brief Allocates the arrays which keep the outcome of a full routing for
+ *         a later incremental reroute.
+ *
+ *  \param[in,out] nue_ctx Nue's context storing graph, cCDG, etc.
+ *  \return NONE
+ */
+static void
+init_reroute_state(nue_context_t *);
+
+/*! \fn is_network_connected(const network_t *)
+ *  \brief Checks whether all switches are reachable without using failed
+ *         links.
+ *
+ *  \param[in] network Nue's network object storing the subnet.
+ *  \return TRUE if the network is connected, or FALSE otherwise.
+ */
+static boolean_t
+is_network_connected(const network_t *);
+
 /*! \fn mark_escape_paths(const osm_ucast_mgr_t *,
  *                        network_t *,
  *                        const ccdg_t *,
@@ -1349,6 +1666,18 @@ nue_get_vl_for_path(void *,
 		    const ib_net16_t,
 		    const ib_net16_t);
 
+/*! \fn nue_publish_routing(void *)
+ *  \brief Interface fn exposed to OpenSM - Copies the virtual layers of the
+ *         last routing to the mapping which nue_get_vl_for_path reads; it is
+ *         called with the subnet lock held exclusively.
+ *
+ *  \param[in,out] context Pointer to a contex object (should be nue_context_t).
+ *  \return Integer 0 if the mapping was published, or any integer unequal
+ *          to 0 otherwise.
+ */
+static int
+nue_publish_routing(void *);
+
 /*! \fn osm_ucast_nue_setup(struct osm_routing_engine *,
  *                          osm_opensm_t *)
  *  \brief Interface fn exposed to OpenSM to initialize the Nue routing engine.
@@ -1361,6 +1690,41 @@ int
 osm_ucast_nue_setup(struct osm_routing_engine *,
 		    osm_opensm_t *);
 
+#if !defined (ENABLE_METIS_FOR_NUE)
+/*! \fn partition_graph_kway(const osm_ucast_mgr_t *,
+ *                           partition_graph_t *,
+ *                           const uint8_t,
+ *                           uint32_t *)
+ *  \brief Multilevel k-way graph partitioning: the graph is coarsened, the
+ *         coarsest graph is partitioned, and the partitioning is projected
+ *         back and refined on each finer graph.
+ *
+ *  \param[in]     mgr    The management object of OpenSM.
+ *  \param[in,out] graph  The graph to partition; coarser graphs are added.
+ *  \param[in]     nparts Number of parts.
+ *  \param[out]    part   Part of each vertex of the graph.
+ *  \return Integer 0 if partitioning was sucessful, or any integer unequal to
+ *          0 otherwise.
+ */
+static int
+partition_graph_kway(const osm_ucast_mgr_t *,
+		     partition_graph_t *,
+		     const uint8_t,
+		     uint32_t *);
+#endif
+
+/*! \fn prepare_incremental_reroute(nue_context_t *)
+ *  \brief Checks whether the subnet only changed by failed switch-to-switch
+ *         links since the last routing, and flags the destination LIDs which
+ *         have to be rerouted around them.
+ *
+ *  \param[in,out] nue_ctx Nue's context storing graph, cCDG, etc.
+ *  \return Integer 0 if the flagged LIDs can be rerouted incrementally, or
+ *          any integer unequal to 0 if a full routing is needed.
+ */
+static int
+prepare_incremental_reroute(nue_context_t *);
+
 /*! \fn print_ccdg(const osm_ucast_mgr_t *,
  *                 const ccdg_t *,
  *                 const boolean_t)
@@ -1510,6 +1874,48 @@ static void
 print_spanning_tree(const osm_ucast_mgr_t *,
 		    const network_t *);
 
+#if !defined (ENABLE_METIS_FOR_NUE)
+/*! \fn refine_partition(const partition_graph_t *,
+ *                       const uint8_t,
+ *                       uint32_t *,
+ *                       uint32_t *)
+ *  \brief Greedy k-way refinement: moves vertices at the border of their part
+ *         to the adjacent part they have the heaviest edges to, as long as
+ *         this reduces the edge cut or fixes the balance of the parts.
+ *
+ *  \param[in]     graph  The partitioned graph.
+ *  \param[in]     nparts Number of parts.
+ *  \param[in,out] part   Part of each vertex.
+ *  \param[out]    pwgt   Vertex weight of each part.
+ *  \return NONE
+ */
+static void
+refine_partition(const partition_graph_t *,
+		 const uint8_t,
+		 uint32_t *,
+		 uint32_t *);
+#endif
+
+/*! \fn release_rerouted_dependencies(nue_context_t *,
+ *                                   const network_t *,
+ *                                   ccdg_t *,
+ *                                   const uint8_t)
+ *  \brief Sets all channels and channel dependencies of a virtual layer back
+ *         to unused, which only the routes of the rerouted destination LIDs
+ *         have used in the last routing.
+ *
+ *  \param[in]     nue_ctx Nue's context storing destinations, etc.
+ *  \param[in]     network Nue's network object storing the subnet.
+ *  \param[in,out] ccdg    Complete CDG with the restored coloring.
+ *  \param[in]     vl      The virtual layer.
+ *  \return Integer 0 if successful, or any integer unequal to 0 otherwise.
+ */
+static int
+release_rerouted_dependencies(nue_context_t *,
+			      const network_t *,
+			      ccdg_t *,
+			      const uint8_t);
+
 /*! \fn reset_ccdg_color_array(const osm_ucast_mgr_t *,
  *                             ccdg_t *,
  *                             const uint16_t *,
@@ -1599,6 +2005,16 @@ reset_delta_for_betw_centrality(const network_t *);
 static void
 reset_mgrp_membership(const network_t *);
 
+/*! \fn reset_routing_of_switches(const network_t *)
+ *  \brief Clears the path counts and hop counts of all switches, which an
+ *         aborted incremental reroute has partially updated.
+ *
+ *  \param[in] network Nue's network object storing the subnet.
+ *  \return NONE
+ */
+static void
+reset_routing_of_switches(const network_t *);
+
 /*! \fn reset_sigma_distance_Ps_for_betw_centrality(const network_t *)
  *  \brief The fn iterates over all network nodes and resets three struct
  *         elementsof network_node_t back to 0 or INFINITY, respectively.
@@ -1609,6 +2025,70 @@ reset_mgrp_membership(const network_t *);
 static void
 reset_sigma_distance_Ps_for_betw_centrality(const network_t *);
 
+/*! \fn restore_hops_towards_destination(const network_t *,
+ *                                       const network_node_t *,
+ *                                       const ib_net16_t,
+ *                                       uint8_t *,
+ *                                       uint16_t *)
+ *  \brief Sets the hop counts of all switches towards a switch LID by
+ *         following the routes in the new LFTs.
+ *
+ *  \param[in]  network        Nue's network object storing the subnet.
+ *  \param[in]  dest_netw_node The network node of the destination switch.
+ *  \param[in]  dlid           Destination LID whose routes are in the LFTs.
+ *  \param[out] hops           Buffer for the hops of each network node.
+ *  \param[out] path           Buffer for the nodes along one route.
+ *  \return NONE
+ */
+static void
+restore_hops_towards_destination(const network_t *,
+				 const network_node_t *,
+				 const ib_net16_t,
+				 uint8_t *,
+				 uint16_t *);
+
+/*! \fn restore_linear_forwarding_tables(nue_context_t *)
+ *  \brief Copies the LFTs of the last routing into the new LFTs.
+ *
+ *  \param[in] nue_ctx Nue's context storing graph, cCDG, etc.
+ *  \return NONE
+ */
+static void
+restore_linear_forwarding_tables(nue_context_t *);
+
+/*! \fn restore_path_counts_and_hops(nue_context_t *)
+ *  \brief Updates the path counts and hop counts of the switches for all
+ *         destination LIDs whose routes are kept by an incremental reroute.
+ *
+ *  \param[in] nue_ctx Nue's context storing graph, cCDG, etc.
+ *  \return Integer 0 if successful, or any integer unequal to 0 otherwise.
+ */
+static int
+restore_path_counts_and_hops(nue_context_t *);
+
+/*! \fn restore_virtual_layer_state(nue_context_t *,
+ *                                  network_t *,
+ *                                  ccdg_t *,
+ *                                  const uint8_t,
+ *                                  const uint32_t)
+ *  \brief Restores the cCDG colors and escape paths a virtual layer had after
+ *         the last routing, and blocks all channel dependencies of channels
+ *         which belong to failed links.
+ *
+ *  \param[in]     nue_ctx    Nue's context storing the saved state.
+ *  \param[in,out] network    Network object of the context.
+ *  \param[in,out] ccdg       Complete CDG of the context.
+ *  \param[in]     vl         The virtual layer.
+ *  \param[in]     num_colors Number of colors needed for the reroute.
+ *  \return Integer 0 if successful, or any integer unequal to 0 otherwise.
+ */
+static int
+restore_virtual_layer_state(nue_context_t *,
+			    network_t *,
+			    ccdg_t *,
+			    const uint8_t,
+			    const uint32_t);
+
 /*! \fn route_via_modified_dijkstra_on_ccdg(const osm_ucast_mgr_t *,
  *                                          const network_t *,
  *                                          ccdg_t *,
@@ -1644,6 +2124,107 @@ route_via_modified_dijkstra_on_ccdg(const osm_ucast_mgr_t *,
 				    const int32_t,
 				    boolean_t *);
 
+/*! \fn route_virtual_layer(nue_context_t *,
+ *                          network_t *,
+ *                          ccdg_t *,
+ *                          const uint8_t,
+ *                          const boolean_t,
+ *                          const boolean_t,
+ *                          const boolean_t)
+ *  \brief Routes all destinations assigned to one virtual layer, i.e., marks
+ *         the escape paths and runs the modified Dijkstra's algorithm on the
+ *         cCDG for each of them.
+ *
+ *  \param[in]     nue_ctx          Nue's context storing destinations, etc.
+ *  \param[in,out] network          Network object the layer is routed on.
+ *  \param[in,out] ccdg             Complete CDG the layer is routed on.
+ *  \param[in]     vl               The virtual layer.
+ *  \param[in]     include_switches Switches are destinations of the layer.
+ *  \param[in]     count_paths      Update the path counts of the switches.
+ *  \param[in]     incremental      Only reroute the flagged LIDs, starting
+ *                                  from the state of the last routing.
+ *  \return Integer 0 if all destinations of the layer were routed, 1 if an
+ *          incremental reroute needs the broken escape paths of the layer,
+ *          or a negative integer otherwise.
+ */
+static int
+route_virtual_layer(nue_context_t *,
+		    network_t *,
+		    ccdg_t *,
+		    const uint8_t,
+		    const boolean_t,
+		    const boolean_t,
+		    const boolean_t);
+
+/*! \fn route_virtual_layer_on_copy(void *,
+ *                                  unsigned,
+ *                                  unsigned)
+ *  \brief Routes one virtual layer on a private copy of the network and the
+ *         cCDG, and records by how much the layer increased the link weights.
+ *
+ *  \param[in,out] context A nue_layer_routing_t object.
+ *  \param[in]     index   The virtual layer.
+ *  \param[in]     thread  Number of the thread (unused).
+ *  \return NONE
+ */
+static void
+route_virtual_layer_on_copy(void *,
+			    unsigned,
+			    unsigned);
+
+/*! \fn route_virtual_layers_in_parallel(nue_context_t *,
+ *                                       const boolean_t)
+ *  \brief Routes all virtual layers concurrently, each on its own copy of
+ *         the network and the cCDG, and merges the link weights and path
+ *         counts of the layers afterwards in the order of the layers.
+ *
+ *  All layers start from the same link weights, so the result only depends
+ *  on the configuration and not on the number of threads.
+ *
+ *  \param[in,out] nue_ctx          Nue's context storing graph, cCDG, etc.
+ *  \param[in]     include_switches Switches are destinations of the layers.
+ *  \return Integer 0 if all virtual layers were routed, or any integer
+ *          unequal to 0 otherwise.
+ */
+static int
+route_virtual_layers_in_parallel(nue_context_t *,
+				 const boolean_t);
+
+/*! \fn save_linear_forwarding_tables(nue_context_t *,
+ *                                    const boolean_t)
+ *  \brief Keeps the new LFTs of a successful routing for a later incremental
+ *         reroute, and marks the saved state as valid.
+ *
+ *  \param[in,out] nue_ctx          Nue's context storing graph, cCDG, etc.
+ *  \param[in]     include_switches Switches were destinations of the layers.
+ *  \return NONE
+ */
+static void
+save_linear_forwarding_tables(nue_context_t *,
+			      const boolean_t);
+
+/*! \fn save_virtual_layer_state(nue_context_t *,
+ *                               const network_t *,
+ *                               const ccdg_t *,
+ *                               const uint8_t,
+ *                               const int32_t)
+ *  \brief Keeps the cCDG colors and escape paths of a routed virtual layer
+ *         for a later incremental reroute.
+ *
+ *  \param[in,out] nue_ctx    Nue's context storing the saved state.
+ *  \param[in]     network    Network object the layer was routed on.
+ *  \param[in]     ccdg       Complete CDG the layer was routed on.
+ *  \param[in]     vl         The virtual layer.
+ *  \param[in]     next_color First color which isn't used in the layer.
+ *  \return NONE
+ */
+static void
+save_virtual_layer_state(nue_context_t *,
+			 const network_t *,
+			 const ccdg_t *,
+			 const uint8_t,
+			 const int32_t);
+
 /*! \fn set_ccdg_edge_into_blocked_state(const ccdg_t *,
  *                                       ccdg_edge_t *)
  *  \brief Change a cCDG edge to set the color ID/Ptr into the BLOCKED state,
@@ -1734,21 +2315,24 @@ update_dlid_to_vl_mapping(uint8_t *,
 /*! \fn update_linear_forwarding_tables(const osm_ucast_mgr_t *,
  *                                      const network_t *,
  *                                      const osm_port_t *,
- *                                      const ib_net16_t)
+ *                                      const ib_net16_t,
+ *                                      const boolean_t)
  *  \brief Update the ucast linear forwarding tables of all switches towards a
  *         given destination LID based on the calculated paths.
  *
- *  \param[in]     mgr       The management object of OpenSM.
- *  \param[in,out] network   Nue's network object storing the subnet.
- *  \param[in]     dest_port OpenSM's internal port object for the destination.
- *  \param[in]     dlid      Destination LID for current routing step.
+ *  \param[in]     mgr         The management object of OpenSM.
+ *  \param[in,out] network     Nue's network object storing the subnet.
+ *  \param[in]     dest_port   OpenSM's internal port object for the desti.
+ *  \param[in]     dlid        Destination LID for current routing step.
+ *  \param[in]     count_paths Update the path counts of the switches too.
  *  \return NONE
  */
 static void
 update_linear_forwarding_tables(const osm_ucast_mgr_t *,
 				const network_t *,
 				const osm_port_t *,
-				const ib_net16_t);
+				const ib_net16_t,
+				const boolean_t);
 
 /*! \fn update_mcast_forwarding_tables(const osm_ucast_mgr_t *,
  *                                     const network_t *,
@@ -2169,6 +2753,61 @@ static inline void destroy_metis_context(metis_context_t * metis_ctx)
 		metis_ctx->part = NULL;
 	}
 }
+#else
+static partition_graph_t *create_partition_graph(const uint32_t num_vertices,
+						 const uint32_t num_adj)
+{
+	partition_graph_t *graph = NULL;
+
+	graph = (partition_graph_t *) calloc(1, sizeof(partition_graph_t));
+	if (!graph)
+		return NULL;
+
+	graph->num_vertices = num_vertices;
+	graph->xadj = (uint32_t *) calloc(num_vertices + 1, sizeof(uint32_t));
+	graph->adjncy = (uint32_t *) malloc((num_adj + 1) * sizeof(uint32_t));
+	graph->adjwgt = (uint32_t *) malloc((num_adj + 1) * sizeof(uint32_t));
+	graph->vwgt = (uint32_t *) calloc(num_vertices + 1, sizeof(uint32_t));
+	graph->cmap = (uint32_t *) malloc((num_vertices + 1) * sizeof(uint32_t));
+	if (!graph->xadj || !graph->adjncy || !graph->adjwgt || !graph->vwgt
+	    || !graph->cmap) {
+		destroy_partition_graph(graph);
+		return NULL;
+	}
+
+	return graph;
+}
+
+static void destroy_partition_graph(partition_graph_t * graph)
+{
+	partition_graph_t *coarser = NULL;
+
+	while (graph) {
+		coarser = graph->coarser;
+		if (graph->xadj)
+			free(graph->xadj);
+		if (graph->adjncy)
+			free(graph->adjncy);
+		if (graph->adjwgt)
+			free(graph->adjwgt);
+		if (graph->vwgt)
+			free(graph->vwgt);
+		if (graph->cmap)
+			free(graph->cmap);
+		free(graph);
+		graph = coarser;
+	}
+}
+
+static inline uint32_t get_random_number(uint32_t * seed)
+{
+	CL_ASSERT(seed && *seed);
+
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 17;
+	*seed ^= *seed << 5;
+	return *seed;
+}
 #endif
 
 /**********************************************************************
@@ -3115,6 +3754,7 @@ static int create_context(nue_context_t * nue_ctx)
 	/* and now initialize internals, i.e. network and ccdg */
 	construct_network(&(nue_ctx->network));
 	construct_ccdg(&(nue_ctx->ccdg));
+	memset(&(nue_ctx->reroute), 0, sizeof(nue_reroute_state_t));
 
 	/* we also need an array of all lids to distribute across VLs */
 	CL_ASSERT(IB_MAX_NUM_VLS);
@@ -3161,6 +3801,8 @@ static nue_context_t *nue_create_context(const osm_opensm_t * osm,
 		/* set initial values with stuff provided by caller */
 		nue_ctx->routing_type = routing_type;
 		nue_ctx->mgr = (osm_ucast_mgr_t *) & (osm->sm.ucast_mgr);
+		nue_ctx->path_sl_mapping = NULL;
+		nue_ctx->path_sl_mapping_size = 0;
 		err = create_context(nue_ctx);
 		if (err) {
 			free(nue_ctx);
@@ -3423,10 +4065,17 @@ static int nue_discover_network(void *context)
 	OSM_LOG(mgr->p_log, OSM_LOG_INFO,
 		"Building network graph for nue routing\n");
 
-	/* if this pointer isn't NULL, this is a reroute step;
-	   old context will be destroyed and we set up a new/clean context
+	/* if this pointer isn't NULL, this is a reroute step; if only links
+	   failed since the last routing, then the network and the cCDG are
+	   kept for an incremental reroute, otherwise the old context will be
+	   destroyed and we set up a new/clean context
 	 */
 	if (nue_ctx->network.nodes) {
+		if (mgr->p_subn->opt.nue_incremental_reroute &&
+		    !prepare_incremental_reroute(nue_ctx)) {
+			OSM_LOG_EXIT(mgr->p_log);
+			return 0;
+		}
 		destroy_context(nue_ctx);
 		create_context(nue_ctx);
 	}
@@ -3800,91 +4449,585 @@ static int distribute_lids_with_metis(nue_context_t * nue_ctx,
 	return 0;
 }
 #else
-static int distribute_lids_semi_randomly(nue_context_t * nue_ctx,
-					 const boolean_t include_sw)
+/* the graph has the same vertices and edges as the one METIS would get, i.e.
+   all destination ports and their links; parallel links are merged into one
+   heavier edge, and switches which aren't destinations get no weight, so that
+   only the destinations are balanced across the virtual layers
+ */
+static partition_graph_t *build_partition_graph(nue_context_t * nue_ctx,
+						const ib_net16_t * desti_arr,
+						const uint16_t num_desti,
+						const boolean_t include_sw)
 {
-	uint8_t vl = 0;
-	uint16_t num_dest = 0, temp_sum = 0, i = 0, max_num_desti_per_layer = 0;
-	ib_net16_t *all_dest = NULL, *dlid_iter = NULL, *partition = NULL;
-	osm_port_t *dest_port = NULL;
-	uint8_t ntype = 0;
-
-	CL_ASSERT(nue_ctx && nue_ctx->destinations[0]);
+	osm_ucast_mgr_t *mgr = nue_ctx->mgr;
+	network_t *network = &(nue_ctx->network);
+	network_node_t *netw_node_iter = NULL;
+	partition_graph_t *graph = NULL;
+	osm_node_t *node = NULL, *r_node = NULL;
+	osm_port_t *port = NULL;
+	osm_physp_t *physp_ptr = NULL;
+	ib_net16_t *r_dlid = NULL;
+	ib_net16_t r_lid = 0;
+	uint32_t total_num_adjnc = 0, u = 0, k = 0;
+	uint16_t i = 0;
+	uint8_t ntype = 0, l_port = 0, first_port = 0, last_port = 0;
+	uint8_t r_port = 0;
 
-	all_dest = nue_ctx->destinations[0];
-	num_dest = nue_ctx->num_destinations[0];
+	for (i = 0, netw_node_iter = network->nodes; i < network->num_nodes;
+	     i++, netw_node_iter++)
+		total_num_adjnc +=
+		    (netw_node_iter->num_base_terminals +
+		     netw_node_iter->num_links);
 
-	for (vl = nue_ctx->max_vl - 1; vl > 0; vl--) {
-		nue_ctx->num_destinations[vl] = num_dest / nue_ctx->max_vl;
-		temp_sum += nue_ctx->num_destinations[vl];
-		if (max_num_desti_per_layer < nue_ctx->num_destinations[vl])
-			max_num_desti_per_layer = nue_ctx->num_destinations[vl];
+	graph = create_partition_graph(num_desti, 2 * total_num_adjnc);
+	if (!graph) {
+		OSM_LOG(mgr->p_log, OSM_LOG_ERROR,
+			"ERR NUE53: cannot allocate memory for the partition"
+			" graph\n");
+		return NULL;
 	}
-	nue_ctx->num_destinations[0] = num_dest - temp_sum;
-	if (max_num_desti_per_layer < nue_ctx->num_destinations[0])
-		max_num_desti_per_layer = nue_ctx->num_destinations[0];
 
-	for (vl = 0; vl < nue_ctx->max_vl; vl++) {
-		nue_ctx->destinations[vl] =
-		    (ib_net16_t *) malloc(max_num_desti_per_layer *
-					  sizeof(ib_net16_t));
-		if (!nue_ctx->destinations[vl]) {
-			OSM_LOG(nue_ctx->mgr->p_log, OSM_LOG_ERROR,
-				"ERR NUE09: cannot allocate memory for"
-				" destinations[%" PRIu8 "]\n", vl);
-			return -1;
+	for (i = 0; i < num_desti; i++) {
+		port = osm_get_port_by_lid(mgr->p_subn, desti_arr[i]);
+		node = port->p_node;
+		ntype = osm_node_get_type(node);
+		/* a CA port is only adjacent to its switch */
+		if (ntype == IB_NODE_TYPE_CA) {
+			graph->vwgt[i] = 1;
+			first_port = last_port = port->p_physp->port_num;
+		} else {
+			graph->vwgt[i] = include_sw ? 1 : 0;
+			first_port = 1;
+			last_port = node->sw->num_ports - 1;
 		}
-	}
+		graph->total_vwgt += graph->vwgt[i];
 
-	memset(nue_ctx->num_destinations, 0, IB_MAX_NUM_VLS * sizeof(uint16_t));
-	dlid_iter = (ib_net16_t *) all_dest;
-	for (i = 0, vl = 0; i < num_dest; i++, dlid_iter++) {
-		if (!include_sw) {
-			dest_port =
-			    osm_get_port_by_lid(nue_ctx->mgr->p_subn,
-						*dlid_iter);
-			ntype = osm_node_get_type(dest_port->p_node);
-			if (ntype == IB_NODE_TYPE_SWITCH)
+		graph->xadj[i + 1] = graph->xadj[i];
+		for (l_port = first_port; l_port && l_port <= last_port;
+		     l_port++) {
+			r_node = osm_node_get_remote_node(node, l_port, &r_port);
+			if (!r_node || r_node == node)
+				continue;
+			physp_ptr = osm_node_get_physp_ptr(node, l_port);
+			if (!physp_ptr || !osm_link_is_healthy(physp_ptr))
 				continue;
-		}
-		partition = (ib_net16_t *) nue_ctx->destinations[vl];
-		partition[nue_ctx->num_destinations[vl]] = *dlid_iter;
-		nue_ctx->num_destinations[vl]++;
-		vl = (vl + 1) % nue_ctx->max_vl;
-	}
-	free(all_dest);
 
-	return 0;
-}
-#endif
+			if (osm_node_get_type(r_node) == IB_NODE_TYPE_SWITCH)
+				r_lid = osm_node_get_base_lid(r_node, 0);
+			else if (ntype == IB_NODE_TYPE_SWITCH)
+				r_lid = osm_node_get_base_lid(r_node, r_port);
+			else {
+				OSM_LOG(mgr->p_log, OSM_LOG_ERROR,
+					"ERR NUE54: found CA attached to"
+					" something other than a switch; nue"
+					" cannot handle this case\n");
+				destroy_partition_graph(graph);
+				return NULL;
+			}
+			r_dlid = get_lid(desti_arr, num_desti, r_lid);
+			if (!r_dlid)
+				continue;
+			u = (uint32_t) (r_dlid - desti_arr);
 
-static inline int distribute_lids_onto_virtual_layers(nue_context_t * nue_ctx,
-						      const boolean_t
-						      include_sw)
-{
-	CL_ASSERT(nue_ctx);
-	OSM_LOG(nue_ctx->mgr->p_log, OSM_LOG_INFO,
-		"Distributing destination lids onto available VLs\n");
+			for (k = graph->xadj[i]; k < graph->xadj[i + 1]; k++)
+				if (graph->adjncy[k] == u)
+					break;
+			if (k < graph->xadj[i + 1]) {
+				graph->adjwgt[k]++;
+			} else {
+				graph->adjncy[k] = u;
+				graph->adjwgt[k] = 1;
+				graph->xadj[i + 1]++;
+			}
+		}
+	}
 
-#if defined (ENABLE_METIS_FOR_NUE)
-	return distribute_lids_with_metis(nue_ctx, include_sw);
-#else
-	return distribute_lids_semi_randomly(nue_ctx, include_sw);
-#endif
+	return graph;
 }
 
-/* returns the input lid if it belongs to a switch or the lid of the adjacent
-   switch otherwise
+/* heavy edge matching: every vertex (in random order) is matched with the
+   unmatched neighbor it has the heaviest edge to; the CAs of a switch only
+   have the switch as neighbor, so once the switch is matched they are
+   matched with each other instead, otherwise the coarsening would stall
  */
-static inline ib_net16_t get_switch_lid(const osm_ucast_mgr_t * mgr,
-					const ib_net16_t lid)
+static partition_graph_t *coarsen_partition_graph(partition_graph_t * graph,
+						  const uint32_t max_vwgt,
+						  uint32_t * seed)
 {
-	osm_node_t *o_rem_node = NULL;
-	osm_port_t *o_port = NULL;
-	uint8_t rem_port = 0;
-	ib_net16_t switch_lid = 0;
+	partition_graph_t *coarser = NULL;
+	uint32_t *perm = NULL, *match = NULL, *leaf = NULL, *marker = NULL;
+	uint32_t n = graph->num_vertices, num_coarse = 0, num_adj = 0;
+	uint32_t i = 0, j = 0, k = 0, v = 0, u = 0, w = 0, c = 0, cu = 0;
+	uint32_t best = 0, best_wgt = 0, start = 0;
+
+	perm = (uint32_t *) malloc((n + 1) * sizeof(uint32_t));
+	match = (uint32_t *) malloc((n + 1) * sizeof(uint32_t));
+	leaf = (uint32_t *) malloc((n + 1) * sizeof(uint32_t));
+	if (!perm || !match || !leaf)
+		goto out;
+
+	for (v = 0; v < n; v++) {
+		perm[v] = v;
+		match[v] = UINT32_MAX;
+		leaf[v] = UINT32_MAX;
+	}
+	for (i = n; i > 1; i--) {
+		j = get_random_number(seed) % i;
+		v = perm[i - 1];
+		perm[i - 1] = perm[j];
+		perm[j] = v;
+	}
 
-	CL_ASSERT(mgr && lid > 0);
+	for (i = 0; i < n; i++) {
+		v = perm[i];
+		if (match[v] != UINT32_MAX)
+			continue;
+		best = UINT32_MAX;
+		best_wgt = 0;
+		for (j = graph->xadj[v]; j < graph->xadj[v + 1]; j++) {
+			u = graph->adjncy[j];
+			if (match[u] != UINT32_MAX ||
+			    graph->adjwgt[j] <= best_wgt ||
+			    graph->vwgt[v] + graph->vwgt[u] > max_vwgt)
+				continue;
+			best = u;
+			best_wgt = graph->adjwgt[j];
+		}
+		if (best == UINT32_MAX &&
+		    graph->xadj[v + 1] - graph->xadj[v] == 1) {
+			u = graph->adjncy[graph->xadj[v]];
+			w = leaf[u];
+			if (w == UINT32_MAX || match[w] != UINT32_MAX ||
+			    graph->vwgt[v] + graph->vwgt[w] > max_vwgt) {
+				/* wait for the next leaf of this neighbor */
+				leaf[u] = v;
+				continue;
+			}
+			leaf[u] = UINT32_MAX;
+			best = w;
+		}
+		if (best == UINT32_MAX)
+			best = v;
+		match[v] = best;
+		match[best] = v;
+	}
+
+	/* number the coarse vertices in the order of their first fine vertex */
+	for (v = 0; v < n; v++)
+		graph->cmap[v] = UINT32_MAX;
+	for (v = 0, num_coarse = 0; v < n; v++) {
+		if (graph->cmap[v] != UINT32_MAX)
+			continue;
+		if (match[v] == UINT32_MAX)
+			match[v] = v;
+		graph->cmap[v] = num_coarse;
+		graph->cmap[match[v]] = num_coarse;
+		num_coarse++;
+	}
+
+	coarser = create_partition_graph(num_coarse, graph->xadj[n]);
+	marker = (uint32_t *) malloc((num_coarse + 1) * sizeof(uint32_t));
+	if (!coarser || !marker) {
+		destroy_partition_graph(coarser);
+		coarser = NULL;
+		goto out;
+	}
+	for (c = 0; c < num_coarse; c++)
+		marker[c] = UINT32_MAX;
+
+	/* merge the adjacency lists of both fine vertices, where marker points
+	   to the edge of the current coarse vertex towards another one
+	 */
+	for (v = 0, num_adj = 0; v < n; v++) {
+		if (match[v] < v)
+			continue;
+		c = graph->cmap[v];
+		start = num_adj;
+		coarser->vwgt[c] = graph->vwgt[v];
+		if (match[v] != v)
+			coarser->vwgt[c] += graph->vwgt[match[v]];
+		for (k = 0; k < 2; k++) {
+			w = k ? match[v] : v;
+			if (k && w == v)
+				break;
+			for (j = graph->xadj[w]; j < graph->xadj[w + 1]; j++) {
+				cu = graph->cmap[graph->adjncy[j]];
+				if (cu == c)
+					continue;
+				if (marker[cu] != UINT32_MAX &&
+				    marker[cu] >= start) {
+					coarser->adjwgt[marker[cu]] +=
+					    graph->adjwgt[j];
+					continue;
+				}
+				marker[cu] = num_adj;
+				coarser->adjncy[num_adj] = cu;
+				coarser->adjwgt[num_adj] = graph->adjwgt[j];
+				num_adj++;
+			}
+		}
+		coarser->xadj[c + 1] = num_adj;
+	}
+	coarser->total_vwgt = graph->total_vwgt;
+
+out:
+	if (perm)
+		free(perm);
+	if (match)
+		free(match);
+	if (leaf)
+		free(leaf);
+	if (marker)
+		free(marker);
+	return coarser;
+}
+
+static uint32_t get_partition_edge_cut(const partition_graph_t * graph,
+				       const uint32_t * part)
+{
+	uint32_t v = 0, j = 0, edge_cut = 0;
+
+	for (v = 0; v < graph->num_vertices; v++)
+		for (j = graph->xadj[v]; j < graph->xadj[v + 1]; j++)
+			if (part[v] != part[graph->adjncy[j]])
+				edge_cut += graph->adjwgt[j];
+
+	/* each edge is stored for both of its vertices */
+	return edge_cut / 2;
+}
+
+static void grow_initial_partition(const partition_graph_t * graph,
+				   const uint8_t nparts, uint32_t * part,
+				   uint32_t * conn, uint32_t * seed)
+{
+	uint32_t n = graph->num_vertices, num_unassigned = graph->num_vertices;
+	uint32_t remaining = graph->total_vwgt, target = 0, pwgt = 0;
+	uint32_t v = 0, j = 0, u = 0, best = 0;
+	uint8_t p = 0;
+
+	for (v = 0; v < n; v++)
+		part[v] = UINT32_MAX;
+
+	for (p = 0; p < nparts && num_unassigned; p++) {
+		if (p == nparts - 1) {
+			for (v = 0; v < n; v++)
+				if (part[v] == UINT32_MAX)
+					part[v] = p;
+			break;
+		}
+
+		target = remaining / (nparts - p);
+		pwgt = 0;
+		memset(conn, 0, n * sizeof(uint32_t));
+		while (pwgt < target && num_unassigned) {
+			best = UINT32_MAX;
+			for (v = 0; v < n; v++)
+				if (part[v] == UINT32_MAX && conn[v] &&
+				    (best == UINT32_MAX || conn[v] > conn[best]))
+					best = v;
+			/* start at a random vertex if the part can't grow */
+			if (best == UINT32_MAX) {
+				best = get_random_number(seed) % n;
+				while (part[best] != UINT32_MAX)
+					best = (best + 1) % n;
+			}
+
+			part[best] = p;
+			pwgt += graph->vwgt[best];
+			num_unassigned--;
+			for (j = graph->xadj[best]; j < graph->xadj[best + 1];
+			     j++) {
+				u = graph->adjncy[j];
+				if (part[u] == UINT32_MAX)
+					conn[u] += graph->adjwgt[j];
+			}
+		}
+		remaining -= pwgt;
+	}
+}
+
+static void refine_partition(const partition_graph_t * graph,
+			     const uint8_t nparts, uint32_t * part,
+			     uint32_t * pwgt)
+{
+	uint32_t ed[IB_MAX_NUM_VLS];
+	uint32_t v = 0, j = 0, id = 0, from = 0, to = 0, q = 0, wgt = 0;
+	uint32_t max_vwgt = 0, avg_pwgt = 0, max_pwgt = 0, num_moves = 0;
+	uint8_t adj_parts[IB_MAX_NUM_VLS];
+	uint8_t num_adj_parts = 0, k = 0, pass = 0;
+
+	CL_ASSERT(nparts <= IB_MAX_NUM_VLS);
+
+	memset(ed, 0, sizeof(ed));
+	memset(pwgt, 0, nparts * sizeof(uint32_t));
+	for (v = 0; v < graph->num_vertices; v++) {
+		pwgt[part[v]] += graph->vwgt[v];
+		if (max_vwgt < graph->vwgt[v])
+			max_vwgt = graph->vwgt[v];
+	}
+
+	/* allow 3% imbalance, or one vertex on the coarse levels */
+	avg_pwgt = (graph->total_vwgt + nparts - 1) / nparts;
+	max_pwgt = avg_pwgt + avg_pwgt * 3 / 100;
+	if (max_pwgt < avg_pwgt + max_vwgt)
+		max_pwgt = avg_pwgt + max_vwgt;
+
+	for (pass = 0; pass < 8; pass++) {
+		num_moves = 0;
+		for (v = 0; v < graph->num_vertices; v++) {
+			from = part[v];
+			wgt = graph->vwgt[v];
+			id = 0;
+			num_adj_parts = 0;
+			for (j = graph->xadj[v]; j < graph->xadj[v + 1]; j++) {
+				q = part[graph->adjncy[j]];
+				if (q == from) {
+					id += graph->adjwgt[j];
+					continue;
+				}
+				if (!ed[q])
+					adj_parts[num_adj_parts++] = (uint8_t) q;
+				ed[q] += graph->adjwgt[j];
+			}
+			if (!num_adj_parts)
+				continue;
+
+			to = UINT32_MAX;
+			for (k = 0; k < num_adj_parts; k++) {
+				q = adj_parts[k];
+				if (wgt && pwgt[q] + wgt > max_pwgt)
+					continue;
+				if (to == UINT32_MAX || ed[q] > ed[to] ||
+				    (ed[q] == ed[to] && pwgt[q] < pwgt[to]))
+					to = q;
+			}
+			/* move if it reduces the edge cut, or improves the
+			   balance without increasing the edge cut, or the part
+			   is too heavy anyway
+			 */
+			if (to != UINT32_MAX &&
+			    (ed[to] > id ||
+			     (wgt && ed[to] == id &&
+			      pwgt[to] + wgt < pwgt[from]) ||
+			     (wgt && pwgt[from] > max_pwgt))) {
+				part[v] = to;
+				pwgt[from] -= wgt;
+				pwgt[to] += wgt;
+				num_moves++;
+			}
+
+			for (k = 0; k < num_adj_parts; k++)
+				ed[adj_parts[k]] = 0;
+		}
+		if (!num_moves)
+			break;
+	}
+}
+
+static int partition_graph_kway(const osm_ucast_mgr_t * mgr,
+				partition_graph_t * graph,
+				const uint8_t nparts, uint32_t * part)
+{
+	partition_graph_t *coarsest = graph, *coarser = NULL;
+	uint32_t pwgt[IB_MAX_NUM_VLS];
+	uint32_t *cpart = NULL, *tmp = NULL, *conn = NULL, *swap = NULL;
+	uint32_t n = graph->num_vertices, coarsen_to = 0, max_vwgt = 0;
+	uint32_t seed = 1, edge_cut = 0, best_edge_cut = UINT32_MAX;
+	uint32_t v = 0;
+	uint8_t trial = 0;
+	boolean_t stalled = FALSE;
+
+	CL_ASSERT(nparts <= IB_MAX_NUM_VLS);
+
+	if (nparts <= 1) {
+		memset(part, 0, n * sizeof(uint32_t));
+		return 0;
+	}
+
+	cpart = (uint32_t *) malloc((n + 1) * sizeof(uint32_t));
+	tmp = (uint32_t *) malloc((n + 1) * sizeof(uint32_t));
+	conn = (uint32_t *) malloc((n + 1) * sizeof(uint32_t));
+	if (!cpart || !tmp || !conn)
+		goto error;
+
+	/* coarsen until a few dozen vertices per part are left, or the
+	   matching doesn't shrink the graph anymore
+	 */
+	coarsen_to = 30 * nparts;
+	max_vwgt = 3 * graph->total_vwgt / (2 * coarsen_to) + 1;
+	while (coarsest->num_vertices > coarsen_to && !stalled) {
+		coarser = coarsen_partition_graph(coarsest, max_vwgt, &seed);
+		if (!coarser)
+			goto error;
+		stalled = (coarser->num_vertices >
+			   coarsest->num_vertices / 20 * 19);
+		coarsest->coarser = coarser;
+		coarser->finer = coarsest;
+		coarsest = coarser;
+	}
+
+	/* partition the coarsest graph a few times and keep the best one */
+	for (trial = 0; trial < 4; trial++) {
+		grow_initial_partition(coarsest, nparts, tmp, conn, &seed);
+		refine_partition(coarsest, nparts, tmp, pwgt);
+		edge_cut = get_partition_edge_cut(coarsest, tmp);
+		if (edge_cut < best_edge_cut) {
+			best_edge_cut = edge_cut;
+			memcpy(cpart, tmp, coarsest->num_vertices *
+			       sizeof(uint32_t));
+		}
+	}
+
+	/* and project it back onto the finer graphs */
+	for (coarser = coarsest, coarsest = coarsest->finer; coarsest;
+	     coarser = coarsest, coarsest = coarsest->finer) {
+		for (v = 0; v < coarsest->num_vertices; v++)
+			tmp[v] = cpart[coarsest->cmap[v]];
+		swap = cpart;
+		cpart = tmp;
+		tmp = swap;
+		refine_partition(coarsest, nparts, cpart, pwgt);
+	}
+	memcpy(part, cpart, n * sizeof(uint32_t));
+
+	free(cpart);
+	free(tmp);
+	free(conn);
+	return 0;
+
+error:
+	OSM_LOG(mgr->p_log, OSM_LOG_ERROR,
+		"ERR NUE55: cannot allocate memory for the graph partitioning\n");
+	if (cpart)
+		free(cpart);
+	if (tmp)
+		free(tmp);
+	if (conn)
+		free(conn);
+	return -1;
+}
+
+static int distribute_lids_with_partitioner(nue_context_t * nue_ctx,
+					    const boolean_t include_sw)
+{
+	osm_ucast_mgr_t *mgr = NULL;
+	partition_graph_t *graph = NULL;
+	ib_net16_t *desti_arr = NULL;
+	ib_net16_t *dlid_arr_iter[IB_MAX_NUM_VLS];
+	uint32_t *part = NULL;
+	uint16_t i = 0, num_desti = 0, min_layer = 0, max_layer = 0;
+	uint8_t vl = 0;
+
+	CL_ASSERT(nue_ctx && nue_ctx->destinations[0]);
+	mgr = nue_ctx->mgr;
+
+	desti_arr = (ib_net16_t *) nue_ctx->destinations[0];
+	num_desti = nue_ctx->num_destinations[0];
+
+	/* same as for METIS, the adjacent destinations are found by bsearch */
+	sort_destinations_by_lid(desti_arr, (uint32_t) num_desti);
+
+	graph = build_partition_graph(nue_ctx, desti_arr, num_desti,
+				      include_sw);
+	if (!graph)
+		return -1;
+
+	part = (uint32_t *) malloc((num_desti + 1) * sizeof(uint32_t));
+	if (!part) {
+		OSM_LOG(mgr->p_log, OSM_LOG_ERROR,
+			"ERR NUE56: can't allocate memory for partition\n");
+		destroy_partition_graph(graph);
+		return -1;
+	}
+
+	if (partition_graph_kway(mgr, graph, nue_ctx->max_vl, part)) {
+		destroy_partition_graph(graph);
+		free(part);
+		return -1;
+	}
+
+	/* only the weighted vertices are destinations */
+	memset(nue_ctx->num_destinations, 0, IB_MAX_NUM_VLS * sizeof(uint16_t));
+	for (i = 0; i < num_desti; i++)
+		if (graph->vwgt[i])
+			nue_ctx->num_destinations[part[i]]++;
+
+	for (vl = 0; vl < nue_ctx->max_vl; vl++) {
+		nue_ctx->destinations[vl] =
+		    (ib_net16_t *) malloc(nue_ctx->num_destinations[vl] *
+					  sizeof(ib_net16_t));
+		if (nue_ctx->num_destinations[vl] &&
+		    !nue_ctx->destinations[vl]) {
+			OSM_LOG(mgr->p_log, OSM_LOG_ERROR,
+				"ERR NUE09: cannot allocate memory for"
+				" destinations[%" PRIu8 "]\n", vl);
+			destroy_partition_graph(graph);
+			free(part);
+			free(desti_arr);
+			return -1;
+		}
+	}
+
+	min_layer = max_layer = nue_ctx->num_destinations[0];
+	for (vl = 1; vl < nue_ctx->max_vl; vl++) {
+		if (min_layer > nue_ctx->num_destinations[vl])
+			min_layer = nue_ctx->num_destinations[vl];
+		if (max_layer < nue_ctx->num_destinations[vl])
+			max_layer = nue_ctx->num_destinations[vl];
+	}
+	OSM_LOG(mgr->p_log, OSM_LOG_VERBOSE,
+		"Partitioned %" PRIu32 " destinations onto %" PRIu8
+		" virtual layers (%" PRIu16 " to %" PRIu16
+		" per layer, edge cut %" PRIu32 ")\n", graph->total_vwgt,
+		nue_ctx->max_vl, min_layer, max_layer,
+		get_partition_edge_cut(graph, part));
+
+	memset(nue_ctx->num_destinations, 0, IB_MAX_NUM_VLS * sizeof(uint16_t));
+	memcpy(dlid_arr_iter, nue_ctx->destinations,
+	       IB_MAX_NUM_VLS * sizeof(ib_net16_t *));
+	for (i = 0; i < num_desti; i++) {
+		if (!graph->vwgt[i])
+			continue;
+		vl = (uint8_t) part[i];
+		*dlid_arr_iter[vl] = desti_arr[i];
+		dlid_arr_iter[vl]++;
+		nue_ctx->num_destinations[vl]++;
+	}
+
+	destroy_partition_graph(graph);
+	free(part);
+	free(desti_arr);
+	return 0;
+}
+#endif
+
+static inline int distribute_lids_onto_virtual_layers(nue_context_t * nue_ctx,
+						      const boolean_t
+						      include_sw)
+{
+	CL_ASSERT(nue_ctx);
+	OSM_LOG(nue_ctx->mgr->p_log, OSM_LOG_INFO,
+		"Distributing destination lids onto available VLs\n");
+
+#if defined (ENABLE_METIS_FOR_NUE)
+	return distribute_lids_with_metis(nue_ctx, include_sw);
+#else
+	return distribute_lids_with_partitioner(nue_ctx, include_sw);
+#endif
+}
+
+/* returns the input lid if it belongs to a switch or the lid of the adjacent
+   switch otherwise
+ */
+static inline ib_net16_t get_switch_lid(const osm_ucast_mgr_t * mgr,
+					const ib_net16_t lid)
+{
+	osm_node_t *o_rem_node = NULL;
+	osm_port_t *o_port = NULL;
+	uint8_t rem_port = 0;
+	ib_net16_t switch_lid = 0;
+
+	CL_ASSERT(mgr && lid > 0);
 
 	switch_lid = lid;
 	o_port = osm_get_port_by_lid(mgr->p_subn, lid);
@@ -4338,6 +5481,8 @@ static int calculate_spanning_tree_in_network(const osm_ucast_mgr_t * mgr,
 		for (i = 0, netw_link_iter = curr_node->links;
 		     i < curr_node->num_links; i++, netw_link_iter++) {
 			curr_link = netw_link_iter;
+			if (curr_link->failed)
+				continue;
 			adj_node = curr_link->to_network_node;
 			new_distance = curr_node->distance + curr_link->weight;
 			if (new_distance < adj_node->distance) {
@@ -5929,19 +7074,47 @@ static void init_linear_forwarding_tables(const osm_ucast_mgr_t * mgr,
 	OSM_LOG_EXIT(mgr->p_log);
 }
 
+/* update the number of paths routed thru the exit port of a switch */
+static inline void count_path_thru_port(const osm_ucast_mgr_t * mgr,
+					osm_switch_t * sw,
+					const osm_port_t * dest_port,
+					const uint8_t exit_port)
+{
+	osm_physp_t *phys_port = NULL;
+	boolean_t is_ignored_by_port_prof = FALSE;
+
+	phys_port = osm_node_get_physp_ptr(sw->p_node, exit_port);
+
+	/* we would like to optionally ignore this port in equalization
+	   as in the case of the Mellanox Anafa Internal PCI TCA port
+	 */
+	is_ignored_by_port_prof = phys_port->is_prof_ignored;
+
+	/* We also would ignore this route if the target lid is of
+	   a switch and the port_profile_switch_node is not TRUE
+	 */
+	if (!mgr->p_subn->opt.port_profile_switch_nodes) {
+		is_ignored_by_port_prof |=
+		    (osm_node_get_type(dest_port->p_node) ==
+		     IB_NODE_TYPE_SWITCH);
+	}
+
+	if (!is_ignored_by_port_prof)
+		osm_switch_count_path(sw, exit_port);
+}
+
 /* update the linear forwarding tables of all switches with the informations
    from the last routing step performed with our modified dijkstra on the ccdg
 */
 static void update_linear_forwarding_tables(const osm_ucast_mgr_t * mgr,
 					    const network_t * network,
 					    const osm_port_t * dest_port,
-					    const ib_net16_t dlid)
+					    const ib_net16_t dlid,
+					    const boolean_t count_paths)
 {
 	network_node_t *netw_node_iter = NULL;
 	osm_switch_t *sw = NULL;
 	uint8_t hops = 0, exit_port = 0;
-	osm_physp_t *phys_port = NULL;
-	boolean_t is_ignored_by_port_prof = FALSE;
 	uint16_t i = 0;
 	cl_status_t ret = CL_SUCCESS;
 
@@ -5983,28 +7156,14 @@ static void update_linear_forwarding_tables(const osm_ucast_mgr_t * mgr,
 			exit_port,
 			cl_ntoh64(osm_node_get_node_guid(sw->p_node)));
 
-		phys_port = osm_node_get_physp_ptr(sw->p_node, exit_port);
-
-		/* we would like to optionally ignore this port in equalization
-		   as in the case of the Mellanox Anafa Internal PCI TCA port
-		 */
-		is_ignored_by_port_prof = phys_port->is_prof_ignored;
-
-		/* We also would ignore this route if the target lid is of
-		   a switch and the port_profile_switch_node is not TRUE
-		 */
-		if (!mgr->p_subn->opt.port_profile_switch_nodes) {
-			is_ignored_by_port_prof |=
-			    (osm_node_get_type(dest_port->p_node) ==
-			     IB_NODE_TYPE_SWITCH);
-		}
-
 		/* set port in LFT, but switches use host byte order */
 		sw->new_lft[cl_ntoh16(dlid)] = exit_port;
 
-		/* update the number of path routing thru this port */
-		if (!is_ignored_by_port_prof)
-			osm_switch_count_path(sw, exit_port);
+		/* update the number of path routing thru this port; the
+		   concurrently routed layers leave this for a final pass
+		 */
+		if (count_paths)
+			count_path_thru_port(mgr, sw, dest_port, exit_port);
 
 		/* set the hop count from this switch to the dlid */
 		ret = osm_switch_set_hops(sw, cl_ntoh16(dlid), exit_port, hops);
@@ -6020,6 +7179,31 @@ static void update_linear_forwarding_tables(const osm_ucast_mgr_t * mgr,
 	OSM_LOG_EXIT(mgr->p_log);
 }
 
+/* update the path counts of all switches for the routes towards a destination
+   LID, after the routes of this LID have been written into the new LFTs
+ */
+static void count_paths_towards_destination(const osm_ucast_mgr_t * mgr,
+					    const network_t * network,
+					    const osm_port_t * dest_port,
+					    const ib_net16_t dlid)
+{
+	network_node_t *netw_node_iter = NULL;
+	osm_switch_t *sw = NULL;
+	uint16_t i = 0;
+
+	CL_ASSERT(mgr && network && dest_port && dlid > 0);
+
+	for (i = 0, netw_node_iter = network->nodes; i < network->num_nodes;
+	     i++, netw_node_iter++) {
+		sw = netw_node_iter->sw;
+		/* the 'route' of a switch to itself goes to port 0 */
+		if (dest_port->p_node->sw == sw)
+			continue;
+		count_path_thru_port(mgr, sw, dest_port,
+				     sw->new_lft[cl_ntoh16(dlid)]);
+	}
+}
+
 static inline void update_dlid_to_vl_mapping(uint8_t * dlid_to_vl_mapping,
 					     const ib_net16_t dlid,
 					     const uint8_t virtual_layer)
@@ -6028,226 +7212,1483 @@ static inline void update_dlid_to_vl_mapping(uint8_t * dlid_to_vl_mapping,
 	dlid_to_vl_mapping[cl_ntoh16(dlid)] = virtual_layer;
 }
 
-static int nue_do_ucast_routing(void *context)
+/* route all destinations of one virtual layer, either on the network and cCDG
+   of the context, or on private copies of them (see
+   route_virtual_layers_in_parallel)
+ */
+static int route_virtual_layer(nue_context_t * nue_ctx, network_t * network,
+			       ccdg_t * ccdg, const uint8_t vl,
+			       const boolean_t include_switches,
+			       const boolean_t count_paths,
+			       const boolean_t incremental)
 {
-	nue_context_t *nue_ctx = (nue_context_t *) context;
-	osm_ucast_mgr_t *mgr = NULL;
+	osm_ucast_mgr_t *mgr = nue_ctx->mgr;
 	osm_port_t *dest_port = NULL;
-	boolean_t include_switches = FALSE;
 	ib_net16_t *dlid_iter = NULL;
 	uint16_t lid = 0, min_lid_ho = 0, max_lid_ho = 0;
 	uint16_t i = 0;
-	uint8_t vl = 0;
+	uint32_t num_lids = 0;
 	uint8_t ntype = 0;
 	int err = 0;
 	int32_t color = 0;
 	boolean_t process_sw = FALSE, fallback_to_escape_paths = FALSE;
-	network_node_t *netw_node_iter = NULL;
 #if defined (_DEBUG_)
 	ccdg_t verify_ccdg = {.num_nodes = 0, .nodes = NULL, .num_colors = 0,
 			      .color_array = NULL};
 #endif
 
-	if (nue_ctx)
-		mgr = (osm_ucast_mgr_t *) nue_ctx->mgr;
-	else
-		return -1;
-
 	OSM_LOG_ENTER(mgr->p_log);
-	OSM_LOG(mgr->p_log, OSM_LOG_INFO, "Start routing process with nue\n");
+	OSM_LOG(mgr->p_log, OSM_LOG_DEBUG,
+		"Processing virtual layer %" PRIu8 "\n", vl);
 
-	init_linear_forwarding_tables(mgr, &(nue_ctx->network));
-
-	if (mgr->p_subn->opt.nue_include_switches) {
+	if (!nue_ctx->num_destinations[vl]) {
 		OSM_LOG(mgr->p_log, OSM_LOG_INFO,
-			" ...and consider switches as traffic sinks\n");
-		include_switches = mgr->p_subn->opt.nue_include_switches;
-	}
-
-	/* assign destination lids to different virtual layers */
-	err = distribute_lids_onto_virtual_layers(nue_ctx, include_switches);
-	if (err) {
-		destroy_context(nue_ctx);
-		return -1;
+			"WRN NUE43: no desti in this VL; skipping\n");
+		OSM_LOG_EXIT(mgr->p_log);
+		return 0;
 	}
-	if (OSM_LOG_IS_ACTIVE_V2(mgr->p_log, OSM_LOG_DEBUG))
-		print_destination_distribution(mgr, nue_ctx->destinations,
-					       nue_ctx->num_destinations);
 
-	for (vl = 0; vl < nue_ctx->max_vl; vl++) {
-		OSM_LOG(mgr->p_log, OSM_LOG_DEBUG,
-			"Processing virtual layer %" PRIu8 "\n", vl);
-
-		if (!nue_ctx->num_destinations[vl]) {
-			OSM_LOG(mgr->p_log, OSM_LOG_INFO,
-				"WRN NUE43: no desti in this VL; skipping\n");
-			continue;
+	if (incremental) {
+		/* continue with the cCDG and escape paths of the last routing,
+		   and only reroute the LIDs flagged by
+		   prepare_incremental_reroute
+		 */
+		num_lids = count_lids_to_reroute(nue_ctx, vl, include_switches);
+		if (!num_lids) {
+			OSM_LOG_EXIT(mgr->p_log);
+			return 0;
 		}
-
+		color = nue_ctx->reroute.next_color[vl];
+		err = restore_virtual_layer_state(nue_ctx, network, ccdg, vl,
+						  (uint32_t) color + num_lids);
+		if (err)
+			return -1;
+	} else {
 		color = ESCAPEPATHCOLOR + 1;
-		err =
-		    reset_ccdg_color_array(mgr, &(nue_ctx->ccdg),
-					   nue_ctx->num_destinations,
-					   nue_ctx->max_vl, nue_ctx->max_lmc);
-		if (err) {
-			destroy_context(nue_ctx);
+		err = reset_ccdg_color_array(mgr, ccdg,
+					     nue_ctx->num_destinations,
+					     nue_ctx->max_vl, nue_ctx->max_lmc);
+		if (err)
 			return -1;
-		}
-		init_ccdg_colors(&(nue_ctx->ccdg));
-
-		err =
-		    mark_escape_paths(mgr, &(nue_ctx->network),
-				      &(nue_ctx->ccdg),
-				      nue_ctx->destinations[vl],
-				      nue_ctx->num_destinations[vl],
-				      (0 == vl) ? TRUE : FALSE);
-		if (err) {
-			destroy_context(nue_ctx);
+		init_ccdg_colors(ccdg);
+
+		err = mark_escape_paths(mgr, network, ccdg,
+					nue_ctx->destinations[vl],
+					nue_ctx->num_destinations[vl],
+					(0 == vl) ? TRUE : FALSE);
+		if (err)
 			return -1;
-		}
-		if (OSM_LOG_IS_ACTIVE_V2(mgr->p_log, OSM_LOG_DEBUG)) {
-			OSM_LOG(mgr->p_log, OSM_LOG_DEBUG,
-				"Complete CDG including escape paths for"
-				" virtual layer %" PRIu8 "\n", vl);
-			print_ccdg(mgr, &(nue_ctx->ccdg), TRUE);
-		}
+	}
+	if (OSM_LOG_IS_ACTIVE_V2(mgr->p_log, OSM_LOG_DEBUG)) {
+		OSM_LOG(mgr->p_log, OSM_LOG_DEBUG,
+			"Complete CDG including escape paths for"
+			" virtual layer %" PRIu8 "\n", vl);
+		print_ccdg(mgr, ccdg, TRUE);
+	}
 
-		/* in the debug mode we monitor the correctness more closely */
-		CL_ASSERT(deep_cpy_ccdg(mgr, &(nue_ctx->ccdg), &verify_ccdg));
+	/* in the debug mode we monitor the correctness more closely */
+	CL_ASSERT(deep_cpy_ccdg(mgr, ccdg, &verify_ccdg));
 
-		process_sw = FALSE;
-		do {
-			dlid_iter = (ib_net16_t *) nue_ctx->destinations[vl];
-			for (i = 0; i < nue_ctx->num_destinations[vl];
-			     i++, dlid_iter++) {
-				dest_port =
-				    osm_get_port_by_lid(mgr->p_subn,
-							*dlid_iter);
-				ntype = osm_node_get_type(dest_port->p_node);
-				if (ntype == IB_NODE_TYPE_CA) {
-					if (process_sw)
-						continue;
+	process_sw = FALSE;
+	do {
+		dlid_iter = (ib_net16_t *) nue_ctx->destinations[vl];
+		for (i = 0; i < nue_ctx->num_destinations[vl];
+		     i++, dlid_iter++) {
+			dest_port = osm_get_port_by_lid(mgr->p_subn, *dlid_iter);
+			ntype = osm_node_get_type(dest_port->p_node);
+			if (ntype == IB_NODE_TYPE_CA) {
+				if (process_sw)
+					continue;
+				OSM_LOG(mgr->p_log, OSM_LOG_DEBUG,
+					"Processing Hca with GUID 0x%016"
+					PRIx64 "\n",
+					cl_ntoh64(osm_node_get_node_guid
+						  (dest_port->p_node)));
+			} else if (ntype == IB_NODE_TYPE_SWITCH) {
+				if (!process_sw)
+					continue;
+				OSM_LOG(mgr->p_log, OSM_LOG_DEBUG,
+					"Processing switch with GUID 0x%016"
+					PRIx64 "\n",
+					cl_ntoh64(osm_node_get_node_guid
+						  (dest_port->p_node)));
+			}
+
+			/* distribute the LID range across the ports that can
+			   reach those LIDs to have disjoint paths for one
+			   destination port with lmc>0; for switches with bsp0:
+			   min=max; with esp0: max>min if lmc>0
+			 */
+			osm_port_get_lid_range_ho(dest_port, &min_lid_ho,
+						  &max_lid_ho);
+			for (lid = min_lid_ho; lid <= max_lid_ho; lid++) {
+				if (incremental &&
+				    !nue_ctx->reroute.reroute_lid[lid])
+					continue;
+				/* search a path from all nodes to dlid without
+				   closing a cycle in the ccdg
+				 */
+				err =
+				    route_via_modified_dijkstra_on_ccdg(mgr,
+									network,
+									ccdg,
+									dest_port,
+									cl_hton16
+									(lid),
+									color++,
+									&fallback_to_escape_paths);
+				if (err)
+					return -1;
+				if (incremental && fallback_to_escape_paths &&
+				    nue_ctx->reroute.broken_escape_paths[vl]) {
+					OSM_LOG_EXIT(mgr->p_log);
+					return 1;
+				}
+				/* check intermediate steps for cycles in the
+				   complete cdg
+				 */
+				CL_ASSERT(add_paths_to_verify_ccdg
+					  (mgr, network,
+					   get_switch_lid(mgr, cl_hton16(lid)),
+					   ccdg, &verify_ccdg,
+					   fallback_to_escape_paths));
+				CL_ASSERT(is_ccdg_cycle_free
+					  (mgr, &verify_ccdg));
+				/* print the updated complete cdg after the
+				   routing for this desti is done
+				 */
+				if (OSM_LOG_IS_ACTIVE_V2
+				    (mgr->p_log, OSM_LOG_DEBUG)) {
 					OSM_LOG(mgr->p_log, OSM_LOG_DEBUG,
-						"Processing Hca with GUID"
-						" 0x%016" PRIx64 "\n",
-						cl_ntoh64(osm_node_get_node_guid
-							  (dest_port->p_node)));
-				} else if (ntype == IB_NODE_TYPE_SWITCH) {
-					if (!process_sw)
-						continue;
+						"Complete CDG after routing destination LID %"
+						PRIu16 " for virtual layer %"
+						PRIu8 "\n", lid, vl);
+					print_ccdg(mgr, ccdg, TRUE);
+				}
+
+				/* and print the calculated routes */
+				if (OSM_LOG_IS_ACTIVE_V2
+				    (mgr->p_log, OSM_LOG_DEBUG)) {
 					OSM_LOG(mgr->p_log, OSM_LOG_DEBUG,
-						"Processing switch with GUID"
-						" 0x%016" PRIx64 "\n",
-						cl_ntoh64(osm_node_get_node_guid
-							  (dest_port->p_node)));
+						"Calculated paths towards destination LID %"
+						PRIu16 "\n", lid);
+					print_routes(mgr, network, dest_port,
+						     cl_hton16(lid));
 				}
 
-				/* distribute the LID range across the ports
-				   that can reach those LIDs to have disjoint
-				   paths for one destination port with lmc>0;
-				   for switches with bsp0: min=max; with esp0:
-				   max>min if lmc>0
+				/* update linear forwarding tables of all
+				   switches towards this desti
 				 */
-				osm_port_get_lid_range_ho(dest_port,
-							  &min_lid_ho,
-							  &max_lid_ho);
-				for (lid = min_lid_ho; lid <= max_lid_ho; lid++) {
-					/* search a path from all nodes to dlid
-					   without closing a cycle in the ccdg
-					 */
-					err =
-					    route_via_modified_dijkstra_on_ccdg
-					    (mgr, &(nue_ctx->network),
-					     &(nue_ctx->ccdg), dest_port,
-					     cl_hton16(lid), color++,
-					     &fallback_to_escape_paths);
-					if (err) {
-						destroy_context(nue_ctx);
-						return -1;
-					}
-					/* check intermediate steps for cycles
-					   in the complete cdg
-					 */
-					CL_ASSERT(add_paths_to_verify_ccdg
-						  (mgr, &(nue_ctx->network),
-						   get_switch_lid(mgr,
-								  cl_hton16
-								  (lid)),
-						   &(nue_ctx->ccdg),
-						   &verify_ccdg,
-						   fallback_to_escape_paths));
-					CL_ASSERT(is_ccdg_cycle_free
-						  (mgr, &verify_ccdg));
-					/* print the updated complete cdg after
-					   the routing for this desti is done
-					 */
-					if (OSM_LOG_IS_ACTIVE_V2
-					    (mgr->p_log, OSM_LOG_DEBUG)) {
-						OSM_LOG(mgr->p_log,
-							OSM_LOG_DEBUG,
-							"Complete CDG after routing destination LID %"
-							PRIu16
-							" for virtual layer %"
-							PRIu8 "\n", lid, vl);
-						print_ccdg(mgr,
-							   &(nue_ctx->ccdg),
-							   TRUE);
-					}
+				update_linear_forwarding_tables(mgr, network,
+								dest_port,
+								cl_hton16(lid),
+								count_paths);
+
+				/* traverse the calculated paths and update
+				   link weights for the next step to increase
+				   the path balancing
+				 */
+				update_network_link_weights(mgr, network,
+							    get_switch_lid
+							    (mgr,
+							     cl_hton16(lid)));
+
+				/* and finally update the mapping of
+				   'destination to virtual layer'
+				 */
+				update_dlid_to_vl_mapping(nue_ctx->
+							  dlid_to_vl_mapping,
+							  cl_hton16(lid), vl);
+			}
+		}
+		if (!process_sw && include_switches)
+			process_sw = TRUE;
+		else
+			break;
+	} while (TRUE);
+
+	/* do a final check if ccdg is acyclic after processing all */
+	CL_ASSERT(is_ccdg_cycle_free(mgr, &verify_ccdg));
+#if defined (_DEBUG_)
+	destroy_ccdg(&verify_ccdg);
+#endif
+
+	save_virtual_layer_state(nue_ctx, network, ccdg, vl, color);
+
+	OSM_LOG_EXIT(mgr->p_log);
+	return 0;
+}
+
+static inline network_link_t *get_copied_network_link(const network_t *
+						      in_network,
+						      const network_t *
+						      out_network,
+						      const network_link_t *
+						      link)
+{
+	network_node_t *in_netw_node = NULL;
+
+	if (!link)
+		return NULL;
+
+	in_netw_node = get_network_node_by_lid(in_network,
+					       link->link_info.local_lid);
+	CL_ASSERT(in_netw_node);
+	return out_network->nodes[in_netw_node - in_network->nodes].links +
+	    (link - in_netw_node->links);
+}
+
+static int copy_network_and_ccdg(const osm_ucast_mgr_t * mgr,
+				 const network_t * in_network,
+				 const ccdg_t * in_ccdg,
+				 network_t * out_network, ccdg_t * out_ccdg)
+{
+	network_node_t *in_netw_node_iter = NULL, *out_netw_node_iter = NULL;
+	network_link_t *in_link_iter = NULL, *out_link_iter = NULL;
+	ccdg_node_t *in_ccdg_node_iter = NULL, *out_ccdg_node_iter = NULL;
+	ccdg_edge_t *in_ccdg_edge_iter = NULL, *out_ccdg_edge_iter = NULL;
+	uint32_t i = 0, j = 0;
+
+	CL_ASSERT(mgr && in_network && in_ccdg && out_network && out_ccdg);
+
+	construct_network(out_network);
+	construct_ccdg(out_ccdg);
+
+	/* the arrays of the nodes are allocated first, before any pointer into
+	   them can be redirected; a partial copy can always be destroyed
+	 */
+	out_network->nodes =
+	    (network_node_t *) malloc(in_network->num_nodes *
+				      sizeof(network_node_t));
+	out_ccdg->nodes =
+	    (ccdg_node_t *) malloc(in_ccdg->num_nodes * sizeof(ccdg_node_t));
+	if ((in_network->num_nodes && !out_network->nodes) ||
+	    (in_ccdg->num_nodes && !out_ccdg->nodes))
+		goto ERROR;
+	memcpy(out_network->nodes, in_network->nodes,
+	       in_network->num_nodes * sizeof(network_node_t));
+	for (i = 0, out_netw_node_iter = out_network->nodes;
+	     i < in_network->num_nodes; i++, out_netw_node_iter++) {
+		out_netw_node_iter->links = NULL;
+		out_netw_node_iter->stack_used_links = NULL;
+		out_netw_node_iter->num_elem_in_link_stack = 0;
+		out_netw_node_iter->Ps = NULL;
+		out_netw_node_iter->num_elem_in_Ps = 0;
+	}
+	out_network->num_nodes = in_network->num_nodes;
+	memcpy(out_ccdg->nodes, in_ccdg->nodes,
+	       in_ccdg->num_nodes * sizeof(ccdg_node_t));
+	for (i = 0, out_ccdg_node_iter = out_ccdg->nodes;
+	     i < in_ccdg->num_nodes; i++, out_ccdg_node_iter++)
+		out_ccdg_node_iter->edges = NULL;
+	out_ccdg->num_nodes = in_ccdg->num_nodes;
+
+	for (i = 0, in_netw_node_iter = in_network->nodes, out_netw_node_iter =
+	     out_network->nodes; i < in_network->num_nodes;
+	     i++, in_netw_node_iter++, out_netw_node_iter++) {
+		if (!in_netw_node_iter->num_links)
+			continue;
+		out_netw_node_iter->links =
+		    (network_link_t *) malloc(in_netw_node_iter->num_links *
+					      sizeof(network_link_t));
+		out_netw_node_iter->stack_used_links =
+		    (network_link_t **) malloc(in_netw_node_iter->num_links *
+					       sizeof(network_link_t *));
+		if (!out_netw_node_iter->links ||
+		    !out_netw_node_iter->stack_used_links)
+			goto ERROR;
+		memcpy(out_netw_node_iter->links, in_netw_node_iter->links,
+		       in_netw_node_iter->num_links * sizeof(network_link_t));
+	}
+	for (i = 0, in_ccdg_node_iter = in_ccdg->nodes, out_ccdg_node_iter =
+	     out_ccdg->nodes; i < in_ccdg->num_nodes;
+	     i++, in_ccdg_node_iter++, out_ccdg_node_iter++) {
+		if (!in_ccdg_node_iter->num_edges)
+			continue;
+		out_ccdg_node_iter->edges =
+		    (ccdg_edge_t *) malloc(in_ccdg_node_iter->num_edges *
+					   sizeof(ccdg_edge_t));
+		if (!out_ccdg_node_iter->edges)
+			goto ERROR;
+		memcpy(out_ccdg_node_iter->edges, in_ccdg_node_iter->edges,
+		       in_ccdg_node_iter->num_edges * sizeof(ccdg_edge_t));
+	}
+
+	/* redirect all pointers into the copy */
+	for (i = 0, in_netw_node_iter = in_network->nodes, out_netw_node_iter =
+	     out_network->nodes; i < in_network->num_nodes;
+	     i++, in_netw_node_iter++, out_netw_node_iter++) {
+		out_netw_node_iter->used_link =
+		    get_copied_network_link(in_network, out_network,
+					    in_netw_node_iter->used_link);
+		out_netw_node_iter->escape_path =
+		    get_copied_network_link(in_network, out_network,
+					    in_netw_node_iter->escape_path);
+		for (j = 0, in_link_iter = in_netw_node_iter->links,
+		     out_link_iter = out_netw_node_iter->links;
+		     j < in_netw_node_iter->num_links;
+		     j++, in_link_iter++, out_link_iter++) {
+			if (in_link_iter->to_network_node)
+				out_link_iter->to_network_node =
+				    out_network->nodes +
+				    (in_link_iter->to_network_node -
+				     in_network->nodes);
+			if (in_link_iter->corresponding_ccdg_node)
+				out_link_iter->corresponding_ccdg_node =
+				    out_ccdg->nodes +
+				    (in_link_iter->corresponding_ccdg_node -
+				     in_ccdg->nodes);
+		}
+	}
+	for (i = 0, in_ccdg_node_iter = in_ccdg->nodes, out_ccdg_node_iter =
+	     out_ccdg->nodes; i < in_ccdg->num_nodes;
+	     i++, in_ccdg_node_iter++, out_ccdg_node_iter++) {
+		out_ccdg_node_iter->corresponding_netw_link =
+		    get_copied_network_link(in_network, out_network,
+					    in_ccdg_node_iter->
+					    corresponding_netw_link);
+		if (in_ccdg_node_iter->pre)
+			out_ccdg_node_iter->pre = out_ccdg->nodes +
+			    (in_ccdg_node_iter->pre - in_ccdg->nodes);
+		out_ccdg_node_iter->color = NULL;
+		out_ccdg_node_iter->wet_paint = FALSE;
+		for (j = 0, in_ccdg_edge_iter = in_ccdg_node_iter->edges,
+		     out_ccdg_edge_iter = out_ccdg_node_iter->edges;
+		     j < in_ccdg_node_iter->num_edges;
+		     j++, in_ccdg_edge_iter++, out_ccdg_edge_iter++) {
+			if (in_ccdg_edge_iter->to_ccdg_node)
+				out_ccdg_edge_iter->to_ccdg_node =
+				    out_ccdg->nodes +
+				    (in_ccdg_edge_iter->to_ccdg_node -
+				     in_ccdg->nodes);
+			out_ccdg_edge_iter->color = NULL;
+			out_ccdg_edge_iter->wet_paint = FALSE;
+		}
+	}
+
+	return 0;
+
+ERROR:
+	OSM_LOG(mgr->p_log, OSM_LOG_ERROR,
+		"ERR NUE47: cannot allocate memory for a copy of the network"
+		" and the cCDG\n");
+	destroy_ccdg(out_ccdg);
+	destroy_network(out_network);
+	return -1;
+}
+
+static void route_virtual_layer_on_copy(void *context, unsigned index,
+					unsigned thread)
+{
+	nue_layer_routing_t *layers = (nue_layer_routing_t *) context;
+	nue_context_t *nue_ctx = layers->nue_ctx;
+	network_t network;
+	ccdg_t ccdg;
+	network_node_t *in_netw_node_iter = NULL, *out_netw_node_iter = NULL;
+	uint64_t *weight_iter = NULL;
+	uint8_t vl = (uint8_t) index;
+	uint16_t i = 0;
+	uint8_t j = 0;
+
+	construct_network(&network);
+	construct_ccdg(&ccdg);
+
+	/* a layer without destinations only logs a warning, and doesn't
+	   need a copy of the graphs for that
+	 */
+	if (nue_ctx->num_destinations[vl] &&
+	    copy_network_and_ccdg(nue_ctx->mgr, &(nue_ctx->network),
+				  &(nue_ctx->ccdg), &network, &ccdg)) {
+		layers->err[vl] = -1;
+		return;
+	}
+
+	layers->err[vl] =
+	    route_virtual_layer(nue_ctx, &network, &ccdg, vl,
+				layers->include_switches, FALSE, FALSE);
+
+	if (!layers->err[vl] && network.nodes) {
+		weight_iter =
+		    layers->weight_increase + (size_t) vl * layers->num_links;
+		for (i = 0, in_netw_node_iter = nue_ctx->network.nodes,
+		     out_netw_node_iter = network.nodes;
+		     i < network.num_nodes;
+		     i++, in_netw_node_iter++, out_netw_node_iter++) {
+			for (j = 0; j < out_netw_node_iter->num_links; j++)
+				*weight_iter++ =
+				    out_netw_node_iter->links[j].weight -
+				    in_netw_node_iter->links[j].weight;
+		}
+	}
+
+	destroy_ccdg(&ccdg);
+	destroy_network(&network);
+}
+
+static int route_virtual_layers_in_parallel(nue_context_t * nue_ctx,
+					    const boolean_t include_switches)
+{
+	osm_ucast_mgr_t *mgr = nue_ctx->mgr;
+	nue_layer_routing_t layers;
+	network_node_t *netw_node_iter = NULL;
+	osm_port_t *dest_port = NULL;
+	ib_net16_t *dlid_iter = NULL;
+	uint64_t *weight_iter = NULL;
+	uint16_t lid = 0, min_lid_ho = 0, max_lid_ho = 0;
+	uint16_t i = 0;
+	uint8_t vl = 0, j = 0;
+
+	OSM_LOG_ENTER(mgr->p_log);
+
+	memset(&layers, 0, sizeof(layers));
+	layers.nue_ctx = nue_ctx;
+	layers.include_switches = include_switches;
+	for (i = 0, netw_node_iter = nue_ctx->network.nodes;
+	     i < nue_ctx->network.num_nodes; i++, netw_node_iter++)
+		layers.num_links += netw_node_iter->num_links;
+	layers.weight_increase =
+	    (uint64_t *) calloc((size_t) nue_ctx->max_vl * layers.num_links + 1,
+				sizeof(uint64_t));
+	if (!layers.weight_increase) {
+		OSM_LOG(mgr->p_log, OSM_LOG_ERROR,
+			"ERR NUE48: cannot allocate memory for link weights\n");
+		return -1;
+	}
+
+	osm_parallel_for(osm_parallel_threads
+			 (mgr->p_subn->opt.routing_threads), nue_ctx->max_vl,
+			 route_virtual_layer_on_copy, &layers);
+
+	for (vl = 0; vl < nue_ctx->max_vl; vl++) {
+		if (layers.err[vl]) {
+			free(layers.weight_increase);
+			return -1;
+		}
+	}
+
+	/* every layer was balanced against the weights all layers started
+	   from, and the weights it added are merged in the order of the
+	   layers, so the next routing step (switch-to-switch paths or the
+	   next sweep) sees the load of all layers
+	 */
+	for (vl = 0, weight_iter = layers.weight_increase;
+	     vl < nue_ctx->max_vl; vl++) {
+		for (i = 0, netw_node_iter = nue_ctx->network.nodes;
+		     i < nue_ctx->network.num_nodes; i++, netw_node_iter++) {
+			for (j = 0; j < netw_node_iter->num_links; j++)
+				netw_node_iter->links[j].weight +=
+				    *weight_iter++;
+		}
+	}
+	free(layers.weight_increase);
+
+	/* the threads only set the LFT entries of their own destinations, but
+	   the path counts of a switch port are shared by all layers
+	 */
+	for (vl = 0; vl < nue_ctx->max_vl; vl++) {
+		dlid_iter = (ib_net16_t *) nue_ctx->destinations[vl];
+		for (i = 0; i < nue_ctx->num_destinations[vl];
+		     i++, dlid_iter++) {
+			dest_port = osm_get_port_by_lid(mgr->p_subn, *dlid_iter);
+			if (!include_switches &&
+			    osm_node_get_type(dest_port->p_node) ==
+			    IB_NODE_TYPE_SWITCH)
+				continue;
+			osm_port_get_lid_range_ho(dest_port, &min_lid_ho,
+						  &max_lid_ho);
+			for (lid = min_lid_ho; lid <= max_lid_ho; lid++)
+				count_paths_towards_destination(mgr,
+								&(nue_ctx->
+								  network),
+								dest_port,
+								cl_hton16(lid));
+		}
+	}
+
+	OSM_LOG_EXIT(mgr->p_log);
+	return 0;
+}
+
+/* free the outcome of the last routing which is kept for incremental reroutes */
+static void destroy_reroute_state(nue_reroute_state_t * state)
+{
+	uint8_t vl = 0;
+
+	CL_ASSERT(state);
+
+	for (vl = 0; vl < IB_MAX_NUM_VLS; vl++) {
+		if (state->colors[vl])
+			free(state->colors[vl]);
+		if (state->escape_paths[vl])
+			free(state->escape_paths[vl]);
+	}
+	if (state->lfts)
+		free(state->lfts);
+	if (state->reroute_lid)
+		free(state->reroute_lid);
+	memset(state, 0, sizeof(nue_reroute_state_t));
+}
+
+/* allocate the arrays which keep the outcome of a full routing, so that a
+   later sweep can reroute only the destinations affected by failed links;
+   without them the next sweep simply routes the whole subnet again
+ */
+static void init_reroute_state(nue_context_t * nue_ctx)
+{
+	osm_ucast_mgr_t *mgr = nue_ctx->mgr;
+	nue_reroute_state_t *state = &(nue_ctx->reroute);
+	ccdg_node_t *ccdg_node_iter = NULL;
+	uint32_t i = 0;
+	uint8_t vl = 0;
+
+	destroy_reroute_state(state);
+
+	state->max_lid_ho = mgr->p_subn->max_ucast_lid_ho;
+	state->num_colors = nue_ctx->ccdg.num_nodes;
+	for (i = 0, ccdg_node_iter = nue_ctx->ccdg.nodes;
+	     i < nue_ctx->ccdg.num_nodes; i++, ccdg_node_iter++)
+		state->num_colors += ccdg_node_iter->num_edges;
+
+	for (vl = 0; vl < nue_ctx->max_vl; vl++) {
+		state->colors[vl] =
+		    (uint16_t *) malloc(state->num_colors * sizeof(uint16_t));
+		state->escape_paths[vl] =
+		    (network_link_t **) calloc(nue_ctx->network.num_nodes,
+					       sizeof(network_link_t *));
+		if (!state->colors[vl] || !state->escape_paths[vl])
+			goto error;
+	}
+	state->lfts =
+	    (uint8_t *) malloc((size_t) nue_ctx->network.num_nodes *
+			       (state->max_lid_ho + 1));
+	state->reroute_lid =
+	    (uint8_t *) calloc(state->max_lid_ho + 1, sizeof(uint8_t));
+	if (!state->lfts || !state->reroute_lid)
+		goto error;
+
+	return;
+
+error:
+	OSM_LOG(mgr->p_log, OSM_LOG_INFO,
+		"WRN NUE49: cannot allocate memory to keep the routing state;"
+		" the next reroute won't be incremental\n");
+	destroy_reroute_state(state);
+}
+
+/* keep the coloring of the cCDG and the escape paths of a routed virtual
+   layer, since an incremental reroute continues from there
+ */
+static void save_virtual_layer_state(nue_context_t * nue_ctx,
+				     const network_t * network,
+				     const ccdg_t * ccdg, const uint8_t vl,
+				     const int32_t next_color)
+{
+	nue_reroute_state_t *state = &(nue_ctx->reroute);
+	uint16_t *color_iter = state->colors[vl];
+	ccdg_node_t *ccdg_node_iter = NULL;
+	ccdg_edge_t *ccdg_edge_iter = NULL;
+	uint32_t i = 0;
+	uint8_t j = 0;
+
+	if (!color_iter)
+		return;
+
+	for (i = 0, ccdg_node_iter = ccdg->nodes; i < ccdg->num_nodes;
+	     i++, ccdg_node_iter++) {
+		*color_iter++ = get_ccdg_node_color(ccdg, ccdg_node_iter);
+		for (j = 0, ccdg_edge_iter = ccdg_node_iter->edges;
+		     j < ccdg_node_iter->num_edges; j++, ccdg_edge_iter++)
+			*color_iter++ =
+			    get_ccdg_edge_color(ccdg, ccdg_edge_iter);
+	}
+	CL_ASSERT(color_iter == state->colors[vl] + state->num_colors);
+
+	/* a layer might be routed on a copy of the network, but the
+	   incremental reroute uses the network of the context
+	 */
+	for (i = 0; i < network->num_nodes; i++)
+		state->escape_paths[vl][i] =
+		    get_copied_network_link(network, &(nue_ctx->network),
+					    network->nodes[i].escape_path);
+
+	state->next_color[vl] = next_color;
+}
+
+static inline network_link_t *get_network_link_at_port(const network_node_t *
+						       netw_node,
+						       const uint8_t port)
+{
+	network_link_t *netw_link_iter = NULL;
+	uint8_t i = 0;
+
+	for (i = 0, netw_link_iter = netw_node->links;
+	     i < netw_node->num_links; i++, netw_link_iter++)
+		if (netw_link_iter->link_info.local_port == port)
+			return netw_link_iter;
+	return NULL;
+}
+
+/* the cCDG nodes are the inverted channels of the routes; a route which
+   leaves a switch thru link L towards the destination uses the cCDG node of
+   the link in the opposite direction
+ */
+static inline ccdg_node_t *get_ccdg_node_of_route(const network_node_t *
+						  netw_node,
+						  const uint8_t exit_port)
+{
+	network_link_t *link = NULL, *r_link = NULL;
+
+	link = get_network_link_at_port(netw_node, exit_port);
+	if (!link)
+		return NULL;
+	r_link = get_network_link_at_port(link->to_network_node,
+					  link->link_info.remote_port);
+	CL_ASSERT(r_link);
+	return r_link->corresponding_ccdg_node;
+}
+
+/* the restored coloring still contains the channel dependencies of the old
+   routes towards the rerouted LIDs, which would only restrict the new
+   routes; so only the dependencies of the kept routes (found by following
+   the LFTs), the escape paths and the blocked edges stay as they are
+ */
+static int release_rerouted_dependencies(nue_context_t * nue_ctx,
+					 const network_t * network,
+					 ccdg_t * ccdg, const uint8_t vl)
+{
+	osm_ucast_mgr_t *mgr = nue_ctx->mgr;
+	nue_reroute_state_t *state = &(nue_ctx->reroute);
+	network_node_t *netw_node_iter = NULL, *next_netw_node = NULL;
+	ccdg_node_t *ccdg_node_iter = NULL, *ccdg_node = NULL, *pre = NULL;
+	ccdg_edge_t *ccdg_edge_iter = NULL;
+	osm_port_t *dest_port = NULL;
+	osm_switch_t *sw = NULL;
+	ib_net16_t *dlid_iter = NULL;
+	uint32_t *offsets = NULL, i = 0, num_edges = 0;
+	uint16_t lid = 0, min_lid_ho = 0, max_lid_ho = 0;
+	uint16_t k = 0;
+	uint8_t *keep = NULL;
+	uint8_t j = 0;
+	boolean_t fake_source = FALSE;
+
+	OSM_LOG_ENTER(mgr->p_log);
+
+	/* one flag for each cCDG node followed by its edges, i.e. in the same
+	   order as the saved colors
+	 */
+	offsets = (uint32_t *) malloc(ccdg->num_nodes * sizeof(uint32_t));
+	keep = (uint8_t *) calloc(state->num_colors, sizeof(uint8_t));
+	if (!offsets || !keep) {
+		OSM_LOG(mgr->p_log, OSM_LOG_ERROR,
+			"ERR NUE52: cannot allocate memory for the kept"
+			" channel dependencies\n");
+		if (offsets)
+			free(offsets);
+		if (keep)
+			free(keep);
+		OSM_LOG_EXIT(mgr->p_log);
+		return -1;
+	}
+	for (i = 0, num_edges = 0, ccdg_node_iter = ccdg->nodes;
+	     i < ccdg->num_nodes; i++, ccdg_node_iter++) {
+		offsets[i] = i + num_edges;
+		num_edges += ccdg_node_iter->num_edges;
+	}
+
+	dlid_iter = (ib_net16_t *) nue_ctx->destinations[vl];
+	for (i = 0; i < nue_ctx->num_destinations[vl]; i++, dlid_iter++) {
+		dest_port = osm_get_port_by_lid(mgr->p_subn, *dlid_iter);
+		if (!state->include_switches &&
+		    osm_node_get_type(dest_port->p_node) ==
+		    IB_NODE_TYPE_SWITCH)
+			continue;
+		osm_port_get_lid_range_ho(dest_port, &min_lid_ho, &max_lid_ho);
+		for (lid = min_lid_ho; lid <= max_lid_ho; lid++) {
+			if (state->reroute_lid[lid])
+				continue;
+			for (k = 0, netw_node_iter = network->nodes;
+			     k < network->num_nodes; k++, netw_node_iter++) {
+				sw = (osm_switch_t *) netw_node_iter->sw;
+				ccdg_node = get_ccdg_node_of_route(netw_node_iter,
+								   sw->
+								   new_lft
+								   [lid]);
+				if (!ccdg_node)
+					continue;
+				keep[offsets[ccdg_node - ccdg->nodes]] = TRUE;
+
+				/* the dependency towards this channel comes
+				   from the channel of the next switch
+				 */
+				next_netw_node =
+				    ccdg_node->corresponding_netw_link->
+				    to_network_node;
+				pre = get_ccdg_node_of_route(next_netw_node,
+							     next_netw_node->
+							     sw->new_lft[lid]);
+				if (!pre)
+					continue;
+				keep[offsets[pre - ccdg->nodes]] = TRUE;
+				for (j = 0, ccdg_edge_iter = pre->edges;
+				     j < pre->num_edges; j++, ccdg_edge_iter++)
+					if (ccdg_edge_iter->to_ccdg_node ==
+					    ccdg_node)
+						keep[offsets[pre - ccdg->nodes]
+						     + 1 + j] = TRUE;
+			}
+		}
+	}
+
+	for (i = 0, ccdg_node_iter = ccdg->nodes; i < ccdg->num_nodes;
+	     i++, ccdg_node_iter++) {
+		/* the fake channels of the switches are only sources of
+		   dependencies; their edges are kept as long as the channel
+		   they lead to is kept
+		 */
+		fake_source =
+		    (ccdg_node_iter->channel_id.local_lid ==
+		     ccdg_node_iter->channel_id.remote_lid &&
+		     !ccdg_node_iter->channel_id.local_port &&
+		     !ccdg_node_iter->channel_id.remote_port);
+		if (!fake_source && !keep[offsets[i]] &&
+		    get_ccdg_node_color(ccdg, ccdg_node_iter) > ESCAPEPATHCOLOR)
+			ccdg_node_iter->color = &(ccdg->color_array[UNUSED]);
+		for (j = 0, ccdg_edge_iter = ccdg_node_iter->edges;
+		     j < ccdg_node_iter->num_edges; j++, ccdg_edge_iter++) {
+			if (get_ccdg_edge_color(ccdg, ccdg_edge_iter) <=
+			    ESCAPEPATHCOLOR || keep[offsets[i] + 1 + j])
+				continue;
+			if (fake_source &&
+			    keep[offsets[ccdg_edge_iter->to_ccdg_node -
+					 ccdg->nodes]])
+				continue;
+			ccdg_edge_iter->color = &(ccdg->color_array[UNUSED]);
+		}
+	}
+
+	free(offsets);
+	free(keep);
+	OSM_LOG_EXIT(mgr->p_log);
+	return 0;
+}
+
+/* restore the coloring of the cCDG and the escape paths of a virtual layer
+   after the last routing, and block all channel dependencies into and out of
+   channels of failed links; the paths of the rerouted destinations avoid
+   those and can't close a cycle with the kept paths, because the colors of
+   the kept channel dependencies are still in place
+ */
+static int restore_virtual_layer_state(nue_context_t * nue_ctx,
+				       network_t * network, ccdg_t * ccdg,
+				       const uint8_t vl,
+				       const uint32_t num_colors)
+{
+	osm_ucast_mgr_t *mgr = nue_ctx->mgr;
+	nue_reroute_state_t *state = &(nue_ctx->reroute);
+	const uint16_t *color_iter = state->colors[vl];
+	ccdg_node_t *ccdg_node_iter = NULL;
+	ccdg_edge_t *ccdg_edge_iter = NULL;
+	network_link_t *link = NULL;
+	boolean_t failed = FALSE;
+	uint32_t i = 0;
+	uint8_t j = 0;
+
+	CL_ASSERT(network == &(nue_ctx->network) && color_iter);
+
+	/* every rerouted LID needs a new color on top of the old ones */
+	if (ccdg->num_colors < num_colors) {
+		if (ccdg->color_array)
+			free(ccdg->color_array);
+		ccdg->num_colors = 0;
+		ccdg->color_array =
+		    (color_t *) malloc(num_colors * sizeof(color_t));
+		if (!ccdg->color_array) {
+			OSM_LOG(mgr->p_log, OSM_LOG_ERROR,
+				"ERR NUE50: cannot allocate memory for ccdg color array\n");
+			return -1;
+		}
+		ccdg->num_colors = num_colors;
+	}
+	if (reset_ccdg_color_array(mgr, ccdg, nue_ctx->num_destinations,
+				   nue_ctx->max_vl, nue_ctx->max_lmc))
+		return -1;
+
+	for (i = 0, ccdg_node_iter = ccdg->nodes; i < ccdg->num_nodes;
+	     i++, ccdg_node_iter++) {
+		ccdg_node_iter->color = &(ccdg->color_array[*color_iter++]);
+		ccdg_node_iter->wet_paint = FALSE;
+		for (j = 0, ccdg_edge_iter = ccdg_node_iter->edges;
+		     j < ccdg_node_iter->num_edges; j++, ccdg_edge_iter++) {
+			ccdg_edge_iter->color =
+			    &(ccdg->color_array[*color_iter++]);
+			ccdg_edge_iter->wet_paint = FALSE;
+		}
+	}
+
+	for (i = 0; i < network->num_nodes; i++)
+		network->nodes[i].escape_path = state->escape_paths[vl][i];
+
+	if (release_rerouted_dependencies(nue_ctx, network, ccdg, vl))
+		return -1;
+
+	for (i = 0, ccdg_node_iter = ccdg->nodes; i < ccdg->num_nodes;
+	     i++, ccdg_node_iter++) {
+		link = ccdg_node_iter->corresponding_netw_link;
+		failed = (link && link->failed);
+		for (j = 0, ccdg_edge_iter = ccdg_node_iter->edges;
+		     j < ccdg_node_iter->num_edges; j++, ccdg_edge_iter++) {
+			link = ccdg_edge_iter->to_ccdg_node->
+			    corresponding_netw_link;
+			if (failed || (link && link->failed))
+				set_ccdg_edge_into_blocked_state(ccdg,
+								 ccdg_edge_iter);
+		}
+	}
+
+	return 0;
+}
+
+/* keep the LFTs of a successful routing; the state is only valid if also the
+   virtual layers have been saved
+ */
+static void save_linear_forwarding_tables(nue_context_t * nue_ctx,
+					  const boolean_t include_switches)
+{
+	nue_reroute_state_t *state = &(nue_ctx->reroute);
+	network_node_t *netw_node_iter = NULL;
+	osm_switch_t *sw = NULL;
+	uint8_t *lft = NULL;
+	uint16_t i = 0, len = 0;
+
+	if (!state->lfts)
+		return;
+
+	for (i = 0, netw_node_iter = nue_ctx->network.nodes,
+	     lft = state->lfts; i < nue_ctx->network.num_nodes;
+	     i++, netw_node_iter++, lft += state->max_lid_ho + 1) {
+		sw = netw_node_iter->sw;
+		len = ((sw->max_lid_ho < state->max_lid_ho) ?
+		       sw->max_lid_ho : state->max_lid_ho) + 1;
+		memcpy(lft, sw->new_lft, len);
+		memset(lft + len, OSM_NO_PATH, state->max_lid_ho + 1 - len);
+	}
+
+	state->include_switches = include_switches;
+	state->num_lids = count_destination_lids(nue_ctx->mgr,
+						 &(state->num_base_lids));
+	state->valid = TRUE;
+}
+
+/* start the new LFTs with the routes of the last routing */
+static void restore_linear_forwarding_tables(nue_context_t * nue_ctx)
+{
+	nue_reroute_state_t *state = &(nue_ctx->reroute);
+	network_node_t *netw_node_iter = NULL;
+	osm_switch_t *sw = NULL;
+	const uint8_t *lft = NULL;
+	uint16_t i = 0, len = 0;
+
+	for (i = 0, netw_node_iter = nue_ctx->network.nodes,
+	     lft = state->lfts; i < nue_ctx->network.num_nodes;
+	     i++, netw_node_iter++, lft += state->max_lid_ho + 1) {
+		sw = netw_node_iter->sw;
+		len = ((sw->max_lid_ho < state->max_lid_ho) ?
+		       sw->max_lid_ho : state->max_lid_ho) + 1;
+		memcpy(sw->new_lft, lft, len);
+	}
+}
+
+/* count the destination ports and LIDs the same way as
+   get_base_lids_and_number_of_lids, but without touching the destinations
+ */
+static uint32_t count_destination_lids(const osm_ucast_mgr_t * mgr,
+				       uint16_t * num_base_lids)
+{
+	cl_qmap_t *port_tbl = NULL;
+	cl_map_item_t *item = NULL;
+	osm_port_t *port = NULL;
+	uint32_t num_lids = 0;
+	uint8_t ntype = 0;
+
+	*num_base_lids = 0;
+	port_tbl = (cl_qmap_t *) & (mgr->p_subn->port_guid_tbl);
+	for (item = cl_qmap_head(port_tbl); item != cl_qmap_end(port_tbl);
+	     item = cl_qmap_next(item)) {
+		port = (osm_port_t *) item;
+		ntype = osm_node_get_type(port->p_node);
+		if (ntype == IB_NODE_TYPE_CA || ntype == IB_NODE_TYPE_SWITCH) {
+			num_lids += (1 << osm_port_get_lmc(port));
+			(*num_base_lids)++;
+		}
+	}
+
+	return num_lids;
+}
+
+/* count the LIDs of a virtual layer which have to be rerouted */
+static uint32_t count_lids_to_reroute(const nue_context_t * nue_ctx,
+				      const uint8_t vl,
+				      const boolean_t include_switches)
+{
+	osm_ucast_mgr_t *mgr = nue_ctx->mgr;
+	osm_port_t *dest_port = NULL;
+	const ib_net16_t *dlid_iter = NULL;
+	uint16_t lid = 0, min_lid_ho = 0, max_lid_ho = 0;
+	uint16_t i = 0;
+	uint32_t num_lids = 0;
+
+	for (i = 0, dlid_iter = nue_ctx->destinations[vl];
+	     i < nue_ctx->num_destinations[vl]; i++, dlid_iter++) {
+		dest_port = osm_get_port_by_lid(mgr->p_subn, *dlid_iter);
+		/* switches are routed separately if they aren't sinks */
+		if (!include_switches &&
+		    osm_node_get_type(dest_port->p_node) ==
+		    IB_NODE_TYPE_SWITCH)
+			continue;
+		osm_port_get_lid_range_ho(dest_port, &min_lid_ho, &max_lid_ho);
+		for (lid = min_lid_ho; lid <= max_lid_ho; lid++)
+			if (nue_ctx->reroute.reroute_lid[lid])
+				num_lids++;
+	}
 
-					/* and print the calculated routes */
-					if (OSM_LOG_IS_ACTIVE_V2
-					    (mgr->p_log, OSM_LOG_DEBUG)) {
-						OSM_LOG(mgr->p_log,
-							OSM_LOG_DEBUG,
-							"Calculated paths towards destination LID %"
-							PRIu16 "\n", lid);
-						print_routes(mgr,
-							     &(nue_ctx->
-							       network),
-							     dest_port,
-							     cl_hton16(lid));
-					}
+	return num_lids;
+}
 
-					/* update linear forwarding tables of
-					   all switches towards this desti
-					 */
-					update_linear_forwarding_tables(mgr,
-									&
-									(nue_ctx->
-									 network),
-									dest_port,
-									cl_hton16
-									(lid));
+/* compare the switch-to-switch links of the last routing with the current
+   subnet; links which went down are marked as failed (in both directions),
+   while any other change requires a full routing; returns the number of
+   newly failed links or -1
+ */
+static int detect_failed_links(nue_context_t * nue_ctx)
+{
+	osm_ucast_mgr_t *mgr = nue_ctx->mgr;
+	network_t *network = &(nue_ctx->network);
+	network_node_t *netw_node_iter = NULL;
+	network_link_t *link = NULL, *netw_link_iter = NULL;
+	osm_physp_t *physp_ptr = NULL;
+	osm_node_t *r_node = NULL;
+	osm_switch_t *sw = NULL;
+	channel_t reverse_channel_id;
+	boolean_t has_fdr10 = FALSE, link_is_up = FALSE;
+	uint16_t i = 0;
+	uint8_t port = 0, r_port = 0, j = 0, k = 0;
+	int num_failed_channels = 0;
 
-					/* traverse the calculated paths and
-					   update link weights for the next
-					   step to increase the path balancing
-					 */
-					update_network_link_weights(mgr,
-								    &(nue_ctx->
-								      network),
-								    get_switch_lid
-								    (mgr,
-								     cl_hton16
-								     (lid)));
-
-					/* and finally update the mapping of
-					   'destination to virtual layer'
-					 */
-					update_dlid_to_vl_mapping(nue_ctx->
-								  dlid_to_vl_mapping,
-								  cl_hton16
-								  (lid), vl);
+	has_fdr10 = (1 == mgr->p_subn->opt.fdr10) ? TRUE : FALSE;
+
+	if (cl_qmap_count(&(mgr->p_subn->sw_guid_tbl)) != network->num_nodes)
+		return -1;
+
+	for (i = 0, netw_node_iter = network->nodes; i < network->num_nodes;
+	     i++, netw_node_iter++) {
+		/* the switch objects must still be the same (compare the
+		   pointers first, an old one might be freed already)
+		 */
+		sw = osm_get_switch_by_guid(mgr->p_subn, netw_node_iter->guid);
+		if (!sw || sw != netw_node_iter->sw ||
+		    osm_node_get_base_lid(sw->p_node, 0) != netw_node_iter->lid)
+			return -1;
+
+		/* the links of a node are sorted by port, see
+		   nue_discover_network which also has the same filter
+		 */
+		for (port = 0, j = 0; port < sw->num_ports; port++) {
+			r_node =
+			    osm_node_get_remote_node(sw->p_node, port, &r_port);
+			physp_ptr = osm_node_get_physp_ptr(sw->p_node, port);
+			link_is_up = r_node && r_node->sw && r_node->sw != sw &&
+			    physp_ptr && osm_link_is_healthy(physp_ptr) &&
+			    !(mgr->p_subn->opt.avoid_throttled_links &&
+			      osm_link_is_throttled(physp_ptr, has_fdr10));
+
+			link = NULL;
+			if (j < netw_node_iter->num_links &&
+			    netw_node_iter->links[j].link_info.local_port ==
+			    port)
+				link = &(netw_node_iter->links[j++]);
+
+			if (!link) {
+				if (link_is_up)
+					return -1;
+			} else if (!link_is_up) {
+				if (!link->failed) {
+					link->failed = TRUE;
+					num_failed_channels++;
 				}
+			} else if (link->failed ||
+				   link->link_info.remote_lid !=
+				   osm_node_get_base_lid(r_node, 0) ||
+				   link->link_info.remote_port != r_port) {
+				return -1;
 			}
-			if (!process_sw && include_switches)
-				process_sw = TRUE;
-			else
+		}
+	}
+
+	/* a link which is down in one direction can't be used at all */
+	for (i = 0, netw_node_iter = network->nodes; i < network->num_nodes;
+	     i++, netw_node_iter++) {
+		for (j = 0, link = netw_node_iter->links;
+		     j < netw_node_iter->num_links; j++, link++) {
+			if (!link->failed)
+				continue;
+			reverse_channel_id =
+			    get_inverted_channel_id(link->link_info);
+			for (k = 0, netw_link_iter =
+			     link->to_network_node->links;
+			     k < link->to_network_node->num_links;
+			     k++, netw_link_iter++) {
+				if (!netw_link_iter->failed &&
+				    0 == compare_two_channel_id
+				    (&reverse_channel_id,
+				     &(netw_link_iter->link_info))) {
+					netw_link_iter->failed = TRUE;
+					num_failed_channels++;
+				}
+			}
+		}
+	}
+
+	return num_failed_channels / 2;
+}
+
+/* check if all switches are still reachable without the failed links */
+static boolean_t is_network_connected(const network_t * network)
+{
+	network_node_t **queue = NULL, *netw_node = NULL;
+	network_node_t *netw_node_iter = NULL;
+	network_link_t *netw_link_iter = NULL;
+	uint16_t i = 0, head = 0, tail = 0;
+	uint8_t j = 0;
+
+	if (!network->num_nodes)
+		return TRUE;
+
+	queue = (network_node_t **) malloc(network->num_nodes *
+					   sizeof(network_node_t *));
+	if (!queue)
+		return FALSE;
+
+	for (i = 0, netw_node_iter = network->nodes; i < network->num_nodes;
+	     i++, netw_node_iter++)
+		netw_node_iter->processed = FALSE;
+
+	network->nodes[0].processed = TRUE;
+	queue[tail++] = network->nodes;
+	while (head < tail) {
+		netw_node = queue[head++];
+		for (j = 0, netw_link_iter = netw_node->links;
+		     j < netw_node->num_links; j++, netw_link_iter++) {
+			if (netw_link_iter->failed ||
+			    netw_link_iter->to_network_node->processed)
+				continue;
+			netw_link_iter->to_network_node->processed = TRUE;
+			queue[tail++] = netw_link_iter->to_network_node;
+		}
+	}
+	free(queue);
+
+	return (tail == network->num_nodes);
+}
+
+/* flag the destination LIDs whose saved routes use one of the failed links,
+   after checking that the destinations are still the same, i.e. each LID
+   still ends at the switch port the saved LFTs deliver it to; returns the
+   number of flagged LIDs or -1
+ */
+static int32_t flag_lids_to_reroute(nue_context_t * nue_ctx)
+{
+	osm_ucast_mgr_t *mgr = nue_ctx->mgr;
+	nue_reroute_state_t *state = &(nue_ctx->reroute);
+	network_t *network = &(nue_ctx->network);
+	network_node_t *netw_node = NULL, *netw_node_iter = NULL;
+	network_link_t *link = NULL;
+	cl_qmap_t *port_tbl = NULL;
+	cl_map_item_t *item = NULL;
+	osm_port_t *port = NULL;
+	osm_node_t *r_node = NULL;
+	const uint8_t *lft = NULL;
+	uint16_t lid = 0, min_lid_ho = 0, max_lid_ho = 0;
+	uint16_t num_base_lids = 0, i = 0;
+	uint8_t ntype = 0, exit_port = 0, j = 0;
+	int32_t num_lids = 0;
+
+	if (count_destination_lids(mgr, &num_base_lids) != state->num_lids ||
+	    num_base_lids != state->num_base_lids)
+		return -1;
+
+	port_tbl = (cl_qmap_t *) & (mgr->p_subn->port_guid_tbl);
+	for (item = cl_qmap_head(port_tbl); item != cl_qmap_end(port_tbl);
+	     item = cl_qmap_next(item)) {
+		port = (osm_port_t *) item;
+		ntype = osm_node_get_type(port->p_node);
+		if (ntype == IB_NODE_TYPE_CA) {
+			r_node = osm_node_get_remote_node(port->p_node,
+							  port->p_physp->
+							  port_num, &exit_port);
+			if (!r_node || !r_node->sw)
+				return -1;
+		} else if (ntype == IB_NODE_TYPE_SWITCH) {
+			r_node = port->p_node;
+			exit_port = 0;
+		} else
+			continue;
+
+		netw_node = get_network_node_by_lid(network,
+						    osm_node_get_base_lid
+						    (r_node, 0));
+		if (!netw_node || netw_node->sw != r_node->sw)
+			return -1;
+		lft = state->lfts +
+		    (size_t) (netw_node - network->nodes) *
+		    (state->max_lid_ho + 1);
+
+		osm_port_get_lid_range_ho(port, &min_lid_ho, &max_lid_ho);
+		for (lid = min_lid_ho; lid <= max_lid_ho; lid++) {
+			if (!lid || lid > state->max_lid_ho ||
+			    lft[lid] != exit_port)
+				return -1;
+		}
+	}
+
+	/* now every saved route leads to an existing destination LID */
+	memset(state->reroute_lid, 0, state->max_lid_ho + 1);
+	for (i = 0, netw_node_iter = network->nodes, lft = state->lfts;
+	     i < network->num_nodes;
+	     i++, netw_node_iter++, lft += state->max_lid_ho + 1) {
+		for (j = 0, link = netw_node_iter->links;
+		     j < netw_node_iter->num_links; j++, link++) {
+			if (!link->failed)
+				continue;
+			for (lid = 1; lid <= state->max_lid_ho; lid++) {
+				if (lft[lid] != link->link_info.local_port ||
+				    state->reroute_lid[lid])
+					continue;
+				state->reroute_lid[lid] = TRUE;
+				num_lids++;
+			}
+		}
+	}
+
+	return num_lids;
+}
+
+/* check whether the subnet only changed by failed switch-to-switch links
+   since the last routing, and if so flag the destination LIDs routed thru
+   these links; returns 0 if they can be rerouted incrementally, i.e. without
+   rebuilding the cCDG and the escape paths
+ */
+static int prepare_incremental_reroute(nue_context_t * nue_ctx)
+{
+	osm_ucast_mgr_t *mgr = nue_ctx->mgr;
+	nue_reroute_state_t *state = &(nue_ctx->reroute);
+	network_t *network = &(nue_ctx->network);
+	const char *reason = NULL;
+	uint32_t num_lids = 0;
+	int32_t num_reroute_lids = 0;
+	uint16_t i = 0;
+	uint8_t max_vl = 0, vl = 0;
+	int num_failed_links = 0;
+
+	OSM_LOG_ENTER(mgr->p_log);
+
+	if (!state->valid) {
+		OSM_LOG_EXIT(mgr->p_log);
+		return -1;
+	}
+	state->valid = FALSE;
+
+	max_vl = get_max_num_vls(mgr);
+	if (max_vl != 1 && !(mgr->p_subn->opt.qos))
+		max_vl = 1;
+	if (max_vl != nue_ctx->max_vl ||
+	    mgr->p_subn->max_ucast_lid_ho != state->max_lid_ho ||
+	    mgr->p_subn->opt.nue_include_switches != state->include_switches) {
+		reason = "configuration changed";
+		goto full_reroute;
+	}
+
+	num_failed_links = detect_failed_links(nue_ctx);
+	if (num_failed_links < 0) {
+		reason = "switches or links changed";
+		goto full_reroute;
+	}
+	if (!is_network_connected(network)) {
+		reason = "network is disconnected";
+		goto full_reroute;
+	}
+
+	num_reroute_lids = flag_lids_to_reroute(nue_ctx);
+	if (num_reroute_lids < 0) {
+		reason = "destinations changed";
+		goto full_reroute;
+	}
+
+	/* Nue falls back to the escape paths if the rerouting runs into an
+	   impasse; route_virtual_layer gives up on the incremental reroute if
+	   this happens in a layer whose escape paths use a failed link
+	 */
+	for (vl = 0; vl < nue_ctx->max_vl; vl++) {
+		state->broken_escape_paths[vl] = FALSE;
+		num_lids = count_lids_to_reroute(nue_ctx, vl,
+						 state->include_switches);
+		if (!num_lids)
+			continue;
+		if (state->next_color[vl] + num_lids > UINT16_MAX) {
+			reason = "out of cCDG colors";
+			goto full_reroute;
+		}
+		for (i = 0; i < network->num_nodes; i++) {
+			if (state->escape_paths[vl][i] &&
+			    state->escape_paths[vl][i]->failed) {
+				state->broken_escape_paths[vl] = TRUE;
+				break;
+			}
+		}
+	}
+
+	OSM_LOG(mgr->p_log, OSM_LOG_INFO,
+		"Rerouting %" PRId32 " of %" PRIu32 " destination LIDs around %d"
+		" failed links incrementally\n", num_reroute_lids,
+		state->num_lids, num_failed_links);
+	state->incremental = TRUE;
+	OSM_LOG_EXIT(mgr->p_log);
+	return 0;
+
+full_reroute:
+	OSM_LOG(mgr->p_log, OSM_LOG_INFO,
+		"Incremental reroute not possible (%s); rerouting all"
+		" destinations\n", reason);
+	OSM_LOG_EXIT(mgr->p_log);
+	return -1;
+}
+
+/* set the hop counts of all switches towards a switch LID by following the
+   LFTs, since the network nodes only know the paths of the current routing
+ */
+static void restore_hops_towards_destination(const network_t * network,
+					     const network_node_t *
+					     dest_netw_node,
+					     const ib_net16_t dlid,
+					     uint8_t * hops, uint16_t * path)
+{
+	network_node_t *netw_node = NULL;
+	osm_node_t *r_node = NULL;
+	osm_switch_t *sw = NULL;
+	uint16_t dlid_ho = cl_ntoh16(dlid);
+	uint16_t i = 0, k = 0, len = 0;
+	uint8_t exit_port = 0, r_port = 0;
+
+	memset(hops, OSM_NO_PATH, network->num_nodes);
+	hops[dest_netw_node - network->nodes] = 0;
+
+	for (i = 0; i < network->num_nodes; i++) {
+		/* walk along the route until a switch with known hops */
+		for (k = i, len = 0;
+		     hops[k] == OSM_NO_PATH && len < network->num_nodes;
+		     len++) {
+			path[len] = k;
+			sw = network->nodes[k].sw;
+			exit_port = sw->new_lft[dlid_ho];
+			if (exit_port >= sw->num_ports)
+				break;
+			r_node = osm_node_get_remote_node(sw->p_node, exit_port,
+							  &r_port);
+			if (!r_node || !r_node->sw)
 				break;
-		} while (TRUE);
+			netw_node =
+			    get_network_node_by_lid(network,
+						    osm_node_get_base_lid
+						    (r_node, 0));
+			if (!netw_node)
+				break;
+			k = netw_node - network->nodes;
+		}
+		CL_ASSERT(hops[k] != OSM_NO_PATH);
+		if (hops[k] == OSM_NO_PATH)
+			continue;
+
+		/* and set the hops on the way back */
+		while (len) {
+			len--;
+			hops[path[len]] = hops[k] + 1;
+			k = path[len];
+			sw = network->nodes[k].sw;
+			osm_switch_set_hops(sw, dlid_ho, sw->new_lft[dlid_ho],
+					    hops[k]);
+		}
+	}
+}
+
+/* the routes towards the destination LIDs, which aren't affected by the failed
+   links, are taken over from the last routing, but their path counts and the
+   hop counts towards switch LIDs have to be set again
+ */
+static int restore_path_counts_and_hops(nue_context_t * nue_ctx)
+{
+	osm_ucast_mgr_t *mgr = nue_ctx->mgr;
+	network_t *network = &(nue_ctx->network);
+	network_node_t *dest_netw_node = NULL;
+	cl_qmap_t *port_tbl = NULL;
+	cl_map_item_t *item = NULL;
+	osm_port_t *port = NULL;
+	uint8_t *hops = NULL;
+	uint16_t *path = NULL;
+	uint16_t lid = 0, min_lid_ho = 0, max_lid_ho = 0;
+	uint8_t ntype = 0;
+
+	OSM_LOG_ENTER(mgr->p_log);
+
+	hops = (uint8_t *) malloc(network->num_nodes * sizeof(uint8_t));
+	path = (uint16_t *) malloc(network->num_nodes * sizeof(uint16_t));
+	if (!hops || !path) {
+		OSM_LOG(mgr->p_log, OSM_LOG_ERROR,
+			"ERR NUE51: cannot allocate memory for hop counts\n");
+		if (hops)
+			free(hops);
+		if (path)
+			free(path);
+		OSM_LOG_EXIT(mgr->p_log);
+		return -1;
+	}
+
+	port_tbl = (cl_qmap_t *) & (mgr->p_subn->port_guid_tbl);
+	for (item = cl_qmap_head(port_tbl); item != cl_qmap_end(port_tbl);
+	     item = cl_qmap_next(item)) {
+		port = (osm_port_t *) item;
+		ntype = osm_node_get_type(port->p_node);
+		if (ntype != IB_NODE_TYPE_CA && ntype != IB_NODE_TYPE_SWITCH)
+			continue;
+		if (ntype == IB_NODE_TYPE_SWITCH) {
+			dest_netw_node =
+			    get_network_node_by_lid(network,
+						    osm_port_get_base_lid
+						    (port));
+			CL_ASSERT(dest_netw_node);
+		}
+		osm_port_get_lid_range_ho(port, &min_lid_ho, &max_lid_ho);
+		for (lid = min_lid_ho; lid <= max_lid_ho; lid++) {
+			if (nue_ctx->reroute.reroute_lid[lid])
+				continue;
+			count_paths_towards_destination(mgr, network, port,
+							cl_hton16(lid));
+			/* the hop tables only store switch LIDs */
+			if (ntype == IB_NODE_TYPE_SWITCH)
+				restore_hops_towards_destination(network,
+								 dest_netw_node,
+								 cl_hton16
+								 (lid), hops,
+								 path);
+		}
+	}
+
+	free(hops);
+	free(path);
+	OSM_LOG_EXIT(mgr->p_log);
+	return 0;
+}
+
+static void reset_routing_of_switches(const network_t * network)
+{
+	network_node_t *netw_node_iter = NULL;
+	osm_switch_t *sw = NULL;
+	uint16_t i = 0;
+	uint8_t port = 0;
+
+	for (i = 0, netw_node_iter = network->nodes; i < network->num_nodes;
+	     i++, netw_node_iter++) {
+		sw = (osm_switch_t *) netw_node_iter->sw;
+		for (port = 0; port < sw->num_ports; port++)
+			osm_port_prof_construct(&(sw->p_prof[port]));
+		osm_switch_clear_hops(sw);
+	}
+}
+
+static int nue_do_ucast_routing(void *context)
+{
+	nue_context_t *nue_ctx = (nue_context_t *) context;
+	osm_ucast_mgr_t *mgr = NULL;
+	osm_port_t *dest_port = NULL;
+	boolean_t include_switches = FALSE, incremental = FALSE;
+	uint16_t lid = 0, min_lid_ho = 0, max_lid_ho = 0;
+	uint16_t i = 0;
+	uint8_t vl = 0;
+	int err = 0;
+	network_node_t *netw_node_iter = NULL;
+
+	if (nue_ctx)
+		mgr = (osm_ucast_mgr_t *) nue_ctx->mgr;
+	else
+		return -1;
+
+	OSM_LOG_ENTER(mgr->p_log);
+	OSM_LOG(mgr->p_log, OSM_LOG_INFO, "Start routing process with nue\n");
+
+	init_linear_forwarding_tables(mgr, &(nue_ctx->network));
 
-		/* do a final check if ccdg is acyclic after processing all */
-		CL_ASSERT(is_ccdg_cycle_free(mgr, &verify_ccdg));
+	if (mgr->p_subn->opt.nue_include_switches) {
+		OSM_LOG(mgr->p_log, OSM_LOG_INFO,
+			" ...and consider switches as traffic sinks\n");
+		include_switches = mgr->p_subn->opt.nue_include_switches;
+	}
+
+	/* nue_discover_network decided whether only the destinations which
+	   were routed thru failed links have to be rerouted; they keep their
+	   virtual layers and all other routes are taken over as they are
+	 */
+	incremental = nue_ctx->reroute.incremental;
+	nue_ctx->reroute.incremental = FALSE;
+	if (incremental)
+		restore_linear_forwarding_tables(nue_ctx);
+	else {
+		/* assign destination lids to different virtual layers */
+		err = distribute_lids_onto_virtual_layers(nue_ctx,
+							  include_switches);
+		if (err) {
+			destroy_context(nue_ctx);
+			return -1;
+		}
+		if (OSM_LOG_IS_ACTIVE_V2(mgr->p_log, OSM_LOG_DEBUG))
+			print_destination_distribution(mgr,
+						       nue_ctx->destinations,
+						       nue_ctx->
+						       num_destinations);
+		if (mgr->p_subn->opt.nue_incremental_reroute)
+			init_reroute_state(nue_ctx);
+	}
+
+	/* route the destinations of each virtual layer; the layers are
+	   optionally routed concurrently on copies of the network and cCDG
+	   (an incremental reroute is done in place, it has few LIDs to route)
+	 */
+	if (mgr->p_subn->opt.nue_parallel_layers && !incremental)
+		err = route_virtual_layers_in_parallel(nue_ctx,
+						       include_switches);
+	else {
+		for (vl = 0; vl < nue_ctx->max_vl && !err; vl++)
+			err = route_virtual_layer(nue_ctx,
+						  &(nue_ctx->network),
+						  &(nue_ctx->ccdg), vl,
+						  include_switches, TRUE,
+						  incremental);
+	}
+	if (err > 0) {
+		/* the impasse can only be solved with the escape paths of a
+		   full routing, so start over with a clean context
+		 */
+		OSM_LOG(mgr->p_log, OSM_LOG_INFO,
+			"Incremental reroute not possible (escape paths use a"
+			" failed link); rerouting all destinations\n");
+		reset_routing_of_switches(&(nue_ctx->network));
+		if (nue_discover_network(nue_ctx)) {
+			OSM_LOG_EXIT(mgr->p_log);
+			return -1;
+		}
+		OSM_LOG_EXIT(mgr->p_log);
+		return nue_do_ucast_routing(nue_ctx);
+	}
+	if (err) {
+		destroy_context(nue_ctx);
+		return -1;
 	}
 
 	/* if switches haven't been included in the original destinations set
@@ -6272,6 +8713,9 @@ static int nue_do_ucast_routing(void *context)
 			osm_port_get_lid_range_ho(dest_port, &min_lid_ho,
 						  &max_lid_ho);
 			for (lid = min_lid_ho; lid <= max_lid_ho; lid++) {
+				if (incremental &&
+				    !nue_ctx->reroute.reroute_lid[lid])
+					continue;
 				/* use our simple multi-graph Dijkstra's algo */
 				err =
 				    calculate_spanning_tree_in_network(mgr,
@@ -6302,7 +8746,8 @@ static int nue_do_ucast_routing(void *context)
 								&(nue_ctx->
 								  network),
 								dest_port,
-								cl_hton16(lid));
+								cl_hton16(lid),
+								TRUE);
 				update_network_link_weights(mgr,
 							    &(nue_ctx->network),
 							    cl_hton16(lid));
@@ -6315,6 +8760,14 @@ static int nue_do_ucast_routing(void *context)
 		}
 	}
 
+	if (incremental && restore_path_counts_and_hops(nue_ctx)) {
+		destroy_context(nue_ctx);
+		return -1;
+	}
+
+	if (mgr->p_subn->opt.nue_incremental_reroute)
+		save_linear_forwarding_tables(nue_ctx, include_switches);
+
 	OSM_LOG_EXIT(mgr->p_log);
 	return 0;
 }
@@ -6668,19 +9121,52 @@ static uint8_t nue_get_vl_for_path(void *context,
 	/* Assuming Nue was only allowed to use one virtual layer, then the
 	   actual path-to-vl mapping is irrelevant, since all paths can be
 	   assigned to any VL without creating credit loops. Hence, we can just
-	   return the suggested/hinted SL to support various QoS levels.
+	   return the suggested/hinted SL to support various QoS levels (no
+	   mapping is published in this case).
 	 */
-	if (1 == nue_ctx->max_vl)
+	if (!nue_ctx->path_sl_mapping)
 		return hint_for_default_sl;
 
 	dest_port = osm_get_port_by_lid(mgr->p_subn, dlid);
-	if (!dest_port)
+	if (!dest_port || cl_ntoh16(dlid) >= nue_ctx->path_sl_mapping_size)
 		return hint_for_default_sl;
 
-	if (!nue_ctx->dlid_to_vl_mapping)
-		return hint_for_default_sl;
+	return nue_ctx->path_sl_mapping[cl_ntoh16(dlid)];
+}
 
-	return nue_ctx->dlid_to_vl_mapping[cl_ntoh16(dlid)];
+static int nue_publish_routing(void *context)
+{
+	nue_context_t *nue_ctx = (nue_context_t *) context;
+	uint16_t size = 0;
+
+	if (!nue_ctx)
+		return -1;
+
+	if (1 == nue_ctx->max_vl || !nue_ctx->dlid_to_vl_mapping) {
+		free(nue_ctx->path_sl_mapping);
+		nue_ctx->path_sl_mapping = NULL;
+		nue_ctx->path_sl_mapping_size = 0;
+		return 0;
+	}
+
+	/* the mapping has the size create_context gave it */
+	size = nue_ctx->mgr->p_subn->max_ucast_lid_ho;
+	if (size != nue_ctx->path_sl_mapping_size) {
+		free(nue_ctx->path_sl_mapping);
+		nue_ctx->path_sl_mapping_size = 0;
+		nue_ctx->path_sl_mapping =
+		    (uint8_t *) malloc(size * sizeof(uint8_t));
+		if (!nue_ctx->path_sl_mapping) {
+			OSM_LOG(nue_ctx->mgr->p_log, OSM_LOG_ERROR,
+				"ERR NUE57: cannot allocate path_sl mapping\n");
+			return -1;
+		}
+		nue_ctx->path_sl_mapping_size = size;
+	}
+	memcpy(nue_ctx->path_sl_mapping, nue_ctx->dlid_to_vl_mapping,
+	       size * sizeof(uint8_t));
+
+	return 0;
 }
 
 static void destroy_context(nue_context_t * nue_ctx)
@@ -6701,6 +9187,8 @@ static void destroy_context(nue_context_t * nue_ctx)
 		free(nue_ctx->dlid_to_vl_mapping);
 		nue_ctx->dlid_to_vl_mapping = NULL;
 	}
+
+	destroy_reroute_state(&(nue_ctx->reroute));
 }
 
 static void nue_destroy_context(void *context)
@@ -6709,6 +9197,7 @@ static void nue_destroy_context(void *context)
 	if (!nue_ctx)
 		return;
 	destroy_context(nue_ctx);
+	free(nue_ctx->path_sl_mapping);
 	free(context);
 }
 
@@ -6728,6 +9217,7 @@ int osm_ucast_nue_setup(struct osm_routing_engine *r, osm_opensm_t * osm)
 	r->update_sl2vl = NULL;
 	r->update_vlarb = NULL;
 	r->path_sl = nue_get_vl_for_path;
+	r->ucast_publish = nue_publish_routing;
 	r->mcast_build_stree = nue_do_mcast_routing;
 	r->destroy = nue_destroy_context;
 
@@ -285,15 +285,17 @@ static int updn_subn_rank(IN updn_t * p_updn)
 static void updn_clear_non_root_hops(updn_t * updn, osm_switch_t * sw)
 {
 	osm_port_t *port;
-	unsigned i;
+	unsigned i, j;
 
-	for (i = 0; i < sw->num_hops; i++)
-		if (sw->hops[i]) {
+	for (i = 1; i <= sw->max_lid_ho; i++)
+		if (sw->hop_rows[i] != OSM_NO_HOP_ROW) {
 			port = osm_get_port_by_lid_ho(&updn->p_osm->subn, i);
 			if (!port || !port->p_node->sw
 			    || ((struct updn_node *)port->p_node->sw->priv)->
 			    rank != 0)
-				memset(sw->hops[i], 0xff, sw->num_ports);
+				for (j = 0; j < sw->num_ports; j++)
+					osm_switch_get_port_hops(sw, j)
+					    [sw->hop_rows[i]] = OSM_NO_PATH;
 		}
 }
 
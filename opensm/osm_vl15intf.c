@@ -45,9 +45,12 @@
 #  include <config.h>
 #endif				/* HAVE_CONFIG_H */
 
+#include <stdlib.h>
 #include <string.h>
 #include <iba/ib_types.h>
+#include <complib/cl_math.h>
 #include <complib/cl_thread.h>
+#include <complib/cl_timer.h>
 #include <opensm/osm_file_ids.h>
 #define FILE_ID OSM_FILE_VL15INTF_C
 #include <vendor/osm_vendor_api.h>
@@ -56,6 +59,233 @@
 #include <opensm/osm_log.h>
 #include <opensm/osm_helper.h>
 
+#define OSM_VL15_DEST_TBL_SIZE 1024
+#define OSM_VL15_RTT_TBL_SIZE 4096
+#define OSM_VL15_RTT_MIN_SAMPLES 4
+#define OSM_VL15_RTT_MAX_BACKOFF 6
+
+static uint64_t vl15_dest_hash(IN const osm_madw_t * p_madw)
+{
+	const ib_smp_t *p_smp;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	uint8_t hops, i;
+
+	p_smp = osm_madw_get_smp_ptr(p_madw);
+	if (p_smp->mgmt_class == IB_MCLASS_SUBN_DIR) {
+		hops = MIN(p_smp->hop_count, IB_SUBNET_PATH_HOPS_MAX - 1);
+		for (i = 1; i <= hops; i++)
+			hash = (hash ^ p_smp->initial_path[i]) *
+			    0x100000001b3ULL;
+		hash = (hash ^ hops) * 0x100000001b3ULL;
+		if (p_smp->dr_slid == IB_LID_PERMISSIVE)
+			return hash;
+	}
+	return (hash ^ cl_ntoh16(p_madw->mad_addr.dest_lid)) *
+	    0x100000001b3ULL;
+}
+
+/*
+ * Destinations are hashed into a fixed table: two destinations that
+ * share a bucket simply share a window.
+ */
+static osm_vl15_dest_t *vl15_get_dest(IN osm_vl15_t * p_vl,
+				      IN const osm_madw_t * p_madw)
+{
+	if (p_vl->dest_tbl_size == 1)
+		return p_vl->dest_tbl;
+
+	return &p_vl->dest_tbl[vl15_dest_hash(p_madw) % p_vl->dest_tbl_size];
+}
+
+static osm_vl15_rtt_t *vl15_get_hop_rtt(IN osm_vl15_t * p_vl,
+					IN const osm_madw_t * p_madw)
+{
+	const ib_smp_t *p_smp = osm_madw_get_smp_ptr(p_madw);
+
+	if (p_smp->mgmt_class != IB_MCLASS_SUBN_DIR ||
+	    p_smp->dr_slid != IB_LID_PERMISSIVE)
+		return &p_vl->hop_rtt[IB_SUBNET_PATH_HOPS_MAX];
+
+	return &p_vl->hop_rtt[MIN(p_smp->hop_count,
+				  IB_SUBNET_PATH_HOPS_MAX - 1)];
+}
+
+/*
+ * Must be called with the lock held.  Returns the timeout in msec
+ * suggested by the estimator, 0 if it does not know enough yet.
+ * A per hop count estimator stands in for destinations not heard
+ * from yet, which may well be the slow ones: it never suggests
+ * less than the longest round trip time seen at that hop count.
+ */
+static uint32_t vl15_rtt_timeout(IN osm_vl15_t * p_vl,
+				 IN const osm_vl15_rtt_t * p_rtt,
+				 IN boolean_t is_hop)
+{
+	uint64_t timeout;
+
+	if (p_rtt->samples < OSM_VL15_RTT_MIN_SAMPLES)
+		return 0;
+
+	timeout = (uint64_t) p_rtt->srtt + 4 * (uint64_t) p_rtt->rttvar;
+	if (is_hop)
+		timeout = MAX(timeout, p_rtt->max_rtt);
+	timeout = ((timeout + 999) / 1000) << p_rtt->backoff;
+
+	return (uint32_t) MIN(MAX(timeout, p_vl->min_timeout),
+			      p_vl->max_timeout);
+}
+
+/*
+ * Must be called with the lock held.
+ */
+static void vl15_rtt_sample(IN osm_vl15_rtt_t * p_rtt, IN uint32_t rtt)
+{
+	int64_t err;
+
+	if (!p_rtt->samples) {
+		p_rtt->srtt = rtt;
+		p_rtt->rttvar = rtt / 2;
+		p_rtt->min_rtt = p_rtt->max_rtt = rtt;
+	} else {
+		err = (int64_t) rtt - p_rtt->srtt;
+		p_rtt->rttvar = (uint32_t) ((3 * (int64_t) p_rtt->rttvar +
+					     (err < 0 ? -err : err)) / 4);
+		p_rtt->srtt = (uint32_t) ((7 * (int64_t) p_rtt->srtt + rtt) / 8);
+		if (rtt < p_rtt->min_rtt)
+			p_rtt->min_rtt = rtt;
+		if (rtt > p_rtt->max_rtt)
+			p_rtt->max_rtt = rtt;
+	}
+	if (p_rtt->samples != UINT32_MAX)
+		p_rtt->samples++;
+	p_rtt->backoff = 0;
+}
+
+/*
+ * Must be called with the lock held.
+ */
+static void vl15_rtt_timed_out(IN osm_vl15_rtt_t * p_rtt)
+{
+	p_rtt->timeouts++;
+	if (p_rtt->backoff < OSM_VL15_RTT_MAX_BACKOFF)
+		p_rtt->backoff++;
+}
+
+/*
+ * Must be called with the lock held.  Stamps the MAD with its send
+ * time and, unless its originator asked for a specific timeout,
+ * gives it the timeout the estimators suggest.
+ */
+static void vl15_arm_timeout(IN osm_vl15_t * p_vl, IN osm_madw_t * p_madw)
+{
+	osm_vl15_rtt_t *p_rtt;
+	uint64_t hash;
+	uint32_t timeout = 0;
+
+	p_madw->send_time = cl_get_time_stamp();
+
+	if (!p_vl->adaptive_timeout || p_madw->timeout)
+		return;
+
+	hash = vl15_dest_hash(p_madw);
+	p_rtt = &p_vl->rtt_tbl[hash % OSM_VL15_RTT_TBL_SIZE];
+	if (p_rtt->tag == hash)
+		timeout = vl15_rtt_timeout(p_vl, p_rtt, FALSE);
+	if (!timeout)
+		timeout = vl15_rtt_timeout(p_vl, vl15_get_hop_rtt(p_vl, p_madw),
+					   TRUE);
+	p_madw->timeout = timeout;
+	p_madw->rtt_timeout = timeout != 0;
+}
+
+/*
+ * Must be called with the lock held.
+ */
+static void vl15_rtt_update(IN osm_vl15_t * p_vl, IN const osm_madw_t * p_madw)
+{
+	osm_vl15_rtt_t *p_rtt, *p_hop_rtt;
+	uint64_t hash, rtt;
+	uint32_t timeout, bucket;
+
+	if (!p_madw->send_time ||
+	    (p_madw->status != IB_SUCCESS && p_madw->status != IB_TIMEOUT))
+		return;
+
+	hash = vl15_dest_hash(p_madw);
+	p_rtt = &p_vl->rtt_tbl[hash % OSM_VL15_RTT_TBL_SIZE];
+	if (p_rtt->tag != hash) {
+		memset(p_rtt, 0, sizeof(*p_rtt));
+		p_rtt->tag = hash;
+	}
+	p_hop_rtt = vl15_get_hop_rtt(p_vl, p_madw);
+
+	rtt = cl_get_time_stamp() - p_madw->send_time;
+	timeout = p_madw->timeout ? p_madw->timeout : p_vl->max_timeout;
+
+	/*
+	   A response that took longer than the timeout answers one of
+	   the retries, and which one is unknown (Karn's algorithm).
+	 */
+	if (p_madw->status == IB_TIMEOUT || rtt > 1000ULL * timeout) {
+		vl15_rtt_timed_out(p_rtt);
+		vl15_rtt_timed_out(p_hop_rtt);
+		return;
+	}
+
+	vl15_rtt_sample(p_rtt, (uint32_t) rtt);
+	vl15_rtt_sample(p_hop_rtt, (uint32_t) rtt);
+
+	for (bucket = 0; bucket < OSM_VL15_RTT_HIST_SIZE - 1 && rtt > 1;
+	     bucket++)
+		rtt >>= 1;
+	p_vl->rtt_hist[bucket]++;
+}
+
+/*
+ * Must be called with the lock held.
+ */
+static void vl15_dest_update(IN osm_vl15_t * p_vl, IN osm_vl15_dest_t * p_dest)
+{
+	if (p_dest->ready || cl_is_qlist_empty(&p_dest->fifo))
+		return;
+
+	if (p_vl->max_wire_smps_per_dest &&
+	    p_dest->on_wire >= p_vl->max_wire_smps_per_dest)
+		return;
+
+	cl_qlist_insert_tail(&p_vl->ready_list, &p_dest->list_item);
+	p_dest->ready = TRUE;
+}
+
+/*
+ * Must be called with the lock held.
+ */
+static osm_madw_t *vl15_get_next_madw(IN osm_vl15_t * p_vl)
+{
+	osm_vl15_dest_t *p_dest;
+	osm_madw_t *p_madw;
+
+	/*
+	   The unicast FIFO has priority, since somebody is waiting
+	   for a timely response.
+	 */
+	if (!cl_is_qlist_empty(&p_vl->ufifo))
+		return (osm_madw_t *) cl_qlist_remove_head(&p_vl->ufifo);
+
+	if (cl_is_qlist_empty(&p_vl->ready_list))
+		return NULL;
+
+	p_dest = (osm_vl15_dest_t *) cl_qlist_remove_head(&p_vl->ready_list);
+	p_dest->ready = FALSE;
+	p_madw = (osm_madw_t *) cl_qlist_remove_head(&p_dest->fifo);
+	p_dest->on_wire++;
+	vl15_arm_timeout(p_vl, p_madw);
+	/* requeue at the tail so that destinations take turns */
+	vl15_dest_update(p_vl, p_dest);
+
+	return p_madw;
+}
+
 static void vl15_send_mad(osm_vl15_t * p_vl, osm_madw_t * p_madw)
 {
 	ib_api_status_t status;
@@ -133,7 +363,6 @@ static void vl15_poller(IN void *p_ptr)
 	ib_api_status_t status;
 	osm_madw_t *p_madw;
 	osm_vl15_t *p_vl = p_ptr;
-	cl_qlist_t *p_fifo;
 	int32_t max_smps = p_vl->max_wire_smps;
 	int32_t max_smps2 = p_vl->max_wire_smps2;
 
@@ -147,22 +376,12 @@ static void vl15_poller(IN void *p_ptr)
 		   Start servicing the FIFOs by pulling off MAD wrappers
 		   and passing them to the transport interface.
 		   There are lots of corner cases here so tread carefully.
-
-		   The unicast FIFO has priority, since somebody is waiting
-		   for a timely response.
 		 */
 		cl_spinlock_acquire(&p_vl->lock);
-
-		if (cl_qlist_count(&p_vl->ufifo) != 0)
-			p_fifo = &p_vl->ufifo;
-		else
-			p_fifo = &p_vl->rfifo;
-
-		p_madw = (osm_madw_t *) cl_qlist_remove_head(p_fifo);
-
+		p_madw = vl15_get_next_madw(p_vl);
 		cl_spinlock_release(&p_vl->lock);
 
-		if (p_madw != (osm_madw_t *) cl_qlist_end(p_fifo)) {
+		if (p_madw) {
 			OSM_LOG(p_vl->p_log, OSM_LOG_DEBUG,
 				"Servicing p_madw = %p\n", p_madw);
 			if (OSM_LOG_IS_ACTIVE_V2(p_vl->p_log, OSM_LOG_FRAMES))
@@ -173,7 +392,9 @@ static void vl15_poller(IN void *p_ptr)
 			vl15_send_mad(p_vl, p_madw);
 		} else
 			/*
-			   The VL15 FIFO is empty, so we have nothing left to do.
+			   The VL15 FIFO is empty or all destinations with
+			   queued MADs are at their limit, so we have nothing
+			   left to do until a MAD completes.
 			 */
 			status = cl_event_wait_on(&p_vl->signal,
 						  EVENT_NO_TIMEOUT, TRUE);
@@ -213,7 +434,7 @@ void osm_vl15_construct(IN osm_vl15_t * p_vl)
 	p_vl->thread_state = OSM_THREAD_STATE_NONE;
 	cl_event_construct(&p_vl->signal);
 	cl_spinlock_construct(&p_vl->lock);
-	cl_qlist_init(&p_vl->rfifo);
+	cl_qlist_init(&p_vl->ready_list);
 	cl_qlist_init(&p_vl->ufifo);
 	cl_thread_construct(&p_vl->poller);
 }
@@ -221,6 +442,7 @@ void osm_vl15_construct(IN osm_vl15_t * p_vl)
 void osm_vl15_destroy(IN osm_vl15_t * p_vl, IN struct osm_mad_pool *p_pool)
 {
 	osm_madw_t *p_madw;
+	uint32_t i;
 
 	OSM_LOG_ENTER(p_vl->p_log);
 
@@ -244,10 +466,13 @@ void osm_vl15_destroy(IN osm_vl15_t * p_vl, IN struct osm_mad_pool *p_pool)
 
 	cl_spinlock_acquire(&p_vl->lock);
 
-	while (!cl_is_qlist_empty(&p_vl->rfifo)) {
-		p_madw = (osm_madw_t *) cl_qlist_remove_head(&p_vl->rfifo);
-		osm_mad_pool_put(p_pool, p_madw);
-	}
+	for (i = 0; i < p_vl->dest_tbl_size; i++)
+		while (!cl_is_qlist_empty(&p_vl->dest_tbl[i].fifo)) {
+			p_madw = (osm_madw_t *)
+			    cl_qlist_remove_head(&p_vl->dest_tbl[i].fifo);
+			osm_mad_pool_put(p_pool, p_madw);
+		}
+	cl_qlist_init(&p_vl->ready_list);
 	while (!cl_is_qlist_empty(&p_vl->ufifo)) {
 		p_madw = (osm_madw_t *) cl_qlist_remove_head(&p_vl->ufifo);
 		osm_mad_pool_put(p_pool, p_madw);
@@ -255,6 +480,12 @@ void osm_vl15_destroy(IN osm_vl15_t * p_vl, IN struct osm_mad_pool *p_pool)
 
 	cl_spinlock_release(&p_vl->lock);
 
+	free(p_vl->dest_tbl);
+	p_vl->dest_tbl = NULL;
+	p_vl->dest_tbl_size = 0;
+	free(p_vl->rtt_tbl);
+	p_vl->rtt_tbl = NULL;
+
 	cl_event_destroy(&p_vl->signal);
 	p_vl->state = OSM_VL15_STATE_INIT;
 	cl_spinlock_destroy(&p_vl->lock);
@@ -267,9 +498,11 @@ ib_api_status_t osm_vl15_init(IN osm_vl15_t * p_vl, IN osm_vendor_t * p_vend,
 			      IN osm_subn_t * p_subn,
 			      IN int32_t max_wire_smps,
 			      IN int32_t max_wire_smps2,
-			      IN uint32_t max_smps_timeout)
+			      IN uint32_t max_smps_timeout,
+			      IN uint32_t max_wire_smps_per_dest)
 {
 	ib_api_status_t status = IB_SUCCESS;
+	uint32_t i;
 
 	OSM_LOG_ENTER(p_log);
 
@@ -281,6 +514,30 @@ ib_api_status_t osm_vl15_init(IN osm_vl15_t * p_vl, IN osm_vendor_t * p_vend,
 	p_vl->max_wire_smps2 = max_wire_smps2;
 	p_vl->max_smps_timeout = max_wire_smps < max_wire_smps2 ?
 				 max_smps_timeout : EVENT_NO_TIMEOUT;
+	p_vl->max_wire_smps_per_dest = max_wire_smps_per_dest;
+	p_vl->adaptive_timeout = p_subn->opt.adaptive_transaction_timeout;
+	p_vl->min_timeout = p_subn->opt.min_transaction_timeout;
+	p_vl->max_timeout = p_subn->opt.transaction_timeout;
+
+	p_vl->rtt_tbl = calloc(OSM_VL15_RTT_TBL_SIZE, sizeof(*p_vl->rtt_tbl));
+	if (!p_vl->rtt_tbl) {
+		status = IB_INSUFFICIENT_MEMORY;
+		goto Exit;
+	}
+
+	p_vl->dest_tbl_size = max_wire_smps_per_dest ?
+	    OSM_VL15_DEST_TBL_SIZE : 1;
+	p_vl->dest_tbl = malloc(p_vl->dest_tbl_size * sizeof(*p_vl->dest_tbl));
+	if (!p_vl->dest_tbl) {
+		p_vl->dest_tbl_size = 0;
+		status = IB_INSUFFICIENT_MEMORY;
+		goto Exit;
+	}
+	for (i = 0; i < p_vl->dest_tbl_size; i++) {
+		cl_qlist_init(&p_vl->dest_tbl[i].fifo);
+		p_vl->dest_tbl[i].on_wire = 0;
+		p_vl->dest_tbl[i].ready = FALSE;
+	}
 
 	status = cl_event_init(&p_vl->signal, FALSE);
 	if (status != IB_SUCCESS)
@@ -330,6 +587,8 @@ void osm_vl15_poll(IN osm_vl15_t * p_vl)
 
 void osm_vl15_post(IN osm_vl15_t * p_vl, IN osm_madw_t * p_madw)
 {
+	osm_vl15_dest_t *p_dest;
+
 	OSM_LOG_ENTER(p_vl->p_log);
 
 	CL_ASSERT(p_vl->state == OSM_VL15_STATE_READY);
@@ -341,7 +600,9 @@ void osm_vl15_post(IN osm_vl15_t * p_vl, IN osm_madw_t * p_madw)
 	 */
 	cl_spinlock_acquire(&p_vl->lock);
 	if (p_madw->resp_expected == TRUE) {
-		cl_qlist_insert_tail(&p_vl->rfifo, &p_madw->list_item);
+		p_dest = vl15_get_dest(p_vl, p_madw);
+		cl_qlist_insert_tail(&p_dest->fifo, &p_madw->list_item);
+		vl15_dest_update(p_vl, p_dest);
 		osm_stats_inc_qp0_outstanding(p_vl->p_stats);
 	} else
 		cl_qlist_insert_tail(&p_vl->ufifo, &p_madw->list_item);
@@ -357,9 +618,89 @@ void osm_vl15_post(IN osm_vl15_t * p_vl, IN osm_madw_t * p_madw)
 	OSM_LOG_EXIT(p_vl->p_log);
 }
 
+void osm_vl15_mad_done(IN osm_vl15_t * p_vl, IN const osm_madw_t * p_madw)
+{
+	osm_vl15_dest_t *p_dest;
+
+	cl_spinlock_acquire(&p_vl->lock);
+	p_dest = vl15_get_dest(p_vl, p_madw);
+	if (p_dest->on_wire)
+		p_dest->on_wire--;
+	vl15_dest_update(p_vl, p_dest);
+	vl15_rtt_update(p_vl, p_madw);
+	cl_spinlock_release(&p_vl->lock);
+}
+
+void osm_vl15_print_rtt(IN osm_vl15_t * p_vl, IN FILE * out)
+{
+	osm_vl15_rtt_t *p_rtt;
+	uint64_t total = 0, count;
+	uint32_t i, dests = 0, backed_off = 0;
+
+	cl_spinlock_acquire(&p_vl->lock);
+
+	fprintf(out, "SMP round trip times (usec), timeouts %s\n",
+		p_vl->adaptive_timeout ? "adaptive" : "static");
+	fprintf(out, "   %-6s %10s %10s %10s %10s %10s %8s %8s\n", "hops",
+		"samples", "srtt", "rttvar", "min", "max", "timeouts",
+		"timeout");
+	for (i = 0; i <= IB_SUBNET_PATH_HOPS_MAX; i++) {
+		p_rtt = &p_vl->hop_rtt[i];
+		if (!p_rtt->samples && !p_rtt->timeouts)
+			continue;
+		if (i == IB_SUBNET_PATH_HOPS_MAX)
+			fprintf(out, "   %-6s", "lid");
+		else
+			fprintf(out, "   %-6u", i);
+		fprintf(out, " %10u %10u %10u %10u %10u %8u %8u\n",
+			p_rtt->samples, p_rtt->srtt, p_rtt->rttvar,
+			p_rtt->min_rtt, p_rtt->max_rtt, p_rtt->timeouts,
+			vl15_rtt_timeout(p_vl, p_rtt, TRUE));
+	}
+
+	for (i = 0; i < OSM_VL15_RTT_TBL_SIZE; i++) {
+		if (!p_vl->rtt_tbl[i].tag)
+			continue;
+		dests++;
+		if (p_vl->rtt_tbl[i].backoff)
+			backed_off++;
+	}
+	fprintf(out, "   %u destinations tracked, %u backed off\n",
+		dests, backed_off);
+
+	for (i = 0; i < OSM_VL15_RTT_HIST_SIZE; i++)
+		total += p_vl->rtt_hist[i];
+	if (total) {
+		fprintf(out, "   Distribution (count, cumulative):\n");
+		count = 0;
+		for (i = 0; i < OSM_VL15_RTT_HIST_SIZE; i++) {
+			if (!p_vl->rtt_hist[i])
+				continue;
+			count += p_vl->rtt_hist[i];
+			fprintf(out, "   %s%10u %10u  %5.1f%%\n",
+				i == OSM_VL15_RTT_HIST_SIZE - 1 ? ">=" : " <",
+				i == OSM_VL15_RTT_HIST_SIZE - 1 ?
+				1U << i : 1U << (i + 1), p_vl->rtt_hist[i],
+				100.0 * count / total);
+		}
+	}
+
+	cl_spinlock_release(&p_vl->lock);
+}
+
+void osm_vl15_clear_rtt(IN osm_vl15_t * p_vl)
+{
+	cl_spinlock_acquire(&p_vl->lock);
+	memset(p_vl->hop_rtt, 0, sizeof(p_vl->hop_rtt));
+	memset(p_vl->rtt_tbl, 0, OSM_VL15_RTT_TBL_SIZE * sizeof(*p_vl->rtt_tbl));
+	memset(p_vl->rtt_hist, 0, sizeof(p_vl->rtt_hist));
+	cl_spinlock_release(&p_vl->lock);
+}
+
 void osm_vl15_shutdown(IN osm_vl15_t * p_vl, IN osm_mad_pool_t * p_mad_pool)
 {
 	osm_madw_t *p_madw;
+	uint32_t i;
 
 	OSM_LOG_ENTER(p_vl->p_log);
 
@@ -383,16 +724,22 @@ void osm_vl15_shutdown(IN osm_vl15_t * p_vl, IN osm_mad_pool_t * p_mad_pool)
 	}
 
 	/* Request MADs we send out */
-	p_madw = (osm_madw_t *) cl_qlist_remove_head(&p_vl->rfifo);
-	while (p_madw != (osm_madw_t *) cl_qlist_end(&p_vl->rfifo)) {
-		OSM_LOG(p_vl->p_log, OSM_LOG_DEBUG,
-			"Releasing Request p_madw = %p\n", p_madw);
+	for (i = 0; i < p_vl->dest_tbl_size; i++) {
+		cl_qlist_t *p_fifo = &p_vl->dest_tbl[i].fifo;
 
-		osm_mad_pool_put(p_mad_pool, p_madw);
-		osm_stats_dec_qp0_outstanding(p_vl->p_stats);
+		p_madw = (osm_madw_t *) cl_qlist_remove_head(p_fifo);
+		while (p_madw != (osm_madw_t *) cl_qlist_end(p_fifo)) {
+			OSM_LOG(p_vl->p_log, OSM_LOG_DEBUG,
+				"Releasing Request p_madw = %p\n", p_madw);
 
-		p_madw = (osm_madw_t *) cl_qlist_remove_head(&p_vl->rfifo);
+			osm_mad_pool_put(p_mad_pool, p_madw);
+			osm_stats_dec_qp0_outstanding(p_vl->p_stats);
+
+			p_madw = (osm_madw_t *) cl_qlist_remove_head(p_fifo);
+		}
+		p_vl->dest_tbl[i].ready = FALSE;
 	}
+	cl_qlist_init(&p_vl->ready_list);
 
 	/* free the lock */
 	cl_spinlock_release(&p_vl->lock);
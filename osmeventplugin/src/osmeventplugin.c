@@ -169,6 +169,23 @@ static void handle_lft_change_event(_log_events_t *log,
 		lft_change->flags, lft_change->lft_top, lft_change->block_num);
 }
 
+static void handle_sweep_stats_event(_log_events_t *log,
+				     osm_sweep_stats_t *sweep)
+{
+	int i;
+
+	fprintf(log->log_file, "Heavy sweep %u done%s: %" PRIu64 " usec, "
+		"%u SMPs sent, %u received, %u failed\n", sweep->sweep_num,
+		sweep->errors ? " with errors" : "", sweep->total.wall_usec,
+		sweep->total.smps_sent, sweep->total.smps_rcvd,
+		sweep->total.smps_timed_out);
+	for (i = 0; i < OSM_SWEEP_PHASE_MAX; i++)
+		if (sweep->phase[i].wall_usec)
+			fprintf(log->log_file, "   %-14s %" PRIu64 " usec\n",
+				osm_sweep_phase_str(i),
+				sweep->phase[i].wall_usec);
+}
+
 /** =========================================================================
  */
 static void report(void *_log, osm_epi_event_id_t event_id, void *event_data)
@@ -210,6 +227,9 @@ static void report(void *_log, osm_epi_event_id_t event_id, void *event_data)
 	case OSM_EVENT_ID_LFT_CHANGE:
 		handle_lft_change_event(log, (osm_epi_lft_change_event_t *) event_data);
 		break;
+	case OSM_EVENT_ID_SWEEP_STATS:
+		handle_sweep_stats_event(log, (osm_sweep_stats_t *) event_data);
+		break;
 	case OSM_EVENT_ID_MAX:
 	default:
 		osm_log(log->osmlog, OSM_LOG_ERROR,
@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2004-2008 Voltaire, Inc. All rights reserved.
+ * Copyright (c) 2002-2005 Mellanox Technologies LTD. All rights reserved.
+ * Copyright (c) 1996-2003 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * Abstract:
+ *    Micro benchmark of the min hop relaxation.  A switch with the
+ *    given number of ports and LIDs relaxes every port over a
+ *    neighbor, once with each kernel on the port major hop tables
+ *    OpenSM uses and once on LID major tables, where the hop counts
+ *    of a LID to all ports are contiguous.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif				/* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <complib/cl_timer.h>
+#include <opensm/osm_base.h>
+#include <opensm/osm_relax_hops.h>
+
+static const char *kernel_names[] = { "scalar", "SSE2", "AVX2" };
+
+/*
+ * One pass of the benchmark: restore the tables and relax ports 1 and
+ * up over the neighbors.  The kernel is NULL for the LID major tables
+ * and for the restore only baseline (with lid_major < 0).
+ */
+static void relax_pass(uint8_t * hops, const uint8_t * orig,
+		       const uint8_t * nbr, unsigned num_lids,
+		       unsigned num_ports, osm_relax_hops_fn_t relax,
+		       int lid_major)
+{
+	unsigned lid, port;
+	uint8_t *least, *row;
+	unsigned new_hops;
+
+	memcpy(hops, orig, num_lids * num_ports);
+	if (lid_major < 0)
+		return;
+
+	if (!lid_major) {
+		for (port = 1; port < num_ports; port++)
+			relax(hops + port * num_lids, hops,
+			      nbr + port * num_lids, num_lids, 1);
+		return;
+	}
+
+	for (port = 1; port < num_ports; port++)
+		for (lid = 0; lid < num_lids; lid++) {
+			row = hops + lid * num_ports;
+			least = row;
+			new_hops = nbr[port * num_lids + lid] + 1;
+			if (new_hops > OSM_NO_PATH)
+				new_hops = OSM_NO_PATH;
+			if (new_hops < row[port]) {
+				row[port] = new_hops;
+				if (new_hops < *least)
+					*least = new_hops;
+			}
+		}
+}
+
+static uint64_t time_passes(uint8_t * hops, const uint8_t * orig,
+			    const uint8_t * nbr, unsigned num_lids,
+			    unsigned num_ports, unsigned iterations,
+			    osm_relax_hops_fn_t relax, int lid_major)
+{
+	uint64_t start = cl_get_time_stamp();
+	unsigned i;
+
+	for (i = 0; i < iterations; i++)
+		relax_pass(hops, orig, nbr, num_lids, num_ports, relax,
+			   lid_major);
+	return cl_get_time_stamp() - start;
+}
+
+static void report(const char *name, uint64_t usecs, uint64_t base,
+		   unsigned num_lids, unsigned num_ports, unsigned iterations)
+{
+	double rows = (double)iterations * num_lids * (num_ports - 1);
+
+	usecs = usecs > base ? usecs - base : 0;
+	printf("%-16s %10llu usec %8.3f ns/row\n", name,
+	       (unsigned long long)usecs, usecs * 1000.0 / rows);
+}
+
+static void show_usage(void)
+{
+	printf("\n------- osmt_relax_bench - Usage and options ----------------------\n");
+	printf("Usage:	  osmt_relax_bench [options]\n");
+	printf("Options:\n");
+	printf("-l <lids>\n"
+	       "--lids <lids>\n"
+	       "          Number of switch LIDs (rows of each port, default 2048).\n\n");
+	printf("-p <ports>\n"
+	       "--ports <ports>\n"
+	       "          Number of switch ports, port 0 included (default 37).\n\n");
+	printf("-i <iterations>\n"
+	       "--iterations <iterations>\n"
+	       "          Number of passes over all ports (default 1000).\n\n");
+	printf("-h\n" "--help\n" "          Display this usage info then exit.\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static const char short_option[] = "l:p:i:h";
+	static const struct option long_option[] = {
+		{"lids", 1, NULL, 'l'},
+		{"ports", 1, NULL, 'p'},
+		{"iterations", 1, NULL, 'i'},
+		{"help", 0, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+	unsigned num_lids = 2048, num_ports = 37, iterations = 1000;
+	uint8_t *orig, *nbr, *hops, *ref, *lid_hops;
+	osm_relax_hops_fn_t relax;
+	uint64_t base, usecs;
+	unsigned i, lid, port, size;
+	int next_option, ret = 0;
+
+	while ((next_option = getopt_long_only(argc, argv, short_option,
+					       long_option, NULL)) != -1) {
+		switch (next_option) {
+		case 'l':
+			num_lids = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			num_ports = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			show_usage();
+			return 0;
+		default:
+			show_usage();
+			return 1;
+		}
+	}
+	if (!num_lids || num_ports < 2 || !iterations) {
+		show_usage();
+		return 1;
+	}
+
+	size = num_lids * num_ports;
+	orig = malloc(size);
+	nbr = malloc(size);
+	hops = malloc(size);
+	ref = malloc(size);
+	lid_hops = malloc(size);
+	if (!orig || !nbr || !hops || !ref || !lid_hops) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	/*
+	 * Port major tables as OpenSM keeps them: row 0 holds the least
+	 * hop counts, which are never larger than those of the ports.
+	 * Some LIDs are unreachable through a port or the neighbor.
+	 */
+	srand(1);
+	for (i = 0; i < size; i++) {
+		orig[i] = rand() % 8 ? rand() % 16 : OSM_NO_PATH;
+		nbr[i] = rand() % 8 ? rand() % 16 : OSM_NO_PATH;
+	}
+	for (lid = 0; lid < num_lids; lid++) {
+		orig[lid] = OSM_NO_PATH;
+		for (port = 1; port < num_ports; port++)
+			if (orig[port * num_lids + lid] < orig[lid])
+				orig[lid] = orig[port * num_lids + lid];
+	}
+
+	printf("%u LIDs, %u ports, %u iterations\n", num_lids, num_ports,
+	       iterations);
+	base = time_passes(hops, orig, nbr, num_lids, num_ports, iterations,
+			   NULL, -1);
+
+	relax_pass(ref, orig, nbr, num_lids, num_ports,
+		   osm_relax_hops_get("scalar"), 0);
+	for (i = 0; i < sizeof(kernel_names) / sizeof(kernel_names[0]); i++) {
+		if (!(relax = osm_relax_hops_get(kernel_names[i]))) {
+			printf("%-16s not supported\n", kernel_names[i]);
+			continue;
+		}
+		usecs = time_passes(hops, orig, nbr, num_lids, num_ports,
+				    iterations, relax, 0);
+		report(kernel_names[i], usecs, base, num_lids, num_ports,
+		       iterations);
+		if (memcmp(hops, ref, size)) {
+			fprintf(stderr, "%s differs from scalar\n",
+				kernel_names[i]);
+			ret = 1;
+		}
+	}
+
+	/* The same tables LID major */
+	for (lid = 0; lid < num_lids; lid++)
+		for (port = 0; port < num_ports; port++)
+			lid_hops[lid * num_ports + port] =
+			    orig[port * num_lids + lid];
+	memcpy(orig, lid_hops, size);
+	usecs = time_passes(hops, orig, nbr, num_lids, num_ports, iterations,
+			    NULL, 1);
+	report("scalar LID major", usecs, base, num_lids, num_ports,
+	       iterations);
+	for (lid = 0; lid < num_lids; lid++)
+		for (port = 0; port < num_ports; port++)
+			if (hops[lid * num_ports + port] !=
+			    ref[port * num_lids + lid]) {
+				fprintf(stderr, "LID major differs from scalar\n");
+				ret = 1;
+				lid = num_lids;
+				break;
+			}
+
+	free(orig);
+	free(nbr);
+	free(hops);
+	free(ref);
+	free(lid_hops);
+	return ret;
+}